@@ -0,0 +1,177 @@
+/*
+ * tux2clf.c: convert a binary TUX logfile to Common Log Format.
+ *
+ * Usage:	tux2clf [-c] [binary-logfile]
+ *
+ *	Reads the binary log written by the TUX logger thread (stdin
+ *	if no file is given) and prints one Common Log Format line per
+ *	entry to stdout. With -c the referer and, for extended logs,
+ *	the user agent are appended (NCSA Combined Log Format).
+ *
+ *	Compile with:	gcc -O2 -Wall -o tux2clf tux2clf.c
+ *
+ *	The log has to be converted on a machine with the same byte
+ *	order as the one that wrote it.
+ *
+ *		This program is free software; you can redistribute it
+ *		and/or modify it under the terms of the GNU General Public
+ *		License as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef unsigned int u32;
+
+/*
+ * Record layout, see net/tux/logger.c:
+ *
+ *	u32 signature, u32 record length, u32 client address,
+ *	[u32 client port,] u32 time,
+ *	[u32 accept, parse, output, flush timestamps,
+ *	 u32 had_cachemiss, u32 keep_alive,]
+ *	u32 bytes sent, u32 status,
+ *	method\0 [vhost]uri\0 version\0 [user agent\0] referer\0
+ *	zero padding up to the record length.
+ *
+ * The bracketed fields are present in the extended format only.
+ */
+#define LOG_SIGNATURE		0x3334beef
+#define LOG_SIGNATURE_EXT	0x4445beef
+
+#define MAX_RECORD		(64*1024)
+
+static const char *usage_msg = "Usage: tux2clf [-c] [binary-logfile]\n";
+
+static const char *month[12] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static int combined = 0;
+
+/*
+ * Return the next zero-terminated string of the record and advance
+ * the cursor, or NULL if the record is truncated.
+ */
+static const char * next_str (const char **curr, const char *end)
+{
+	const char *str = *curr;
+	const char *zero = memchr(str, 0, end - str);
+
+	if (!zero)
+		return NULL;
+	*curr = zero + 1;
+	return str;
+}
+
+static int print_record (u32 *rec)
+{
+	const char *curr, *end, *method, *uri, *version, *agent = "", *referer;
+	int extended = (rec[0] == LOG_SIGNATURE_EXT);
+	u32 *field = rec + 2;
+	u32 addr, bytes, status;
+	struct in_addr in;
+	time_t timestamp;
+	struct tm *tm;
+
+	addr = *field++;
+	if (extended)
+		field++;
+	timestamp = *field++;
+	if (extended)
+		field += 6;
+	bytes = *field++;
+	status = *field++;
+
+	curr = (const char *)field;
+	end = (const char *)rec + rec[1];
+	if (curr > end)
+		return -1;
+	method = next_str(&curr, end);
+	uri = next_str(&curr, end);
+	version = next_str(&curr, end);
+	if (extended)
+		agent = next_str(&curr, end);
+	referer = next_str(&curr, end);
+	if (!method || !uri || !version || !agent || !referer)
+		return -1;
+
+	in.s_addr = addr;
+	tm = gmtime(&timestamp);
+	if (!tm)
+		return -1;
+
+	printf("%s - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"%s %s%s%s\" %u ",
+		inet_ntoa(in), tm->tm_mday, month[tm->tm_mon],
+		tm->tm_year + 1900, tm->tm_hour, tm->tm_min, tm->tm_sec,
+		method, uri, *version ? " " : "", version, status);
+	if (bytes == (u32)-1)
+		printf("-");
+	else
+		printf("%u", bytes);
+	if (combined)
+		printf(" \"%s\" \"%s\"", *referer ? referer : "-",
+			*agent ? agent : "-");
+	printf("\n");
+
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	static u32 rec[MAX_RECORD / sizeof(u32)];
+	unsigned long nr = 0, bad = 0;
+	FILE *in = stdin;
+	int c;
+
+	while ((c = getopt(argc, argv, "ch")) != -1) {
+		switch (c) {
+		case 'c':
+			combined = 1;
+			break;
+		default:
+			fprintf(stderr, usage_msg);
+			return 2;
+		}
+	}
+	if (optind < argc - 1) {
+		fprintf(stderr, usage_msg);
+		return 2;
+	}
+	if (optind == argc - 1) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	while (fread(rec, sizeof(u32), 2, in) == 2) {
+		nr++;
+		if ((rec[0] != LOG_SIGNATURE && rec[0] != LOG_SIGNATURE_EXT) ||
+				rec[1] < 6*sizeof(u32) || rec[1] > MAX_RECORD ||
+				(rec[1] % sizeof(u32))) {
+			fprintf(stderr, "tux2clf: bad record #%lu, giving up.\n", nr);
+			return 1;
+		}
+		if (fread(rec + 2, 1, rec[1] - 2*sizeof(u32), in) !=
+						rec[1] - 2*sizeof(u32)) {
+			fprintf(stderr, "tux2clf: truncated record #%lu.\n", nr);
+			return 1;
+		}
+		if (print_record(rec)) {
+			fprintf(stderr, "tux2clf: skipping malformed record #%lu.\n", nr);
+			bad++;
+		}
+	}
+	if (in != stdin)
+		fclose(in);
+
+	return bad ? 1 : 0;
+}
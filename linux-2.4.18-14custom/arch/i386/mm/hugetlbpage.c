@@ -0,0 +1,323 @@
+/*
+ *  linux/arch/i386/mm/hugetlbpage.c
+ *
+ *  IA-32 huge TLB page support.
+ *
+ *  Huge pages are mapped by a single PSE pmd entry (4MB, or 2MB with
+ *  PAE).  They come from a pool that is set aside at boot time with
+ *  "hugepages=" or later through /proc/sys/vm/nr_hugepages, never take
+ *  part in page reclaim and are only reachable through hugetlbfs files.
+ */
+
+#include <linux/config.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/hugetlb.h>
+#include <linux/pagemap.h>
+#include <linux/smp_lock.h>
+#include <linux/slab.h>
+#include <linux/sysctl.h>
+#include <asm/pgalloc.h>
+#include <asm/pgtable.h>
+
+#define HPAGE_NR_PAGES	(HPAGE_SIZE >> PAGE_SHIFT)
+
+int htlbpage_max;
+static int htlbpage_total;
+static int htlbpage_free;
+static spinlock_t htlbpage_lock = SPIN_LOCK_UNLOCKED;
+static LIST_HEAD(htlbpage_freelist);
+
+/*
+ * Every subpage of a pool page carries a reference of its own, so that
+ * get_user_pages() users taking and dropping subpage references never
+ * hand a subpage back to the buddy allocator.
+ */
+static struct page *alloc_pool_page(void)
+{
+	struct page *page;
+	int i;
+
+	page = alloc_pages(GFP_HIGHUSER, HUGETLB_PAGE_ORDER);
+	if (!page)
+		return NULL;
+	for (i = 1; i < HPAGE_NR_PAGES; i++)
+		set_page_count(page + i, 1);
+	return page;
+}
+
+static void free_pool_page(struct page *page)
+{
+	int i;
+
+	for (i = 1; i < HPAGE_NR_PAGES; i++)
+		set_page_count(page + i, 0);
+	__free_pages(page, HUGETLB_PAGE_ORDER);
+}
+
+struct page *alloc_huge_page(void)
+{
+	struct page *page = NULL;
+	int i;
+
+	spin_lock(&htlbpage_lock);
+	if (!list_empty(&htlbpage_freelist)) {
+		page = list_entry(htlbpage_freelist.next, struct page, list);
+		list_del(&page->list);
+		htlbpage_free--;
+	}
+	spin_unlock(&htlbpage_lock);
+	if (!page)
+		return NULL;
+
+	INIT_LIST_HEAD(&page->list);
+	for (i = 0; i < HPAGE_NR_PAGES; i++)
+		clear_highpage(page + i);
+	return page;
+}
+
+void free_huge_page(struct page *page)
+{
+	spin_lock(&htlbpage_lock);
+	list_add(&page->list, &htlbpage_freelist);
+	htlbpage_free++;
+	spin_unlock(&htlbpage_lock);
+}
+
+/*
+ * Grow or shrink the pool towards 'count' pages.  Pages in use can't
+ * be taken back, so a shrink stops once the free list is empty.
+ * Returns the resulting pool size.
+ */
+static int set_hugetlb_mem_size(int count)
+{
+	struct page *page;
+
+	if (!cpu_has_pse)
+		return 0;
+
+	while (count > htlbpage_total) {
+		page = alloc_pool_page();
+		if (!page)
+			break;
+		spin_lock(&htlbpage_lock);
+		list_add(&page->list, &htlbpage_freelist);
+		htlbpage_free++;
+		htlbpage_total++;
+		spin_unlock(&htlbpage_lock);
+	}
+
+	while (count < htlbpage_total) {
+		spin_lock(&htlbpage_lock);
+		if (list_empty(&htlbpage_freelist)) {
+			spin_unlock(&htlbpage_lock);
+			break;
+		}
+		page = list_entry(htlbpage_freelist.next, struct page, list);
+		list_del(&page->list);
+		htlbpage_free--;
+		htlbpage_total--;
+		spin_unlock(&htlbpage_lock);
+		free_pool_page(page);
+	}
+	return htlbpage_total;
+}
+
+int hugetlb_sysctl_handler(ctl_table *table, int write, struct file *file,
+			   void *buffer, size_t *length)
+{
+	int err;
+
+	err = proc_dointvec(table, write, file, buffer, length);
+	if (!err && write) {
+		lock_kernel();
+		htlbpage_max = set_hugetlb_mem_size(htlbpage_max);
+		unlock_kernel();
+	}
+	return err;
+}
+
+int hugetlb_report_meminfo(char *buf)
+{
+	return sprintf(buf,
+			"HugePages_Total: %5d\n"
+			"HugePages_Free:  %5d\n"
+			"Hugepagesize:    %5lu kB\n",
+			htlbpage_total,
+			htlbpage_free,
+			HPAGE_SIZE >> 10);
+}
+
+static int __init hugetlb_setup(char *str)
+{
+	htlbpage_max = simple_strtol(str, NULL, 0);
+	return 1;
+}
+__setup("hugepages=", hugetlb_setup);
+
+static int __init hugetlb_init(void)
+{
+	if (!htlbpage_max)
+		return 0;
+	if (!cpu_has_pse) {
+		printk(KERN_WARNING "HugeTLB: CPU lacks PSE, no huge pages\n");
+		htlbpage_max = 0;
+		return 0;
+	}
+	htlbpage_max = set_hugetlb_mem_size(htlbpage_max);
+	printk(KERN_INFO "HugeTLB: %d pages of %lukB allocated\n",
+		htlbpage_max, HPAGE_SIZE >> 10);
+	return 0;
+}
+__initcall(hugetlb_init);
+
+/*
+ * The pmd entry of a huge page is handled as a pte, as in the kernel
+ * direct mapping.  Both need mm->page_table_lock.
+ */
+static pte_t *huge_pte_alloc(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd = pgd_offset(mm, addr);
+
+	return (pte_t *) pmd_alloc(mm, pgd, addr);
+}
+
+static pte_t *huge_pte_offset(struct mm_struct *mm, unsigned long addr)
+{
+	pgd_t *pgd = pgd_offset(mm, addr);
+
+	if (!pgd_present(*pgd))
+		return NULL;
+	return (pte_t *) pmd_offset(pgd, addr);
+}
+
+static void set_huge_pte(struct mm_struct *mm, struct vm_area_struct *vma,
+			 struct page *page, pte_t *ptep)
+{
+	pgprot_t prot = __pgprot(pgprot_val(vma->vm_page_prot) | _PAGE_PSE);
+	pte_t entry;
+
+	entry = pte_mkyoung(mk_pte(page, prot));
+	if (vma->vm_flags & VM_WRITE)
+		entry = pte_mkdirty(pte_mkwrite(entry));
+	mm->rss += HPAGE_NR_PAGES;
+	set_pte(ptep, entry);
+}
+
+/*
+ * Huge pages are owned by their hugetlbfs inode, the mappings take no
+ * page references.  dst->page_table_lock is held on entry and exit.
+ */
+int copy_hugetlb_page_range(struct mm_struct *dst, struct mm_struct *src,
+			    struct vm_area_struct *vma)
+{
+	unsigned long addr;
+	pte_t *src_pte, *dst_pte, entry;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += HPAGE_SIZE) {
+		src_pte = huge_pte_offset(src, addr);
+		if (!src_pte)
+			continue;
+		dst_pte = huge_pte_alloc(dst, addr);
+		if (!dst_pte)
+			return -ENOMEM;
+		spin_lock(&src->page_table_lock);
+		entry = *src_pte;
+		spin_unlock(&src->page_table_lock);
+		if (pte_none(entry))
+			continue;
+		set_pte(dst_pte, entry);
+		dst->rss += HPAGE_NR_PAGES;
+	}
+	return 0;
+}
+
+/*
+ * get_user_pages() for a hugetlb vma: every 4k subpage is returned on
+ * its own, pinned by a reference of its own.  A hole (the file was
+ * truncated under the mapping) ends the walk.
+ */
+int follow_hugetlb_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			struct page **pages, struct vm_area_struct **vmas,
+			unsigned long *st, int *length, int i)
+{
+	unsigned long start = *st;
+	int len = *length;
+	pte_t *ptep;
+	struct page *page;
+
+	spin_lock(&mm->page_table_lock);
+	while (len && start < vma->vm_end) {
+		ptep = huge_pte_offset(mm, start);
+		if (!ptep || pte_none(*ptep)) {
+			len = 0;
+			if (!i)
+				i = -EFAULT;
+			break;
+		}
+		page = pte_page(*ptep) + ((start & ~HPAGE_MASK) >> PAGE_SHIFT);
+		if (pages) {
+			get_page(page);
+			pages[i] = page;
+		}
+		if (vmas)
+			vmas[i] = vma;
+		i++;
+		len--;
+		start += PAGE_SIZE;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	*st = start;
+	*length = len;
+	return i;
+}
+
+/*
+ * Called from zap_pte_range() with mm->page_table_lock held.  The
+ * mmu_gather only knows about ptes, so flush the huge entry here.
+ */
+int zap_hugetlb_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long addr)
+{
+	addr &= HPAGE_MASK;
+	pmd_clear(pmd);
+	flush_tlb_range(mm, addr, addr + HPAGE_SIZE);
+	return HPAGE_NR_PAGES;
+}
+
+/*
+ * Map the whole vma at mmap time, hugetlb vmas never take page faults.
+ * Called with mm->mmap_sem held for writing.
+ */
+int hugetlb_prefault(struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct inode *inode = vma->vm_file->f_dentry->d_inode;
+	unsigned long addr, idx;
+	struct page *page;
+	pte_t *ptep;
+	int ret = 0;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr += HPAGE_SIZE) {
+		idx = ((addr - vma->vm_start) >> HPAGE_SHIFT) +
+			(vma->vm_pgoff >> (HPAGE_SHIFT - PAGE_SHIFT));
+		page = hugetlbfs_get_page(inode, idx);
+		if (!page) {
+			ret = -ENOMEM;
+			break;
+		}
+		spin_lock(&mm->page_table_lock);
+		ptep = huge_pte_alloc(mm, addr);
+		if (!ptep) {
+			spin_unlock(&mm->page_table_lock);
+			ret = -ENOMEM;
+			break;
+		}
+		if (pte_none(*ptep))
+			set_huge_pte(mm, vma, page, ptep);
+		spin_unlock(&mm->page_table_lock);
+	}
+	return ret;
+}
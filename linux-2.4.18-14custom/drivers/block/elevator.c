@@ -18,6 +18,10 @@
  * Removed tests for max-bomb-segments, which was breaking elvtune
  *  when run without -bN
  *
+ * Deadline elevator: reads are kept sorted in front of the sorted
+ *  writes, and every request carries a FIFO expiry time that new
+ *  requests are never allowed to pass.
+ *
  */
 
 #include <linux/fs.h>
@@ -25,6 +29,8 @@
 #include <linux/elevator.h>
 #include <linux/blk.h>
 #include <linux/module.h>
+#include <linux/init.h>
+#include <linux/string.h>
 #include <asm/uaccess.h>
 
 /*
@@ -223,6 +229,110 @@ int elevator_noop_merge(request_queue_t *q, struct request **req,
 
 void elevator_noop_merge_req(struct request *req, struct request *next) {}
 
+/*
+ * The deadline elevator reuses the tunables of elevator_t:
+ *
+ * read_latency		- read FIFO expiry, in jiffies
+ * write_latency	- write FIFO expiry, in jiffies
+ * max_bomb_segments	- write batch a new read may be placed in front of
+ *
+ * The request list is kept as a run of sector sorted reads followed by
+ * a run of sector sorted writes. Once a request has been queued longer
+ * than its expiry time it becomes a barrier, nothing queued later is
+ * allowed to go in front of it, so both directions get a hard upper
+ * bound on how long they can be starved.
+ */
+static inline int elevator_deadline_expired(elevator_t *elevator,
+					    struct request *rq)
+{
+	unsigned long expire = elevator_request_latency(elevator, rq->cmd);
+
+	return time_after_eq(jiffies, rq->start_time + expire);
+}
+
+int elevator_deadline_merge(request_queue_t *q, struct request **req,
+			    struct list_head * head,
+			    struct buffer_head *bh, int rw,
+			    int max_sectors)
+{
+	elevator_t *elevator = &q->elevator;
+	struct list_head *entry;
+	struct request *sorted = NULL, *front = NULL;
+	unsigned int count = bh->b_size >> 9;
+	int batch = 0, same = 0;
+
+	entry = &q->queue_head;
+	while ((entry = entry->prev) != head) {
+		struct request *__rq = blkdev_entry_to_request(entry);
+
+		if (__rq->waiting)
+			continue;
+		if (__rq->rq_dev != bh->b_rdev)
+			continue;
+		if (__rq->cmd != rw)
+			continue;
+		if (__rq->nr_sectors + count > max_sectors)
+			continue;
+		if (__rq->sector + __rq->nr_sectors == bh->b_rsector) {
+			*req = __rq;
+			return ELEVATOR_BACK_MERGE;
+		} else if (__rq->sector - count == bh->b_rsector) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	/*
+	 * No merge, find the insertion point. Walk backwards from the tail
+	 * and stop at the first expired request. Writes are sorted into the
+	 * trailing run of writes only, reads may also go in front of up to
+	 * max_bomb_segments worth of writes.
+	 */
+	entry = &q->queue_head;
+	while ((entry = entry->prev) != head) {
+		struct request *__rq = blkdev_entry_to_request(entry);
+
+		if (elevator_deadline_expired(elevator, __rq))
+			break;
+		if (__rq->cmd != rw) {
+			/*
+			 * writes stay behind all reads, and a read never
+			 * goes past a write run in front of the read run
+			 */
+			if (rw == WRITE || same)
+				break;
+			batch += 1 + __rq->nr_sectors / 64;
+			if (batch > elevator->max_bomb_segments)
+				break;
+			front = __rq;
+			continue;
+		}
+		same = 1;
+		if (__rq->rq_dev == bh->b_rdev &&
+		    bh_rq_in_between(bh, __rq, &q->queue_head)) {
+			sorted = __rq;
+			break;
+		}
+	}
+
+	if (sorted)
+		*req = sorted;
+	else if (front)
+		*req = blkdev_entry_to_request(front->queue.prev);
+	else
+		*req = blkdev_entry_to_request(q->queue_head.prev);
+	return ELEVATOR_NO_MERGE;
+}
+
+void elevator_deadline_merge_req(struct request *req, struct request *next)
+{
+	/*
+	 * the merged request inherits the earliest deadline
+	 */
+	if (time_before(next->start_time, req->start_time))
+		req->start_time = next->start_time;
+}
+
 int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 {
 	blkelv_ioctl_arg_t output;
@@ -265,3 +375,30 @@ void elevator_init(elevator_t * elevator, elevator_t type)
 	*elevator = type;
 	elevator->queue_ID = queue_ID++;
 }
+
+/*
+ * "elevator=deadline" on the command line makes the deadline elevator
+ * the default for queues set up through blk_init_queue()
+ */
+static int elevator_deadline_default;
+
+static int __init elevator_setup(char *str)
+{
+	if (!strcmp(str, "deadline"))
+		elevator_deadline_default = 1;
+	else if (!strcmp(str, "linus"))
+		elevator_deadline_default = 0;
+	else
+		printk(KERN_WARNING "elevator: unknown elevator %s\n", str);
+	return 1;
+}
+
+__setup("elevator=", elevator_setup);
+
+void elevator_init_default(elevator_t * elevator)
+{
+	if (elevator_deadline_default)
+		elevator_init(elevator, ELEVATOR_DEADLINE);
+	else
+		elevator_init(elevator, ELEVATOR_LINUS);
+}
@@ -458,7 +458,7 @@ static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
 void blk_init_queue(request_queue_t * q, request_fn_proc * rfn)
 {
 	INIT_LIST_HEAD(&q->queue_head);
-	elevator_init(&q->elevator, ELEVATOR_LINUS);
+	elevator_init_default(&q->elevator);
 	q->queue_lock		= &io_request_lock;
 	blk_init_free_list(q);
 	q->request_fn     	= rfn;
@@ -403,6 +403,9 @@ static inline size_t read_zero_pagealigned(char * buf, size_t size)
 		if (count > size)
 			count = size;
 
+		/* No memory to copy a shared page table: clear instead */
+		if (unshare_cow_edges(mm, addr, addr + count))
+			break;
 		zap_page_range(mm, addr, count, 0);
         	zeromap_page_range(addr, count, PAGE_COPY);
 
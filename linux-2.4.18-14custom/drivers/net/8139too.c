@@ -591,6 +591,7 @@ static void mdio_write (struct net_device *dev, int phy_id, int location,
 static int rtl8139_thread (void *data);
 static void rtl8139_tx_timeout (struct net_device *dev);
 static void rtl8139_init_ring (struct net_device *dev);
+static int rtl8139_poll (struct net_device *dev, int *budget);
 static int rtl8139_start_xmit (struct sk_buff *skb,
 			       struct net_device *dev);
 static void rtl8139_interrupt (int irq, void *dev_instance,
@@ -664,6 +665,11 @@ static const u16 rtl8139_intr_mask =
 	PCIErr | PCSTimeout | RxUnderrun | RxOverflow | RxFIFOOver |
 	TxErr | TxOK | RxErr | RxOK;
 
+/* Rx events are left to rtl8139_poll() while it is scheduled */
+static const u16 rtl8139_norx_intr_mask =
+	PCIErr | PCSTimeout | RxUnderrun |
+	TxErr | TxOK | RxErr;
+
 static const unsigned int rtl8139_rx_config =
 	RxCfgRcv32K | RxNoWrap |
 	(RX_FIFO_THRESH << RxCfgFIFOShift) |
@@ -945,6 +951,8 @@ static int __devinit rtl8139_init_one (struct pci_dev *pdev,
 	dev->do_ioctl = netdev_ioctl;
 	dev->tx_timeout = rtl8139_tx_timeout;
 	dev->watchdog_timeo = TX_TIMEOUT;
+	dev->poll = rtl8139_poll;
+	dev->weight = 16;
 	dev->features |= NETIF_F_SG|NETIF_F_HW_CSUM;
 
 	dev->irq = pdev->irq;
@@ -1842,11 +1850,12 @@ static void rtl8139_rx_err (u32 rx_status, struct net_device *dev,
 #endif
 }
 
-static void rtl8139_rx_interrupt (struct net_device *dev,
-				  struct rtl8139_private *tp, void *ioaddr)
+static int rtl8139_rx (struct net_device *dev, struct rtl8139_private *tp,
+		       void *ioaddr, int budget)
 {
 	unsigned char *rx_ring;
 	u16 cur_rx;
+	int received = 0;
 
 	assert (dev != NULL);
 	assert (tp != NULL);
@@ -1860,7 +1869,8 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 		 RTL_R16 (RxBufAddr),
 		 RTL_R16 (RxBufPtr), RTL_R8 (ChipCmd));
 
-	while ((RTL_R8 (ChipCmd) & RxBufEmpty) == 0) {
+	while (netif_running (dev) && received < budget &&
+	       (RTL_R8 (ChipCmd) & RxBufEmpty) == 0) {
 		int ring_offset = cur_rx % RX_BUF_LEN;
 		u32 rx_status;
 		unsigned int rx_size;
@@ -1905,19 +1915,17 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 		if ((rx_size > (MAX_ETH_FRAME_SIZE+4)) ||
 		    (rx_size < 8) ||
 		    (!(rx_status & RxStatusOK))) {
+			unsigned long flags;
+
+			spin_lock_irqsave (&tp->lock, flags);
 			rtl8139_rx_err (rx_status, dev, tp, ioaddr);
-			return;
+			spin_unlock_irqrestore (&tp->lock, flags);
+			return received;
 		}
 
 		/* Malloc up new buffer, compatible with net-2e. */
 		/* Omit the four octet CRC from the length. */
 
-		/* TODO: consider allocating skb's outside of
-		 * interrupt context, both to speed interrupt processing,
-		 * and also to reduce the chances of having to
-		 * drop packets here under memory pressure.
-		 */
-
 		skb = dev_alloc_skb (pkt_size + 2);
 		if (skb) {
 			skb->dev = dev;
@@ -1927,7 +1935,7 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 			skb_put (skb, pkt_size);
 
 			skb->protocol = eth_type_trans (skb, dev);
-			netif_rx (skb);
+			netif_receive_skb (skb);
 			dev->last_rx = jiffies;
 			tp->stats.rx_bytes += pkt_size;
 			tp->stats.rx_packets++;
@@ -1937,6 +1945,7 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 				dev->name);
 			tp->stats.rx_dropped++;
 		}
+		received++;
 
 		cur_rx = (cur_rx + rx_size + 4 + 3) & ~3;
 		RTL_W16 (RxBufPtr, cur_rx - 16);
@@ -1951,6 +1960,40 @@ static void rtl8139_rx_interrupt (struct net_device *dev,
 		 RTL_R16 (RxBufPtr), RTL_R8 (ChipCmd));
 
 	tp->cur_rx = cur_rx;
+	return received;
+}
+
+/*
+ * NAPI poll routine: the interrupt handler masks the Rx events and
+ * schedules us, we pull at most 'quota' frames out of the ring and
+ * unmask them again once the ring is empty.
+ */
+static int rtl8139_poll (struct net_device *dev, int *budget)
+{
+	struct rtl8139_private *tp = dev->priv;
+	void *ioaddr = tp->mmio_addr;
+	int orig_budget = min (*budget, dev->quota);
+	int work_done = 0;
+	unsigned long flags;
+
+	if (RTL_R16 (IntrStatus) & RxAckBits) {
+		work_done = rtl8139_rx (dev, tp, ioaddr, orig_budget);
+		*budget -= work_done;
+		dev->quota -= work_done;
+		if (work_done >= orig_budget)
+			return 1;
+	}
+
+	/* Ring is empty: re-enable Rx interrupts.  This has to be atomic
+	 * with respect to the interrupt handler, or it could mask them
+	 * again after we have left the poll list.
+	 */
+	spin_lock_irqsave (&tp->lock, flags);
+	netif_rx_complete (dev);
+	RTL_W16_F (IntrMask, rtl8139_intr_mask);
+	spin_unlock_irqrestore (&tp->lock, flags);
+
+	return 0;
 }
 
 
@@ -2028,6 +2071,10 @@ static void rtl8139_interrupt (int irq, void *dev_instance,
 		if (status == 0xFFFF)
 			break;
 
+		/* Pending Rx events are the poll routine's business */
+		if (test_bit (__LINK_STATE_RX_SCHED, &dev->state))
+			status &= ~RxAckBits;
+
 		if ((status &
 		     (PCIErr | PCSTimeout | RxUnderrun | RxOverflow |
 		      RxFIFOOver | TxErr | TxOK | RxErr | RxOK)) == 0)
@@ -2039,7 +2086,7 @@ static void rtl8139_interrupt (int irq, void *dev_instance,
 			link_changed = RTL_R16 (CSCR) & CSCR_LinkChangeBit;
 
 		/* The chip takes special action when we clear RxAckBits,
-		 * so we clear them later in rtl8139_rx_interrupt
+		 * so we clear them later in rtl8139_rx(), from ->poll
 		 */
 		ackstat = status & ~(RxAckBits | TxErr);
 		RTL_W16 (IntrStatus, ackstat);
@@ -2047,8 +2094,14 @@ static void rtl8139_interrupt (int irq, void *dev_instance,
 		DPRINTK ("%s: interrupt  status=%#4.4x ackstat=%#4.4x new intstat=%#4.4x.\n",
 			 dev->name, ackstat, status, RTL_R16 (IntrStatus));
 
-		if (netif_running (dev) && (status & RxAckBits))
-			rtl8139_rx_interrupt (dev, tp, ioaddr);
+		/* Rx is handled by rtl8139_poll(), with Rx interrupts
+		 * masked until it has emptied the ring.
+		 */
+		if (netif_running (dev) && (status & RxAckBits) &&
+		    netif_rx_schedule_prep (dev)) {
+			RTL_W16_F (IntrMask, rtl8139_norx_intr_mask);
+			__netif_rx_schedule (dev);
+		}
 
 		/* Check uncommon events with one test. */
 		if (status & (PCIErr | PCSTimeout | RxUnderrun | RxOverflow |
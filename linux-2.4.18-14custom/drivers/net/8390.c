@@ -110,8 +110,10 @@ int ei_debug = 1;
 static void ei_tx_intr(struct net_device *dev);
 static void ei_tx_err(struct net_device *dev);
 static void ei_tx_timeout(struct net_device *dev);
-static void ei_receive(struct net_device *dev);
+static int ei_receive(struct net_device *dev, int budget,
+		      struct sk_buff_head *rxq);
 static void ei_rx_overrun(struct net_device *dev);
+static int ei_poll(struct net_device *dev, int *budget);
 
 /* Routines generic to NS8390-based boards. */
 static void NS8390_trigger_send(struct net_device *dev, unsigned int length,
@@ -143,6 +145,13 @@ static void do_set_multicast_list(struct net_device *dev);
  *	annoying the transmit function is called bh atomic. That places
  *	restrictions on the user context callers as disable_irq won't save
  *	them.
+ *
+ *	Receive is done by ei_poll() from the net softirq: the interrupt
+ *	handler only masks the Rx sources (ei_local->imr is the mask to
+ *	restore whenever the IMR gets rewritten) and schedules the poll.
+ *	The ring is emptied with the page lock held, but the packets are
+ *	handed to the stack only after dropping it, as the stack may well
+ *	come back to us via ei_start_xmit.
  */
  
 
@@ -329,7 +338,7 @@ static int ei_start_xmit(struct sk_buff *skb, struct net_device *dev)
 				dev->name, ei_local->tx1, ei_local->tx2, ei_local->lasttx);
 		ei_local->irqlock = 0;
 		netif_stop_queue(dev);
-		outb_p(ENISR_ALL, e8390_base + EN0_IMR);
+		outb_p(ei_local->imr, e8390_base + EN0_IMR);
 		spin_unlock(&ei_local->page_lock);
 		enable_irq(dev->irq);
 		ei_local->stat.tx_errors++;
@@ -384,7 +393,7 @@ static int ei_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* Turn 8390 interrupts back on. */
 	ei_local->irqlock = 0;
-	outb_p(ENISR_ALL, e8390_base + EN0_IMR);
+	outb_p(ei_local->imr, e8390_base + EN0_IMR);
 	
 	spin_unlock(&ei_local->page_lock);
 	enable_irq(dev->irq);
@@ -450,8 +459,13 @@ void ei_interrupt(int irq, void *dev_id, struct pt_regs * regs)
 		printk(KERN_DEBUG "%s: interrupt(isr=%#2.2x).\n", dev->name,
 			   inb_p(e8390_base + EN0_ISR));
     
-	/* !!Assumption!! -- we stay in page 0.	 Don't break this. */
-	while ((interrupts = inb_p(e8390_base + EN0_ISR)) != 0
+	/*
+	 * !!Assumption!! -- we stay in page 0.	 Don't break this.
+	 * Rx sources masked for ei_poll() are left pending in the ISR
+	 * until the poll acks them, so don't look at them here.
+	 */
+	while ((interrupts = inb_p(e8390_base + EN0_ISR) &
+			(ei_local->imr | ~ENISR_ALL)) != 0
 		   && ++nr_serviced < MAX_SERVICE) 
 	{
 		if (!netif_running(dev)) {
@@ -465,8 +479,11 @@ void ei_interrupt(int irq, void *dev_id, struct pt_regs * regs)
 			ei_rx_overrun(dev);
 		else if (interrupts & (ENISR_RX+ENISR_RX_ERR)) 
 		{
-			/* Got a good (?) packet. */
-			ei_receive(dev);
+			/* Got a good (?) packet, leave it to ei_poll(). */
+			ei_local->imr = ENISR_ALL & ~(ENISR_RX+ENISR_RX_ERR);
+			outb_p(ei_local->imr, e8390_base + EN0_IMR);
+			if (netif_rx_schedule_prep(dev))
+				__netif_rx_schedule(dev);
 		}
 		/* Push the next to-transmit packet through. */
 		if (interrupts & ENISR_TX)
@@ -654,12 +671,17 @@ static void ei_tx_intr(struct net_device *dev)
 /**
  * ei_receive - receive some packets
  * @dev: network device with which receive will be run
+ * @budget: maximum number of frames to take off the ring
+ * @rxq: queue the good packets are appended to
  *
  * We have a good packet(s), get it/them out of the buffers. 
- * Called with lock held.
+ * Called with lock held, so the packets are only queued on @rxq and
+ * the caller passes them up once the lock is dropped. Returns the
+ * number of frames removed from the ring.
  */
 
-static void ei_receive(struct net_device *dev)
+static int ei_receive(struct net_device *dev, int budget,
+		      struct sk_buff_head *rxq)
 {
 	long e8390_base = dev->base_addr;
 	struct ei_device *ei_local = (struct ei_device *) dev->priv;
@@ -669,7 +691,7 @@ static void ei_receive(struct net_device *dev)
 	struct e8390_pkt_hdr rx_frame;
 	int num_rx_pages = ei_local->stop_page-ei_local->rx_start_page;
     
-	while (++rx_pkt_count < 10) 
+	while (rx_pkt_count < budget) 
 	{
 		int pkt_len, pkt_stat;
 		
@@ -695,6 +717,7 @@ static void ei_receive(struct net_device *dev)
 		
 		if (this_frame == rxing_page)	/* Read all the frames? */
 			break;				/* Done for now */
+		rx_pkt_count++;
 		
 		current_offset = this_frame << 8;
 		ei_get_8390_hdr(dev, &rx_frame, this_frame);
@@ -746,7 +769,7 @@ static void ei_receive(struct net_device *dev)
 				skb_put(skb, pkt_len);	/* Make room */
 				ei_block_input(dev, pkt_len, skb, current_offset + sizeof(rx_frame));
 				skb->protocol=eth_type_trans(skb,dev);
-				netif_rx(skb);
+				__skb_queue_tail(rxq, skb);
 				dev->last_rx = jiffies;
 				ei_local->stat.rx_packets++;
 				ei_local->stat.rx_bytes += pkt_len;
@@ -780,7 +803,48 @@ static void ei_receive(struct net_device *dev)
 	/* We used to also ack ENISR_OVER here, but that would sometimes mask
 	   a real overrun, leaving the 8390 in a stopped state with rec'vr off. */
 	outb_p(ENISR_RX+ENISR_RX_ERR, e8390_base+EN0_ISR);
-	return;
+	return rx_pkt_count;
+}
+
+/**
+ * ei_poll - receive poll routine
+ * @dev: network device to poll
+ * @budget: packet budget of this softirq run
+ *
+ * Empty the receive ring, at most dev->quota frames at a time. Once it
+ * is empty the Rx interrupt sources are unmasked again.
+ */
+
+static int ei_poll(struct net_device *dev, int *budget)
+{
+	struct ei_device *ei_local = (struct ei_device *) dev->priv;
+	long e8390_base = dev->base_addr;
+	int orig_budget = min(*budget, dev->quota);
+	struct sk_buff_head rxq;
+	struct sk_buff *skb;
+	unsigned long flags;
+	int received, done = 0;
+
+	skb_queue_head_init(&rxq);
+
+	spin_lock_irqsave(&ei_local->page_lock, flags);
+	received = ei_receive(dev, orig_budget, &rxq);
+	if (received < orig_budget) {
+		netif_rx_complete(dev);
+		ei_local->imr = ENISR_ALL;
+		if (!ei_local->irqlock)
+			outb_p(ei_local->imr, e8390_base + EN0_IMR);
+		done = 1;
+	}
+	spin_unlock_irqrestore(&ei_local->page_lock, flags);
+
+	while ((skb = __skb_dequeue(&rxq)) != NULL)
+		netif_receive_skb(skb);
+
+	*budget -= received;
+	dev->quota -= received;
+
+	return !done;
 }
 
 /**
@@ -801,6 +865,8 @@ static void ei_rx_overrun(struct net_device *dev)
 	long e8390_base = dev->base_addr;
 	unsigned char was_txing, must_resend = 0;
 	struct ei_device *ei_local = (struct ei_device *) dev->priv;
+	struct sk_buff_head rxq;
+	struct sk_buff *skb;
     
 	/*
 	 * Record whether a Tx was in progress and then issue the
@@ -850,7 +916,10 @@ static void ei_rx_overrun(struct net_device *dev)
 	/*
 	 * Clear the Rx ring of all the debris, and ack the interrupt.
 	 */
-	ei_receive(dev);
+	skb_queue_head_init(&rxq);
+	ei_receive(dev, 9, &rxq);
+	while ((skb = __skb_dequeue(&rxq)) != NULL)
+		netif_rx(skb);
 	outb_p(ENISR_OVER, e8390_base+EN0_ISR);
 
 	/*
@@ -1012,6 +1081,8 @@ int ethdev_init(struct net_device *dev)
 	dev->hard_start_xmit = &ei_start_xmit;
 	dev->get_stats	= get_stats;
 	dev->set_multicast_list = &set_multicast_list;
+	dev->poll = ei_poll;
+	dev->weight = 16;
 
 	ether_setup(dev);
         
@@ -1082,7 +1153,8 @@ void NS8390_init(struct net_device *dev, int startp)
 	if (startp) 
 	{
 		outb_p(0xff,  e8390_base + EN0_ISR);
-		outb_p(ENISR_ALL,  e8390_base + EN0_IMR);
+		ei_local->imr = ENISR_ALL;
+		outb_p(ei_local->imr,  e8390_base + EN0_IMR);
 		outb_p(E8390_NODMA+E8390_PAGE0+E8390_START, e8390_base+E8390_CMD);
 		outb_p(E8390_TXCONFIG, e8390_base + EN0_TXCR); /* xmit on. */
 		/* 3c503 TechMan says rxconfig only after the NIC is started. */
@@ -328,7 +328,9 @@ static int  pcnet32_probe1(unsigned long, unsigned int, int, struct pci_dev *);
 static int  pcnet32_open(struct net_device *);
 static int  pcnet32_init_ring(struct net_device *);
 static int  pcnet32_start_xmit(struct sk_buff *, struct net_device *);
-static int  pcnet32_rx(struct net_device *);
+static int  pcnet32_rx(struct net_device *, int);
+static int  pcnet32_poll(struct net_device *, int *);
+static void pcnet32_rx_schedule(struct net_device *);
 static void pcnet32_tx_timeout (struct net_device *dev);
 static void pcnet32_interrupt(int, void *, struct pt_regs *);
 static int  pcnet32_close(struct net_device *);
@@ -791,6 +793,8 @@ pcnet32_probe1(unsigned long ioaddr, unsigned int irq_line, int shared,
     dev->do_ioctl = &pcnet32_ioctl;
     dev->tx_timeout = pcnet32_tx_timeout;
     dev->watchdog_timeo = (5*HZ);
+    dev->poll = pcnet32_poll;
+    dev->weight = RX_RING_SIZE;
 
     lp->next = pcnet32_dev;
     pcnet32_dev = dev;
@@ -1156,8 +1160,8 @@ pcnet32_interrupt(int irq, void *dev_id, struct pt_regs * regs)
 	    printk(KERN_DEBUG "%s: interrupt  csr0=%#2.2x new csr=%#2.2x.\n",
 		   dev->name, csr0, lp->a.read_csr (ioaddr, 0));
 
-	if (csr0 & 0x0400)		/* Rx interrupt */
-	    pcnet32_rx(dev);
+	if (csr0 & 0x1400)		/* Rx interrupt or missed frame */
+	    pcnet32_rx_schedule(dev);
 
 	if (csr0 & 0x0200) {		/* Tx-done interrupt */
 	    unsigned int dirty_tx = lp->dirty_tx;
@@ -1234,9 +1238,8 @@ pcnet32_interrupt(int irq, void *dev_id, struct pt_regs * regs)
 	     * this on SP3G with Intel saturn chipset) which have sometimes problems
 	     * and will fill up the receive ring with error descriptors. In this
 	     * situation we don't get a rx interrupt, but a missed frame interrupt sooner
-	     * or later. So we try to clean up our receive ring here.
+	     * or later. So the poll routine is scheduled to clean up our receive ring.
 	     */
-	    pcnet32_rx(dev);
 	    lp->stats.rx_errors++; /* Missed a Rx frame. */
 	}
 	if (csr0 & 0x0800) {
@@ -1263,14 +1266,67 @@ pcnet32_interrupt(int irq, void *dev_id, struct pt_regs * regs)
     spin_unlock(&lp->lock);
 }
 
+/*
+ * Rx is done by pcnet32_poll(): mask Rx interrupts (CSR3 RINTM) and
+ * schedule it. Called from the interrupt handler with lp->lock held.
+ */
+static void
+pcnet32_rx_schedule(struct net_device *dev)
+{
+    struct pcnet32_private *lp = dev->priv;
+    unsigned long ioaddr = dev->base_addr;
+
+    if (netif_rx_schedule_prep(dev)) {
+	lp->a.write_csr (ioaddr, 3, lp->a.read_csr (ioaddr, 3) | 0x0400);
+	__netif_rx_schedule(dev);
+    }
+}
+
 static int
-pcnet32_rx(struct net_device *dev)
+pcnet32_poll(struct net_device *dev, int *budget)
+{
+    struct pcnet32_private *lp = dev->priv;
+    unsigned long ioaddr = dev->base_addr;
+    int orig_budget = min(*budget, dev->quota);
+    int work_done, entry;
+    unsigned long flags;
+    u16 rap;
+
+    work_done = pcnet32_rx(dev, orig_budget);
+    *budget -= work_done;
+    dev->quota -= work_done;
+    if (work_done >= orig_budget)
+	return 1;
+
+    /*
+     * Ring is empty: unmask Rx interrupts. A frame that came in after
+     * we looked could have had its RINT acked by a Tx interrupt in the
+     * meantime, so look again once unmasked.
+     */
+    spin_lock_irqsave(&lp->lock, flags);
+    rap = lp->a.read_rap(ioaddr);
+    netif_rx_complete(dev);
+    lp->a.write_csr (ioaddr, 3, lp->a.read_csr (ioaddr, 3) & ~0x0400);
+    entry = lp->cur_rx & RX_RING_MOD_MASK;
+    if ((short)le16_to_cpu(lp->rx_ring[entry].status) >= 0 &&
+	netif_rx_reschedule(dev, 0))
+	lp->a.write_csr (ioaddr, 3, lp->a.read_csr (ioaddr, 3) | 0x0400);
+    lp->a.write_rap (ioaddr, rap);
+    spin_unlock_irqrestore(&lp->lock, flags);
+
+    return 0;
+}
+
+static int
+pcnet32_rx(struct net_device *dev, int budget)
 {
     struct pcnet32_private *lp = dev->priv;
     int entry = lp->cur_rx & RX_RING_MOD_MASK;
+    int received = 0;
 
     /* If we own the next entry, it's a new packet. Send it up. */
-    while ((short)le16_to_cpu(lp->rx_ring[entry].status) >= 0) {
+    while (received < budget &&
+	   (short)le16_to_cpu(lp->rx_ring[entry].status) >= 0) {
 	int status = (short)le16_to_cpu(lp->rx_ring[entry].status) >> 8;
 
 	if (status != 0x03) {			/* There was an error. */
@@ -1343,11 +1399,12 @@ pcnet32_rx(struct net_device *dev)
 		}
 		lp->stats.rx_bytes += skb->len;
 		skb->protocol=eth_type_trans(skb,dev);
-		netif_rx(skb);
+		netif_receive_skb(skb);
 		dev->last_rx = jiffies;
 		lp->stats.rx_packets++;
 	    }
 	}
+	received++;
 	/*
 	 * The docs say that the buffer length isn't touched, but Andrew Boyd
 	 * of QNX reports that some revs of the 79C965 clear it.
@@ -1357,7 +1414,7 @@ pcnet32_rx(struct net_device *dev)
 	entry = (++lp->cur_rx) & RX_RING_MOD_MASK;
     }
 
-    return 0;
+    return received;
 }
 
 static int
@@ -51,6 +51,79 @@ static kmem_cache_t *dentry_cache;
 static unsigned int d_hash_mask;
 static unsigned int d_hash_shift;
 static struct list_head *dentry_hashtable;
+
+/*
+ * d_lookup() walks a hash chain under the read lock of the chain's
+ * stripe of d_hash_locks, without dcache_lock. Changes to a chain
+ * hold dcache_lock and write-lock the stripe, so dcache_lock holders
+ * still see stable chains. A create, unlink or rename then only holds
+ * off the lookups that hash to the same stripe, where a global lock
+ * would have to be taken from every CPU.
+ */
+#define D_HASH_LOCKS	128
+
+static struct d_hash_lock {
+	rwlock_t lock;
+} ____cacheline_aligned d_hash_locks[D_HASH_LOCKS];
+
+static inline struct list_head * d_hash(struct dentry * parent, unsigned long hash)
+{
+	hash += (unsigned long) parent / L1_CACHE_BYTES;
+	hash = hash ^ (hash >> D_HASHBITS);
+	return dentry_hashtable + (hash & D_HASHMASK);
+}
+
+static inline rwlock_t * d_hash_lock(struct list_head * chain)
+{
+	return &d_hash_locks[(chain - dentry_hashtable) & (D_HASH_LOCKS-1)].lock;
+}
+
+/* The lock of the chain the dentry is hashed on, or would be */
+static inline rwlock_t * dentry_hash_lock(struct dentry * dentry)
+{
+	return d_hash_lock(d_hash(dentry->d_parent, dentry->d_name.hash));
+}
+
+/*
+ * __d_drop - unhash a dentry, with dcache_lock held
+ */
+void __d_drop(struct dentry * dentry)
+{
+	rwlock_t *lock = dentry_hash_lock(dentry);
+
+	write_lock(lock);
+	list_del_init(&dentry->d_hash);
+	write_unlock(lock);
+}
+
+/*
+ * __d_drop_unused - unhash a dentry that has no more than count users
+ *
+ * The count is checked under the hash chain lock, so that d_lookup()
+ * can't take a reference between the check and the unhash. Returns 0
+ * if the dentry is unhashed, -EBUSY if it is used. Called with
+ * dcache_lock held.
+ */
+int __d_drop_unused(struct dentry * dentry, int count)
+{
+	rwlock_t *lock = dentry_hash_lock(dentry);
+
+	write_lock(lock);
+	if (atomic_read(&dentry->d_count) > count) {
+		write_unlock(lock);
+		return -EBUSY;
+	}
+	list_del_init(&dentry->d_hash);
+	write_unlock(lock);
+	return 0;
+}
+
+/*
+ * The unused list is maintained lazily: d_lookup() takes its reference
+ * without dcache_lock, so it cannot take the dentry off the list. Entries
+ * on dentry_unused may therefore be in use again, prune_dcache() skips
+ * those and dput() leaves a dentry where it is if it is still queued.
+ */
 static LIST_HEAD(dentry_unused);
 
 /* Statistics gathering. */
@@ -129,9 +202,6 @@ repeat:
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
-	/* dput on a free dentry? */
-	if (!list_empty(&dentry->d_lru))
-		BUG();
 	/*
 	 * AV: ->d_delete() is _NOT_ allowed to block now.
 	 */
@@ -142,16 +212,27 @@ repeat:
 	/* Unreachable? Get rid of it */
 	if (list_empty(&dentry->d_hash))
 		goto kill_it;
-	list_add(&dentry->d_lru, &dentry_unused);
-	dentry_stat.nr_unused++;
+	if (list_empty(&dentry->d_lru)) {
+		list_add(&dentry->d_lru, &dentry_unused);
+		dentry_stat.nr_unused++;
+	}
 	spin_unlock(&dcache_lock);
 	return;
 
 unhash_it:
-	list_del_init(&dentry->d_hash);
+	__d_drop(dentry);
+	/* d_lookup() got to it before we unhashed it? */
+	if (atomic_read(&dentry->d_count)) {
+		spin_unlock(&dcache_lock);
+		return;
+	}
 
 kill_it: {
 		struct dentry *parent;
+		if (!list_empty(&dentry->d_lru)) {
+			list_del(&dentry->d_lru);
+			dentry_stat.nr_unused--;
+		}
 		list_del(&dentry->d_child);
 		/* drops the lock, at that point nobody can reach this dentry */
 		dentry_iput(dentry);
@@ -206,14 +287,13 @@ int d_invalidate(struct dentry * dentry)
 	 * we might still populate it if it was a
 	 * working directory or similar).
 	 */
-	if (atomic_read(&dentry->d_count) > 1) {
-		if (dentry->d_inode && S_ISDIR(dentry->d_inode->i_mode)) {
+	if (dentry->d_inode && S_ISDIR(dentry->d_inode->i_mode)) {
+		if (__d_drop_unused(dentry, 1)) {
 			spin_unlock(&dcache_lock);
 			return -EBUSY;
 		}
-	}
-
-	list_del_init(&dentry->d_hash);
+	} else
+		__d_drop(dentry);
 	spin_unlock(&dcache_lock);
 	return 0;
 }
@@ -223,7 +303,8 @@ int d_invalidate(struct dentry * dentry)
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	if (atomic_read(&dentry->d_count) == 1) {
+	if (atomic_read(&dentry->d_count) == 1 &&
+	    !list_empty(&dentry->d_lru)) {
 		dentry_stat.nr_unused--;
 		list_del_init(&dentry->d_lru);
 	}
@@ -295,12 +376,15 @@ restart:
  * This requires that the LRU list has already been
  * removed.
  * Called with dcache_lock, drops it and then regains.
+ * Returns 0 without touching the dentry if d_lookup()
+ * has picked it up again in the meantime.
  */
-static inline void prune_one_dentry(struct dentry * dentry)
+static inline int prune_one_dentry(struct dentry * dentry)
 {
 	struct dentry * parent;
 
-	list_del_init(&dentry->d_hash);
+	if (__d_drop_unused(dentry, 0))
+		return 0;
 	list_del(&dentry->d_child);
 	dentry_iput(dentry);
 	parent = dentry->d_parent;
@@ -308,6 +392,7 @@ static inline void prune_one_dentry(struct dentry * dentry)
 	if (parent != dentry)
 		dput(parent);
 	spin_lock(&dcache_lock);
+	return 1;
 }
 
 /**
@@ -357,11 +442,9 @@ redo:
 		}
 		dentry_stat.nr_unused--;
 
-		/* Unused dentry with a count? */
-		if (atomic_read(&dentry->d_count))
-			BUG();
-
-		prune_one_dentry(dentry);
+		/* Looked up again since it went unused? */
+		if (!prune_one_dentry(dentry))
+			continue;
 		if (!--count)
 			break;
 	}
@@ -711,13 +794,6 @@ struct dentry * d_alloc_root(struct inode * root_inode)
 	return res;
 }
 
-static inline struct list_head * d_hash(struct dentry * parent, unsigned long hash)
-{
-	hash += (unsigned long) parent / L1_CACHE_BYTES;
-	hash = hash ^ (hash >> D_HASHBITS);
-	return dentry_hashtable + (hash & D_HASHMASK);
-}
-
 /**
  * d_lookup - search for a dentry
  * @parent: parent dentry
@@ -727,6 +803,10 @@ static inline struct list_head * d_hash(struct dentry * parent, unsigned long ha
  * the dentry is found its reference count is incremented and the dentry
  * is returned. The caller must use d_put to free the entry when it has
  * finished using it. %NULL is returned on failure.
+ *
+ * This does not take dcache_lock, the hash chain is protected by the
+ * read lock of its stripe of d_hash_locks. The dentry is not taken off the
+ * unused list either, prune_dcache() checks the count before freeing.
  */
  
 struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
@@ -735,9 +815,10 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 	unsigned int hash = name->hash;
 	const unsigned char *str = name->name;
 	struct list_head *head = d_hash(parent,hash);
+	rwlock_t *lock = d_hash_lock(head);
 	struct list_head *tmp;
 
-	spin_lock(&dcache_lock);
+	read_lock(lock);
 	tmp = head->next;
 	for (;;) {
 		struct dentry * dentry = list_entry(tmp, struct dentry, d_hash);
@@ -757,12 +838,13 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 			if (memcmp(dentry->d_name.name, str, len))
 				continue;
 		}
-		__dget_locked(dentry);
+		atomic_inc(&dentry->d_count);
+		/* racy against prune_dcache(), it is only a hint */
 		dentry->d_vfs_flags |= DCACHE_REFERENCED;
-		spin_unlock(&dcache_lock);
+		read_unlock(lock);
 		return dentry;
 	}
-	spin_unlock(&dcache_lock);
+	read_unlock(lock);
 	return NULL;
 }
 
@@ -835,14 +917,33 @@ out:
  
 void d_delete(struct dentry * dentry)
 {
+	struct inode *inode;
+	rwlock_t *lock;
+
 	/*
-	 * Are we the only user?
+	 * Are we the only user? The hash lock keeps d_lookup() from
+	 * handing out the dentry until it is negative.
 	 */
 	spin_lock(&dcache_lock);
+	lock = dentry_hash_lock(dentry);
+	write_lock(lock);
 	if (atomic_read(&dentry->d_count) == 1) {
-		dentry_iput(dentry);
+		inode = dentry->d_inode;
+		dentry->d_inode = NULL;
+		write_unlock(lock);
+		if (!inode) {
+			spin_unlock(&dcache_lock);
+			return;
+		}
+		list_del_init(&dentry->d_alias);
+		spin_unlock(&dcache_lock);
+		if (dentry->d_op && dentry->d_op->d_iput)
+			dentry->d_op->d_iput(dentry, inode);
+		else
+			iput(inode);
 		return;
 	}
+	write_unlock(lock);
 	spin_unlock(&dcache_lock);
 
 	/*
@@ -862,9 +963,12 @@ void d_delete(struct dentry * dentry)
 void d_rehash(struct dentry * entry)
 {
 	struct list_head *list = d_hash(entry->d_parent, entry->d_name.hash);
+	rwlock_t *lock = d_hash_lock(list);
 	if (!list_empty(&entry->d_hash)) BUG();
 	spin_lock(&dcache_lock);
+	write_lock(lock);
 	list_add(&entry->d_hash, list);
+	write_unlock(lock);
 	spin_unlock(&dcache_lock);
 }
 
@@ -926,12 +1030,24 @@ static inline void switch_names(struct dentry * dentry, struct dentry * target)
   
 void d_move(struct dentry * dentry, struct dentry * target)
 {
+	rwlock_t *lock1, *lock2;
+
 	check_lock();
 
 	if (!dentry->d_inode)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
 	spin_lock(&dcache_lock);
+	/*
+	 * d_lookup() must not see the hash chains or the names
+	 * half way through the switch. Writers all hold dcache_lock,
+	 * so taking two chain locks can't deadlock.
+	 */
+	lock1 = dentry_hash_lock(dentry);
+	lock2 = dentry_hash_lock(target);
+	write_lock(lock1);
+	if (lock2 != lock1)
+		write_lock(lock2);
 	/* Move the dentry to the target hash queue */
 	list_del(&dentry->d_hash);
 	list_add(&dentry->d_hash, &target->d_hash);
@@ -957,6 +1073,9 @@ void d_move(struct dentry * dentry, struct dentry * target)
 	do_switch(dentry->d_parent, target->d_parent);
 	do_switch(dentry->d_name.len, target->d_name.len);
 	do_switch(dentry->d_name.hash, target->d_name.hash);
+	if (lock2 != lock1)
+		write_unlock(lock2);
+	write_unlock(lock1);
 
 	/* And add them back to the (new) parent lists */
 	list_add(&target->d_child, &target->d_parent->d_subdirs);
@@ -1281,6 +1400,9 @@ static void __init dcache_init(unsigned long mempages)
 		d++;
 		i--;
 	} while (i);
+
+	for (i = 0; i < D_HASH_LOCKS; i++)
+		rwlock_init(&d_hash_locks[i].lock);
 }
 
 static void init_buffer_head(void * foo, kmem_cache_t * cachep, unsigned long flags)
@@ -21,20 +21,35 @@
 #include <linux/fs.h>
 #include <linux/jbd.h>
 #include <linux/ext3_fs.h>
+#include <linux/slab.h>
 
 static unsigned char ext3_filetype_table[] = {
 	DT_UNKNOWN, DT_REG, DT_DIR, DT_CHR, DT_BLK, DT_FIFO, DT_SOCK, DT_LNK
 };
 
 static int ext3_readdir(struct file *, void *, filldir_t);
+static int ext3_dx_readdir(struct file * filp,
+			   void * dirent, filldir_t filldir);
+static int ext3_release_dir (struct inode * inode,
+			     struct file * filp);
 
 struct file_operations ext3_dir_operations = {
 	read:		generic_read_dir,
 	readdir:	ext3_readdir,		/* BKL held */
 	ioctl:		ext3_ioctl,		/* BKL held */
 	fsync:		ext3_sync_file,		/* BKL held */
+	release:	ext3_release_dir,
 };
 
+static unsigned char get_dtype(struct super_block *sb, int filetype)
+{
+	if (!EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_FILETYPE) ||
+	    (filetype >= EXT3_FT_MAX))
+		return DT_UNKNOWN;
+
+	return (ext3_filetype_table[filetype]);
+}
+
 int ext3_check_dir_entry (const char * function, struct inode * dir,
 			  struct ext3_dir_entry_2 * de,
 			  struct buffer_head * bh,
@@ -79,6 +94,16 @@ static int ext3_readdir(struct file * filp,
 
 	sb = inode->i_sb;
 
+	if (is_dx(inode)) {
+		err = ext3_dx_readdir(filp, dirent, filldir);
+		if (err != ERR_BAD_DX_DIR)
+			return err;
+		/*
+		 * We don't set the inode dirty flag since it's not
+		 * critical that it get flushed back to the disk.
+		 */
+		inode->u.ext3_i.i_flags &= ~EXT3_INDEX_FL;
+	}
 	stored = 0;
 	bh = NULL;
 	offset = filp->f_pos & (sb->s_blocksize - 1);
@@ -162,18 +187,12 @@ revalidate:
 				 * during the copy operation.
 				 */
 				unsigned long version = filp->f_version;
-				unsigned char d_type = DT_UNKNOWN;
 
-				if (EXT3_HAS_INCOMPAT_FEATURE(sb,
-						EXT3_FEATURE_INCOMPAT_FILETYPE)
-						&& de->file_type < EXT3_FT_MAX)
-					d_type =
-					  ext3_filetype_table[de->file_type];
 				error = filldir(dirent, de->name,
 						de->name_len,
 						filp->f_pos,
 						le32_to_cpu(de->inode),
-						d_type);
+						get_dtype(sb, de->file_type));
 				if (error)
 					break;
 				if (version != filp->f_version)
@@ -188,3 +207,158 @@ revalidate:
 	UPDATE_ATIME(inode);
 	return 0;
 }
+
+/*
+ * Indexed directories are returned in hash order, and f_pos holds the
+ * major hash of the next entry to return (shifted down one bit, as the
+ * low bit of a hash is never set) rather than a byte offset.  That
+ * cookie stays valid however the leaves get split underneath us, which
+ * a byte offset into a block that has been split would not.
+ *
+ * The names of one run of index leaves are read in at a time and kept,
+ * sorted by hash, in the file's private data until they are returned.
+ */
+struct fname {
+	__u32		hash;
+	__u32		minor_hash;
+	struct fname	*next;
+	__u32		inode;
+	__u8		name_len;
+	__u8		file_type;
+	char		name[0];
+};
+
+struct dir_private_info {
+	struct fname	*list;		/* pending names, in hash order */
+	__u32		next_hash;	/* where the next run of leaves starts */
+	loff_t		last_pos;	/* f_pos when we last returned */
+};
+
+#define hash2pos(major)		((major) >> 1)
+#define pos2maj_hash(pos)	(((pos) << 1) & 0xffffffff)
+
+static void free_fname_list(struct fname *p)
+{
+	struct fname *next;
+
+	while (p) {
+		next = p->next;
+		kfree(p);
+		p = next;
+	}
+}
+
+static struct dir_private_info *create_dir_info(loff_t pos)
+{
+	struct dir_private_info *p;
+
+	p = kmalloc(sizeof(struct dir_private_info), GFP_KERNEL);
+	if (!p)
+		return NULL;
+	p->list = NULL;
+	p->next_hash = pos2maj_hash(pos);
+	p->last_pos = pos;
+	return p;
+}
+
+/*
+ * Called by ext3_htree_fill_tree() for each name it collects.  Inserts
+ * a copy of the entry into the file's pending list, keeping it sorted
+ * by (hash, minor_hash).
+ */
+int ext3_htree_store_dirent(struct file *dir_file, __u32 hash,
+			    __u32 minor_hash,
+			    struct ext3_dir_entry_2 *dirent)
+{
+	struct dir_private_info *info = dir_file->private_data;
+	struct fname *new_fn, **p;
+
+	new_fn = kmalloc(sizeof(struct fname) + dirent->name_len + 1,
+			 GFP_KERNEL);
+	if (!new_fn)
+		return -ENOMEM;
+	new_fn->hash = hash;
+	new_fn->minor_hash = minor_hash;
+	new_fn->inode = le32_to_cpu(dirent->inode);
+	new_fn->name_len = dirent->name_len;
+	new_fn->file_type = dirent->file_type;
+	memcpy(new_fn->name, dirent->name, dirent->name_len);
+	new_fn->name[dirent->name_len] = 0;
+
+	for (p = &info->list; *p; p = &(*p)->next) {
+		if (hash < (*p)->hash)
+			break;
+		if (hash == (*p)->hash && minor_hash < (*p)->minor_hash)
+			break;
+	}
+	new_fn->next = *p;
+	*p = new_fn;
+	return 0;
+}
+
+static int ext3_dx_readdir(struct file * filp,
+			   void * dirent, filldir_t filldir)
+{
+	struct dir_private_info *info = filp->private_data;
+	struct inode *inode = filp->f_dentry->d_inode;
+	struct fname *fname;
+	__u32 start_hash;
+	int ret;
+
+	if (!info) {
+		info = create_dir_info(filp->f_pos);
+		if (!info)
+			return -ENOMEM;
+		filp->private_data = info;
+	}
+
+	/* Someone has moved f_pos; start again from the hash it names */
+	if (info->last_pos != filp->f_pos) {
+		free_fname_list(info->list);
+		info->list = NULL;
+		info->next_hash = pos2maj_hash(filp->f_pos);
+	}
+
+	while (filp->f_pos != EXT3_HTREE_EOF) {
+		if (!info->list) {
+			if (hash2pos(info->next_hash) == EXT3_HTREE_EOF) {
+				filp->f_pos = EXT3_HTREE_EOF;
+				break;
+			}
+			start_hash = info->next_hash;
+			ret = ext3_htree_fill_tree(filp, start_hash, 0,
+						   &info->next_hash);
+			if (ret < 0) {
+				free_fname_list(info->list);
+				info->list = NULL;
+				return ret;
+			}
+			filp->f_pos = hash2pos(start_hash);
+			continue;
+		}
+		fname = info->list;
+		filp->f_pos = hash2pos(fname->hash);
+		if (filldir(dirent, fname->name, fname->name_len,
+			    filp->f_pos, fname->inode,
+			    get_dtype(inode->i_sb, fname->file_type)))
+			break;
+		info->list = fname->next;
+		kfree(fname);
+		filp->f_pos = info->list ? hash2pos(info->list->hash) :
+			hash2pos(info->next_hash);
+	}
+	info->last_pos = filp->f_pos;
+	UPDATE_ATIME(inode);
+	return 0;
+}
+
+static int ext3_release_dir (struct inode * inode, struct file * filp)
+{
+	struct dir_private_info *info = filp->private_data;
+
+	if (info) {
+		free_fname_list(info->list);
+		kfree(info);
+	}
+	return 0;
+}
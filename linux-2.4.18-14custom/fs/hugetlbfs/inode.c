@@ -0,0 +1,558 @@
+/*
+ * hugetlbfs: a ram filesystem whose files are backed by huge pages.
+ *
+ * The namespace side is ramfs.  File data lives in huge pages from the
+ * pool in arch/<arch>/mm/hugetlbpage.c and can only be reached through
+ * shared mmap(); there is no read() or write().  The pages are kept on
+ * a private per-inode list rather than in the page cache, they are
+ * never written back, aged or swapped.
+ *
+ * Files are also handed out internally to SysV shm for SHM_HUGETLB
+ * segments, see hugetlbfs_file_setup().
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/file.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/dcache.h>
+#include <linux/hugetlb.h>
+#include <linux/spinlock.h>
+
+#include <asm/uaccess.h>
+#include <asm/pgalloc.h>
+
+/* some random number */
+#define HUGETLBFS_MAGIC	0x958458f6
+
+static struct super_operations hugetlbfs_ops;
+static struct file_operations hugetlbfs_dir_operations;
+static struct inode_operations hugetlbfs_dir_inode_operations;
+static struct inode_operations hugetlbfs_inode_operations;
+
+static struct vfsmount *hugetlbfs_mnt;
+
+/*
+ * Huge pages of a file, linked through page->list with page->index
+ * holding the huge page index in the file.
+ */
+struct hugetlbfs_inode_info {
+	spinlock_t lock;
+	struct list_head pages;
+};
+
+#define HUGETLBFS_I(inode) \
+	((struct hugetlbfs_inode_info *)((inode)->u.generic_ip))
+
+static struct page *hugetlbfs_find_page(struct hugetlbfs_inode_info *info,
+					unsigned long idx)
+{
+	struct list_head *p;
+	struct page *page;
+
+	list_for_each(p, &info->pages) {
+		page = list_entry(p, struct page, list);
+		if (page->index == idx)
+			return page;
+	}
+	return NULL;
+}
+
+/*
+ * Look up huge page 'idx' of the file, allocating it from the pool if
+ * it isn't there yet.  Returns NULL if the pool is exhausted.
+ * Called with inode->i_sem held.
+ */
+struct page *hugetlbfs_get_page(struct inode *inode, unsigned long idx)
+{
+	struct hugetlbfs_inode_info *info = HUGETLBFS_I(inode);
+	struct page *page;
+
+	spin_lock(&info->lock);
+	page = hugetlbfs_find_page(info, idx);
+	spin_unlock(&info->lock);
+	if (page)
+		return page;
+
+	page = alloc_huge_page();
+	if (!page)
+		return NULL;
+	page->index = idx;
+
+	spin_lock(&info->lock);
+	list_add(&page->list, &info->pages);
+	inode->i_blocks += HPAGE_SIZE / 512;
+	spin_unlock(&info->lock);
+	return page;
+}
+
+/*
+ * Give back the huge pages at or beyond byte offset 'lstart'.  All
+ * mappings of them must have been torn down already.
+ */
+static void hugetlbfs_truncate_pages(struct inode *inode, loff_t lstart)
+{
+	struct hugetlbfs_inode_info *info = HUGETLBFS_I(inode);
+	unsigned long start = (lstart + HPAGE_SIZE - 1) >> HPAGE_SHIFT;
+	struct list_head *p, *n;
+	struct page *page;
+	LIST_HEAD(freed);
+
+	spin_lock(&info->lock);
+	list_for_each_safe(p, n, &info->pages) {
+		page = list_entry(p, struct page, list);
+		if (page->index < start)
+			continue;
+		list_del(&page->list);
+		list_add(&page->list, &freed);
+		inode->i_blocks -= HPAGE_SIZE / 512;
+	}
+	spin_unlock(&info->lock);
+
+	while (!list_empty(&freed)) {
+		page = list_entry(freed.next, struct page, list);
+		list_del(&page->list);
+		free_huge_page(page);
+	}
+}
+
+static void hugetlbfs_vmtruncate_list(struct vm_area_struct *mpnt,
+				      unsigned long pgoff)
+{
+	do {
+		struct mm_struct *mm = mpnt->vm_mm;
+		unsigned long start = mpnt->vm_start;
+		unsigned long len = mpnt->vm_end - start;
+		unsigned long diff;
+
+		if (mpnt->vm_pgoff >= pgoff) {
+			zap_page_range(mm, start, len, 0);
+			continue;
+		}
+		len >>= PAGE_SHIFT;
+		diff = pgoff - mpnt->vm_pgoff;
+		if (diff >= len)
+			continue;
+		start += diff << PAGE_SHIFT;
+		len = (len - diff) << PAGE_SHIFT;
+		zap_page_range(mm, start, len, 0);
+	} while ((mpnt = mpnt->vm_next_share) != NULL);
+}
+
+/*
+ * vmtruncate() for hugetlbfs: the size is rounded up to a huge page,
+ * so only whole huge pages are ever unmapped and freed.
+ */
+static int hugetlbfs_truncate(struct inode *inode, loff_t size)
+{
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long pgoff;
+
+	if (size > inode->i_size) {
+		inode->i_size = size;
+		return 0;
+	}
+	inode->i_size = size;
+	size = (size + HPAGE_SIZE - 1) & HPAGE_MASK;
+	pgoff = size >> PAGE_SHIFT;
+
+	spin_lock(&mapping->i_shared_lock);
+	if (mapping->i_mmap_shared != NULL)
+		hugetlbfs_vmtruncate_list(mapping->i_mmap_shared, pgoff);
+	spin_unlock(&mapping->i_shared_lock);
+
+	hugetlbfs_truncate_pages(inode, size);
+	return 0;
+}
+
+static int hugetlbfs_setattr(struct dentry *dentry, struct iattr *attr)
+{
+	struct inode *inode = dentry->d_inode;
+	int error;
+
+	error = inode_change_ok(inode, attr);
+	if (error)
+		return error;
+
+	if (attr->ia_valid & ATTR_SIZE) {
+		error = hugetlbfs_truncate(inode, attr->ia_size);
+		if (error)
+			return error;
+		attr->ia_valid &= ~ATTR_SIZE;
+	}
+	inode_setattr(inode, attr);
+	return 0;
+}
+
+/*
+ * Only shared mappings of whole, aligned huge pages.  The mapping is
+ * populated right away; hugetlb vmas never fault.
+ */
+static int hugetlbfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	loff_t len;
+	int ret;
+
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	if (vma->vm_start & ~HPAGE_MASK)
+		return -EINVAL;
+	if (vma->vm_end & ~HPAGE_MASK)
+		return -EINVAL;
+	if (vma->vm_pgoff & ((HPAGE_SIZE >> PAGE_SHIFT) - 1))
+		return -EINVAL;
+
+	UPDATE_ATIME(inode);
+	vma->vm_flags |= VM_HUGETLB | VM_RESERVED;
+	vma->vm_ops = NULL;
+
+	down(&inode->i_sem);
+	len = (loff_t)(vma->vm_end - vma->vm_start) +
+		((loff_t)vma->vm_pgoff << PAGE_SHIFT);
+	if (inode->i_size < len)
+		inode->i_size = len;
+	ret = hugetlb_prefault(vma);
+	up(&inode->i_sem);
+	return ret;
+}
+
+/*
+ * Huge page aligned placement, mmap() of a hugetlbfs file fails for
+ * anything else.
+ */
+static unsigned long hugetlbfs_get_unmapped_area(struct file *file,
+		unsigned long addr, unsigned long len, unsigned long pgoff,
+		unsigned long flags)
+{
+	struct vm_area_struct *vma;
+
+	if (len & ~HPAGE_MASK)
+		return -EINVAL;
+	if (len > TASK_SIZE)
+		return -ENOMEM;
+
+	if (addr) {
+		addr = (addr + HPAGE_SIZE - 1) & HPAGE_MASK;
+		vma = find_vma(current->mm, addr);
+		if (TASK_SIZE - len >= addr &&
+		    (!vma || addr + len <= vma->vm_start))
+			return addr;
+	}
+	addr = (TASK_UNMAPPED_BASE + HPAGE_SIZE - 1) & HPAGE_MASK;
+
+	for (vma = find_vma(current->mm, addr); ; vma = vma->vm_next) {
+		/* At this point:  (!vma || addr < vma->vm_end). */
+		if (TASK_SIZE - len < addr)
+			return -ENOMEM;
+		if (!vma || addr + len <= vma->vm_start)
+			return addr;
+		addr = (vma->vm_end + HPAGE_SIZE - 1) & HPAGE_MASK;
+	}
+}
+
+static struct inode *hugetlbfs_get_inode(struct super_block *sb, int mode,
+					 int dev)
+{
+	struct inode *inode;
+	struct hugetlbfs_inode_info *info;
+
+	inode = new_inode(sb);
+	if (!inode)
+		return NULL;
+
+	inode->i_mode = mode;
+	inode->i_uid = current->fsuid;
+	inode->i_gid = current->fsgid;
+	inode->i_blksize = HPAGE_SIZE;
+	inode->i_blocks = 0;
+	inode->i_rdev = NODEV;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->u.generic_ip = NULL;
+	switch (mode & S_IFMT) {
+	default:
+		init_special_inode(inode, mode, dev);
+		break;
+	case S_IFREG:
+		info = kmalloc(sizeof(*info), GFP_KERNEL);
+		if (!info) {
+			make_bad_inode(inode);
+			iput(inode);
+			return NULL;
+		}
+		spin_lock_init(&info->lock);
+		INIT_LIST_HEAD(&info->pages);
+		inode->u.generic_ip = info;
+		inode->i_op = &hugetlbfs_inode_operations;
+		inode->i_fop = &hugetlbfs_file_operations;
+		break;
+	case S_IFDIR:
+		inode->i_op = &hugetlbfs_dir_inode_operations;
+		inode->i_fop = &hugetlbfs_dir_operations;
+		break;
+	}
+	return inode;
+}
+
+static struct dentry *hugetlbfs_lookup(struct inode *dir, struct dentry *dentry)
+{
+	d_add(dentry, NULL);
+	return NULL;
+}
+
+static int hugetlbfs_mknod(struct inode *dir, struct dentry *dentry,
+			   int mode, int dev)
+{
+	struct inode *inode = hugetlbfs_get_inode(dir->i_sb, mode, dev);
+
+	if (!inode)
+		return -ENOSPC;
+	d_instantiate(dentry, inode);
+	dget(dentry);		/* Extra count - pin the dentry in core */
+	return 0;
+}
+
+static int hugetlbfs_mkdir(struct inode *dir, struct dentry *dentry, int mode)
+{
+	return hugetlbfs_mknod(dir, dentry, mode | S_IFDIR, 0);
+}
+
+static int hugetlbfs_create(struct inode *dir, struct dentry *dentry, int mode)
+{
+	return hugetlbfs_mknod(dir, dentry, mode | S_IFREG, 0);
+}
+
+static int hugetlbfs_link(struct dentry *old_dentry, struct inode *dir,
+			  struct dentry *dentry)
+{
+	struct inode *inode = old_dentry->d_inode;
+
+	if (S_ISDIR(inode->i_mode))
+		return -EPERM;
+
+	inode->i_nlink++;
+	atomic_inc(&inode->i_count);	/* New dentry reference */
+	dget(dentry);		/* Extra pinning count for the created dentry */
+	d_instantiate(dentry, inode);
+	return 0;
+}
+
+static inline int hugetlbfs_positive(struct dentry *dentry)
+{
+	return dentry->d_inode && !d_unhashed(dentry);
+}
+
+static int hugetlbfs_empty(struct dentry *dentry)
+{
+	struct list_head *list;
+
+	spin_lock(&dcache_lock);
+	list = dentry->d_subdirs.next;
+	while (list != &dentry->d_subdirs) {
+		struct dentry *de = list_entry(list, struct dentry, d_child);
+
+		if (hugetlbfs_positive(de)) {
+			spin_unlock(&dcache_lock);
+			return 0;
+		}
+		list = list->next;
+	}
+	spin_unlock(&dcache_lock);
+	return 1;
+}
+
+static int hugetlbfs_unlink(struct inode *dir, struct dentry *dentry)
+{
+	if (!hugetlbfs_empty(dentry))
+		return -ENOTEMPTY;
+
+	dentry->d_inode->i_nlink--;
+	dput(dentry);	/* Undo the count from "create" - this does all the work */
+	return 0;
+}
+
+#define hugetlbfs_rmdir hugetlbfs_unlink
+
+static int hugetlbfs_rename(struct inode *old_dir, struct dentry *old_dentry,
+			    struct inode *new_dir, struct dentry *new_dentry)
+{
+	struct inode *inode = new_dentry->d_inode;
+
+	if (!hugetlbfs_empty(new_dentry))
+		return -ENOTEMPTY;
+
+	if (inode) {
+		inode->i_nlink--;
+		dput(new_dentry);
+	}
+	return 0;
+}
+
+static void hugetlbfs_delete_inode(struct inode *inode)
+{
+	struct hugetlbfs_inode_info *info = HUGETLBFS_I(inode);
+
+	if (info) {
+		hugetlbfs_truncate_pages(inode, 0);
+		kfree(info);
+		inode->u.generic_ip = NULL;
+	}
+	clear_inode(inode);
+}
+
+static int hugetlbfs_statfs(struct super_block *sb, struct statfs *buf)
+{
+	buf->f_type = HUGETLBFS_MAGIC;
+	buf->f_bsize = HPAGE_SIZE;
+	buf->f_namelen = 255;
+	return 0;
+}
+
+static int hugetlbfs_sync_file(struct file *file, struct dentry *dentry,
+			       int datasync)
+{
+	return 0;
+}
+
+struct file_operations hugetlbfs_file_operations = {
+	mmap:			hugetlbfs_file_mmap,
+	fsync:			hugetlbfs_sync_file,
+	get_unmapped_area:	hugetlbfs_get_unmapped_area,
+};
+
+static struct file_operations hugetlbfs_dir_operations = {
+	read:		generic_read_dir,
+	readdir:	dcache_readdir,
+	fsync:		hugetlbfs_sync_file,
+};
+
+static struct inode_operations hugetlbfs_dir_inode_operations = {
+	create:		hugetlbfs_create,
+	lookup:		hugetlbfs_lookup,
+	link:		hugetlbfs_link,
+	unlink:		hugetlbfs_unlink,
+	mkdir:		hugetlbfs_mkdir,
+	rmdir:		hugetlbfs_rmdir,
+	mknod:		hugetlbfs_mknod,
+	rename:		hugetlbfs_rename,
+};
+
+static struct inode_operations hugetlbfs_inode_operations = {
+	setattr:	hugetlbfs_setattr,
+};
+
+static struct super_operations hugetlbfs_ops = {
+	statfs:		hugetlbfs_statfs,
+	put_inode:	force_delete,
+	delete_inode:	hugetlbfs_delete_inode,
+};
+
+static struct super_block *hugetlbfs_read_super(struct super_block *sb,
+						void *data, int silent)
+{
+	struct inode *inode;
+	struct dentry *root;
+
+	sb->s_blocksize = PAGE_CACHE_SIZE;
+	sb->s_blocksize_bits = PAGE_CACHE_SHIFT;
+	sb->s_magic = HUGETLBFS_MAGIC;
+	sb->s_op = &hugetlbfs_ops;
+
+	inode = hugetlbfs_get_inode(sb, S_IFDIR | 0755, 0);
+	if (!inode)
+		return NULL;
+
+	root = d_alloc_root(inode);
+	if (!root) {
+		iput(inode);
+		return NULL;
+	}
+	sb->s_root = root;
+	return sb;
+}
+
+static DECLARE_FSTYPE(hugetlbfs_fs_type, "hugetlbfs", hugetlbfs_read_super,
+		      FS_LITTER);
+
+/**
+ * hugetlbfs_file_setup - get an unlinked file living in hugetlbfs
+ *
+ * @name: name for dentry (to be seen in /proc/<pid>/maps
+ * @size: size to be set for the file
+ *
+ * Huge page counterpart of shmem_file_setup(), used for SHM_HUGETLB
+ * segments.  The size is rounded up to whole huge pages; the pages
+ * themselves are allocated at attach time.
+ */
+struct file *hugetlbfs_file_setup(char *name, size_t size)
+{
+	int error;
+	struct file *file;
+	struct inode *inode;
+	struct dentry *dentry, *root;
+	struct qstr this;
+
+	if (!hugetlbfs_mnt)
+		return ERR_PTR(-ENOENT);
+
+	error = -ENOMEM;
+	this.name = name;
+	this.len = strlen(name);
+	this.hash = 0; /* will go */
+	root = hugetlbfs_mnt->mnt_root;
+	dentry = d_alloc(root, &this);
+	if (!dentry)
+		goto out;
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto put_dentry;
+
+	error = -ENOSPC;
+	inode = hugetlbfs_get_inode(root->d_sb, S_IFREG | S_IRWXUGO, 0);
+	if (!inode)
+		goto close_file;
+
+	d_instantiate(dentry, inode);
+	inode->i_size = (size + HPAGE_SIZE - 1) & HPAGE_MASK;
+	inode->i_nlink = 0;	/* It is unlinked */
+	file->f_vfsmnt = mntget(hugetlbfs_mnt);
+	file->f_dentry = dentry;
+	file->f_op = &hugetlbfs_file_operations;
+	file->f_mode = FMODE_WRITE | FMODE_READ;
+	return file;
+
+close_file:
+	put_filp(file);
+put_dentry:
+	dput(dentry);
+out:
+	return ERR_PTR(error);
+}
+
+static int __init init_hugetlbfs_fs(void)
+{
+	int error;
+	struct vfsmount *res;
+
+	error = register_filesystem(&hugetlbfs_fs_type);
+	if (error)
+		return error;
+
+	res = kern_mount(&hugetlbfs_fs_type);
+	if (IS_ERR(res)) {
+		printk(KERN_ERR "could not kern_mount hugetlbfs\n");
+		unregister_filesystem(&hugetlbfs_fs_type);
+		return PTR_ERR(res);
+	}
+	hugetlbfs_mnt = res;
+	return 0;
+}
+
+module_init(init_hugetlbfs_fs)
@@ -56,6 +56,9 @@ void journal_commit_transaction(journal_t *journal)
 	int first_tag = 0;
 	int tag_flag;
 	int i;
+	struct timeval start_time;
+	unsigned long run_time, locked_time, commit_time;
+	unsigned long log_start, nr_buffers = 0;
 
 	/*
 	 * First job: lock down the current transaction and wait for
@@ -81,6 +84,9 @@ void journal_commit_transaction(journal_t *journal)
 	jbd_debug (1, "JBD: starting commit of transaction %d\n",
 		   commit_transaction->t_tid);
 
+	do_gettimeofday(&start_time);
+	run_time = jbd_time_diff(&commit_transaction->t_start_time);
+
 	commit_transaction->t_state = T_LOCKED;
 	while (commit_transaction->t_updates != 0) {
 		unlock_journal(journal);
@@ -88,6 +94,8 @@ void journal_commit_transaction(journal_t *journal)
 		lock_journal(journal);
 	}
 
+	locked_time = jbd_time_diff(&start_time);
+
 	J_ASSERT (commit_transaction->t_outstanding_credits <=
 			journal->j_max_transaction_buffers);
 
@@ -144,6 +152,7 @@ void journal_commit_transaction(journal_t *journal)
 
 	jbd_debug (3, "JBD: commit phase 1\n");
 
+	log_start = journal->j_head;
 	journal_write_revoke_records(journal, commit_transaction);
 
 	/*
@@ -426,6 +435,7 @@ sync_datalist_empty:
 		JBUFFER_TRACE(jh, "ph3: write metadata");
 		flags = journal_write_metadata_buffer(commit_transaction,
 						      jh, &new_jh, blocknr);
+		nr_buffers++;
 		set_bit(BH_JWrite, &jh2bh(new_jh)->b_state);
 		set_bit(BH_Lock, &jh2bh(new_jh)->b_state);
 		wbuf[bufs++] = jh2bh(new_jh);
@@ -758,6 +768,31 @@ skip_commit: /* The journal should be unlocked by now. */
 	journal->j_commit_sequence = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
 
+	/*
+	 * Account for the commit, and fold its duration into the
+	 * average which sizes the sync batching window.
+	 */
+	commit_time = jbd_time_diff(&start_time);
+	journal->j_stats.ts_tid++;
+	journal->j_stats.ts_handles += commit_transaction->t_handle_count;
+	journal->j_stats.ts_blocks += nr_buffers;
+	if (journal->j_head >= log_start)
+		journal->j_stats.ts_blocks_logged += journal->j_head - log_start;
+	else
+		journal->j_stats.ts_blocks_logged +=
+			(journal->j_last - log_start) +
+			(journal->j_head - journal->j_first);
+	journal->j_stats.ts_running += run_time;
+	journal->j_stats.ts_locked += locked_time;
+	journal->j_stats.ts_commit += commit_time;
+	if (commit_time > journal->j_stats.ts_max_commit)
+		journal->j_stats.ts_max_commit = commit_time;
+	if (journal->j_average_commit_time)
+		journal->j_average_commit_time =
+			(commit_time + journal->j_average_commit_time * 3) / 4;
+	else
+		journal->j_average_commit_time = commit_time;
+
 	spin_lock(&journal_datalist_lock);
 	if (commit_transaction->t_checkpoint_list == NULL) {
 		__journal_drop_transaction(journal, commit_transaction);
@@ -36,6 +36,7 @@
 #include <linux/slab.h>
 #include <linux/suspend.h>
 #include <asm/uaccess.h>
+#include <asm/div64.h>
 #include <linux/proc_fs.h>
 
 EXPORT_SYMBOL(journal_start);
@@ -692,6 +693,9 @@ struct journal_head * journal_get_descriptor_buffer(journal_t *journal)
  * destroy journal_t structures, and to initialise and read existing
  * journal blocks from disk.  */
 
+static void journal_register_stats(journal_t *journal);
+static void journal_unregister_stats(journal_t *journal);
+
 /* First: create and setup a journal_t object in memory.  We initialise
  * very few fields yet: that has to wait until we have created the
  * journal structures from from scratch, or loaded them from disk. */
@@ -769,6 +773,7 @@ journal_t * journal_init_dev(kdev_t dev, kdev_t fs_dev,
 	J_ASSERT(bh != NULL);
 	journal->j_sb_buffer = bh;
 	journal->j_superblock = (journal_superblock_t *)bh->b_data;
+	journal_register_stats(journal);
 
 	return journal;
 }
@@ -808,6 +813,7 @@ journal_t * journal_init_inode (struct inode *inode)
 	J_ASSERT(bh != NULL);
 	journal->j_sb_buffer = bh;
 	journal->j_superblock = (journal_superblock_t *)bh->b_data;
+	journal_register_stats(journal);
 
 	return journal;
 }
@@ -1133,6 +1139,7 @@ void journal_destroy (journal_t *journal)
 		iput(journal->j_inode);
 	if (journal->j_revoke)
 		journal_destroy_revoke(journal);
+	journal_unregister_stats(journal);
 
 	unlock_journal(journal);
 	kfree(journal);
@@ -1879,6 +1886,101 @@ static void __exit remove_jbd_proc_entry(void)
 
 #endif
 
+/*
+ * Per-journal commit statistics, in /proc/fs/jbd/<device>/info
+ */
+#ifdef CONFIG_PROC_FS
+
+static struct proc_dir_entry *proc_jbd_stats;
+
+static unsigned long jbd_stats_avg(__u64 total, unsigned long n)
+{
+	do_div(total, n);
+	return (unsigned long) total;
+}
+
+static int jbd_read_info(char *page, char **start, off_t off,
+			 int count, int *eof, void *data)
+{
+	journal_t *journal = data;
+	struct transaction_stats_s s = journal->j_stats;
+	unsigned long n = s.ts_tid ? s.ts_tid : 1;
+	unsigned long window;
+	int len;
+
+	window = journal->j_average_commit_time;
+	if (window > JBD_MAX_BATCH_TIME)
+		window = JBD_MAX_BATCH_TIME;
+
+	len = sprintf(page, "%lu transactions, each up to %d blocks\n",
+		      s.ts_tid, journal->j_max_transaction_buffers);
+	len += sprintf(page + len, "average: \n"
+		       "  %luus running transaction\n"
+		       "  %luus transaction was being locked\n"
+		       "  %luus committing transaction (max %luus)\n"
+		       "  %lu handles per transaction\n"
+		       "  %lu blocks per transaction\n"
+		       "  %lu logged blocks per transaction\n"
+		       "sync batching window: %luus\n",
+		       jbd_stats_avg(s.ts_running, n),
+		       jbd_stats_avg(s.ts_locked, n),
+		       jbd_stats_avg(s.ts_commit, n), s.ts_max_commit,
+		       s.ts_handles / n, s.ts_blocks / n,
+		       s.ts_blocks_logged / n, window);
+
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return len;
+}
+
+static void journal_register_stats(journal_t *journal)
+{
+	if (!proc_jbd_stats)
+		return;
+	journal->j_proc_entry = proc_mkdir(bdevname(journal->j_fs_dev),
+					   proc_jbd_stats);
+	if (journal->j_proc_entry)
+		create_proc_read_entry("info", 0444, journal->j_proc_entry,
+				       jbd_read_info, journal);
+}
+
+static void journal_unregister_stats(journal_t *journal)
+{
+	if (!journal->j_proc_entry)
+		return;
+	remove_proc_entry("info", journal->j_proc_entry);
+	remove_proc_entry(journal->j_proc_entry->name, proc_jbd_stats);
+	journal->j_proc_entry = NULL;
+}
+
+#define JBD_STATS_PROC_NAME "fs/jbd"
+
+static void __init create_jbd_stats_proc_entry(void)
+{
+	proc_jbd_stats = proc_mkdir(JBD_STATS_PROC_NAME, NULL);
+}
+
+static void __exit remove_jbd_stats_proc_entry(void)
+{
+	if (proc_jbd_stats)
+		remove_proc_entry(JBD_STATS_PROC_NAME, NULL);
+}
+
+#else
+
+static void journal_register_stats(journal_t *journal) {}
+static void journal_unregister_stats(journal_t *journal) {}
+#define create_jbd_stats_proc_entry() do {} while (0)
+#define remove_jbd_stats_proc_entry() do {} while (0)
+
+#endif
+
 /*
  * Module startup and shutdown
  */
@@ -1908,6 +2010,7 @@ static int __init journal_init(void)
 	if (ret != 0)
 		journal_destroy_caches();
 	create_jbd_proc_entry();
+	create_jbd_stats_proc_entry();
 	return ret;
 }
 
@@ -1918,6 +2021,7 @@ static void __exit journal_exit(void)
 	if (n)
 		printk(KERN_EMERG "JBD: leaked %d journal_heads!\n", n);
 #endif
+	remove_jbd_stats_proc_entry();
 	remove_jbd_proc_entry();
 	journal_destroy_caches();
 }
@@ -57,6 +57,7 @@ static transaction_t * get_transaction (journal_t * journal, int is_try)
 	transaction->t_state = T_RUNNING;
 	transaction->t_tid = journal->j_transaction_sequence++;
 	transaction->t_expires = jiffies + journal->j_commit_interval;
+	do_gettimeofday(&transaction->t_start_time);
 	INIT_LIST_HEAD(&transaction->t_jcb);
 
 	/* Set up the commit timer for the new transaction. */
@@ -1375,6 +1376,7 @@ int journal_stop(handle_t *handle)
 	transaction_t *transaction = handle->h_transaction;
 	journal_t *journal = transaction->t_journal;
 	int old_handle_count, err;
+	pid_t pid;
 	
 	if (!handle)
 		return 0;
@@ -1398,18 +1400,36 @@ int journal_stop(handle_t *handle)
 	/*
 	 * Implement synchronous transaction batching.  If the handle
 	 * was synchronous, don't force a commit immediately.  Let's
-	 * yield and let another thread piggyback onto this transaction.
-	 * Keep doing that while new threads continue to arrive.
-	 * It doesn't cost much - we're about to run a commit and sleep
-	 * on IO anyway.  Speeds up many-threaded, many-dir operations
-	 * by 30x or more...
+	 * wait and let other threads piggyback onto this transaction,
+	 * for as long as new handles keep arriving, but no longer than
+	 * a commit typically takes: past that, we would do better to
+	 * commit now and let the latecomers start the next one.  It
+	 * doesn't cost much - we're about to run a commit and sleep on
+	 * IO anyway.  A process doing back-to-back syncs on its own
+	 * has nobody to wait for, so it never waits.  Neither do we
+	 * when the wait left is shorter than a tick: we can't sleep
+	 * for less, and fast storage commits quicker than that.
 	 */
-	if (handle->h_sync) {
-		do {
-			old_handle_count = transaction->t_handle_count;
-			set_current_state(TASK_RUNNING);
-			yield();
-		} while (old_handle_count != transaction->t_handle_count);
+	pid = current->pid;
+	if (handle->h_sync && journal->j_last_sync_writer != pid) {
+		unsigned long commit_time, trans_time, expires;
+
+		journal->j_last_sync_writer = pid;
+		commit_time = journal->j_average_commit_time;
+		if (commit_time > JBD_MAX_BATCH_TIME)
+			commit_time = JBD_MAX_BATCH_TIME;
+		trans_time = jbd_time_diff(&transaction->t_start_time);
+		if (commit_time * HZ >= 1000000 && trans_time < commit_time) {
+			/* whole ticks only */
+			expires = jiffies + (commit_time - trans_time) * HZ / 1000000;
+			while (time_before(jiffies, expires)) {
+				old_handle_count = transaction->t_handle_count;
+				set_current_state(TASK_UNINTERRUPTIBLE);
+				schedule_timeout(1);
+				if (old_handle_count == transaction->t_handle_count)
+					break;
+			}
+		}
 	}
 
 	current->journal_info = NULL;
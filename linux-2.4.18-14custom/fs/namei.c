@@ -1400,7 +1400,8 @@ static void d_unhash(struct dentry *dentry)
 		if (atomic_read(&dentry->d_count) != 2)
 			break;
 	case 2:
-		list_del_init(&dentry->d_hash);
+		/* recheck, d_lookup() may have got a reference since */
+		__d_drop_unused(dentry, 2);
 	}
 	spin_unlock(&dcache_lock);
 }
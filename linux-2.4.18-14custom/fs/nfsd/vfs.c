@@ -71,7 +71,9 @@ struct raparms {
 				p_ramax,
 				p_raend,
 				p_ralen,
-				p_rawin;
+				p_rawin,
+				p_raprev,
+				p_rastride;
 };
 
 static struct raparms *		raparml;
@@ -578,6 +580,8 @@ nfsd_get_raparms(dev_t dev, ino_t ino)
 	ra->p_raend = 0;
 	ra->p_ralen = 0;
 	ra->p_rawin = 0;
+	ra->p_raprev = 0;
+	ra->p_rastride = 0;
 found:
 	if (rap != &raparm_cache) {
 		*rap = ra->p_next;
@@ -624,6 +628,8 @@ nfsd_read(struct svc_rqst *rqstp, struct svc_fh *fhp, loff_t offset,
 		file.f_raend = ra->p_raend;
 		file.f_ralen = ra->p_ralen;
 		file.f_rawin = ra->p_rawin;
+		file.f_raprev = ra->p_raprev;
+		file.f_rastride = ra->p_rastride;
 	}
 	file.f_pos = offset;
 
@@ -641,6 +647,8 @@ nfsd_read(struct svc_rqst *rqstp, struct svc_fh *fhp, loff_t offset,
 		ra->p_raend = file.f_raend;
 		ra->p_ralen = file.f_ralen;
 		ra->p_rawin = file.f_rawin;
+		ra->p_raprev = file.f_raprev;
+		ra->p_rastride = file.f_rastride;
 		ra->p_count -= 1;
 	}
 
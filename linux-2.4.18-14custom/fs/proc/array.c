@@ -61,6 +61,7 @@
 #include <linux/tty.h>
 #include <linux/string.h>
 #include <linux/mman.h>
+#include <linux/file.h>
 #include <linux/proc_fs.h>
 #include <linux/ioport.h>
 #include <linux/mm.h>
@@ -70,6 +71,7 @@
 #include <linux/smp.h>
 #include <linux/signal.h>
 #include <linux/highmem.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -490,7 +492,11 @@ int proc_pid_statm(struct task_struct *task, char * buffer)
 			pgd_t *pgd = pgd_offset(mm, vma->vm_start);
 			int pages = 0, shared = 0, dirty = 0, total = 0;
 
-			statm_pgd_range(pgd, vma->vm_start, vma->vm_end, &pages, &shared, &dirty, &total);
+			/* huge pages are always mapped, and never on the pte level */
+			if (is_vm_hugetlb_page(vma))
+				pages = shared = total = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+			else
+				statm_pgd_range(pgd, vma->vm_start, vma->vm_end, &pages, &shared, &dirty, &total);
 			resident += pages;
 			share += shared;
 			dt += dirty;
@@ -512,6 +518,39 @@ int proc_pid_statm(struct task_struct *task, char * buffer)
 		       size, resident, share, trs, lrs, drs, dt);
 }
 
+/*
+ * One line per open regular file: fd, read-ahead hits, misses and the
+ * current read-ahead maximum in pages.
+ */
+int proc_pid_readahead(struct task_struct *task, char * buffer)
+{
+	struct files_struct *files;
+	int fd, len = 0;
+
+	task_lock(task);
+	files = task->files;
+	if (files)
+		atomic_inc(&files->count);
+	task_unlock(task);
+	if (!files)
+		return 0;
+
+	read_lock(&files->file_lock);
+	for (fd = 0; fd < files->max_fds; fd++) {
+		struct file *file = fcheck_files(files, fd);
+
+		if (!file || !S_ISREG(file->f_dentry->d_inode->i_mode))
+			continue;
+		if (len > PAGE_SIZE - 64)
+			break;
+		len += sprintf(buffer + len, "%d %lu %lu %lu\n", fd,
+			       file->f_rahit, file->f_ramiss, file->f_ramax);
+	}
+	read_unlock(&files->file_lock);
+	put_files_struct(files);
+	return len;
+}
+
 /*
  * The way we support synthetic files > 4K
  * - without storing their contents in some buffer and
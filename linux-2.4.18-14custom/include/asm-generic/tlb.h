@@ -68,6 +68,8 @@ static inline mmu_gather_t *tlb_gather_mmu(struct mm_struct *mm)
 			tlb_finish_mmu((ctxp), 0, 0);\
 	} while (0)
 
+#define tlb_mm(ctxp)	((ctxp)->mm)
+
 /* tlb_finish_mmu
  *	Called at the end of the shootdown operation to free up any resources
  *	that were required.  The page talbe lock is still held at this point.
@@ -107,6 +109,8 @@ typedef struct mm_struct mmu_gather_t;
 		__free_pte(__pte);\
 	} while (0)
 
+#define tlb_mm(tlb)	(tlb)
+
 #endif
 
 
@@ -11,6 +11,18 @@
 
 #include <linux/config.h>
 
+#ifdef CONFIG_HUGETLB_PAGE
+/* HPAGE_SHIFT is the size of a PSE page, mapped by a single pmd */
+#ifdef CONFIG_X86_PAE
+#define HPAGE_SHIFT	21
+#else
+#define HPAGE_SHIFT	22
+#endif
+#define HPAGE_SIZE	(1UL << HPAGE_SHIFT)
+#define HPAGE_MASK	(~(HPAGE_SIZE-1))
+#define HUGETLB_PAGE_ORDER	(HPAGE_SHIFT - PAGE_SHIFT)
+#endif
+
 #ifdef CONFIG_X86_USE_3DNOW
 
 #include <asm/mmx.h>
@@ -263,6 +263,9 @@ extern unsigned long pg0[1024];
 #define pmd_present(x)	(pmd_val(x) & _PAGE_PRESENT)
 #define pmd_clear(xp)	do { set_pmd(xp, __pmd(0)); } while (0)
 #define	pmd_bad(x)	((pmd_val(x) & (~PAGE_MASK & ~_PAGE_USER)) != _KERNPG_TABLE)
+#ifdef CONFIG_HUGETLB_PAGE
+#define pmd_huge(x)	(pmd_val(x) & _PAGE_PSE)
+#endif
 
 
 #define pages_to_mb(x) ((x) >> (20-PAGE_SHIFT))
@@ -247,6 +247,7 @@
 #define __NR_futex		240
 #define __NR_sched_setaffinity	241
 #define __NR_sched_getaffinity	242
+#define __NR_spawn		247
 
 /* user-visible error numbers are in the range -1 - -124: see <asm-i386/errno.h> */
 
@@ -30,6 +30,8 @@
  * implementation to use with a __BRLOCK_USE_ATOMICS define. -DaveM
  *
  * Added BR_LLC_LOCK for use in net/core/ext8022.c -acme
+ *
+ * Added BR_TUX_MIMETYPES_LOCK for the MIME type hash in net/tux
  */
 
 /* Register bigreader lock indices here. */
@@ -37,6 +39,7 @@ enum brlock_indices {
 	BR_GLOBALIRQ_LOCK,
 	BR_NETPROTO_LOCK,
 	BR_LLC_LOCK,
+	BR_TUX_MIMETYPES_LOCK,
 	__BR_END
 };
 
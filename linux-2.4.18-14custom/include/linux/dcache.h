@@ -127,6 +127,17 @@ d_iput:		no		no		yes
 
 extern spinlock_t dcache_lock;
 
+/*
+ * The dentry hash chains are read by d_lookup() under per-chain
+ * locks only. Anything that adds to or removes from a hash chain
+ * must hold dcache_lock and use these, so holding dcache_lock alone
+ * is still enough to see stable chains. Both unhash with dcache_lock
+ * held; __d_drop_unused() only if the dentry has at most count users,
+ * checked so that d_lookup() can't take a new reference meanwhile.
+ */
+extern void __d_drop(struct dentry *);
+extern int __d_drop_unused(struct dentry *, int);
+
 /**
  * d_drop - drop a dentry
  * @dentry: dentry to drop
@@ -147,8 +158,7 @@ extern spinlock_t dcache_lock;
 static __inline__ void d_drop(struct dentry * dentry)
 {
 	spin_lock(&dcache_lock);
-	list_del(&dentry->d_hash);
-	INIT_LIST_HEAD(&dentry->d_hash);
+	__d_drop(dentry);
 	spin_unlock(&dcache_lock);
 }
 
@@ -25,6 +25,9 @@ elevator_merge_req_fn		elevator_noop_merge_req;
 elevator_merge_fn		elevator_linus_merge;
 elevator_merge_req_fn		elevator_linus_merge_req;
 
+elevator_merge_fn		elevator_deadline_merge;
+elevator_merge_req_fn		elevator_deadline_merge_req;
+
 typedef struct blkelv_ioctl_arg_s {
 	int queue_ID;
 	int read_latency;
@@ -39,6 +42,7 @@ extern int blkelvget_ioctl(elevator_t *, blkelv_ioctl_arg_t *);
 extern int blkelvset_ioctl(elevator_t *, const blkelv_ioctl_arg_t *);
 
 extern void elevator_init(elevator_t *, elevator_t);
+extern void elevator_init_default(elevator_t *);
 
 /*
  * Return values from elevator merger
@@ -76,4 +80,13 @@ static inline int elevator_request_latency(elevator_t * elevator, int rw)
 	elevator_linus_merge_req,	/* elevator_merge_req_fn */	\
 	})
 
+#define ELEVATOR_DEADLINE						\
+((elevator_t) {								\
+	HZ / 2,				/* read expire */		\
+	5 * HZ,				/* write expire */		\
+	16,				/* write batch */		\
+	elevator_deadline_merge,	/* elevator_merge_fn */		\
+	elevator_deadline_merge_req,	/* elevator_merge_req_fn */	\
+	})
+
 #endif
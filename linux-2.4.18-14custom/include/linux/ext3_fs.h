@@ -437,8 +437,11 @@ struct ext3_super_block {
 /*E0*/	__u32	s_journal_inum;		/* inode number of journal file */
 	__u32	s_journal_dev;		/* device number of journal file */
 	__u32	s_last_orphan;		/* start of list of inodes to delete */
-
-/*EC*/	__u32	s_reserved[197];	/* Padding to the end of the block */
+/*EC*/	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+/*100*/	__u32	s_reserved[192];	/* Padding to the end of the block */
 };
 
 #ifdef __KERNEL__
@@ -577,6 +580,38 @@ struct ext3_dir_entry_2 {
 					 ~EXT3_DIR_ROUND)
 
 #ifdef __KERNEL__
+/*
+ * Hashed directory index.  An indexed directory keeps a small tree of
+ * (hash, block) pairs in its first block, behind the "." and ".."
+ * entries, so that old kernels still see a valid (if sparse) directory.
+ */
+#define is_dx(dir) (EXT3_HAS_COMPAT_FEATURE(dir->i_sb, \
+				EXT3_FEATURE_COMPAT_DIR_INDEX) && \
+		    (dir->u.ext3_i.i_flags & EXT3_INDEX_FL))
+
+/* Legal values for the dx_root hash_version field: */
+
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+
+/* hash info structure used by the directory hash */
+struct dx_hash_info
+{
+	u32		hash;
+	u32		minor_hash;
+	int		hash_version;
+	u32		*seed;
+};
+
+#define EXT3_HTREE_EOF	0x7fffffff
+
+/*
+ * Returned by the index code when the on-disk index can't be trusted;
+ * callers fall back to treating the directory as unindexed.
+ */
+#define ERR_BAD_DX_DIR	-75000
+
 /*
  * Describe an inode's exact location on disk and in memory
  */
@@ -616,9 +651,15 @@ extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 extern int ext3_check_dir_entry(const char *, struct inode *,
 				struct ext3_dir_entry_2 *, struct buffer_head *,
 				unsigned long);
+extern int ext3_htree_store_dirent(struct file *, __u32, __u32,
+				   struct ext3_dir_entry_2 *);
 /* fsync.c */
 extern int ext3_sync_file (struct file *, struct dentry *, int);
 
+/* hash.c */
+extern int ext3fs_dirhash(const char *name, int len, struct
+			  dx_hash_info *hinfo);
+
 /* ialloc.c */
 extern struct inode * ext3_new_inode (handle_t *, const struct inode *, int);
 extern void ext3_free_inode (handle_t *, struct inode *);
@@ -648,6 +689,7 @@ extern int ext3_ioctl (struct inode *, struct file *, unsigned int,
 		       unsigned long);
 
 /* namei.c */
+extern int ext3_htree_fill_tree(struct file *, __u32, __u32, __u32 *);
 extern int ext3_orphan_add(handle_t *, struct inode *);
 extern int ext3_orphan_del(handle_t *, struct inode *);
 
@@ -40,6 +40,12 @@
 
 extern int ext3_writepage_trans_blocks(struct inode *inode);
 
+/* Adding a name to an indexed directory may split a leaf and an index
+ * node and grow the tree by a level: two new blocks and their
+ * allocation, plus the root and the old node and leaf. */
+
+#define EXT3_INDEX_EXTRA_TRANS_BLOCKS	8
+
 /* Delete operations potentially hit one directory's namespace plus an
  * entire inode, plus arbitrary amounts of bitmap/indirection data.  Be
  * generous.  We can grow the delete transaction later if necessary. */
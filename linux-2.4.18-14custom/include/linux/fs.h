@@ -568,6 +568,8 @@ struct file {
 	mode_t			f_mode;
 	loff_t			f_pos;
 	unsigned long 		f_reada, f_ramax, f_raend, f_ralen, f_rawin;
+	unsigned long		f_raprev, f_rastride;
+	unsigned long		f_rahit, f_ramiss;
 	struct fown_struct	f_owner;
 	unsigned int		f_uid, f_gid;
 	int			f_error;
@@ -0,0 +1,63 @@
+#ifndef _LINUX_HUGETLB_H
+#define _LINUX_HUGETLB_H
+
+#include <linux/config.h>
+
+#ifdef CONFIG_HUGETLB_PAGE
+
+#include <linux/mm.h>
+#include <asm/pgtable.h>
+
+struct ctl_table;
+
+static inline int is_vm_hugetlb_page(struct vm_area_struct *vma)
+{
+	return vma->vm_flags & VM_HUGETLB;
+}
+
+static inline int is_aligned_hugepage_range(unsigned long addr,
+					    unsigned long len)
+{
+	return !(addr & ~HPAGE_MASK) && !(len & ~HPAGE_MASK);
+}
+
+/* arch/<arch>/mm/hugetlbpage.c: the huge page pool and page tables */
+extern int htlbpage_max;
+extern int hugetlb_sysctl_handler(struct ctl_table *, int, struct file *,
+				  void *, size_t *);
+extern int hugetlb_report_meminfo(char *);
+extern struct page *alloc_huge_page(void);
+extern void free_huge_page(struct page *);
+extern int copy_hugetlb_page_range(struct mm_struct *, struct mm_struct *,
+				   struct vm_area_struct *);
+extern int follow_hugetlb_page(struct mm_struct *, struct vm_area_struct *,
+			       struct page **, struct vm_area_struct **,
+			       unsigned long *, int *, int);
+extern int zap_hugetlb_pmd(struct mm_struct *, pmd_t *, unsigned long);
+extern int hugetlb_prefault(struct vm_area_struct *);
+
+/* fs/hugetlbfs: files backed by huge pages */
+extern struct file_operations hugetlbfs_file_operations;
+extern struct file *hugetlbfs_file_setup(char *, size_t);
+extern struct page *hugetlbfs_get_page(struct inode *, unsigned long);
+
+static inline int is_file_hugepages(struct file *file)
+{
+	return file->f_op == &hugetlbfs_file_operations;
+}
+
+#else /* !CONFIG_HUGETLB_PAGE */
+
+#define is_vm_hugetlb_page(vma)			0
+#define is_aligned_hugepage_range(addr, len)	1
+#define hugetlb_report_meminfo(buf)		0
+#define copy_hugetlb_page_range(dst, src, vma)	({ BUG(); 0; })
+#define follow_hugetlb_page(mm, vma, p, vs, st, len, i)	({ BUG(); 0; })
+#define zap_hugetlb_pmd(mm, pmd, addr)		0
+#define pmd_huge(pmd)				0
+#define is_file_hugepages(file)			0
+#define hugetlbfs_file_setup(name, size)	ERR_PTR(-ENOSYS)
+
+#endif /* !CONFIG_HUGETLB_PAGE */
+
+#endif /* _LINUX_HUGETLB_H */
@@ -420,12 +420,31 @@ struct transaction_s
 	/* How many handles used this transaction? */
 	int t_handle_count;
 
+	/* When was the transaction created?  Used for the commit
+	 * statistics and the sync batching window. */
+	struct timeval		t_start_time;
+
 	/* List of registered callback functions for this transaction.
 	 * Called when the transaction is committed. */
 	struct list_head	t_jcb;
 };
 
 
+/* Running totals of what the commits of one journal have cost,
+ * reported in /proc/fs/jbd/<device>/info.  Times are in microseconds. */
+
+struct transaction_stats_s
+{
+	unsigned long		ts_tid;		/* Transactions committed */
+	unsigned long		ts_handles;	/* Handles they held */
+	unsigned long		ts_blocks;	/* Metadata buffers journaled */
+	unsigned long		ts_blocks_logged; /* Log blocks written */
+	__u64			ts_running;	/* Open before commit began */
+	__u64			ts_locked;	/* Waiting for updates to end */
+	__u64			ts_commit;	/* Whole commit */
+	unsigned long		ts_max_commit;	/* Slowest single commit */
+};
+
 /* The journal_t maintains all of the journaling state information for a
  * single filesystem.  It is linked to from the fs superblock structure.
  * 
@@ -561,6 +580,19 @@ struct journal_s
 	/* The revoke table: maintains the list of revoked blocks in the
            current transaction. */
 	struct jbd_revoke_table_s *j_revoke;
+
+	/* Decaying average of the time, in microseconds, a commit
+	 * takes.  A synchronous handle holds its transaction open for
+	 * up to this long while other handles keep joining it. */
+	unsigned long		j_average_commit_time;
+
+	/* The process which last closed a synchronous handle.  A lone
+	 * process issuing back-to-back syncs never waits for company. */
+	pid_t			j_last_sync_writer;
+
+	/* Commit statistics and their /proc directory */
+	struct transaction_stats_s j_stats;
+	struct proc_dir_entry *	j_proc_entry;
 };
 
 /* 
@@ -816,6 +848,27 @@ static inline int tid_geq(tid_t x, tid_t y)
 
 extern int journal_blocks_per_page(struct inode *inode);
 
+#ifdef __KERNEL__
+
+/* Longest we will hold a transaction open for sync batching, in usecs */
+#define JBD_MAX_BATCH_TIME	15000
+
+/* Microseconds elapsed since *start, saturating at a minute. */
+static inline unsigned long jbd_time_diff(struct timeval *start)
+{
+	struct timeval now;
+	long secs, usecs;
+
+	do_gettimeofday(&now);
+	secs = now.tv_sec - start->tv_sec;
+	if (secs >= 60)
+		return 60 * 1000000UL;
+	usecs = secs * 1000000 + now.tv_usec - start->tv_usec;
+	return usecs < 0 ? 0 : usecs;
+}
+
+#endif /* __KERNEL__ */
+
 /*
  * Definitions which augment the buffer_head layer
  */
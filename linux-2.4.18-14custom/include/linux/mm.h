@@ -67,7 +67,6 @@ struct vm_area_struct {
 	unsigned long vm_pgoff;		/* Offset (within vm_file) in PAGE_SIZE
 					   units, *not* PAGE_CACHE_SIZE */
 	struct file * vm_file;		/* File we map to (can be NULL). */
-	unsigned long vm_raend;		/* XXX: put full readahead info here. */
 	void * vm_private_data;		/* was vm_pte (shared mem) */
 };
 
@@ -102,6 +101,8 @@ struct vm_area_struct {
 #define VM_RESERVED	0x00080000	/* Don't unmap it from swap_out */
 
 #define VM_ACCOUNT	0x00100000	/* Memory is a vm accounted object */
+#define VM_HUGETLB	0x00200000	/* Huge TLB page mapping */
+#define VM_PTSHARE	0x00400000	/* Page tables may be shared with other mms */
 
 #define VM_STACK_FLAGS	(0x00000177|VM_ACCOUNT)
 
@@ -115,6 +116,25 @@ struct vm_area_struct {
 extern int vm_min_readahead;
 extern int vm_max_readahead;
 
+/* pages mapped around a file fault */
+extern int vm_fault_around;
+
+/* fork shares the page tables of anonymous memory copy-on-write */
+extern int vm_pagetable_cow;
+
+/*
+ * Read-ahead accounting, see /proc/sys/vm/readahead-stat:
+ * hits are page cache lookups served from an up to date page, misses
+ * had to start a read, and thrashed counts the misses on pages that
+ * were read ahead but got evicted before the reader got to them.
+ */
+struct readahead_stat {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long thrashed;
+};
+extern struct readahead_stat readahead_stat;
+
 /*
  * mapping from the currently active vm_flags protection bits (the
  * low four bits) to a page protection mask..
@@ -130,6 +150,7 @@ struct vm_operations_struct {
 	void (*open)(struct vm_area_struct * area);
 	void (*close)(struct vm_area_struct * area);
 	struct page * (*nopage)(struct vm_area_struct * area, unsigned long address, int unused);
+	void (*fault_around)(struct vm_area_struct * area, unsigned long address, pte_t * page_table);
 };
 
 /* forward declaration; pte_chain is meant to be internal to rmap.c */
@@ -166,7 +187,8 @@ typedef struct page {
 	struct list_head lru;		/* Pageout list, eg. active_list;
 					   protected by pagemap_lru_lock !! */
 	unsigned char age;		/* Page aging counter. */
-	struct pte_chain * pte_chain;	/* Reverse pte mapping pointer.
+	struct pte_chain * pte_chain;	/* Reverse pte mapping pointer,
+					 * or number of ptes if PG_objrmap.
 					 * protected by PG_chainlock
 					 */ 
 	struct page **pprev_hash;	/* Complement to *next_hash. */
@@ -309,6 +331,8 @@ typedef struct page {
 #define PG_chainlock		16	/* lock bit for ->pte_chain */
 #define PG_nosave		16
 #define PG_lru			17
+#define PG_ptshared		18	/* page table page shared by several mms */
+#define PG_objrmap		19	/* ptes found through ->mapping, see rmap.c */
 /* Don't you dare to use high bits, they seem to be used for something else! */
 
 /* Actions for zap_page_range() */
@@ -358,6 +382,22 @@ static inline void pte_chain_unlock(struct page *page)
 #endif
 }
 
+/*
+ * Page table pages have no pte_chain of their own, so PG_chainlock of
+ * a page table page serializes the mms sharing it (see PG_ptshared).
+ */
+#define pte_page_lock(page)	pte_chain_lock(page)
+#define pte_page_unlock(page)	pte_chain_unlock(page)
+
+static inline int pte_page_trylock(struct page *page)
+{
+#ifdef CONFIG_SMP
+	return !test_and_set_bit(PG_chainlock, &page->flags);
+#else
+	return 1;
+#endif
+}
+
 /*
  * The zone field is never updated after free_area_init_core()
  * sets it, so none of the operations on it need to be atomic.
@@ -466,6 +506,20 @@ extern void FASTCALL(set_page_dirty(struct page *));
 #define SetPageLRU(page)	set_bit(PG_lru, &(page)->flags)
 #define ClearPageLRU(page)	clear_bit(PG_lru, &(page)->flags)
 
+/*
+ * A page table page with PG_ptshared set is mapped by the pmds of
+ * several mms, page_count() being the number of pmds.  Its ->mapping
+ * then points to the address_space of the shared mapping instead of
+ * the owning mm, and its ptes are not accounted in anybody's rss.
+ */
+#define PagePtShared(page)	test_bit(PG_ptshared, &(page)->flags)
+#define SetPagePtShared(page)	set_bit(PG_ptshared, &(page)->flags)
+#define ClearPagePtShared(page)	clear_bit(PG_ptshared, &(page)->flags)
+
+#define PageObjRmap(page)	test_bit(PG_objrmap, &(page)->flags)
+#define SetPageObjRmap(page)	set_bit(PG_objrmap, &(page)->flags)
+#define ClearPageObjRmap(page)	clear_bit(PG_objrmap, &(page)->flags)
+
  
 /*
  * Error return values for the *_nopage functions
@@ -543,6 +597,8 @@ extern int shmem_zero_setup(struct vm_area_struct *);
 
 extern void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size, int actions);
 extern int copy_page_range(struct mm_struct *dst, struct mm_struct *src, struct vm_area_struct *vma);
+extern int unshare_page_range(struct vm_area_struct *vma, unsigned long start, unsigned long end);
+extern int unshare_cow_edges(struct mm_struct *mm, unsigned long start, unsigned long end);
 extern int remap_page_range(unsigned long from, unsigned long to, unsigned long size, pgprot_t prot);
 extern int zeromap_page_range(unsigned long from, unsigned long size, pgprot_t prot);
 
@@ -561,6 +617,8 @@ extern int ptrace_check_attach(struct task_struct *task, int kill);
 
 int get_user_pages(struct task_struct *tsk, struct mm_struct *mm, unsigned long start,
 		int len, int write, int force, struct page **pages, struct vm_area_struct **vmas);
+int get_user_pages_cow(unsigned long start, int nr, struct page **pages);
+int map_user_page_cow(unsigned long address, struct page *page);
 
 /*
  * On a two-level page table, this ends up being trivial. Thus the
@@ -655,6 +713,7 @@ extern void truncate_inode_pages(struct address_space *, loff_t);
 /* generic vm_area_ops exported for stackable file systems */
 extern int filemap_sync(struct vm_area_struct *, unsigned long,	size_t, unsigned int);
 extern struct page *filemap_nopage(struct vm_area_struct *, unsigned long, int);
+extern void filemap_fault_around(struct vm_area_struct *, unsigned long, pte_t *);
 
 /*
  * GFP bitmasks..
@@ -59,6 +59,15 @@ typedef struct zone_struct {
 	unsigned long		pages_min, pages_low, pages_high, pages_plenty;
 	int			need_balance;
 
+	/*
+	 * reclaim statistics, shown in /proc/vmstat
+	 */
+	unsigned long		pgscan_kswapd;
+	unsigned long		pgscan_direct;
+	unsigned long		pgsteal;
+	unsigned long		allocstall;
+	unsigned long		kswapd_wake;
+
 	/*
 	 * free areas of different sizes
 	 */
@@ -159,6 +168,8 @@ typedef struct pglist_data {
 	unsigned long node_size;
 	int node_id;
 	struct pglist_data *node_next;
+	wait_queue_head_t kswapd_wait;
+	struct task_struct *kswapd;
 } pg_data_t;
 
 extern int numnodes;
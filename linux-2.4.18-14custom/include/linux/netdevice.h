@@ -334,6 +334,7 @@ struct net_device
 	struct list_head	poll_list;	/* Link to poll list	*/
 	int			quota;
 	int			weight;
+	void			*weight_sysctl;	/* net/core/dev/<name>	*/
 
 	struct Qdisc		*qdisc;
 	struct Qdisc		*qdisc_sleeping;
@@ -591,6 +592,11 @@ static inline void dev_kfree_skb_any(struct sk_buff *skb)
 extern void		net_call_rx_atomic(void (*fn)(void));
 #define HAVE_NETIF_RX 1
 extern int		netif_rx(struct sk_buff *skb);
+#ifdef CONFIG_SYSCTL
+extern void		dev_sysctl_init(void);
+#else
+static inline void	dev_sysctl_init(void) { }
+#endif
 #define HAVE_NETIF_RECEIVE_SKB 1
 extern int		netif_receive_skb(struct sk_buff *skb);
 extern int		dev_ioctl(unsigned int cmd, void *);
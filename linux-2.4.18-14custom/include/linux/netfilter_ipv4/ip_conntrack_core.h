@@ -1,6 +1,7 @@
 #ifndef _IP_CONNTRACK_CORE_H
 #define _IP_CONNTRACK_CORE_H
 #include <linux/netfilter_ipv4/lockhelp.h>
+#include <asm/timex.h>
 
 /* This header is used to share core functionality between the
    standalone connection tracking module, and the compatibility layer's use
@@ -47,5 +48,64 @@ static inline int ip_conntrack_confirm(struct sk_buff *skb)
 extern struct list_head *ip_conntrack_hash;
 extern struct list_head expect_list;
 DECLARE_RWLOCK_EXTERN(ip_conntrack_lock);
+
+/* The hash chains are covered by IP_CT_HASH_LOCKS striped locks:
+   bucket n by lock n % IP_CT_HASH_LOCKS.  The table size is always a
+   multiple of IP_CT_HASH_LOCKS, so the lock of a tuple does not change
+   when the table is resized.  Walking the whole table also needs
+   ip_conntrack_lock (which resizing takes for writing); lock order is
+   ip_conntrack_lock, then the bucket locks in ascending order. */
+#define IP_CT_HASH_LOCKS 64
+
+struct ip_conntrack_hash_lock
+{
+	rwlock_t lock;
+
+	/* Write hold statistics, only touched under the write lock. */
+	cycles_t write_start;
+	cycles_t write_cycles;
+	cycles_t write_max;
+	unsigned long write_holds;
+} ____cacheline_aligned;
+
+extern struct ip_conntrack_hash_lock ip_conntrack_hash_locks[IP_CT_HASH_LOCKS];
+
+static inline struct ip_conntrack_hash_lock *ip_ct_hash_lock(u_int32_t hash)
+{
+	return &ip_conntrack_hash_locks[hash % IP_CT_HASH_LOCKS];
+}
+
+static inline void ip_ct_hash_read_lock(u_int32_t hash)
+{
+	read_lock_bh(&ip_ct_hash_lock(hash)->lock);
+}
+
+static inline void ip_ct_hash_read_unlock(u_int32_t hash)
+{
+	read_unlock_bh(&ip_ct_hash_lock(hash)->lock);
+}
+
+static inline void ip_ct_hash_write_lock(u_int32_t hash)
+{
+	struct ip_conntrack_hash_lock *l = ip_ct_hash_lock(hash);
+
+	write_lock_bh(&l->lock);
+	l->write_start = get_cycles();
+}
+
+static inline void ip_ct_hash_write_unlock(u_int32_t hash)
+{
+	struct ip_conntrack_hash_lock *l = ip_ct_hash_lock(hash);
+	cycles_t held = get_cycles() - l->write_start;
+
+	l->write_holds++;
+	l->write_cycles += held;
+	if (held > l->write_max)
+		l->write_max = held;
+	write_unlock_bh(&l->lock);
+}
+
+/* Resize the hash table; takes ip_conntrack_lock for writing. */
+extern int ip_conntrack_resize(unsigned int size);
 #endif /* _IP_CONNTRACK_CORE_H */
 
@@ -90,6 +90,9 @@ extern void add_to_page_cache_locked(struct page * page, struct address_space *m
 extern int add_to_page_cache_unique(struct page * page, struct address_space *mapping, unsigned long index, struct page **hash);
 
 extern void ___wait_on_page(struct page *);
+extern void add_page_wait_queue(struct page *, wait_queue_t *);
+extern void remove_page_wait_queue(struct page *, wait_queue_t *);
+extern struct page * page_cache_read_async(struct file *, unsigned long, unsigned long);
 
 static inline void wait_on_page(struct page * page)
 {
@@ -82,6 +82,8 @@ struct  seminfo {
 struct sem {
 	int	semval;		/* current value */
 	int	sempid;		/* pid of last operation */
+	struct sem_queue *sem_pending;	/* pending single-sop operations */
+	struct sem_queue **sem_pending_last; /* last pending single-sop operation */
 };
 
 /* One sem_array data structure for each set of semaphores in the system. */
@@ -90,8 +92,8 @@ struct sem_array {
 	time_t			sem_otime;	/* last semop time */
 	time_t			sem_ctime;	/* last change time */
 	struct sem		*sem_base;	/* ptr to first semaphore in array */
-	struct sem_queue	*sem_pending;	/* pending operations to be processed */
-	struct sem_queue	**sem_pending_last; /* last pending operation */
+	struct sem_queue	*sem_pending;	/* pending multi-sop operations */
+	struct sem_queue	**sem_pending_last; /* last pending multi-sop operation */
 	struct sem_undo		*undo;		/* undo requests on this array */
 	unsigned long		sem_nsems;	/* no. of semaphores in array */
 };
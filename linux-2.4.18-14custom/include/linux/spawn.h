@@ -0,0 +1,59 @@
+#ifndef _LINUX_SPAWN_H
+#define _LINUX_SPAWN_H
+
+/*
+ * spawn(): start a program in a new child process without copying the
+ * caller's address space first.  See Documentation/spawn.txt.
+ */
+
+#include <asm/signal.h>
+
+/* spawn_attr.flags */
+#define SPAWN_SETSIGMASK	0x01	/* the child blocks sigmask */
+#define SPAWN_SETSIGDEF		0x02	/* the child resets sigdefault to SIG_DFL */
+#define SPAWN_FLAGS		(SPAWN_SETSIGMASK | SPAWN_SETSIGDEF)
+
+/* spawn_action.type, the actions run in the child in array order */
+#define SPAWN_CLOSE		1	/* close(fd) */
+#define SPAWN_DUP2		2	/* dup2(srcfd, fd) */
+#define SPAWN_OPEN		3	/* open(path, flags, mode) as fd */
+#define SPAWN_CLOSEFROM		4	/* close fd and all descriptors above */
+
+#define SPAWN_MAX_ACTIONS	64
+
+struct spawn_action {
+	int		type;
+	int		fd;
+	int		srcfd;
+	int		flags;
+	int		mode;
+	const char	*path;
+};
+
+/*
+ * The signal sets have the layout of the kernel's sigset_t, the one
+ * rt_sigprocmask() takes (_NSIG / 8 bytes), not the C library's.
+ */
+#ifdef __KERNEL__
+typedef sigset_t spawn_sigset_t;
+#else
+typedef struct {
+	unsigned long sig[64 / (8 * sizeof(unsigned long))];
+} spawn_sigset_t;
+#endif
+
+struct spawn_attr {
+	unsigned int	flags;
+	spawn_sigset_t	sigmask;
+	spawn_sigset_t	sigdefault;
+	int		nr_actions;
+	struct spawn_action *actions;
+};
+
+#ifdef __KERNEL__
+/* filename, argv, envp and the action paths are in the get_fs() space */
+extern pid_t do_spawn(char *filename, char **argv, char **envp,
+		      struct spawn_attr *attr, int *error);
+#endif
+
+#endif /* _LINUX_SPAWN_H */
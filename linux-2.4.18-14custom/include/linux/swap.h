@@ -106,7 +106,10 @@ extern int FASTCALL(page_referenced(struct page *));
 extern void FASTCALL(page_add_rmap(struct page *, pte_t *));
 extern void FASTCALL(page_remove_rmap(struct page *, pte_t *));
 extern int FASTCALL(try_to_unmap(struct page *));
+extern void page_objrmap_to_chain(struct page *);
 extern int FASTCALL(page_over_rsslimit(struct page *));
+extern swp_entry_t page_swap_hint(struct page *);
+extern int rmap_report_meminfo(char *);
 
 /* return values of try_to_unmap */
 #define	SWAP_SUCCESS	0
@@ -128,10 +131,11 @@ extern void FASTCALL(drop_page(struct page *));
 extern void swap_setup(void);
 
 /* linux/mm/vmscan.c */
-extern wait_queue_head_t kswapd_wait;
 extern struct page * FASTCALL(reclaim_page(zone_t *));
 extern int FASTCALL(try_to_free_pages(unsigned int gfp_mask));
+extern void FASTCALL(wakeup_zone_kswapd(zone_t *));
 extern void wakeup_kswapd(unsigned int);
+extern int get_vmstat_info(char *);
 extern void rss_free_pages(unsigned int);
 
 /* linux/mm/page_io.c */
@@ -161,6 +165,7 @@ extern struct swap_info_struct swap_info[];
 extern int is_swap_partition(kdev_t);
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
+extern swp_entry_t get_swap_page_near(swp_entry_t);
 extern void get_swaphandle_info(swp_entry_t, unsigned long *, kdev_t *, 
 					struct inode **);
 extern int swap_duplicate(swp_entry_t);
@@ -21,6 +21,7 @@ struct pollfd;
 struct rlimit;
 struct sigaction;
 struct sockaddr;
+struct spawn_attr;
 struct statfs;
 struct timespec;
 struct timeval;
@@ -183,6 +184,10 @@ extern asmlinkage long sys_sigprocmask(int how, old_sigset_t *set,
 extern asmlinkage int sys_sigsuspend(int history0, int history1,
 				old_sigset_t mask);
 
+/* kernel/spawn.c */
+extern asmlinkage long sys_spawn(const char *filename, char **argv,
+				char **envp, struct spawn_attr *attr);
+
 /* kernel/sys.c */
 extern asmlinkage long sys_gethostname(char *name, int len);
 extern asmlinkage long sys_sethostname(char *name, int len);
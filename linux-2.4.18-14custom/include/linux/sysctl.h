@@ -126,6 +126,7 @@ enum
 	KERN_TAINTED=53,	/* int: various kernel tainted flags */
 	KERN_CADPID=54,		/* int: PID of the process to notify on CAD */
 	KERN_LOWLATENCY=55,     /* int: enable low latency scheduling */
+	KERN_MSGDIRECT=56,	/* int: min size of directly copied messages */
 };
 
 
@@ -145,6 +146,10 @@ enum
 	VM_MAX_MAP_COUNT=11,	/* int: Maximum number of active map areas */
 	VM_MIN_READAHEAD=12,    /* Min file readahead */
 	VM_MAX_READAHEAD=13,    /* Max file readahead */
+	VM_READAHEAD_STAT=14,	/* struct: Read-ahead hit/miss counters */
+	VM_HUGETLB_PAGES=15,	/* int: Number of available huge pages */
+	VM_FAULT_AROUND=16,	/* int: Pages to map around a file fault */
+	VM_PAGETABLE_COW=17,	/* int: Share page tables copy-on-write on fork */
 };
 
 
@@ -209,7 +214,14 @@ enum
 	NET_CORE_NO_CONG=14,
 	NET_CORE_LO_CONG=15,
 	NET_CORE_MOD_CONG=16,
-	NET_CORE_DEV_WEIGHT=17
+	NET_CORE_DEV_WEIGHT=17,
+	NET_CORE_DEV=18
+};
+
+/* /proc/sys/net/core/dev/<ifname> */
+enum
+{
+	NET_CORE_DEV_POLL_WEIGHT=1
 };
 
 /* /proc/sys/net/ethernet */
@@ -536,6 +548,8 @@ enum {
 	NET_TUX_MAX_HEADER_LEN		= 42,
 	NET_TUX_404_PAGE		= 43,
 	NET_TUX_MAX_KEEPALIVES		= 44,
+	NET_TUX_COMPRESSED_CACHE_SIZE	= 45,
+	NET_TUX_LISTEN_PER_CPU		= 46,
 };
 
 /* /proc/sys/net/khttpd/ */
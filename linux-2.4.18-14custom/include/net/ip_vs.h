@@ -317,6 +317,7 @@ enum {
 	NET_IPV4_VS_EXPIRE_NODEST_CONN=23,
 	NET_IPV4_VS_SYNC_THRESHOLD=24,
 	NET_IPV4_VS_NAT_ICMP_SEND=25,
+	NET_IPV4_VS_CONN_TAB_BITS=26,
 	NET_IPV4_VS_LAST
 };
 
@@ -377,6 +378,19 @@ struct ip_vs_seq {
 /*
  *	IPVS statistics object
  */
+/*
+ *	Per-cpu packet and connection counters, folded into the totals
+ *	of struct ip_vs_stats by the estimator and on every read
+ */
+struct ip_vs_cpu_stats
+{
+	__u32                   conns;          /* connections scheduled */
+	__u32                   inpkts;         /* incoming packets */
+	__u32                   outpkts;        /* outgoing packets */
+	__u64                   inbytes;        /* incoming bytes */
+	__u64                   outbytes;       /* outgoing bytes */
+} __attribute__((__aligned__(SMP_CACHE_BYTES)));
+
 struct ip_vs_stats
 {
 	__u32                   conns;          /* connections scheduled */
@@ -392,8 +406,17 @@ struct ip_vs_stats
 	__u32			outbps;		/* current out byte rate */
 
 	spinlock_t              lock;           /* spin lock */
+
+	struct ip_vs_cpu_stats	base;		/* per-cpu sums at last zeroing */
+	struct ip_vs_cpu_stats	cpustats[NR_CPUS];
 };
 
+/* Only called from bh context, so the cpu can't change under us */
+static inline struct ip_vs_cpu_stats *ip_vs_cpu_stats(struct ip_vs_stats *s)
+{
+	return &s->cpustats[smp_processor_id()];
+}
+
 
 /*
  *	IP_VS structure allocated for each dynamically scheduled connection
@@ -562,7 +585,8 @@ extern unsigned int check_for_ip_vs_out(struct sk_buff **skb_p,
  */
 
 /*
- *     IPVS connection entry hash table
+ *     IPVS connection entry hash table, IP_VS_CONN_TAB_BITS is the
+ *     default size; see the conn_tab_bits module parameter and sysctl
  */
 #ifndef CONFIG_IP_VS_TAB_BITS
 #define CONFIG_IP_VS_TAB_BITS   12
@@ -577,8 +601,12 @@ extern unsigned int check_for_ip_vs_out(struct sk_buff **skb_p,
 #if 8 <= CONFIG_IP_VS_TAB_BITS && CONFIG_IP_VS_TAB_BITS <= 20
 #define IP_VS_CONN_TAB_BITS	CONFIG_IP_VS_TAB_BITS
 #endif
-#define IP_VS_CONN_TAB_SIZE     (1 << IP_VS_CONN_TAB_BITS)
-#define IP_VS_CONN_TAB_MASK     (IP_VS_CONN_TAB_SIZE - 1)
+#define IP_VS_CONN_TAB_MIN_BITS	8
+#define IP_VS_CONN_TAB_MAX_BITS	20
+
+extern int ip_vs_conn_tab_bits;
+extern int ip_vs_conn_tab_size;
+extern int ip_vs_conn_tab_resize(int bits);
 
 #define VS_STATE_INPUT	        0
 #define VS_STATE_OUTPUT	        4
@@ -738,6 +766,8 @@ extern void ip_vs_sync_conn(struct ip_vs_conn *cp);
 extern int ip_vs_new_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_kill_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_zero_estimator(struct ip_vs_stats *stats);
+extern void ip_vs_fold_stats(struct ip_vs_stats *stats);
+extern void ip_vs_rebase_stats(struct ip_vs_stats *stats);
 
 
 /*
@@ -505,7 +505,7 @@ struct sock {
 	__u16			sport;		/* Source port				*/
 
 	unsigned short		family;		/* Address family			*/
-	unsigned char		reuse;		/* SO_REUSEADDR setting			*/
+	unsigned char		reuse;		/* SO_REUSEADDR, >1: listener group	*/
 	unsigned char		shutdown;
 	atomic_t		refcnt;		/* Reference count			*/
 
@@ -34,6 +34,7 @@
 #include <asm/div64.h>
 #include <asm/unaligned.h>
 #include <linux/compiler.h>
+#include <linux/brlock.h>
 
 #include <net/tcp.h>
 #include <net/tux_u.h>
@@ -88,7 +89,8 @@ extern int tux_Dprintk;
 # define DEBUG_DEL_LIST(x...) do { INIT_LIST_HEAD((x)); } while (0)
 
 
-#define LOG_LEN (8*1024*1024UL)
+/* per-thread log ring size, must be a power of two: */
+#define LOG_LEN (1024*1024UL)
 
 struct tux_req_struct;
 typedef struct tux_req_struct tux_req_t;
@@ -106,6 +108,7 @@ typedef struct tcapi_template_s {
 
 typedef struct mimetype_s {
 	struct list_head list;
+	struct list_head hash;
 
 	char *ext;
 	unsigned int ext_len;
@@ -117,11 +120,54 @@ typedef struct mimetype_s {
 	unsigned int special;
 } mimetype_t;
 
+#define TUX_ATTR_HEADER_LEN 320
+
 typedef struct tux_attribute_s {
 	mimetype_t *mime;
 	tcapi_template_t *tcapi;
+
+	/*
+	 * Prebuilt response header, minus the Connection and
+	 * Date lines which go between the two parts:
+	 */
+	spinlock_t header_lock;
+	time_t header_mtime;
+	loff_t header_size;
+	unsigned int header_flags;
+	unsigned int header_len1;
+	unsigned int header_len;
+	char header [TUX_ATTR_HEADER_LEN];
 } tux_attribute_t;
 
+/*
+ * Cached gzip-compressed body of a static object, keyed by
+ * (device, inode, mtime, size). nr_pages == 0 means the object
+ * is still being compressed, or, with incompressible set, that it
+ * does not shrink and is sent uncompressed.
+ */
+typedef struct tux_gzobj_s {
+	struct list_head hash;
+	struct list_head lru;
+	atomic_t count;
+
+	kdev_t dev;
+	unsigned long ino;
+	time_t mtime;
+	loff_t size;
+
+	unsigned int len;
+	unsigned int nr_pages;
+	struct page **pages;
+	unsigned int incompressible;
+} tux_gzobj_t;
+
+typedef struct tux_gzfill_s {
+	struct list_head list;
+	tux_gzobj_t *obj;
+	struct dentry *dentry;
+	struct vfsmount *mnt;
+} tux_gzfill_t;
+
 #define MAX_TUX_ATOMS 8
 
 typedef void (atom_func_t)(tux_req_t *req, int cachemiss);
@@ -243,6 +289,11 @@ struct tux_req_struct
 	unsigned int headers_len;
 
 	unsigned int parsed_len;
+	/*
+	 * Bytes of pipelined follow-up requests already peeked into
+	 * ->headers (they are still on the socket's receive queue):
+	 */
+	unsigned int pipelined_len;
 
 	// FTP part
 	ftp_command_t ftp_command;
@@ -360,6 +411,10 @@ struct tux_req_struct
 	const char *accept_encoding_str;
 	unsigned int accept_encoding_len;
 	unsigned int may_send_gzip;
+#define TUX_GZIP_NONE		0
+#define TUX_GZIP_STATIC		1	/* .gz object */
+#define TUX_GZIP_ON_THE_FLY	2	/* compressed on the fly */
+#define TUX_GZIP_CACHED		3	/* compressed cache */
 	unsigned int content_gzipped;
 
 	/* Host */
@@ -401,6 +456,13 @@ struct tux_req_struct
 	unsigned int nr_keepalives;
 
 	void *gzip_state;
+	tux_gzobj_t *gzobj;
+
+	/*
+	 * Page an asynchronous cachemiss read is waiting for:
+	 */
+	struct page *async_page;
+	wait_queue_t async_wait;
 
 	unsigned int event;
 	void *private;
@@ -444,6 +506,8 @@ typedef struct iothread_s
 	struct list_head async_queue;
 	wait_queue_head_t async_sleep;
 	unsigned int nr_async_pending;
+	struct list_head gzfill_queue;
+	unsigned int nr_gzfill_pending;
 	unsigned int threads;
 	unsigned int shutdown;
 	wait_queue_head_t wait_shutdown;
@@ -481,9 +545,24 @@ struct tux_threadinfo
 	struct list_head lru;
 	unsigned int nr_lru;
 
+	struct list_head async_reads;
+	unsigned int nr_async_reads;
+
 	unsigned int listen_error;
 	tux_listen_t listen[CONFIG_TUX_NUMSOCKETS];
 
+	unsigned int nr_mime_hits;
+	unsigned int nr_mime_misses;
+
+	/*
+	 * Log ring: only this thread advances log_head, only
+	 * the logger thread advances log_tail.
+	 */
+	char *log_buffer;
+	unsigned int log_head;
+	unsigned int log_tail;
+	unsigned int nr_log_dropped;
+
 	unsigned int cpu;
 	unsigned int __padding[16];
 };
@@ -600,12 +679,16 @@ extern tux_req_t * pick_userspace_req (threadinfo_t *ti);
 extern atom_func_t redirect_request;
 extern atom_func_t parse_request;
 extern void queue_cachemiss (tux_req_t *req);
+extern void queue_async_read (tux_req_t *req);
+extern int complete_async_reads (threadinfo_t *ti);
+extern void queue_gzfill (tux_req_t *req, tux_gzobj_t *obj);
 extern int start_cachemiss_threads (threadinfo_t *ti);
 extern void stop_cachemiss_threads (threadinfo_t *ti);
 struct file * tux_open_file(char *filename, int mode);
 extern void start_log_thread (void);
 extern void stop_log_thread (void);
 extern void add_mimetype (char *new_ext, char *new_type, char *new_expire);
+extern void init_mimetypes (void);
 extern void free_mimetypes (void);
 extern int lookup_object (tux_req_t *req, const unsigned int flag);
 extern int handle_gzip_req (tux_req_t *req, unsigned int flags);
@@ -618,14 +701,7 @@ extern int user_register_module (user_req_t *u_info);
 extern int user_unregister_module (user_req_t *u_info);
 extern void unregister_all_tuxmodules (void);
 
-typedef struct exec_param_s {
-	char *command;
-	char **argv;
-	char **envp;
-	unsigned int pipe_fds;
-} exec_param_t;
-
-extern pid_t tux_exec_process (char *command, char **argv, char **envp, int pipe_fds, exec_param_t *param, int wait);
+extern pid_t tux_exec_process (char *command, char **argv, char **envp, int pipe_fds, int wait);
 
 extern void start_external_cgi (tux_req_t *req);
 extern tcapi_template_t extcgi_tcapi;
@@ -653,6 +729,7 @@ extern int __connection_too_fast (tux_req_t *req);
 
 extern void trunc_headers (tux_req_t *req);
 extern int generic_send_file (tux_req_t *req, struct socket *sock, int cachemiss);
+extern int tux_send_page (struct socket *sock, struct page *page, unsigned long offset, unsigned int size, unsigned int flags);
 extern int tux_fetch_file (tux_req_t *req, int nonblock);
 
 extern void postpone_request (tux_req_t *req);
@@ -719,6 +796,7 @@ extern unsigned int tux_referer_logging;
 extern unsigned int tux_log_incomplete;
 extern unsigned int tux_max_header_len;
 extern unsigned int tux_cpu_offset;
+extern unsigned int tux_listen_per_cpu;
 extern unsigned int tux_ftp_login_message;
 
 extern void drop_permissions (void);
@@ -752,9 +830,24 @@ extern char * tux_print_path (tux_req_t *req, struct dentry *dentry, struct vfsm
 
 extern unsigned int tux_http_dir_indexing;
 
+extern void tux_gzip_init (void);
 extern void tux_gzip_start (tux_req_t *req);
 extern void tux_gzip_end (tux_req_t *req);
 int tux_gzip_compress (void *state, unsigned char *data_in, unsigned char *data_out, __u32 *in_len, __u32 *out_len);
+extern int tux_gzip_compress_object (unsigned char *data_in, __u32 in_len, unsigned char *data_out, __u32 *out_len);
+
+extern unsigned int tux_compressed_cache_size;
+/* tux_gzcache_lookup() results: */
+#define TUX_GZCACHE_MISS	0	/* compress on the fly, fill queued */
+#define TUX_GZCACHE_HIT		1	/* send the cached compressed body */
+#define TUX_GZCACHE_PLAIN	2	/* incompressible or being filled */
+
+extern int tux_gzcache_lookup (tux_req_t *req);
+extern void tux_gzcache_put_obj (tux_gzobj_t *obj);
+extern void tux_gzcache_fill (tux_gzfill_t *fill);
+extern void tux_gzcache_flush (void);
+extern void tux_gzcache_init (void);
+extern int tux_gzcache_send (tux_req_t *req, struct socket *sock, int cachemiss);
 
 struct dentry * __tux_lookup (tux_req_t *req, const char *filename,
                          struct nameidata *base, struct vfsmount **mnt);
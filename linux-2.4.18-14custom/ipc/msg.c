@@ -13,6 +13,10 @@
  * mostly rewritten, threaded and wake-one semantics added
  * MSGMAX limit removed, sysctl's added
  * (c) 1999 Manfred Spraul <manfreds@colorfullife.com>
+ *
+ * Direct copy of large messages into a waiting receiver, copy-on-write
+ * sharing of the pages of large queued messages, slab cache for full
+ * message segments.
  */
 
 #include <linux/config.h>
@@ -22,13 +26,18 @@
 #include <linux/init.h>
 #include <linux/proc_fs.h>
 #include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
 #include <asm/uaccess.h>
+#include <asm/pgtable.h>
 #include "util.h"
 
 /* sysctl: */
 int msg_ctlmax = MSGMAX;
 int msg_ctlmnb = MSGMNB;
 int msg_ctlmni = MSGMNI;
+int msg_ctldirect = 0;	/* min size for direct copy or COW pages, 0 = off */
 
 /* one msg_receiver structure for each sleeping receiver */
 struct msg_receiver {
@@ -38,6 +47,8 @@ struct msg_receiver {
 	int r_mode;
 	long r_msgtype;
 	long r_maxsize;
+	void* r_buf;		/* receiver's mtext, for direct copy */
+	long r_bufsize;
 
 	struct msg_msg* volatile r_msg;
 };
@@ -57,13 +68,22 @@ struct msg_msg {
 	struct list_head m_list; 
 	long  m_type;          
 	int m_ts;           /* message text size */
+	int m_direct;       /* text already copied to the receiver */
+	int m_nr_pages;     /* leading text pages shared COW with the sender */
+	struct page** m_pages;
 	struct msg_msgseg* next;
-	/* the actual message follows immediately */
+	/* the rest of the message follows immediately */
 };
 
 #define DATALEN_MSG	(PAGE_SIZE-sizeof(struct msg_msg))
 #define DATALEN_SEG	(PAGE_SIZE-sizeof(struct msg_msgseg))
 
+/* receiver pages pinned at a time by a direct copy */
+#define DIRECT_PAGES	16
+
+/* full sized message parts, PAGE_SIZE each */
+static kmem_cache_t *msg_seg_cachep;
+
 /* one msq_queue structure for each present queue on the system */
 struct msg_queue {
 	struct kern_ipc_perm q_perm;
@@ -109,6 +129,11 @@ void __init msg_init (void)
 {
 	ipc_init_ids(&msg_ids,msg_ctlmni);
 
+	msg_seg_cachep = kmem_cache_create("msg_seg", PAGE_SIZE, 0, 0,
+					   NULL, NULL);
+	if (!msg_seg_cachep)
+		panic("msg_init(): cannot create msg_seg SLAB cache");
+
 #ifdef CONFIG_PROC_FS
 	create_proc_read_entry("sysvipc/msg", 0, 0, sysvipc_msg_read_proc, NULL);
 #endif
@@ -143,35 +168,115 @@ static int newque (key_t key, int msgflg)
 	return msg_buildid(id,msq->q_perm.seq);
 }
 
+/*
+ * Message parts filled up to the page come from msg_seg_cachep,
+ * shorter ones from kmalloc.
+ */
+static inline void* alloc_msg_part(int size)
+{
+	if (size == PAGE_SIZE)
+		return kmem_cache_alloc(msg_seg_cachep, GFP_KERNEL);
+	return kmalloc(size, GFP_KERNEL);
+}
+
+static inline void free_msg_part(void* part, int size)
+{
+	if (size == PAGE_SIZE)
+		kmem_cache_free(msg_seg_cachep, part);
+	else
+		kfree(part);
+}
+
 static void free_msg(struct msg_msg* msg)
 {
 	struct msg_msgseg* seg;
+	int len, alen, i;
+
+	for (i = 0; i < msg->m_nr_pages; i++)
+		page_cache_release(msg->m_pages[i]);
+	if (msg->m_pages)
+		kfree(msg->m_pages);
+
+	len = msg->m_direct ? 0 : msg->m_ts - (msg->m_nr_pages << PAGE_SHIFT);
+	alen = len;
+	if(alen > DATALEN_MSG)
+		alen = DATALEN_MSG;
 	seg = msg->next;
-	kfree(msg);
+	free_msg_part(msg, sizeof(*msg) + alen);
+	len -= alen;
 	while(seg != NULL) {
 		struct msg_msgseg* tmp = seg->next;
-		kfree(seg);
+		alen = len;
+		if(alen > DATALEN_SEG)
+			alen = DATALEN_SEG;
+		free_msg_part(seg, sizeof(*seg) + alen);
+		len -= alen;
 		seg = tmp;
 	}
 }
 
+/*
+ * Take the whole pages at the start of a page aligned message of at
+ * least msg_ctldirect bytes copy-on-write from the sender instead of
+ * copying them. Pages that can't be shared, and the rest of the text,
+ * are copied as usual. Returns the number of pages taken.
+ */
+static int load_msg_pages(void* src, int len, struct page*** ppages)
+{
+	struct page** pages;
+	int nr;
+
+	*ppages = NULL;
+	if (!msg_ctldirect || len < msg_ctldirect || ((unsigned long)src & ~PAGE_MASK))
+		return 0;
+	nr = len >> PAGE_SHIFT;
+	if (!nr)
+		return 0;
+	pages = (struct page **) kmalloc (nr * sizeof(*pages), GFP_KERNEL);
+	if (pages == NULL)
+		return 0;
+	nr = get_user_pages_cow((unsigned long)src, nr, pages);
+	if (!nr) {
+		kfree(pages);
+		return 0;
+	}
+	*ppages = pages;
+	return nr;
+}
+
 static struct msg_msg* load_msg(void* src, int len)
 {
 	struct msg_msg* msg;
 	struct msg_msgseg** pseg;
+	struct page** pages;
+	int nr_pages;
 	int err;
 	int alen;
 
-	alen = len;
+	nr_pages = load_msg_pages(src, len, &pages);
+
+	alen = len - (nr_pages << PAGE_SHIFT);
 	if(alen > DATALEN_MSG)
 		alen = DATALEN_MSG;
 
-	msg = (struct msg_msg *) kmalloc (sizeof(*msg) + alen, GFP_KERNEL);
-	if(msg==NULL)
+	msg = (struct msg_msg *) alloc_msg_part (sizeof(*msg) + alen);
+	if(msg==NULL) {
+		while (nr_pages--)
+			page_cache_release(pages[nr_pages]);
+		if (pages)
+			kfree(pages);
 		return ERR_PTR(-ENOMEM);
+	}
 
+	msg->m_ts = len;
+	msg->m_direct = 0;
+	msg->m_nr_pages = nr_pages;
+	msg->m_pages = pages;
 	msg->next = NULL;
 
+	len -= nr_pages << PAGE_SHIFT;
+	src = ((char*)src) + (nr_pages << PAGE_SHIFT);
+
 	if (copy_from_user(msg+1, src, alen)) {
 		err = -EFAULT;
 		goto out_err;
@@ -185,7 +290,7 @@ static struct msg_msg* load_msg(void* src, int len)
 		alen = len;
 		if(alen > DATALEN_SEG)
 			alen = DATALEN_SEG;
-		seg = (struct msg_msgseg *) kmalloc (sizeof(*seg) + alen, GFP_KERNEL);
+		seg = (struct msg_msgseg *) alloc_msg_part (sizeof(*seg) + alen);
 		if(seg==NULL) {
 			err=-ENOMEM;
 			goto out_err;
@@ -209,8 +314,39 @@ out_err:
 
 static int store_msg(void* dest, struct msg_msg* msg, int len)
 {
-	int alen;
+	int alen, i, remap;
 	struct msg_msgseg *seg;
+	char* kaddr;
+
+	if(msg->m_direct)
+		return 0;	/* the sender already copied the text */
+
+	/*
+	 * Pages shared with the sender are mapped COW into a page aligned
+	 * buffer of private anonymous memory; otherwise, or if mapping
+	 * one fails, they are copied.
+	 */
+	remap = !((unsigned long)dest & ~PAGE_MASK);
+	for (i = 0; i < msg->m_nr_pages && len > 0; i++) {
+		alen = len;
+		if(alen > PAGE_SIZE)
+			alen = PAGE_SIZE;
+		if(remap && alen == PAGE_SIZE &&
+		   !map_user_page_cow((unsigned long)dest, msg->m_pages[i])) {
+			len -= alen;
+			dest = ((char*)dest)+alen;
+			continue;
+		}
+		remap = 0;
+		kaddr = kmap(msg->m_pages[i]);
+		if(copy_to_user (dest, kaddr, alen)) {
+			kunmap(msg->m_pages[i]);
+			return -1;
+		}
+		kunmap(msg->m_pages[i]);
+		len -= alen;
+		dest = ((char*)dest)+alen;
+	}
 
 	alen = len;
 	if(alen > DATALEN_MSG)
@@ -597,6 +733,142 @@ static int testmsg(struct msg_msg* msg,long type,int mode)
 	return 0;
 }
 
+/*
+ * Copy len bytes of message text from the sender's buffer at src
+ * straight into the buffer of the sleeping receiver msr, instead of
+ * going through a kernel copy of the message. The receiver waits in
+ * sys_msgrcv() until the copy is done, so its mm stays around.
+ * Returns -EFAULT if the sender's buffer faults and 1 if the
+ * receiver's buffer can't be mapped.
+ */
+static int copy_msg_direct(struct msg_receiver* msr, void* src, int len)
+{
+	struct task_struct* tsk = msr->r_tsk;
+	struct mm_struct* mm = tsk->mm;
+	unsigned long addr = (unsigned long) msr->r_buf;
+	struct page* pages[DIRECT_PAGES];
+	int i, nr, offset, alen, err = 0;
+	char* maddr;
+
+	while(len > 0 && !err) {
+		offset = addr & (PAGE_SIZE-1);
+		nr = (offset + len + PAGE_SIZE-1) >> PAGE_SHIFT;
+		if(nr > DIRECT_PAGES)
+			nr = DIRECT_PAGES;
+
+		down_read(&mm->mmap_sem);
+		nr = get_user_pages(tsk, mm, addr, nr, 1, 0, pages, NULL);
+		up_read(&mm->mmap_sem);
+		if(nr <= 0)
+			return 1;
+
+		for (i = 0; i < nr; i++) {
+			if(len > 0 && !err) {
+				alen = PAGE_SIZE - offset;
+				if(alen > len)
+					alen = len;
+				maddr = kmap(pages[i]);
+				if(copy_from_user(maddr + offset, src, alen))
+					err = -EFAULT;
+				flush_page_to_ram(pages[i]);
+				kunmap(pages[i]);
+				len -= alen;
+				src = ((char*)src)+alen;
+				addr += alen;
+				offset = 0;
+			}
+			page_cache_release(pages[i]);
+		}
+	}
+	return err;
+}
+
+/*
+ * Try to deliver a message of at least msg_ctldirect bytes with a
+ * single copy to a receiver that is already waiting for it.
+ * Returns 1 if the message was delivered, 0 if it has to go through
+ * the queue, or an error code.
+ */
+static int direct_send(int msqid, long mtype, void* src, int len)
+{
+	struct msg_queue *msq;
+	struct msg_receiver *msr = NULL;
+	struct msg_msg *msg;
+	struct list_head *tmp;
+	int err;
+
+	/* the header handed to the receiver, allocated early as it can't fail later */
+	msg = (struct msg_msg *) kmalloc (sizeof(*msg), GFP_KERNEL);
+	if(msg==NULL)
+		return 0;
+	msg->m_type = mtype;
+	msg->m_ts = len;
+	msg->m_direct = 1;
+	msg->m_nr_pages = 0;
+	msg->m_pages = NULL;
+	msg->next = NULL;
+
+	msq = msg_lock(msqid);
+	if(msq==NULL)
+		goto out_free;
+	if (msg_checkid(msq,msqid) || ipcperms(&msq->q_perm, S_IWUGO))
+		goto out_unlock_free;
+
+	/* Same receiver as pipelined_send() would pick, E2BIG is left to it */
+	for (tmp = msq->q_receivers.next; tmp != &msq->q_receivers;
+	     tmp = tmp->next) {
+		msr = list_entry(tmp,struct msg_receiver,r_list);
+		if(testmsg(msg,msr->r_msgtype,msr->r_mode))
+			break;
+		msr = NULL;
+	}
+	if(msr==NULL || msr->r_maxsize < len)
+		goto out_unlock_free;
+
+	/* Take the receiver off the queue, it waits for us now. */
+	list_del(&msr->r_list);
+	msr->r_msg = ERR_PTR(-EINPROGRESS);
+	msq->q_lspid = current->pid;
+	msq->q_stime = CURRENT_TIME;
+	msq->q_lrpid = msr->r_tsk->pid;
+	msq->q_rtime = CURRENT_TIME;
+	msg_unlock(msqid);
+
+	err = copy_msg_direct(msr, src, len < msr->r_bufsize ? len : msr->r_bufsize);
+	if(!err) {
+		msr->r_msg = msg;
+		wake_up_process(msr->r_tsk);
+		return 1;
+	}
+
+	/*
+	 * Give the receiver back to the queue. If the receiver's buffer
+	 * is bad, fall back to the normal path: it will get the
+	 * message and the error from store_msg().
+	 */
+	msq = msg_lock(msqid);
+	if(msq==NULL)
+		msr->r_msg = ERR_PTR(-EIDRM);
+	else {
+		if(msg_checkid(msq,msqid))
+			msr->r_msg = ERR_PTR(-EIDRM);
+		else {
+			list_add(&msr->r_list,&msq->q_receivers);
+			msr->r_msg = ERR_PTR(-EAGAIN);
+		}
+		msg_unlock(msqid);
+	}
+	wake_up_process(msr->r_tsk);
+	kfree(msg);
+	return err < 0 ? err : 0;
+
+out_unlock_free:
+	msg_unlock(msqid);
+out_free:
+	kfree(msg);
+	return 0;
+}
+
 int inline pipelined_send(struct msg_queue* msq, struct msg_msg* msg)
 {
 	struct list_head* tmp;
@@ -637,6 +909,12 @@ asmlinkage long sys_msgsnd (int msqid, struct msgbuf *msgp, size_t msgsz, int ms
 	if (mtype < 1)
 		return -EINVAL;
 
+	if (msg_ctldirect && msgsz >= msg_ctldirect) {
+		err = direct_send(msqid, mtype, msgp->mtext, msgsz);
+		if (err)
+			return err < 0 ? err : 0;
+	}
+
 	msg = load_msg(msgp->mtext, msgsz);
 	if(IS_ERR(msg))
 		return PTR_ERR(msg);
@@ -706,6 +984,22 @@ out_free:
 	return err;
 }
 
+/*
+ * Wait until a direct sender that took msr off the queue is done
+ * with our buffer, and return the outcome.
+ */
+static struct msg_msg* wait_direct(struct msg_receiver* msr)
+{
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (msr->r_msg != ERR_PTR(-EINPROGRESS))
+			break;
+		schedule();
+	}
+	current->state = TASK_RUNNING;
+	return (struct msg_msg*) msr->r_msg;
+}
+
 int inline convert_mode(long* msgtyp, int msgflg)
 {
 	/* 
@@ -804,6 +1098,8 @@ out_success:
 		msr_d.r_tsk = current;
 		msr_d.r_msgtype = msgtyp;
 		msr_d.r_mode = mode;
+		msr_d.r_buf = msgp->mtext;
+		msr_d.r_bufsize = msgsz;
 		if(msgflg & MSG_NOERROR)
 			msr_d.r_maxsize = INT_MAX;
 		 else
@@ -815,7 +1111,9 @@ out_success:
 		schedule();
 		current->state = TASK_RUNNING;
 
-		msg = (struct msg_msg*) msr_d.r_msg;
+wait:
+		/* A sender may be copying straight into our buffer. */
+		msg = wait_direct(&msr_d);
 		if(!IS_ERR(msg)) 
 			goto out_success;
 
@@ -823,6 +1121,16 @@ out_success:
 		if(t==NULL)
 			msqid=-1;
 		msg = (struct msg_msg*)msr_d.r_msg;
+		if(msg == ERR_PTR(-EINPROGRESS)) {
+			/* picked by a direct sender while we waited for
+			 * the spinlock.
+			 */
+			if(msqid!=-1) {
+				msg_unlock(msqid);
+				goto wait;
+			}
+			msg = wait_direct(&msr_d);
+		}
 		if(!IS_ERR(msg)) {
 			/* our message arived while we waited for
 			 * the spinlock. Process it.
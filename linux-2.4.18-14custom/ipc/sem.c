@@ -55,6 +55,13 @@
  * (c) 1999 Manfred Spraul <manfreds@colorfullife.com>
  * Enforced range limit on SEM_UNDO
  * (c) 2001 Red Hat Inc <alan@redhat.com>
+ *
+ * Per-semaphore pending queues:
+ * - A semop with a single operation sleeps on the pending queue of the
+ *   semaphore it operates on, only operations on several semaphores
+ *   go to the pending queue of the array. A change of one semaphore
+ *   thus only retries the waiters of that semaphore and the multi-sop
+ *   waiters, instead of every waiter of the array.
  */
 
 #include <linux/config.h>
@@ -88,6 +95,7 @@ static int sysvipc_sem_read_proc(char *buffer, char **start, off_t offset, int l
  * linked list protection:
  *	sem_undo.id_next,
  *	sem_array.sem_pending{,last},
+ *	sem.sem_pending{,last},
  *	sem_array.sem_undo: sem_lock() for read/write
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
  *	
@@ -113,7 +121,7 @@ void __init sem_init (void)
 
 static int newary (key_t key, int nsems, int semflg)
 {
-	int id;
+	int id, i;
 	struct sem_array *sma;
 	int size;
 
@@ -141,6 +149,11 @@ static int newary (key_t key, int nsems, int semflg)
 	sma->sem_base = (struct sem *) &sma[1];
 	/* sma->sem_pending = NULL; */
 	sma->sem_pending_last = &sma->sem_pending;
+	for (i = 0; i < nsems; i++) {
+		/* sma->sem_base[i].sem_pending = NULL; */
+		sma->sem_base[i].sem_pending_last =
+				&sma->sem_base[i].sem_pending;
+	}
 	/* sma->undo = NULL; */
 	sma->sem_nsems = nsems;
 	sma->sem_ctime = CURRENT_TIME;
@@ -203,25 +216,47 @@ static int sem_revalidate(int semid, struct sem_array* sma, int nsems, short flg
 	}
 	return 0;
 }
-/* Manage the doubly linked list sma->sem_pending as a FIFO:
- * insert new queue elements at the tail sma->sem_pending_last.
+/* Manage the doubly linked lists sma->sem_pending and sem->sem_pending
+ * as FIFOs: insert new queue elements at the tail sem_pending_last.
+ * A queue element operating on a single semaphore lives on the list
+ * of that semaphore, all others on the list of the array.
  */
+static inline struct sem_queue ** queue_head (struct sem_array * sma,
+					      struct sem_queue * q)
+{
+	if (q->nsops == 1)
+		return &sma->sem_base[q->sops->sem_num].sem_pending;
+	return &sma->sem_pending;
+}
+
+static inline struct sem_queue *** queue_last (struct sem_array * sma,
+					       struct sem_queue * q)
+{
+	if (q->nsops == 1)
+		return &sma->sem_base[q->sops->sem_num].sem_pending_last;
+	return &sma->sem_pending_last;
+}
+
 static inline void append_to_queue (struct sem_array * sma,
 				    struct sem_queue * q)
 {
-	*(q->prev = sma->sem_pending_last) = q;
-	*(sma->sem_pending_last = &q->next) = NULL;
+	struct sem_queue *** last = queue_last(sma, q);
+
+	*(q->prev = *last) = q;
+	*(*last = &q->next) = NULL;
 }
 
 static inline void prepend_to_queue (struct sem_array * sma,
 				     struct sem_queue * q)
 {
-	q->next = sma->sem_pending;
-	*(q->prev = &sma->sem_pending) = q;
+	struct sem_queue ** head = queue_head(sma, q);
+
+	q->next = *head;
+	*(q->prev = head) = q;
 	if (q->next)
 		q->next->prev = &q->next;
-	else /* sma->sem_pending_last == &sma->sem_pending */
-		sma->sem_pending_last = &q->next;
+	else /* *last == head */
+		*queue_last(sma, q) = &q->next;
 }
 
 static inline void remove_from_queue (struct sem_array * sma,
@@ -230,8 +265,8 @@ static inline void remove_from_queue (struct sem_array * sma,
 	*(q->prev) = q->next;
 	if (q->next)
 		q->next->prev = q->prev;
-	else /* sma->sem_pending_last == &q->next */
-		sma->sem_pending_last = q->prev;
+	else /* *last == &q->next */
+		*queue_last(sma, q) = q->prev;
 	q->prev = NULL; /* mark as removed */
 }
 
@@ -311,16 +346,16 @@ undo:
 	return result;
 }
 
-/* Go through the pending queue for the indicated semaphore
- * looking for tasks that can be completed.
+/* Go through one pending queue looking for tasks that can be completed.
  */
-static void update_queue (struct sem_array * sma)
+static void update_queue_list (struct sem_array * sma, struct sem_queue * q)
 {
 	int error;
-	struct sem_queue * q;
+	struct sem_queue * n;
+
+	for (; q; q = n) {
+		n = q->next;
 
-	for (q = sma->sem_pending; q; q = q->next) {
-			
 		if (q->status == 1)
 			continue;	/* this one was woken up before */
 
@@ -332,7 +367,8 @@ static void update_queue (struct sem_array * sma)
 				/* Found one, wake it up */
 			wake_up_process(q->sleeper);
 			if (error == 0 && q->alter) {
-				/* if q-> alter let it self try */
+				/* if q-> alter let it self try, it runs
+				 * update_queue() again once it is done */
 				q->status = 1;
 				return;
 			}
@@ -342,6 +378,24 @@ static void update_queue (struct sem_array * sma)
 	}
 }
 
+/* Go through the pending queues that may have been unblocked by a
+ * change of semaphore semnum, or of all semaphores if semnum is -1:
+ * the single-sop queue of each changed semaphore and the multi-sop
+ * queue of the array.
+ */
+static void update_queue (struct sem_array * sma, int semnum)
+{
+	int i;
+
+	if (semnum >= 0)
+		update_queue_list(sma, sma->sem_base[semnum].sem_pending);
+	else {
+		for (i = 0; i < sma->sem_nsems; i++)
+			update_queue_list(sma, sma->sem_base[i].sem_pending);
+	}
+	update_queue_list(sma, sma->sem_pending);
+}
+
 /* The following counts are associated to each semaphore:
  *   semncnt        number of tasks waiting on semval being nonzero
  *   semzcnt        number of tasks waiting on semval being zero
@@ -357,6 +411,11 @@ static int count_semncnt (struct sem_array * sma, ushort semnum)
 	struct sem_queue * q;
 
 	semncnt = 0;
+	for (q = sma->sem_base[semnum].sem_pending; q; q = q->next) {
+		if ((q->sops->sem_op < 0)
+		    && !(q->sops->sem_flg & IPC_NOWAIT))
+			semncnt++;
+	}
 	for (q = sma->sem_pending; q; q = q->next) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
@@ -375,6 +434,11 @@ static int count_semzcnt (struct sem_array * sma, ushort semnum)
 	struct sem_queue * q;
 
 	semzcnt = 0;
+	for (q = sma->sem_base[semnum].sem_pending; q; q = q->next) {
+		if ((q->sops->sem_op == 0)
+		    && !(q->sops->sem_flg & IPC_NOWAIT))
+			semzcnt++;
+	}
 	for (q = sma->sem_pending; q; q = q->next) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
@@ -394,7 +458,7 @@ static void freeary (int id)
 	struct sem_array *sma;
 	struct sem_undo *un;
 	struct sem_queue *q;
-	int size;
+	int size, i;
 
 	sma = sem_rmid(id);
 
@@ -411,6 +475,13 @@ static void freeary (int id)
 		q->prev = NULL;
 		wake_up_process(q->sleeper); /* doesn't sleep */
 	}
+	for (i = 0; i < sma->sem_nsems; i++) {
+		for (q = sma->sem_base[i].sem_pending; q; q = q->next) {
+			q->status = -EIDRM;
+			q->prev = NULL;
+			wake_up_process(q->sleeper); /* doesn't sleep */
+		}
+	}
 	sem_unlock(id);
 
 	used_sems -= sma->sem_nsems;
@@ -594,7 +665,7 @@ int semctl_main(int semid, int semnum, int cmd, int version, union semun arg)
 				un->semadj[i] = 0;
 		sma->sem_ctime = CURRENT_TIME;
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		update_queue(sma, -1);
 		err = 0;
 		goto out_unlock;
 	}
@@ -646,7 +717,7 @@ int semctl_main(int semid, int semnum, int cmd, int version, union semun arg)
 		curr->sempid = current->pid;
 		sma->sem_ctime = CURRENT_TIME;
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		update_queue(sma, semnum);
 		err = 0;
 		goto out_unlock;
 	}
@@ -968,7 +1039,7 @@ asmlinkage long sys_semop (int semid, struct sembuf *tsops, unsigned nsops)
 	remove_from_queue(sma,&queue);
 update:
 	if (alter)
-		update_queue (sma);
+		update_queue (sma, nsops == 1 ? sops->sem_num : -1);
 out_unlock_free:
 	sem_unlock(semid);
 out_free:
@@ -1047,7 +1118,7 @@ found:
 		}
 		sma->sem_otime = CURRENT_TIME;
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		update_queue(sma, -1);
 next_entry:
 		sem_unlock(semid);
 	}
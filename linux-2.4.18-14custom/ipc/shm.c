@@ -22,6 +22,7 @@
 #include <linux/file.h>
 #include <linux/mman.h>
 #include <linux/proc_fs.h>
+#include <linux/hugetlb.h>
 #include <asm/uaccess.h>
 
 #include "util.h"
@@ -45,6 +46,14 @@ struct shmid_kernel /* private to the kernel */
 static struct file_operations shm_file_operations;
 static struct vm_operations_struct shm_vm_ops;
 
+#ifdef CONFIG_HUGETLB_PAGE
+static struct file_operations shm_hugetlb_file_operations;
+#define is_file_shm_hugepages(file) \
+	((file)->f_op == &shm_hugetlb_file_operations)
+#else
+#define is_file_shm_hugepages(file)	0
+#endif
+
 static struct ipc_ids shm_ids;
 
 #define shm_lock(id)	((struct shmid_kernel*)ipc_lock(&shm_ids,id))
@@ -125,7 +134,8 @@ static void shm_destroy (struct shmid_kernel *shp)
 	shm_tot -= (shp->shm_segsz + PAGE_SIZE - 1) >> PAGE_SHIFT;
 	shm_rmid (shp->id);
 	shm_unlock(shp->id);
-	shmem_lock(shp->shm_file, 0);
+	if (!is_file_shm_hugepages(shp->shm_file))
+		shmem_lock(shp->shm_file, 0);
 	fput (shp->shm_file);
 	kfree (shp);
 }
@@ -161,6 +171,7 @@ static int shm_mmap(struct file * file, struct vm_area_struct * vma)
 {
 	UPDATE_ATIME(file->f_dentry->d_inode);
 	vma->vm_ops = &shm_vm_ops;
+	vma->vm_flags |= VM_PTSHARE;
 	shm_inc(file->f_dentry->d_inode->i_ino);
 	return 0;
 }
@@ -169,6 +180,33 @@ static struct file_operations shm_file_operations = {
 	mmap:	shm_mmap
 };
 
+#ifdef CONFIG_HUGETLB_PAGE
+static int shm_hugetlb_mmap(struct file * file, struct vm_area_struct * vma)
+{
+	int error;
+
+	error = hugetlbfs_file_operations.mmap(file, vma);
+	if (error)
+		return error;
+	vma->vm_ops = &shm_vm_ops;
+	shm_inc(file->f_dentry->d_inode->i_ino);
+	return 0;
+}
+
+static unsigned long shm_hugetlb_get_unmapped_area(struct file *file,
+	unsigned long addr, unsigned long len, unsigned long pgoff,
+	unsigned long flags)
+{
+	return hugetlbfs_file_operations.get_unmapped_area(file, addr, len,
+							   pgoff, flags);
+}
+
+static struct file_operations shm_hugetlb_file_operations = {
+	mmap:			shm_hugetlb_mmap,
+	get_unmapped_area:	shm_hugetlb_get_unmapped_area,
+};
+#endif
+
 static struct vm_operations_struct shm_vm_ops = {
 	open:	shm_open,	/* callback for a new vm-area open */
 	close:	shm_close,	/* callback for when the vm-area is released */
@@ -194,7 +232,10 @@ static int newseg (key_t key, int shmflg, size_t size)
 	if (!shp)
 		return -ENOMEM;
 	sprintf (name, "SYSV%08x", key);
-	file = shmem_file_setup(name, size);
+	if (shmflg & SHM_HUGETLB)
+		file = hugetlbfs_file_setup(name, size);
+	else
+		file = shmem_file_setup(name, size);
 	error = PTR_ERR(file);
 	if (IS_ERR(file))
 		goto no_file;
@@ -214,7 +255,12 @@ static int newseg (key_t key, int shmflg, size_t size)
 	shp->id = shm_buildid(id,shp->shm_perm.seq);
 	shp->shm_file = file;
 	file->f_dentry->d_inode->i_ino = shp->id;
-	file->f_op = &shm_file_operations;
+#ifdef CONFIG_HUGETLB_PAGE
+	if (shmflg & SHM_HUGETLB)
+		file->f_op = &shm_hugetlb_file_operations;
+	else
+#endif
+		file->f_op = &shm_file_operations;
 	shm_tot += numpages;
 	shm_unlock (id);
 	return shp->id;
@@ -364,6 +410,10 @@ static void shm_get_stat (unsigned long *rss, unsigned long *swp)
 		if(shp == NULL)
 			continue;
 		inode = shp->shm_file->f_dentry->d_inode;
+		if (is_file_shm_hugepages(shp->shm_file)) {
+			*rss += inode->i_blocks >> (PAGE_SHIFT - 9);
+			continue;
+		}
 		info = SHMEM_I(inode);
 		spin_lock (&info->lock);
 		*rss += inode->i_mapping->nrpages;
@@ -474,10 +524,12 @@ asmlinkage long sys_shmctl (int shmid, int cmd, struct shmid_ds *buf)
 		if(err)
 			goto out_unlock;
 		if(cmd==SHM_LOCK) {
-			shmem_lock(shp->shm_file, 1);
+			if (!is_file_shm_hugepages(shp->shm_file))
+				shmem_lock(shp->shm_file, 1);
 			shp->shm_flags |= SHM_LOCKED;
 		} else {
-			shmem_lock(shp->shm_file, 0);
+			if (!is_file_shm_hugepages(shp->shm_file))
+				shmem_lock(shp->shm_file, 0);
 			shp->shm_flags &= ~SHM_LOCKED;
 		}
 		shm_unlock(shmid);
@@ -48,6 +48,7 @@
 #include <linux/in6.h>
 #include <linux/completion.h>
 #include <linux/seq_file.h>
+#include <linux/spawn.h>
 #include <asm/checksum.h>
 #include <linux/unistd.h>
 
@@ -180,6 +181,7 @@ EXPORT_SYMBOL(d_delete);
 EXPORT_SYMBOL(dget_locked);
 EXPORT_SYMBOL(d_validate);
 EXPORT_SYMBOL(d_rehash);
+EXPORT_SYMBOL(__d_drop);
 EXPORT_SYMBOL(d_invalidate);	/* May be it will be better in dcache.h? */
 EXPORT_SYMBOL(d_move);
 EXPORT_SYMBOL(d_instantiate);
@@ -230,6 +232,9 @@ EXPORT_SYMBOL(submit_bh);
 EXPORT_SYMBOL(unlock_buffer);
 EXPORT_SYMBOL(__wait_on_buffer);
 EXPORT_SYMBOL(___wait_on_page);
+EXPORT_SYMBOL(add_page_wait_queue);
+EXPORT_SYMBOL(remove_page_wait_queue);
+EXPORT_SYMBOL(page_cache_read_async);
 EXPORT_SYMBOL(generic_direct_IO);
 EXPORT_SYMBOL(discard_bh_page);
 EXPORT_SYMBOL(block_write_full_page);
@@ -549,6 +554,7 @@ EXPORT_SYMBOL(do_execve);
 EXPORT_SYMBOL(flush_old_exec);
 EXPORT_SYMBOL(kernel_read);
 EXPORT_SYMBOL(open_exec);
+EXPORT_SYMBOL(do_spawn);
 
 /* Miscellaneous access points */
 EXPORT_SYMBOL(si_meminfo);
@@ -0,0 +1,200 @@
+/*
+ *  linux/kernel/spawn.c
+ *
+ *  spawn(): fork and exec in one go, for callers that start a program
+ *  and nothing else.  The child is a vfork() child that never returns
+ *  to user space before the exec: it borrows the caller's mm while it
+ *  sets up its files and signals and reads the exec arguments, so no
+ *  address space is copied only to be thrown away again by the exec.
+ *  The caller sleeps until the child has exec'd or failed, and gets
+ *  the exec's error back instead of a child that exits with it.
+ */
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/unistd.h>
+#include <linux/spawn.h>
+
+#include <asm/uaccess.h>
+
+struct spawn_args {
+	char *filename;
+	char **argv;
+	char **envp;
+	struct spawn_attr *attr;
+	int error;
+};
+
+static int spawn_file_action(struct spawn_action *act)
+{
+	int fd, err;
+
+	switch (act->type) {
+	case SPAWN_CLOSE:
+		return sys_close(act->fd);
+	case SPAWN_DUP2:
+		return sys_dup2(act->srcfd, act->fd);
+	case SPAWN_OPEN:
+		fd = sys_open(act->path, act->flags, act->mode);
+		if (fd < 0 || fd == act->fd)
+			return fd;
+		err = sys_dup2(fd, act->fd);
+		sys_close(fd);
+		return err;
+	case SPAWN_CLOSEFROM:
+		if (act->fd < 0)
+			return -EBADF;
+		for (fd = act->fd; fd < current->files->max_fds; fd++)
+			if (current->files->fd[fd])
+				sys_close(fd);
+		return 0;
+	}
+	return -EINVAL;
+}
+
+/*
+ * execve() that returns the error of the system call directly.  The
+ * __KERNEL_SYSCALLS__ stub leaves it in the global errno, where a
+ * concurrent failing spawn can overwrite it before we read it.
+ */
+static inline int spawn_execve(const char *file, char **argv, char **envp)
+{
+	int ret;
+
+	__asm__ volatile ("int $0x80"
+		: "=a" (ret)
+		: "0" (__NR_execve),
+		  "b" ((long)file),
+		  "c" ((long)argv),
+		  "d" ((long)envp));
+	return ret;
+}
+
+/*
+ * A child that failed to exec is init's to reap: the spawn() caller
+ * gets the error instead, and never sees the child.
+ */
+static void spawn_orphan(void)
+{
+	write_lock_irq(&tasklist_lock);
+	REMOVE_LINKS(current);
+	current->p_pptr = child_reaper;
+	current->p_opptr = child_reaper;
+	SET_LINKS(current);
+	current->exit_signal = SIGCHLD;
+	write_unlock_irq(&tasklist_lock);
+}
+
+/*
+ * Runs in the child, on the caller's mm and with the caller's address
+ * limit, so the arguments are read from wherever the caller had them.
+ * A successful execve() goes on in user space and never returns here.
+ */
+static int spawn_child(void *data)
+{
+	struct spawn_args *args = data;
+	struct spawn_attr *attr = args->attr;
+	int i, err = 0;
+
+	spin_lock_irq(&current->sigmask_lock);
+	if (attr->flags & SPAWN_SETSIGDEF) {
+		for (i = 1; i <= _NSIG; i++) {
+			struct k_sigaction *ka = current->sig->action + i-1;
+
+			if (!sigismember(&attr->sigdefault, i))
+				continue;
+			ka->sa.sa_handler = SIG_DFL;
+			ka->sa.sa_flags = 0;
+			sigemptyset(&ka->sa.sa_mask);
+		}
+	}
+	if (attr->flags & SPAWN_SETSIGMASK) {
+		current->blocked = attr->sigmask;
+		sigdelsetmask(&current->blocked, sigmask(SIGKILL) | sigmask(SIGSTOP));
+		recalc_sigpending(current);
+	}
+	spin_unlock_irq(&current->sigmask_lock);
+
+	for (i = 0; i < attr->nr_actions; i++) {
+		err = spawn_file_action(attr->actions + i);
+		if (err < 0)
+			goto fail;
+	}
+
+	err = spawn_execve(args->filename, args->argv, args->envp);
+fail:
+	args->error = err;
+	spawn_orphan();
+	return err;
+}
+
+/**
+ * do_spawn - start a program in a new child process
+ * @filename: program to execute
+ * @argv: its argument vector
+ * @envp: its environment
+ * @attr: signal setup and file actions for the child, in kernel memory
+ * @error: where the error of a file action or of the exec goes
+ *
+ * The strings are taken from the get_fs() space of the caller, so
+ * kernel callers can set_fs(KERNEL_DS) and pass kernel buffers.
+ * Returns the pid of the child or the error of the fork.  If the
+ * child got as far as that but then failed, *error is set and there
+ * is no child any more; it is 0 if the child exec'd.
+ */
+pid_t do_spawn(char *filename, char **argv, char **envp,
+	       struct spawn_attr *attr, int *error)
+{
+	struct spawn_args args;
+	pid_t pid;
+
+	args.filename = filename;
+	args.argv = argv;
+	args.envp = envp;
+	args.attr = attr;
+	args.error = 0;
+
+	/* CLONE_VFORK: args stays valid until the child exec'd or failed */
+	pid = kernel_thread(spawn_child, &args, CLONE_VFORK | SIGCHLD);
+	*error = args.error;
+	return pid;
+}
+
+asmlinkage long sys_spawn(const char *filename, char **argv, char **envp,
+			  struct spawn_attr *uattr)
+{
+	struct spawn_action *actions = NULL;
+	struct spawn_attr attr;
+	int error;
+	long ret;
+
+	memset(&attr, 0, sizeof(attr));
+	if (uattr) {
+		if (copy_from_user(&attr, uattr, sizeof(attr)))
+			return -EFAULT;
+		if ((attr.flags & ~SPAWN_FLAGS) ||
+		    attr.nr_actions < 0 || attr.nr_actions > SPAWN_MAX_ACTIONS)
+			return -EINVAL;
+	}
+	if (attr.nr_actions) {
+		size_t size = attr.nr_actions * sizeof(*actions);
+
+		actions = kmalloc(size, GFP_KERNEL);
+		if (!actions)
+			return -ENOMEM;
+		if (copy_from_user(actions, attr.actions, size)) {
+			kfree(actions);
+			return -EFAULT;
+		}
+		attr.actions = actions;
+	}
+
+	ret = do_spawn((char *) filename, argv, envp, &attr, &error);
+	if (ret >= 0 && error)
+		ret = error;
+
+	if (actions)
+		kfree(actions);
+	return ret;
+}
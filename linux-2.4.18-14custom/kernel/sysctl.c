@@ -30,6 +30,7 @@
 #include <linux/init.h>
 #include <linux/sysrq.h>
 #include <linux/highuid.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 
@@ -71,6 +72,7 @@ extern int shm_ctlmni;
 extern int msg_ctlmax;
 extern int msg_ctlmnb;
 extern int msg_ctlmni;
+extern int msg_ctldirect;
 extern int sem_ctls[];
 #endif
 
@@ -233,6 +235,8 @@ static ctl_table kern_table[] = {
 	 0644, NULL, &proc_dointvec},
 	{KERN_MSGMNB, "msgmnb", &msg_ctlmnb, sizeof (int),
 	 0644, NULL, &proc_dointvec},
+	{KERN_MSGDIRECT, "msgdirect", &msg_ctldirect, sizeof (int),
+	 0644, NULL, &proc_dointvec},
 	{KERN_SEM, "sem", &sem_ctls, 4*sizeof (int),
 	 0644, NULL, &proc_dointvec},
 #endif
@@ -284,6 +288,16 @@ static ctl_table vm_table[] = {
 	&vm_min_readahead,sizeof(int), 0644, NULL, &proc_dointvec},
 	{VM_MAX_READAHEAD, "max-readahead",
 	&vm_max_readahead,sizeof(int), 0644, NULL, &proc_dointvec},
+	{VM_READAHEAD_STAT, "readahead-stat", &readahead_stat,
+	 sizeof(struct readahead_stat), 0444, NULL, &proc_doulongvec_minmax},
+	{VM_FAULT_AROUND, "fault-around",
+	&vm_fault_around, sizeof(int), 0644, NULL, &proc_dointvec},
+	{VM_PAGETABLE_COW, "pagetable-cow",
+	&vm_pagetable_cow, sizeof(int), 0644, NULL, &proc_dointvec},
+#ifdef CONFIG_HUGETLB_PAGE
+	{VM_HUGETLB_PAGES, "nr_hugepages", &htlbpage_max, sizeof(int), 0644,
+	 NULL, &hugetlb_sysctl_handler},
+#endif
 	{0}
 };
 
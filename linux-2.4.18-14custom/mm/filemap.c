@@ -24,6 +24,7 @@
 #include <linux/mm.h>
 #include <linux/mm_inline.h>
 #include <linux/iobuf.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -49,9 +50,12 @@ struct page **page_hash_table;
 
 int vm_max_readahead = 127;
 int vm_min_readahead = 3;
+int vm_fault_around = 16;
 EXPORT_SYMBOL(vm_max_readahead);
 EXPORT_SYMBOL(vm_min_readahead);
 
+struct readahead_stat readahead_stat;
+
 
 spinlock_cacheline_t pagecache_lock_cacheline  = {SPIN_LOCK_UNLOCKED};
 /*
@@ -247,6 +251,16 @@ static inline void truncate_partial_page(struct page *page, unsigned partial)
 
 static void truncate_complete_page(struct page *page)
 {
+	/*
+	 * A fault that raced with the truncate can still have the page
+	 * mapped.  Without ->mapping its ptes can't be found through the
+	 * page cache, so it gets a pte_chain while they still can.  Once
+	 * it is not up to date, new ptes get a pte_chain right away.
+	 */
+	ClearPageUptodate(page);
+	if (page->pte_chain)
+		page_objrmap_to_chain(page);
+
 	/*
 	 * Leave it on the LRU if it gets converted into anonymous buffers
 	 * or anonymous process memory.
@@ -262,7 +276,6 @@ static void truncate_complete_page(struct page *page)
 	 * all sorts of fun problems ...  
 	 */
 	ClearPageDirty(page);
-	ClearPageUptodate(page);
 	remove_inode_page(page);
 	page_cache_release(page);
 }
@@ -789,6 +802,59 @@ static int read_cluster_nonblocking(struct file * file, unsigned long offset,
 	return 0;
 }
 
+/*
+ * Start reading 'nr' pages of a file from 'offset' on, without waiting
+ * for any of the IO. Returns the first page of the range that is not
+ * uptodate yet, with a reference held, or NULL if the whole range is
+ * in the page cache already. If no such page could be found because
+ * a page could not be added to the cache, the error is returned with
+ * ERR_PTR().
+ */
+struct page * page_cache_read_async(struct file * file, unsigned long offset,
+	unsigned long nr)
+{
+	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
+	unsigned long end_index;
+	struct page *page, *first = NULL;
+	int error;
+
+	end_index = (mapping->host->i_size + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
+	if (offset >= end_index)
+		return NULL;
+	if (nr > end_index - offset)
+		nr = end_index - offset;
+
+	for (; nr; nr--, offset++) {
+		page = find_get_page(mapping, offset);
+		if (!page) {
+			error = page_cache_read(file, offset);
+			if (error < 0) {
+				if (!first)
+					return ERR_PTR(error);
+				break;
+			}
+			page = find_get_page(mapping, offset);
+			if (!page)
+				continue;
+		}
+		/*
+		 * Not uptodate and nobody reading it - an earlier read
+		 * failed or was never started:
+		 */
+		if (!Page_Uptodate(page) && !TryLockPage(page)) {
+			if (!page->mapping || Page_Uptodate(page))
+				UnlockPage(page);
+			else
+				mapping->a_ops->readpage(file, page);
+		}
+		if (!first && !Page_Uptodate(page))
+			first = page;
+		else
+			page_cache_release(page);
+	}
+	return first;
+}
+
 /*
  * Knuth recommends primes in approximately golden ratio to the maximum
  * integer representable by a machine word for multiplicative hashing.
@@ -916,6 +982,22 @@ void unlock_page(struct page *page)
 		wake_up_all(waitqueue);
 }
 
+/*
+ * Wait for a page to get unlocked without sleeping right away -
+ * the poll() way, for callers that have many reads in flight.
+ * The caller has to hold a reference to the page and must recheck
+ * PageLocked() after adding itself.
+ */
+void add_page_wait_queue(struct page *page, wait_queue_t *wait)
+{
+	add_wait_queue(page_waitqueue(page), wait);
+}
+
+void remove_page_wait_queue(struct page *page, wait_queue_t *wait)
+{
+	remove_wait_queue(page_waitqueue(page), wait);
+}
+
 /*
  * Get a lock on the page, assuming we need to sleep
  * to get it..
@@ -1108,8 +1190,8 @@ static void drop_behind(struct file * file, unsigned long index)
 	if (!index)
 		return;
 
-	if (index > file->f_rawin)
-		start = index - file->f_rawin;
+	if (index > file->f_ramax)
+		start = index - file->f_ramax;
 	else
 		start = 0;
 
@@ -1247,15 +1329,13 @@ static void profile_readahead(int async, struct file *filp)
  * Read-ahead context:
  * -------------------
  * The read ahead context fields of the "struct file" are the following:
- * - f_raend : position of the first byte after the last page we tried to
- *	       read ahead.
- * - f_ramax : current read-ahead maximum size.
- * - f_ralen : length of the current IO read block we tried to read-ahead.
- * - f_rawin : length of the current read-ahead window.
- *		if last read-ahead was synchronous then
- *			f_rawin = f_ralen
- *		otherwise (was asynchronous)
- *			f_rawin = previous value of f_ralen + f_ralen
+ * - f_raprev  : index of the last page accessed.
+ * - f_rastride: distance between the last two accesses, 0 if the last
+ *		 access went back or too far to be a stride.
+ * - f_raend   : first page of the stream we have not read ahead yet.
+ * - f_ralen   : number of pages in the last read-ahead batch.
+ * - f_ramax   : number of pages to read ahead in the next batch.
+ * - f_rawin   : cap on f_ramax after thrashing, 0 if none.
  *
  * Read-ahead limits:
  * ------------------
@@ -1306,114 +1386,151 @@ static inline int get_max_readahead(struct inode * inode)
 	return max_readahead[MAJOR(inode->i_dev)][MINOR(inode->i_dev)];
 }
 
-static void generic_file_readahead(int reada_ok,
-	struct file * filp, struct inode * inode,
-	struct page * page)
+/*
+ * Read-ahead accounting:
+ * ----------------------
+ * Every page cache lookup done on behalf of a file is accounted as a hit
+ * or a miss, per file and globally. The counters are not locked, they
+ * are statistics only.
+ */
+static inline void readahead_hit(struct file * filp)
 {
-	unsigned long end_index;
-	unsigned long index = page->index;
-	unsigned long max_ahead, ahead;
-	unsigned long raend;
-	int max_readahead = get_max_readahead(inode);
-
-	end_index = inode->i_size >> PAGE_CACHE_SHIFT;
+	filp->f_rahit++;
+	readahead_stat.hits++;
+}
 
-	raend = filp->f_raend;
-	max_ahead = 0;
+static inline void readahead_miss(struct file * filp)
+{
+	filp->f_ramiss++;
+	readahead_stat.misses++;
+}
 
 /*
- * The current page is locked.
- * If the current position is inside the previous read IO request, do not
- * try to reread previously read ahead pages.
- * Otherwise decide or not to read ahead some pages synchronously.
- * If we are not going to read ahead, set the read ahead context for this 
- * page only.
- */
-	if (PageLocked(page)) {
-		if (!filp->f_ralen || index >= raend || index + filp->f_rawin < raend) {
-			raend = index;
-			if (raend < end_index)
-				max_ahead = filp->f_ramax;
-			filp->f_rawin = 0;
-			filp->f_ralen = 1;
-			if (!max_ahead) {
-				filp->f_raend  = index + filp->f_ralen;
-				filp->f_rawin += filp->f_ralen;
-			}
-		}
-	}
-/*
- * The current page is not locked.
- * If we were reading ahead and,
- * if the current max read ahead size is not zero and,
- * if the current position is inside the last read-ahead IO request,
- *   it is the moment to try to read ahead asynchronously.
- * We will later force unplug device in order to force asynchronous read IO.
+ * A miss on a page of the stream we read ahead in the last two batches
+ * means it got evicted before the reader got there. Halve the window
+ * and cap it there, file_readahead() lifts the cap a page per batch.
+ * The stream is read again from this page on.
  */
-	else if (reada_ok && filp->f_ramax && raend >= 1 &&
-		 index <= raend && index + filp->f_ralen >= raend) {
-/*
- * Add ONE page to max_ahead in order to try to have about the same IO max size
- * as synchronous read-ahead (MAX_READAHEAD + 1)*PAGE_CACHE_SIZE.
- * Compute the position of the last page we have tried to read in order to 
- * begin to read ahead just at the next page.
- */
-		raend -= 1;
-		if (raend < end_index)
-			max_ahead = filp->f_ramax + 1;
-
-		if (max_ahead) {
-			filp->f_rawin = filp->f_ralen;
-			filp->f_ralen = 0;
-			reada_ok      = 2;
-		}
-	}
+static void readahead_thrashed(struct file * filp, unsigned long index)
+{
+	unsigned long span = 2 * filp->f_ralen * filp->f_rastride;
+
+	if (!span || index >= filp->f_raend || index + span < filp->f_raend)
+		return;
+
+	readahead_stat.thrashed++;
+	filp->f_ramax -= filp->f_ramax >> 1;
+	if (filp->f_ramax < vm_min_readahead)
+		filp->f_ramax = vm_min_readahead;
+	filp->f_rawin = filp->f_ramax;
+	filp->f_raend = index;
+}
+
+#define RA_HIT		1	/* the page was in the page cache */
+#define RA_MMAP		2	/* page fault, not read() */
+#define RA_SEQUENTIAL	4	/* in a MADV_SEQUENTIAL mapping */
+
 /*
- * Try to read ahead pages.
- * We hope that ll_rw_blk() plug/unplug, coalescence, requests sort and the
- * scheduler, will work enough for us to avoid too bad actuals IO requests.
+ * file_readahead - read ahead for an access to page @index of @filp
+ * @last:  last page the caller is going to access anyway
+ * @limit: first page past the end of the file or mapping
+ *
+ * Called for every page read() or a fault accesses. An access one page
+ * on from the last one, or as far on as the last one was from the one
+ * before, continues a stream. Anything else only reads the pages the
+ * caller needs and remembers the distance as the stride for the next
+ * access to confirm.
+ *
+ * A stream is read ahead f_ramax pages at a time. If the reader has
+ * caught up with the read-ahead the batch starts at @index, so the page
+ * it waits for goes out with it. Once it reaches the last batch the next
+ * one is started asynchronously. Each batch doubles the window, up to
+ * the device maximum or the cap readahead_thrashed() left.
  */
-	ahead = 0;
-	while (ahead < max_ahead) {
-		ahead ++;
-		if ((raend + ahead) >= end_index)
-			break;
-		if (page_cache_read(filp, raend + ahead) < 0)
+static void file_readahead(struct file * filp, struct inode * inode,
+	unsigned long index, unsigned long last, unsigned long limit,
+	int flags)
+{
+	unsigned long max_readahead = get_max_readahead(inode);
+	unsigned long max = max_readahead;
+	unsigned long stride, start, nr, ahead;
+	int stream = 0;
+	long delta;
+
+	if (filp->f_raend && index == filp->f_raprev)
+		return;
+	delta = index - filp->f_raprev;
+	filp->f_raprev = index;
+
+	if (flags & RA_SEQUENTIAL)
+		delta = 1;
+
+	if (delta <= 0 || (delta != 1 && delta != filp->f_rastride)) {
+		filp->f_rastride = (delta > 0 && delta <= max) ? delta : 0;
+		filp->f_ramax = vm_min_readahead;
+		stride = 1;
+		start = index;
+		nr = last - index + 1;
+		goto read;
+	}
+
+	stride = filp->f_rastride = delta;
+	stream = 1;
+	if (!(flags & RA_HIT))
+		readahead_thrashed(filp, index);
+	if (filp->f_rawin && filp->f_rawin < max)
+		max = filp->f_rawin;
+	if (flags & RA_SEQUENTIAL)
+		filp->f_ramax = max;
+
+	if (index >= filp->f_raend)
+		start = index;
+	else if (index + filp->f_ralen * stride >= filp->f_raend)
+		start = filp->f_raend;
+	else
+		return;
+
+	if (!filp->f_ramax)
+		filp->f_ramax = 1;
+	nr = filp->f_ramax;
+	if (last >= start && nr <= (last - start) / stride)
+		nr = (last - start) / stride + 1;
+
+	filp->f_ramax += filp->f_ramax;
+	if (filp->f_ramax > max)
+		filp->f_ramax = max;
+	if (filp->f_rawin && ++filp->f_rawin >= max_readahead)
+		filp->f_rawin = 0;
+
+read:
+	if (nr > max)
+		nr = max;
+	for (ahead = 0; ahead < nr; ahead++) {
+		unsigned long pos = start + ahead * stride;
+
+		if (pos >= limit || page_cache_read(filp, pos) < 0)
 			break;
 	}
-/*
- * If we tried to read ahead some pages,
- * If we tried to read ahead asynchronously,
- *   Try to force unplug of the device in order to start an asynchronous
- *   read IO request.
- * Update the read-ahead context.
- * Store the length of the current read-ahead window.
- * Double the current max read ahead size.
- *   That heuristic avoid to do some large IO for files that are not really
- *   accessed sequentially.
- */
-	if (ahead) {
-		filp->f_ralen += ahead;
-		filp->f_rawin += filp->f_ralen;
-		filp->f_raend = raend + ahead + 1;
+	filp->f_ralen = ahead;
+	filp->f_raend = start + ahead * stride;
 
-		filp->f_ramax += filp->f_ramax;
+	if (!ahead || !stream)
+		return;
 
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
+	/* Nobody waits on an asynchronous batch yet, start the IO */
+	if (start != index)
+		run_task_queue(&tq_disk);
 
-		/*
-		 * Move the pages that have already been passed
-		 * to the inactive list.
-		 */
+	/*
+	 * Move the pages read() has passed to the inactive list.
+	 * Mapped pages are left alone unless the mapping said so.
+	 */
+	if (stride == 1 && (!(flags & RA_MMAP) || (flags & RA_SEQUENTIAL)))
 		drop_behind(filp, index);
 
 #ifdef PROFILE_READAHEAD
-		profile_readahead((reada_ok == 2), filp);
+	profile_readahead(start != index, filp);
 #endif
-	}
-
-	return;
 }
 
 /*
@@ -1431,7 +1548,7 @@ void mark_page_accessed(struct page *page)
 
 		activate_page(page);
 		if (free < zone->pages_low)
-			wakeup_kswapd(GFP_NOIO);
+			wakeup_zone_kswapd(zone);
 		if (zone->free_pages < zone->pages_min)
 			fixup_freespace(zone, 1);
 		return;
@@ -1454,60 +1571,25 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 {
 	struct address_space *mapping = filp->f_dentry->d_inode->i_mapping;
 	struct inode *inode = mapping->host;
-	unsigned long index, offset;
+	unsigned long index, offset, last;
 	struct page *cached_page;
-	int reada_ok;
 	int error;
-	int max_readahead = get_max_readahead(inode);
 
 	cached_page = NULL;
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
 
-/*
- * If the current position is outside the previous read-ahead window, 
- * we reset the current read-ahead context and set read ahead max to zero
- * (will be set to just needed value later),
- * otherwise, we assume that the file accesses are sequential enough to
- * continue read-ahead.
- */
-	if (index > filp->f_raend || index + filp->f_rawin < filp->f_raend) {
-		reada_ok = 0;
-		filp->f_raend = 0;
-		filp->f_ralen = 0;
-		filp->f_ramax = 0;
-		filp->f_rawin = 0;
-	} else {
-		reada_ok = 1;
-	}
-/*
- * Adjust the current value of read-ahead max.
- * If the read operation stay in the first half page, force no readahead.
- * Otherwise try to increase read ahead max just enough to do the read request.
- * Then, at least MIN_READAHEAD if read ahead is ok,
- * and at most MAX_READAHEAD in all cases.
- */
-	if (!index && offset + desc->count <= (PAGE_CACHE_SIZE >> 1)) {
-		filp->f_ramax = 0;
-	} else {
-		unsigned long needed;
-
-		needed = ((offset + desc->count) >> PAGE_CACHE_SHIFT) + 1;
-
-		if (filp->f_ramax < needed)
-			filp->f_ramax = needed;
-
-		if (reada_ok && filp->f_ramax < vm_min_readahead)
-				filp->f_ramax = vm_min_readahead;
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
-	}
+	/* The last page of the request, read-ahead reads up to it anyway */
+	last = index;
+	if (desc->count)
+		last = (*ppos + desc->count - 1) >> PAGE_CACHE_SHIFT;
 
 	for (;;) {
 		struct page *page, **hash;
-		unsigned long end_index, nr, ret;
+		unsigned long end_index, limit, nr, ret;
 
 		end_index = inode->i_size >> PAGE_CACHE_SHIFT;
+		limit = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 			
 		if (index > end_index)
 			break;
@@ -1529,10 +1611,14 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 		page = __find_page_nolock(mapping, index, *hash);
 		if (!page)
 			goto no_cached_page;
+		readahead_hit(filp);
 found_page:
 		page_cache_get(page);
 		spin_unlock(&pagecache_lock);
 
+		if (!nonblock)
+			file_readahead(filp, inode, index, last, limit, RA_HIT);
+
 		if (!Page_Uptodate(page)) {
 			if (nonblock) {
 				page_cache_release(page);
@@ -1542,10 +1628,8 @@ found_page:
 			goto page_not_up_to_date;
 		}
 		
-		if (!nonblock) {
+		if (!nonblock)
 			conditional_schedule();         /* sys_read() */
-			generic_file_readahead(reada_ok, filp, inode, page);
-		}
 page_ok:
 		/* If users can be writing to this page using arbitrary
 		 * virtual addresses, take care about potential aliasing
@@ -1582,14 +1666,9 @@ page_ok:
 		break;
 
 /*
- * Ok, the page was not immediately readable, so let's try to read ahead while we're at it..
+ * Ok, the page was not immediately readable, so wait for it..
  */
 page_not_up_to_date:
-		generic_file_readahead(reada_ok, filp, inode, page);
-
-		if (Page_Uptodate(page))
-			goto page_ok;
-
 		/* Get exclusive access to the page ... */
 		lock_page(page);
 
@@ -1614,8 +1693,6 @@ readpage:
 			if (Page_Uptodate(page))
 				goto page_ok;
 
-			/* Again, try some read-ahead while waiting for the page to finish.. */
-			generic_file_readahead(reada_ok, filp, inode, page);
 			wait_on_page(page);
 			if (Page_Uptodate(page))
 				goto page_ok;
@@ -1633,6 +1710,19 @@ no_cached_page:
 			desc->error = -EWOULDBLOCKIO;
 			break;
 		}
+		readahead_miss(filp);
+
+		/*
+		 * The read-ahead may read this page with the ones
+		 * after it, so look again once it has run.
+		 */
+		spin_unlock(&pagecache_lock);
+		file_readahead(filp, inode, index, last, limit, 0);
+		spin_lock(&pagecache_lock);
+		page = __find_page_nolock(mapping, index, *hash);
+		if (page)
+			goto found_page;
+
 		/*
 		 * Ok, it wasn't cached, so we need to create a new
 		 * page..
@@ -2019,61 +2109,6 @@ asmlinkage ssize_t sys_readahead(int fd, loff_t offset, size_t count)
 	return ret;
 }
 
-/*
- * Read-ahead and flush behind for MADV_SEQUENTIAL areas.  Since we are
- * sure this is sequential access, we don't need a flexible read-ahead
- * window size -- we can always use a large fixed size window.
- */
-static void nopage_sequential_readahead(struct vm_area_struct * vma,
-	unsigned long pgoff, unsigned long filesize)
-{
-	unsigned long ra_window;
-
-	ra_window = get_max_readahead(vma->vm_file->f_dentry->d_inode);
-	ra_window = CLUSTER_OFFSET(ra_window + CLUSTER_PAGES - 1);
-
-	/* vm_raend is zero if we haven't read ahead in this area yet.  */
-	if (vma->vm_raend == 0)
-		vma->vm_raend = vma->vm_pgoff + ra_window;
-
-	/*
-	 * If we've just faulted the page half-way through our window,
-	 * then schedule reads for the next window, and release the
-	 * pages in the previous window.
-	 */
-	if ((pgoff + (ra_window >> 1)) == vma->vm_raend) {
-		unsigned long start = vma->vm_pgoff + vma->vm_raend;
-		unsigned long end = start + ra_window;
-
-		if (end > ((vma->vm_end >> PAGE_SHIFT) + vma->vm_pgoff))
-			end = (vma->vm_end >> PAGE_SHIFT) + vma->vm_pgoff;
-		if (start > end)
-			return;
-
-		while ((start < end) && (start < filesize)) {
-			if (read_cluster_nonblocking(vma->vm_file,
-							start, filesize) < 0)
-				break;
-			start += CLUSTER_PAGES;
-		}
-		run_task_queue(&tq_disk);
-
-		/* if we're far enough past the beginning of this area,
-		   recycle pages that are in the previous window. */
-		if (vma->vm_raend > (vma->vm_pgoff + ra_window + ra_window)) {
-			unsigned long window = ra_window << PAGE_SHIFT;
-
-			end = vma->vm_start + (vma->vm_raend << PAGE_SHIFT);
-			end -= window + window;
-			filemap_sync(vma, end - window, window, MS_INVALIDATE);
-		}
-
-		vma->vm_raend += ra_window;
-	}
-
-	return;
-}
-
 /*
  * filemap_nopage() is invoked via the vma operations vector for a
  * mapped memory region to read in file data during a page fault.
@@ -2084,13 +2119,16 @@ static void nopage_sequential_readahead(struct vm_area_struct * vma,
  */
 struct page * filemap_nopage(struct vm_area_struct * area, unsigned long address, int unused)
 {
-	int error;
+	int error, missed = 0;
 	struct file *file = area->vm_file;
 	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
 	struct inode *inode = mapping->host;
 	struct page *page, **hash;
 	unsigned long size, pgoff, endoff;
+	int ra_flags = RA_MMAP;
 
+	if (VM_SequentialReadHint(area))
+		ra_flags |= RA_SEQUENTIAL;
 	pgoff = ((address - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
 	endoff = ((area->vm_end - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
 
@@ -2115,6 +2153,10 @@ retry_find:
 	page = __find_get_page(mapping, pgoff, hash);
 	if (!page)
 		goto no_cached_page;
+	if (!missed) {
+		readahead_hit(file);
+		ra_flags |= RA_HIT;
+	}
 
 	/*
 	 * Ok, found a page in the page cache, now we need to check
@@ -2124,11 +2166,12 @@ retry_find:
 		goto page_not_uptodate;
 
 success:
- 	/*
-	 * Try read-ahead for sequential areas.
+	/*
+	 * Keep reading ahead of a stream of faults. A miss has done
+	 * this already.
 	 */
-	if (VM_SequentialReadHint(area))
-		nopage_sequential_readahead(area, pgoff, size);
+	if (!VM_RandomReadHint(area))
+		file_readahead(file, inode, pgoff, pgoff, size, ra_flags);
 
 	/*
 	 * Found the page and have a reference on it, need to check sharing
@@ -2146,9 +2189,12 @@ no_cached_page:
 	 * Otherwise, we're off the end of a privately mapped file,
 	 * so we need to map a zero page.
 	 */
-	if ((pgoff < size) && !VM_RandomReadHint(area))
+	if (!missed++)
+		readahead_miss(file);
+	if ((pgoff < size) && !VM_RandomReadHint(area)) {
+		file_readahead(file, inode, pgoff, pgoff, size, ra_flags);
 		error = read_cluster_nonblocking(file, pgoff, size);
-	else
+	} else
 		error = page_cache_read(file, pgoff);
 
 	/*
@@ -2258,6 +2304,9 @@ static inline int filemap_sync_pte_range(pmd_t * pmd,
 		pmd_clear(pmd);
 		return 0;
 	}
+	/* A shared page table keeps its dirty bits until it is unmapped */
+	if (PagePtShared(virt_to_page(pte_offset(pmd, 0))))
+		return 0;
 	pte = pte_offset(pmd, address);
 	offset += address & PMD_MASK;
 	address &= ~PMD_MASK;
@@ -2316,6 +2365,10 @@ int filemap_sync(struct vm_area_struct * vma, unsigned long address,
 	unsigned long end = address + size;
 	int error = 0;
 
+	/* Huge pages have no backing store to sync to */
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
 	/* Aquire the lock early; it may be possible to avoid dropping
 	 * and reaquiring it repeatedly.
 	 */
@@ -2337,8 +2390,80 @@ int filemap_sync(struct vm_area_struct * vma, unsigned long address,
 	return error;
 }
 
+/*
+ * Map the pages around a fault that are already up to date in the page
+ * cache, so that running through a cached file doesn't take a fault
+ * for every page.  The window is vm_fault_around pages, or the ones
+ * ahead of the fault for MADV_SEQUENTIAL areas, and never leaves the
+ * page table of the fault.  Locked pages (under I/O or truncate) are
+ * left to the fault path.  The ptes are mapped old, with the normal
+ * protections of the area, so private mappings still COW on write.
+ *
+ * Called from do_no_page() with mm->page_table_lock held, which also
+ * makes the i_size check safe against a truncate: vmtruncate() sets
+ * i_size before zapping the ptes.  A page the truncate took out of the
+ * page cache since find_get_page() has lost its ->mapping.
+ */
+void filemap_fault_around(struct vm_area_struct * area, unsigned long address, pte_t * page_table)
+{
+	struct mm_struct *mm = area->vm_mm;
+	struct address_space *mapping = area->vm_file->f_dentry->d_inode->i_mapping;
+	unsigned long start, end, base, size, pgoff;
+	unsigned long nr = vm_fault_around;
+	pte_t *pte;
+
+	if (nr <= 1 || VM_RandomReadHint(area))
+		return;
+
+	address &= PAGE_MASK;
+	base = address & PMD_MASK;
+	if (VM_SequentialReadHint(area))
+		start = address;
+	else
+		start = address - ((address >> PAGE_SHIFT) % nr) * PAGE_SIZE;
+	end = start + nr * PAGE_SIZE;
+	if (start < area->vm_start)
+		start = area->vm_start;
+	if (start < base)
+		start = base;
+	if (end > area->vm_end)
+		end = area->vm_end;
+	if (end > base + PMD_SIZE)
+		end = base + PMD_SIZE;
+
+	size = (mapping->host->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	pgoff = ((start - area->vm_start) >> PAGE_SHIFT) + area->vm_pgoff;
+	pte = page_table - ((address - start) >> PAGE_SHIFT);
+
+	for (; start < end; start += PAGE_SIZE, pgoff++, pte++) {
+		struct page *page;
+		pte_t entry;
+
+		if (start == address || !pte_none(*pte))
+			continue;
+		if (pgoff >= size)
+			break;
+		page = find_get_page(mapping, pgoff);
+		if (!page)
+			continue;
+		if (!Page_Uptodate(page) || PageLocked(page) ||
+		    page->mapping != mapping) {
+			page_cache_release(page);
+			continue;
+		}
+		++mm->rss;
+		flush_page_to_ram(page);
+		flush_icache_page(area, page);
+		entry = pte_mkold(mk_pte(page, area->vm_page_prot));
+		set_pte(pte, entry);
+		page_add_rmap(page, pte);
+		update_mmu_cache(area, start, entry);
+	}
+}
+
 static struct vm_operations_struct generic_file_vm_ops = {
 	nopage:		filemap_nopage,
+	fault_around:	filemap_fault_around,
 };
 
 /* This is used for a general mmap of a disk file */
@@ -2495,7 +2620,6 @@ static long madvise_fixup_start(struct vm_area_struct * vma,
 	*n = *vma;
 	n->vm_end = end;
 	setup_read_behavior(n, behavior);
-	n->vm_raend = 0;
 	if (n->vm_file)
 		get_file(n->vm_file);
 	if (n->vm_ops && n->vm_ops->open)
@@ -2523,7 +2647,6 @@ static long madvise_fixup_end(struct vm_area_struct * vma,
 	n->vm_start = start;
 	n->vm_pgoff += (n->vm_start - vma->vm_start) >> PAGE_SHIFT;
 	setup_read_behavior(n, behavior);
-	n->vm_raend = 0;
 	if (n->vm_file)
 		get_file(n->vm_file);
 	if (n->vm_ops && n->vm_ops->open)
@@ -2556,8 +2679,6 @@ static long madvise_fixup_middle(struct vm_area_struct * vma,
 	left->vm_end = start;
 	right->vm_start = end;
 	right->vm_pgoff += (right->vm_start - left->vm_start) >> PAGE_SHIFT;
-	left->vm_raend = 0;
-	right->vm_raend = 0;
 	if (vma->vm_file)
 		atomic_add(2, &vma->vm_file->f_count);
 
@@ -2566,7 +2687,6 @@ static long madvise_fixup_middle(struct vm_area_struct * vma,
 		vma->vm_ops->open(right);
 	}
 	vma->vm_pgoff += (start - vma->vm_start) >> PAGE_SHIFT;
-	vma->vm_raend = 0;
 	lock_vma_mappings(vma);
 	spin_lock(&mm->page_table_lock);
 	vma->vm_start = start;
@@ -2593,10 +2713,9 @@ static long madvise_behavior(struct vm_area_struct * vma,
 		return -ENOMEM;
 
 	if (start == vma->vm_start) {
-		if (end == vma->vm_end) {
+		if (end == vma->vm_end)
 			setup_read_behavior(vma, behavior);
-			vma->vm_raend = 0;
-		} else
+		else
 			error = madvise_fixup_start(vma, end, behavior);
 	} else {
 		if (end == vma->vm_end)
@@ -2688,6 +2807,10 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 {
 	if (vma->vm_flags & VM_LOCKED)
 		return -EINVAL;
+	if (is_vm_hugetlb_page(vma))
+		return -EINVAL;
+	if (unshare_cow_edges(vma->vm_mm, start, end))
+		return -ENOMEM;
 
         zap_page_range(vma->vm_mm, start, end - start,
 		ZPR_COND_RESCHED);        /* sys_madvise(MADV_DONTNEED) */
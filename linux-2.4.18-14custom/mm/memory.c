@@ -61,6 +61,7 @@
 #include <linux/pagemap.h>
 #include <linux/mm_inline.h>
 #include <linux/module.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgalloc.h>
 #include <asm/rmap.h>
@@ -102,6 +103,356 @@ void __free_pte(pte_t pte)
 	free_page_and_swap_cache(page);
 }
 
+/*
+ * Shared page tables.
+ *
+ * SysV shm attaches are marked VM_PTSHARE.  A page table that lies
+ * entirely within such a vma can be mapped by the pmd of every other
+ * mm that maps the same part of the same segment at the same address
+ * with the same protections, so a big segment attached by hundreds of
+ * processes needs one set of page tables instead of hundreds.
+ *
+ * A shared table has PG_ptshared set, one page reference per pmd that
+ * maps it and ->mapping pointing to the address_space of the segment;
+ * its ptes are not accounted in anybody's rss.  Each mm changes its own
+ * pmds under its own page_table_lock; the ptes of a shared table and
+ * its reference count are protected by pte_page_lock() of the table.
+ * A table becomes shared under the page_table_lock of its owner, and
+ * turns private again only in the hands of its last user.
+ */
+static inline int pte_shareable(struct vm_area_struct *vma, unsigned long address)
+{
+	unsigned long base = address & PMD_MASK;
+
+	if ((vma->vm_flags & (VM_PTSHARE | VM_LOCKED)) != VM_PTSHARE)
+		return 0;
+	return base >= vma->vm_start && base + PMD_SIZE <= vma->vm_end;
+}
+
+static int pte_table_present(pte_t *table)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < PTRS_PER_PTE; i++)
+		if (pte_present(table[i]))
+			nr++;
+	return nr;
+}
+
+/*
+ * Take a reference to the table for one more pmd, making it shared
+ * first if need be.  The owner's page_table_lock is held.
+ */
+static void get_shared_pte_page(struct mm_struct *owner, pte_t *table,
+	struct address_space *mapping)
+{
+	struct page *ptepage = virt_to_page(table);
+
+	pte_page_lock(ptepage);
+	if (!PagePtShared(ptepage)) {
+		owner->rss -= pte_table_present(table);
+		ptepage->mapping = mapping;
+		SetPagePtShared(ptepage);
+	}
+	get_page(ptepage);
+	pte_page_unlock(ptepage);
+}
+
+/*
+ * The last user of a shared table takes it over as a private one.
+ * Called with mm->page_table_lock and the pte_page_lock() held.
+ */
+static void take_pte_page(struct mm_struct *mm, pte_t *table, unsigned long address)
+{
+	ClearPagePtShared(virt_to_page(table));
+	pgtable_add_rmap(table, mm, address);
+	mm->rss += pte_table_present(table);
+}
+
+/*
+ * Drop a pmd's reference to a shared table whose ptes are already gone.
+ * Returns 1 if that was the last one and the table is to be freed.
+ */
+static int put_shared_pte_page(pte_t *table)
+{
+	struct page *ptepage = virt_to_page(table);
+	int last = 1;
+
+	pte_page_lock(ptepage);
+	if (page_count(ptepage) > 1) {
+		atomic_dec(&ptepage->count);
+		last = 0;
+	} else
+		ClearPagePtShared(ptepage);
+	pte_page_unlock(ptepage);
+	return last;
+}
+
+/*
+ * Drop this mm's reference to the shared table mapped by 'pmd', the
+ * pages get faulted back into a private table.  The last user keeps
+ * the table instead.  Called with mm->page_table_lock held, returns 0
+ * if the table is now ours.
+ */
+static int drop_shared_pte_page(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long base = address & PMD_MASK;
+	pte_t *table = pte_offset(pmd, 0);
+	struct page *ptepage = virt_to_page(table);
+	int dropped = 1;
+
+	pte_page_lock(ptepage);
+	if (page_count(ptepage) == 1) {
+		take_pte_page(mm, table, base);
+		dropped = 0;
+	} else {
+		pmd_clear(pmd);
+		flush_tlb_range(mm, base, base + PMD_SIZE);
+		atomic_dec(&ptepage->count);
+	}
+	pte_page_unlock(ptepage);
+	return dropped;
+}
+
+/*
+ * Copy-on-write page tables.
+ *
+ * fork() doesn't copy the page tables that lie entirely within a
+ * private anonymous vma, the child maps the parent's table with its
+ * pmd and the ptes are write protected for both, as fork would have
+ * done anyway.  Such a table is shared like an shm one, but with a
+ * NULL ->mapping, and may not be changed: the first mm to fault on it
+ * gets a copy of its own first, doing the work fork deferred.  A fork
+ * followed by exec then never copies these tables at all.
+ */
+int vm_pagetable_cow = 1;
+
+static inline int pte_cow_shareable(struct vm_area_struct *vma, unsigned long address)
+{
+	unsigned long base = address & PMD_MASK;
+
+	if (!vm_pagetable_cow || vma->vm_file ||
+	    (vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_IO | VM_RESERVED)))
+		return 0;
+	return base >= vma->vm_start && base + PMD_SIZE <= vma->vm_end;
+}
+
+static inline int pte_page_cow(struct page *ptepage)
+{
+	return PagePtShared(ptepage) && !ptepage->mapping;
+}
+
+/*
+ * Share the owner's table with a child.  A private table gets its
+ * ptes write protected first, a shared one already has them so.
+ * The owner's page_table_lock is held.
+ */
+static void share_cow_pte_page(struct mm_struct *owner, pte_t *table)
+{
+	int i;
+
+	if (!PagePtShared(virt_to_page(table))) {
+		for (i = 0; i < PTRS_PER_PTE; i++)
+			if (pte_present(table[i]))
+				ptep_set_wrprotect(table + i);
+	}
+	get_shared_pte_page(owner, table, NULL);
+}
+
+/*
+ * Give this mm a private copy of the copy-on-write table mapped by
+ * 'pmd': the pages and swap entries get a reference for the copy and
+ * the present pages are accounted to this mm.  The last user takes
+ * the table over instead.  Called with mm->page_table_lock held, which
+ * is dropped to allocate the copy.  Returns 0 or -ENOMEM.
+ */
+static int unshare_cow_pte_page(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long base = address & PMD_MASK;
+	pte_t *table = pte_offset(pmd, 0);
+	struct page *ptepage = virt_to_page(table);
+	pte_t *new;
+	int i;
+
+	new = pte_alloc_one_fast(mm, base);
+	if (!new) {
+		spin_unlock(&mm->page_table_lock);
+		new = pte_alloc_one(mm, base);
+		spin_lock(&mm->page_table_lock);
+		if (!new)
+			return -ENOMEM;
+	}
+
+	/* Another thread may have dealt with it while we slept. */
+	if (pmd_none(*pmd) || pte_offset(pmd, 0) != table) {
+		pte_free(new);
+		return 0;
+	}
+
+	pte_page_lock(ptepage);
+	if (!PagePtShared(ptepage) || page_count(ptepage) == 1) {
+		if (PagePtShared(ptepage))
+			take_pte_page(mm, table, base);
+		pte_page_unlock(ptepage);
+		pte_free(new);
+		return 0;
+	}
+
+	pgtable_add_rmap(new, mm, base);
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		pte_t pte = table[i];
+		struct page *page;
+
+		if (pte_none(pte))
+			continue;
+		if (!pte_present(pte)) {
+			swap_duplicate(pte_to_swp_entry(pte));
+			set_pte(new + i, pte);
+			continue;
+		}
+		page = pte_page(pte);
+		if (VALID_PAGE(page) && !PageReserved(page)) {
+			get_page(page);
+			mm->rss++;
+		}
+		set_pte(new + i, pte);
+		page_add_rmap(page, new + i);
+	}
+	pmd_populate(mm, pmd, new);
+	atomic_dec(&ptepage->count);
+	pte_page_unlock(ptepage);
+
+	flush_tlb_range(mm, base, base + PMD_SIZE);
+	return 0;
+}
+
+static int unshare_cow_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd = pgd_offset(mm, address);
+	pmd_t *pmd;
+
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		return 0;
+	pmd = pmd_offset(pgd, address);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return 0;
+	if (!pte_page_cow(virt_to_page(pte_offset(pmd, 0))))
+		return 0;
+	return unshare_cow_pte_page(mm, pmd, address);
+}
+
+/*
+ * zap_pte_range() drops a copy-on-write table from the mm, which is
+ * only right if the zap covers all of it.  So the tables at either
+ * end of a zap, which it may cover only partly, are copied first.
+ * A zap can't fail, so callers that may zap part of such a table
+ * (munmap, MADV_DONTNEED, /dev/zero reads) call this before they
+ * commit to the zap and fail with -ENOMEM themselves.  Nothing can
+ * share the tables again until the zap: that takes a fork, and fork
+ * waits for the mmap_sem.  Returns 0 or -ENOMEM.
+ */
+int unshare_cow_edges(struct mm_struct *mm, unsigned long start, unsigned long end)
+{
+	unsigned long edge[2];
+	int i, nr = 0, error = 0;
+
+	if (start & ~PMD_MASK)
+		edge[nr++] = start;
+	if (end & ~PMD_MASK)
+		edge[nr++] = end - 1;
+
+	spin_lock(&mm->page_table_lock);
+	for (i = 0; i < nr && !error; i++)
+		error = unshare_cow_pmd(mm, edge[i]);
+	spin_unlock(&mm->page_table_lock);
+	return error;
+}
+
+/*
+ * Stop [start, end) of the vma, rounded out to whole pmds, from using
+ * shared page tables, and the vma from sharing again.  For mprotect(),
+ * mlock() and mremap(), which change the ptes of one mm only.  Shm
+ * tables are dropped, copy-on-write ones copied.  Called with mmap_sem
+ * held for writing, returns 0 or -ENOMEM.
+ */
+int unshare_page_range(struct vm_area_struct *vma, unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long address;
+	int error = 0;
+
+	spin_lock(&mm->page_table_lock);
+	vma->vm_flags &= ~VM_PTSHARE;
+	for (address = start & PMD_MASK; address < end; address += PMD_SIZE) {
+		pgd_t *pgd = pgd_offset(mm, address);
+		struct page *ptepage;
+		pmd_t *pmd;
+
+		if (pgd_none(*pgd) || pgd_bad(*pgd))
+			continue;
+		pmd = pmd_offset(pgd, address);
+		if (pmd_none(*pmd) || pmd_bad(*pmd))
+			continue;
+		ptepage = virt_to_page(pte_offset(pmd, 0));
+		if (pte_page_cow(ptepage)) {
+			error = unshare_cow_pte_page(mm, pmd, address);
+			if (error)
+				break;
+		} else if (PagePtShared(ptepage))
+			drop_shared_pte_page(mm, pmd, address);
+	}
+	spin_unlock(&mm->page_table_lock);
+	return error;
+}
+
+/*
+ * Look for another mm mapping the same part of the segment at the same
+ * address whose table we can use, and map it with our empty pmd.  The
+ * locks are taken in the wrong order here, so any contention makes us
+ * fall back to a private table.  mm->page_table_lock is held.
+ */
+static pte_t *pte_try_share(struct mm_struct *mm, struct vm_area_struct *vma,
+	pmd_t *pmd, unsigned long address)
+{
+	struct address_space *mapping = vma->vm_file->f_dentry->d_inode->i_mapping;
+	unsigned long base = address & PMD_MASK;
+	unsigned long vm_base = vma->vm_start - (vma->vm_pgoff << PAGE_SHIFT);
+	struct vm_area_struct *svma;
+	pte_t *pte = NULL;
+
+	if (!spin_trylock(&mapping->i_shared_lock))
+		return NULL;
+	for (svma = mapping->i_mmap_shared; svma && !pte; svma = svma->vm_next_share) {
+		struct mm_struct *smm = svma->vm_mm;
+		pgd_t *spgd;
+		pmd_t *spmd;
+
+		if (smm == mm)
+			continue;
+		if (svma->vm_start - (svma->vm_pgoff << PAGE_SHIFT) != vm_base)
+			continue;
+		if (!spin_trylock(&smm->page_table_lock))
+			continue;
+		/* vm_flags and the table itself are only stable under the lock */
+		if (!pte_shareable(svma, base) ||
+		    ((svma->vm_flags ^ vma->vm_flags) & (VM_READ | VM_WRITE | VM_EXEC)) ||
+		    pgprot_val(svma->vm_page_prot) != pgprot_val(vma->vm_page_prot))
+			goto next;
+		spgd = pgd_offset(smm, base);
+		if (pgd_none(*spgd) || pgd_bad(*spgd))
+			goto next;
+		spmd = pmd_offset(spgd, base);
+		if (pmd_none(*spmd) || pmd_bad(*spmd))
+			goto next;
+		get_shared_pte_page(smm, pte_offset(spmd, 0), mapping);
+		set_pmd(pmd, *spmd);
+		pte = pte_offset(pmd, address);
+next:
+		spin_unlock(&smm->page_table_lock);
+	}
+	spin_unlock(&mapping->i_shared_lock);
+	return pte;
+}
 
 /*
  * Note: this doesn't free the actual pages themselves. That
@@ -120,6 +471,8 @@ static inline void free_one_pmd(pmd_t * dir)
 	}
 	pte = pte_offset(dir, 0);
 	pmd_clear(dir);
+	if (PagePtShared(virt_to_page(pte)) && !put_shared_pte_page(pte))
+		return;
 	pgtable_remove_rmap(pte);
 	pte_free(pte);
 }
@@ -201,6 +554,12 @@ int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
 	unsigned long address = vma->vm_start;
 	unsigned long end = vma->vm_end;
 	unsigned long cow = (vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
+	struct address_space *mapping = NULL;
+
+	if (is_vm_hugetlb_page(vma))
+		return copy_hugetlb_page_range(dst, src, vma);
+	if (vma->vm_flags & VM_PTSHARE)
+		mapping = vma->vm_file->f_dentry->d_inode->i_mapping;
 
 	src_pgd = pgd_offset(src, address)-1;
 	dst_pgd = pgd_offset(dst, address)-1;
@@ -244,6 +603,24 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 				goto cont_copy_pmd_range;
 			}
 
+			/* The child can simply share whole shm page tables */
+			if (mapping && pte_shareable(vma, address)) {
+				spin_lock(&src->page_table_lock);
+				get_shared_pte_page(src, pte_offset(src_pmd, 0), mapping);
+				set_pmd(dst_pmd, *src_pmd);
+				spin_unlock(&src->page_table_lock);
+				goto skip_copy_pte_range;
+			}
+
+			/* Anonymous memory shares them copy-on-write */
+			if (!mapping && pte_cow_shareable(vma, address)) {
+				spin_lock(&src->page_table_lock);
+				share_cow_pte_page(src, pte_offset(src_pmd, 0));
+				set_pmd(dst_pmd, *src_pmd);
+				spin_unlock(&src->page_table_lock);
+				goto skip_copy_pte_range;
+			}
+
 			src_pte = pte_offset(src_pmd, address);
 			dst_pte = pte_alloc(dst, dst_pmd, address);
 			if (!dst_pte)
@@ -323,12 +700,18 @@ static inline int zap_pte_range(mmu_gather_t *tlb, pmd_t * pmd, unsigned long ad
 
 	if (pmd_none(*pmd))
 		return 0;
+	if (pmd_huge(*pmd))
+		return zap_hugetlb_pmd(tlb_mm(tlb), pmd, address);
 	if (pmd_bad(*pmd)) {
 		pmd_ERROR(*pmd);
 		pmd_clear(pmd);
 		return 0;
 	}
 	ptep = pte_offset(pmd, address);
+	/* Other mms still use a shared table, just drop it from ours */
+	if (PagePtShared(virt_to_page(ptep)) &&
+	    drop_shared_pte_page(tlb_mm(tlb), pmd, address))
+		return 0;
 	offset = address & ~PMD_MASK;
 	if (offset + size > PMD_SIZE)
 		size = PMD_SIZE - offset;
@@ -499,6 +882,14 @@ int get_user_pages(struct task_struct *tsk, struct mm_struct *mm, unsigned long
 		if ( !vma || (pages && vma->vm_flags & VM_IO) || !(flags & vma->vm_flags) )
 			return i ? : -EFAULT;
 
+		if (is_vm_hugetlb_page(vma)) {
+			i = follow_hugetlb_page(mm, vma, pages, vmas,
+						&start, &len, i);
+			if (i < 0)
+				return i;
+			continue;
+		}
+
 		spin_lock(&mm->page_table_lock);
 		do {
 			struct page *map;
@@ -558,6 +949,132 @@ bad_page:
 
 EXPORT_SYMBOL(get_user_pages);
 
+/*
+ * Private anonymous memory, the only kind whose pages can be handed
+ * from one mm to another copy-on-write like fork() does.
+ */
+static inline int anon_cow_vma(struct vm_area_struct *vma)
+{
+	return !vma->vm_file && !(vma->vm_flags & (VM_SHARED | VM_IO | VM_RESERVED));
+}
+
+/*
+ * The pte that maps page at address, or NULL if the page got unmapped
+ * since get_user_pages() found it.  Called with the page_table_lock.
+ */
+static pte_t *follow_page_pte(struct mm_struct *mm, unsigned long address, struct page *page)
+{
+	pgd_t *pgd;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		return NULL;
+	pmd = pmd_offset(pgd, address);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return NULL;
+	pte = pte_offset(pmd, address);
+	if (!pte_present(*pte) || pte_page(*pte) != page)
+		return NULL;
+	return pte;
+}
+
+/*
+ * Take references to nr pages of the current process's private
+ * anonymous memory from start on and write protect them, so that the
+ * caller holds a copy-on-write snapshot of them: the next write by the
+ * process copies the page instead of changing it.  Stops at the first
+ * page that isn't private anonymous memory.  Returns the number of
+ * pages taken, to be released with page_cache_release().
+ */
+int get_user_pages_cow(unsigned long start, int nr, struct page **pages)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	struct page *page;
+	pte_t *pte;
+	int i;
+
+	down_read(&mm->mmap_sem);
+	for (i = 0; i < nr; i++, start += PAGE_SIZE) {
+		/* A write fault first, so the page and its table are ours alone */
+		if (get_user_pages(current, mm, start, 1, 1, 0, &page, &vma) != 1)
+			break;
+		if (!anon_cow_vma(vma) || PageReserved(page) ||
+		    (page->mapping && !PageSwapCache(page))) {
+			page_cache_release(page);
+			break;
+		}
+		spin_lock(&mm->page_table_lock);
+		pte = follow_page_pte(mm, start, page);
+		if (!pte) {
+			spin_unlock(&mm->page_table_lock);
+			page_cache_release(page);
+			break;
+		}
+		ptep_set_wrprotect(pte);
+		flush_tlb_page(vma, start);
+		spin_unlock(&mm->page_table_lock);
+		pages[i] = page;
+	}
+	up_read(&mm->mmap_sem);
+	return i;
+}
+
+/*
+ * Map page read-only at address in the current process, in place of
+ * the page there, the other side of get_user_pages_cow().  The address
+ * has to be in private anonymous memory the process may write to.
+ * Returns 0 if the page is mapped, or an error and the caller has to
+ * copy the data instead.
+ */
+int map_user_page_cow(unsigned long address, struct page *page)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	struct page *old;
+	pte_t *pte, entry;
+	int err = -EFAULT;
+
+	down_read(&mm->mmap_sem);
+	/* Fault the old page in, the same as a write there would */
+	if (get_user_pages(current, mm, address, 1, 1, 0, &old, &vma) != 1)
+		goto out;
+	err = -EINVAL;
+	if (!anon_cow_vma(vma))
+		goto out_release;
+
+	spin_lock(&mm->page_table_lock);
+	pte = follow_page_pte(mm, address, old);
+	if (!pte) {
+		spin_unlock(&mm->page_table_lock);
+		err = -EFAULT;
+		goto out_release;
+	}
+	page_remove_rmap(old, pte);
+	get_page(page);
+	flush_cache_page(vma, address);
+	entry = pte_mkdirty(pte_wrprotect(mk_pte(page, vma->vm_page_prot)));
+	set_pte(pte, entry);
+	flush_tlb_page(vma, address);
+	update_mmu_cache(vma, address, entry);
+	page_add_rmap(page, pte);
+	spin_unlock(&mm->page_table_lock);
+
+	/* Our reference and the one of the pte, rss stays the same */
+	page_cache_release(old);
+	free_page_and_swap_cache(old);
+	up_read(&mm->mmap_sem);
+	return 0;
+
+out_release:
+	page_cache_release(old);
+out:
+	up_read(&mm->mmap_sem);
+	return err;
+}
+
 /*
  * Force in an entire range of pages from the current process's user VA,
  * and pin them in physical memory.  
@@ -671,6 +1188,9 @@ void unmap_kiobuf (struct kiobuf *iobuf)
 
 void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size, int actions)
 {
+	/* The callers copied any partly covered table already, see above */
+	if (unshare_cow_edges(mm, address, address + size))
+		BUG();
 	while (size) {
 		unsigned long chunk = size;
 		if (actions & ZPR_COND_RESCHED && chunk > MAX_ZAP_BYTES)
@@ -1166,6 +1686,73 @@ void swapin_readahead(swp_entry_t entry)
 	return;
 }
 
+#define SWAPIN_RA_MAX	32
+
+/*
+ * Swap readahead for a process page: read the swap entries of the
+ * (1 << page_cluster) ptes around the faulting one, in address order.
+ * Those are the pages the process is likely to touch next, and since
+ * add_to_swap() places virtual neighbours next to each other in swap
+ * they usually are one contiguous extent on disk as well.  If none of
+ * the neighbours is in swap we fall back to the swap area cluster.
+ */
+static void swapin_readahead_vma(struct vm_area_struct * vma,
+	unsigned long address, pte_t * page_table, swp_entry_t entry)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	swp_entry_t entries[SWAPIN_RA_MAX];
+	unsigned long start, end, base;
+	unsigned long nr = 1 << page_cluster;
+	struct page *new_page;
+	int i, count = 0;
+	pte_t *pte;
+
+	if (nr <= 1 || VM_RandomReadHint(vma))
+		goto fallback;
+	if (free_low(ALL_ZONES) < 0)
+		return;
+	if (nr > SWAPIN_RA_MAX)
+		nr = SWAPIN_RA_MAX;
+
+	address &= PAGE_MASK;
+	base = address & PMD_MASK;
+	if (VM_SequentialReadHint(vma))
+		start = address;
+	else
+		start = address - ((address >> PAGE_SHIFT) % nr) * PAGE_SIZE;
+	end = start + nr * PAGE_SIZE;
+	if (start < vma->vm_start)
+		start = vma->vm_start;
+	if (start < base)
+		start = base;
+	if (end > vma->vm_end)
+		end = vma->vm_end;
+	if (end > base + PMD_SIZE)
+		end = base + PMD_SIZE;
+	pte = page_table - ((address - start) >> PAGE_SHIFT);
+
+	spin_lock(&mm->page_table_lock);
+	for (; start < end; start += PAGE_SIZE, pte++) {
+		if (pte_none(*pte) || pte_present(*pte))
+			continue;
+		entries[count++] = pte_to_swp_entry(*pte);
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	if (count <= 1)
+		goto fallback;
+	for (i = 0; i < count; i++) {
+		new_page = read_swap_cache_async(entries[i]);
+		if (!new_page)
+			break;
+		page_cache_release(new_page);
+	}
+	return;
+
+fallback:
+	swapin_readahead(entry);
+}
+
 /*
  * We hold the mm semaphore and the page_table_lock on entry and
  * should release the pagetable lock on exit..
@@ -1182,7 +1769,7 @@ static int do_swap_page(struct mm_struct * mm,
 	spin_unlock(&mm->page_table_lock);
 	page = lookup_swap_cache(entry);
 	if (!page) {
-		swapin_readahead(entry);
+		swapin_readahead_vma(vma, address, page_table, entry);
 		page = read_swap_cache_async(entry);
 		if (!page) {
 			/*
@@ -1301,8 +1888,10 @@ no_mem:
 static int do_no_page(struct mm_struct * mm, struct vm_area_struct * vma,
 	unsigned long address, int write_access, pte_t *page_table)
 {
-	struct page * new_page;
+	struct page * new_page, * ptepage;
+	struct address_space * mapping = NULL;
 	pte_t entry;
+	int shared;
 
 	if (!vma->vm_ops || !vma->vm_ops->nopage)
 		return do_anonymous_page(mm, vma, page_table, write_access, address);
@@ -1328,11 +1917,26 @@ static int do_no_page(struct mm_struct * mm, struct vm_area_struct * vma,
 		page_cache_release(new_page);
 		lru_cache_add(page);
 		new_page = page;
-	}
+	} else
+		mapping = new_page->mapping;
 
 	mark_page_accessed(new_page);
 
 	spin_lock(&mm->page_table_lock);
+	/*
+	 * A truncate may have taken the page out of the page cache since
+	 * ->nopage found it.  Fault again, ->nopage then sees the new size.
+	 */
+	if (mapping && new_page->mapping != mapping) {
+		page_cache_release(new_page);
+		spin_unlock(&mm->page_table_lock);
+		return 1;
+	}
+	/* Other mms fault on a shared page table under their own locks */
+	ptepage = virt_to_page(page_table);
+	shared = PagePtShared(ptepage);
+	if (shared)
+		pte_page_lock(ptepage);
 	/*
 	 * This silly early PAGE_DIRTY setting removes a race
 	 * due to the bad i386 page protection. But it's valid
@@ -1345,7 +1949,8 @@ static int do_no_page(struct mm_struct * mm, struct vm_area_struct * vma,
 	 */
 	/* Only go through if we didn't race with anybody else... */
 	if (pte_none(*page_table)) {
-		++mm->rss;
+		if (!shared)
+			++mm->rss;
 		flush_page_to_ram(new_page);
 		flush_icache_page(vma, new_page);
 		entry = mk_pte(new_page, vma->vm_page_prot);
@@ -1353,8 +1958,14 @@ static int do_no_page(struct mm_struct * mm, struct vm_area_struct * vma,
 			entry = pte_mkwrite(pte_mkdirty(entry));
 		set_pte(page_table, entry);
 		page_add_rmap(new_page, page_table);
+		if (shared)
+			pte_page_unlock(ptepage);
+		else if (vma->vm_ops->fault_around)
+			vma->vm_ops->fault_around(vma, address, page_table);
 	} else {
 		/* One of our sibling threads was faster, back out. */
+		if (shared)
+			pte_page_unlock(ptepage);
 		page_cache_release(new_page);
 		spin_unlock(&mm->page_table_lock);
 		return 1;
@@ -1411,12 +2022,62 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 
 		entry = pte_mkdirty(entry);
 	}
+	if (PagePtShared(virt_to_page(pte))) {
+		struct page *ptepage = virt_to_page(pte);
+
+		/*
+		 * Other mms and page reclaim may have changed the pte
+		 * since we looked, redo it under the table's lock.
+		 */
+		pte_page_lock(ptepage);
+		entry = *pte;
+		if (pte_present(entry)) {
+			if (write_access)
+				entry = pte_mkdirty(entry);
+			establish_pte(vma, address, pte, pte_mkyoung(entry));
+		}
+		pte_page_unlock(ptepage);
+		spin_unlock(&mm->page_table_lock);
+		return 1;
+	}
 	entry = pte_mkyoung(entry);
 	establish_pte(vma, address, pte, entry);
 	spin_unlock(&mm->page_table_lock);
 	return 1;
 }
 
+/*
+ * pte_alloc() for the fault path: try to share the page table of an
+ * shm mapping, and make sure no private page ever lands in a shared
+ * table.  A write through a read-only mapping (ptrace) makes such a
+ * private COW copy, after which the vma must not share any more.
+ * A copy-on-write table is copied before we touch it.
+ */
+static pte_t *pte_alloc_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+	pmd_t *pmd, unsigned long address, int write_access)
+{
+	pte_t *pte;
+
+	if (write_access && (vma->vm_flags & (VM_PTSHARE | VM_WRITE)) == VM_PTSHARE)
+		vma->vm_flags &= ~VM_PTSHARE;
+	if (pmd_none(*pmd) && pte_shareable(vma, address)) {
+		pte = pte_try_share(mm, vma, pmd, address);
+		if (pte)
+			return pte;
+	}
+	pte = pte_alloc(mm, pmd, address);
+	if (pte && pte_page_cow(virt_to_page(pte))) {
+		if (unshare_cow_pte_page(mm, pmd, address))
+			return NULL;
+		pte = pte_alloc(mm, pmd, address);
+	}
+	if (pte && PagePtShared(virt_to_page(pte)) && !pte_shareable(vma, address)) {
+		drop_shared_pte_page(mm, pmd, address);
+		pte = pte_alloc(mm, pmd, address);
+	}
+	return pte;
+}
+
 /*
  * By the time we get here, we already hold the mm semaphore
  */
@@ -1427,6 +2088,11 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 	pmd_t *pmd;
 
 	current->state = TASK_RUNNING;
+
+	/* Huge pages are all mapped at mmap() time, a fault is a SIGBUS */
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
 	pgd = pgd_offset(mm, address);
 
 	/* 
@@ -1445,7 +2111,7 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 	pmd = pmd_alloc(mm, pgd, address);
 
 	if (pmd) {
-		pte_t * pte = pte_alloc(mm, pmd, address);
+		pte_t * pte = pte_alloc_fault(mm, vma, pmd, address, write_access);
 		if (pte)
 			return handle_pte_fault(mm, vma, address, write_access, pte);
 	}
@@ -8,6 +8,7 @@
 #include <linux/mman.h>
 #include <linux/smp_lock.h>
 #include <linux/pagemap.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -31,7 +32,6 @@ static inline int mlock_fixup_start(struct vm_area_struct * vma,
 	*n = *vma;
 	n->vm_end = end;
 	n->vm_flags = newflags;
-	n->vm_raend = 0;
 	if (n->vm_file)
 		get_file(n->vm_file);
 	if (n->vm_ops && n->vm_ops->open)
@@ -58,7 +58,6 @@ static inline int mlock_fixup_end(struct vm_area_struct * vma,
 	n->vm_start = start;
 	n->vm_pgoff += (n->vm_start - vma->vm_start) >> PAGE_SHIFT;
 	n->vm_flags = newflags;
-	n->vm_raend = 0;
 	if (n->vm_file)
 		get_file(n->vm_file);
 	if (n->vm_ops && n->vm_ops->open)
@@ -91,8 +90,6 @@ static inline int mlock_fixup_middle(struct vm_area_struct * vma,
 	right->vm_start = end;
 	right->vm_pgoff += (right->vm_start - left->vm_start) >> PAGE_SHIFT;
 	vma->vm_flags = newflags;
-	left->vm_raend = 0;
-	right->vm_raend = 0;
 	if (vma->vm_file)
 		atomic_add(2, &vma->vm_file->f_count);
 
@@ -100,7 +97,6 @@ static inline int mlock_fixup_middle(struct vm_area_struct * vma,
 		vma->vm_ops->open(left);
 		vma->vm_ops->open(right);
 	}
-	vma->vm_raend = 0;
 	vma->vm_pgoff += (start - vma->vm_start) >> PAGE_SHIFT;
 	lock_vma_mappings(vma);
 	spin_lock(&vma->vm_mm->page_table_lock);
@@ -119,6 +115,19 @@ static int mlock_fixup(struct vm_area_struct * vma,
 {
 	int pages, retval;
 
+	/* Huge page mappings can only be split at huge page boundaries */
+	if (is_vm_hugetlb_page(vma) &&
+	    !is_aligned_hugepage_range(start, end - start))
+		return -EINVAL;
+
+	/* Locked vmas don't share page tables, see pte_shareable() */
+	if ((newflags & VM_LOCKED) &&
+	    ((vma->vm_flags & VM_PTSHARE) || !vma->vm_file)) {
+		if (unshare_page_range(vma, start, end))
+			return -ENOMEM;
+		newflags &= ~VM_PTSHARE;
+	}
+
 	if (newflags == vma->vm_flags)
 		return 0;
 
@@ -31,6 +31,7 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/personality.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -629,7 +630,6 @@ munmap_back:
 	vma->vm_pgoff = pgoff;
 	vma->vm_file = NULL;
 	vma->vm_private_data = NULL;
-	vma->vm_raend = 0;
 
 	if (file) {
 		error = -EINVAL;
@@ -988,7 +988,6 @@ static struct vm_area_struct * unmap_fixup(struct mm_struct *mm,
 		mpnt->vm_end = area->vm_end;
 		mpnt->vm_page_prot = area->vm_page_prot;
 		mpnt->vm_flags = area->vm_flags;
-		mpnt->vm_raend = 0;
 		mpnt->vm_ops = area->vm_ops;
 		mpnt->vm_pgoff = area->vm_pgoff + ((end - area->vm_start) >> PAGE_SHIFT);
 		mpnt->vm_file = area->vm_file;
@@ -1100,11 +1099,25 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len, int acct)
 	if (mpnt->vm_start >= addr+len)
 		return 0;
 
+	/* Huge page mappings can only be cut at huge page boundaries */
+	if (!is_aligned_hugepage_range(addr, len)) {
+		struct vm_area_struct *last = find_vma(mm, addr + len - 1);
+
+		if (is_vm_hugetlb_page(mpnt) ||
+		    (last && last->vm_start < addr + len &&
+		     is_vm_hugetlb_page(last)))
+			return -EINVAL;
+	}
+
 	/* If we'll make "hole", check the vm areas limit */
 	if ((mpnt->vm_start < addr && mpnt->vm_end > addr+len)
 	    && mm->map_count >= max_map_count)
 		return -ENOMEM;
 
+	/* Copy the copy-on-write page tables the unmap cuts through */
+	if (unshare_cow_edges(mm, addr, addr+len))
+		return -ENOMEM;
+
 	/*
 	 * We may need one additional vma to fix up the mappings ... 
 	 * and this is the last chance for an easy error exit.
@@ -24,6 +24,7 @@
 #include <linux/smp_lock.h>
 #include <linux/shm.h>
 #include <linux/mman.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -160,7 +161,6 @@ static inline int mprotect_fixup_start(struct vm_area_struct * vma, struct vm_ar
 	*n = *vma;
 	n->vm_end = end;
 	n->vm_flags = newflags;
-	n->vm_raend = 0;
 	n->vm_page_prot = prot;
 	if (n->vm_file)
 		get_file(n->vm_file);
@@ -190,7 +190,6 @@ static inline int mprotect_fixup_end(struct vm_area_struct * vma, struct vm_area
 	n->vm_start = start;
 	n->vm_pgoff += (n->vm_start - vma->vm_start) >> PAGE_SHIFT;
 	n->vm_flags = newflags;
-	n->vm_raend = 0;
 	n->vm_page_prot = prot;
 	if (n->vm_file)
 		get_file(n->vm_file);
@@ -227,8 +226,6 @@ static inline int mprotect_fixup_middle(struct vm_area_struct * vma, struct vm_a
 	left->vm_end = start;
 	right->vm_start = end;
 	right->vm_pgoff += (right->vm_start - left->vm_start) >> PAGE_SHIFT;
-	left->vm_raend = 0;
-	right->vm_raend = 0;
 	if (vma->vm_file)
 		atomic_add(2,&vma->vm_file->f_count);
 	if (vma->vm_ops && vma->vm_ops->open) {
@@ -236,7 +233,6 @@ static inline int mprotect_fixup_middle(struct vm_area_struct * vma, struct vm_a
 		vma->vm_ops->open(right);
 	}
 	vma->vm_pgoff += (start - vma->vm_start) >> PAGE_SHIFT;
-	vma->vm_raend = 0;
 	vma->vm_page_prot = prot;
 	lock_vma_mappings(vma);
 	spin_lock(&vma->vm_mm->page_table_lock);
@@ -260,6 +256,13 @@ static int mprotect_fixup(struct vm_area_struct * vma, struct vm_area_struct **
 	int error;
 	unsigned long charged = 0;
 
+	/* The new protections are for this mm only */
+	if ((vma->vm_flags & VM_PTSHARE) || !vma->vm_file) {
+		if (unshare_page_range(vma, start, end))
+			return -ENOMEM;
+		newflags &= ~VM_PTSHARE;
+	}
+
 	if (newflags == vma->vm_flags) {
 		*pprev = vma;
 		return 0;
@@ -341,6 +344,11 @@ asmlinkage long sys_mprotect(unsigned long start, size_t len, unsigned long prot
 
 		/* Here we know that  vma->vm_start <= nstart < vma->vm_end. */
 
+		if (is_vm_hugetlb_page(vma)) {
+			error = -EINVAL;
+			goto out;
+		}
+
 		newflags = prot | (vma->vm_flags & ~(PROT_READ | PROT_WRITE | PROT_EXEC));
 		if ((newflags & ~(newflags >> 4)) & 0xf) {
 			error = -EACCES;
@@ -354,7 +354,18 @@ void fixup_freespace(zone_t * zone, int direct_reclaim)
 				__free_pages_ok(page, 0);
 		} while (page && zone->free_pages <= zone->pages_min);
 	} else
-		wakeup_kswapd(GFP_ATOMIC);
+		wakeup_zone_kswapd(zone);
+}
+
+/*
+ * Start background reclaim as soon as an allocation takes a zone
+ * below its low watermark, so kswapd can catch up before anybody
+ * has to free pages in the allocation path.
+ */
+static inline void check_zone_low(zone_t * zone)
+{
+	if (zone->free_pages + zone->inactive_clean_pages < zone->pages_low)
+		wakeup_zone_kswapd(zone);
 }
 
 #define PAGES_KERNEL	0
@@ -408,8 +419,10 @@ static struct page * __alloc_pages_limit(zonelist_t *zonelist,
 			/* If that fails, fall back to rmqueue. */
 			if (!page)
 				page = rmqueue(z, order);
-			if (page)
+			if (page) {
+				check_zone_low(z);
 				return page;
+			}
 		}
 	}
 
@@ -460,8 +473,10 @@ try_again:
 		min += z->pages_min;
 		if (z->free_pages > min) {
 			page = rmqueue(z, order);
-			if (page)
+			if (page) {
+				check_zone_low(z);
 				return page;
+			}
 		} else if (z->free_pages < z->pages_min)
 			fixup_freespace(z, direct_reclaim);
 	}
@@ -560,7 +575,10 @@ try_again:
 			__set_current_state(TASK_RUNNING);
 			yield();
 			if (!order || free_high(ALL_ZONES) >= 0) {
-				int progress = try_to_free_pages(gfp_mask);
+				int progress;
+
+				zonelist->zones[0]->allocstall++;
+				progress = try_to_free_pages(gfp_mask);
 				if (progress || (gfp_mask & __GFP_FS))
 					goto try_again;
 				/*
@@ -654,6 +672,7 @@ defragment_again:
 			freed = 1;
 			flags = current->flags;
 			current->flags |= PF_MEMALLOC;
+			zonelist->zones[0]->allocstall++;
 			try_to_free_pages(gfp_mask);
 			current->flags &= (~PF_MEMALLOC) | (flags & PF_MEMALLOC);
 			goto defragment_again;
@@ -979,6 +998,8 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 	pgdat->node_start_paddr = zone_start_paddr;
 	pgdat->node_start_mapnr = (lmem_map - mem_map);
 	pgdat->nr_zones = 0;
+	init_waitqueue_head(&pgdat->kswapd_wait);
+	pgdat->kswapd = NULL;
 
 	offset = lmem_map - mem_map;	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -1013,6 +1034,8 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 		zone->inactive_clean_pages = 0;
 		zone->inactive_dirty_pages = 0;
 		zone->need_balance = 0;
+		zone->pgscan_kswapd = zone->pgscan_direct = 0;
+		zone->pgsteal = zone->allocstall = zone->kswapd_wake = 0;
 		zone->pte_chain_freelist = NULL;
 		INIT_LIST_HEAD(&zone->active_list);
 		INIT_LIST_HEAD(&zone->inactive_dirty_list);
@@ -19,10 +19,18 @@
  * - because swapout locking is opposite to the locking order
  *   in the page fault path, the swapout path uses trylocks
  *   on the mm->page_table_lock
+ * - a page table shared by several mms (PG_ptshared) is protected
+ *   by the pte_page_lock of the page table page, which nests within
+ *   the mm->page_table_lock and outside the pte_chain_lock; the
+ *   swapout path trylocks it too
+ * - the vma walks for PG_objrmap pages nest within the pte_chain_lock
+ *   and trylock the mapping->i_shared_lock, then the
+ *   mm->page_table_lock
  */
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/swap.h>
+#include <linux/cache.h>
 
 #include <asm/pgalloc.h>
 #include <asm/rmap.h>
@@ -53,6 +61,123 @@ static inline void pte_chain_free(struct pte_chain *, struct pte_chain *,
 		struct page *, zone_t *);
 static void alloc_new_pte_chains(zone_t *);
 
+/*
+ * Object-based reverse mapping.  A page of a file or shm segment is
+ * mapped at the same offset by every vma of its address_space, so its
+ * ptes can be found by walking mapping->i_mmap and ->i_mmap_shared
+ * instead of keeping a pte_chain per mapping.  With hundreds of
+ * processes mapping libc or a big shm segment those chains take a lot
+ * of memory, and fork has to allocate one for every pte it copies.
+ *
+ * Such pages have PG_objrmap set and ->pte_chain holds the number of
+ * ptes mapping them, so that "is the page mapped" tests still work.
+ * Anonymous and swap cache pages keep their pte_chains.  The mode is
+ * chosen when the first pte is added and kept until the last one goes,
+ * or until a truncate takes the page out of the page cache while it is
+ * still mapped: without ->mapping its ptes can't be found any more, so
+ * it is turned into a pte_chain page first, see page_objrmap_to_chain().
+ */
+#define page_mapcount(page)	((unsigned long) (page)->pte_chain)
+#define page_objrmap_ok(page)	((page)->mapping && !PageSwapCache(page))
+
+/* ptes of PG_objrmap pages, ie. pte_chains saved */
+static struct objrmap_stat {
+	long nr;
+} ____cacheline_aligned objrmap_stat[NR_CPUS];
+
+static inline void page_inc_mapcount(struct page * page)
+{
+	page->pte_chain = (struct pte_chain *) (page_mapcount(page) + 1);
+	objrmap_stat[smp_processor_id()].nr++;
+}
+
+static inline void page_dec_mapcount(struct page * page)
+{
+	page->pte_chain = (struct pte_chain *) (page_mapcount(page) - 1);
+	if (!page->pte_chain)
+		ClearPageObjRmap(page);
+	objrmap_stat[smp_processor_id()].nr--;
+}
+
+/*
+ * Where the vma maps the page, or -EFAULT if it doesn't cover it.
+ */
+static inline unsigned long vma_address(struct page * page,
+		struct vm_area_struct * vma)
+{
+	unsigned long pgoff = page->index - vma->vm_pgoff;
+
+	if (page->index < vma->vm_pgoff ||
+	    pgoff >= ((vma->vm_end - vma->vm_start) >> PAGE_SHIFT))
+		return -EFAULT;
+	return vma->vm_start + (pgoff << PAGE_SHIFT);
+}
+
+/*
+ * The pte mapping the page at address in mm, if there is one.
+ * Caller needs to hold the mm->page_table_lock.
+ */
+static pte_t * page_vma_pte(struct page * page, struct mm_struct * mm,
+		unsigned long address)
+{
+	pgd_t * pgd;
+	pmd_t * pmd;
+	pte_t * ptep;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		return NULL;
+	pmd = pmd_offset(pgd, address);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return NULL;
+	ptep = pte_offset(pmd, address);
+	if (!pte_present(*ptep) || pte_page(*ptep) != page)
+		return NULL;
+	return ptep;
+}
+
+/*
+ * page_referenced() for one vma of a PG_objrmap page.  A busy
+ * page_table_lock counts as a reference.
+ */
+static int page_referenced_vma(struct page * page, struct vm_area_struct * vma)
+{
+	unsigned long address = vma_address(page, vma);
+	struct mm_struct * mm = vma->vm_mm;
+	pte_t * ptep;
+	int referenced = 0;
+
+	if (address == -EFAULT)
+		return 0;
+	if (!spin_trylock(&mm->page_table_lock))
+		return 1;
+	ptep = page_vma_pte(page, mm, address);
+	if (ptep && ptep_test_and_clear_young(ptep))
+		referenced++;
+	spin_unlock(&mm->page_table_lock);
+	return referenced;
+}
+
+static int page_referenced_obj(struct page * page)
+{
+	struct address_space * mapping = page->mapping;
+	struct vm_area_struct * vma;
+	int referenced = 0;
+
+	/* No page cache to find the vmas through any more. */
+	if (!page_objrmap_ok(page))
+		return 0;
+	if (!spin_trylock(&mapping->i_shared_lock))
+		return 1;
+	for (vma = mapping->i_mmap; vma; vma = vma->vm_next_share)
+		referenced += page_referenced_vma(page, vma);
+	for (vma = mapping->i_mmap_shared; vma; vma = vma->vm_next_share)
+		referenced += page_referenced_vma(page, vma);
+	spin_unlock(&mapping->i_shared_lock);
+
+	return referenced;
+}
+
 /**
  * page_referenced - test if the page was referenced
  * @page: the page to test
@@ -69,6 +194,9 @@ int page_referenced(struct page * page)
 	if (PageTestandClearReferenced(page))
 		referenced++;
 
+	if (PageObjRmap(page))
+		return referenced + page_referenced_obj(page);
+
 	/* Check all the page tables mapping this page. */
 	for (pc = page->pte_chain; pc; pc = pc->next) {
 		if (ptep_test_and_clear_young(pc->ptep))
@@ -102,8 +230,20 @@ void page_add_rmap(struct page * page, pte_t * ptep)
 	if (!VALID_PAGE(page) || PageReserved(page))
 		return;
 
-#ifdef DEBUG_RMAP
+	/*
+	 * File and shm pages are found through their mapping.  A page that
+	 * truncate is taking out of the page cache, no longer up to date,
+	 * gets a pte_chain.
+	 */
 	pte_chain_lock(page);
+	if (PageObjRmap(page) || (!page->pte_chain && page_objrmap_ok(page) &&
+				  Page_Uptodate(page))) {
+		SetPageObjRmap(page);
+		page_inc_mapcount(page);
+		pte_chain_unlock(page);
+		return;
+	}
+#ifdef DEBUG_RMAP
 	{
 		struct pte_chain * pc;
 		for (pc = page->pte_chain; pc; pc = pc->next) {
@@ -111,13 +251,21 @@ void page_add_rmap(struct page * page, pte_t * ptep)
 				BUG();
 		}
 	}
-	pte_chain_unlock(page);
 #endif
+	pte_chain_unlock(page);
 
 	pte_chain = pte_chain_alloc(page_zone(page));
 
 	pte_chain_lock(page);
 
+	/* The last pte went away and a file page came back meanwhile? */
+	if (PageObjRmap(page)) {
+		page_inc_mapcount(page);
+		pte_chain_unlock(page);
+		pte_chain_free(pte_chain, NULL, NULL, page_zone(page));
+		return;
+	}
+
 	/* Hook up the pte_chain to the page. */
 	pte_chain->ptep = ptep;
 	pte_chain->next = page->pte_chain;
@@ -149,6 +297,10 @@ void page_remove_rmap(struct page * page, pte_t * ptep)
 	zone = page_zone(page);
 
 	pte_chain_lock(page);
+	if (PageObjRmap(page)) {
+		page_dec_mapcount(page);
+		goto out;
+	}
 	for (pc = page->pte_chain; pc; prev_pc = pc, pc = pc->next) {
 		if (pc->ptep == ptep) {
 			pte_chain_free(pc, prev_pc, page, zone);
@@ -171,6 +323,35 @@ out:
 			
 }
 
+/*
+ * Unmap a page from a shared page table.  No rss to adjust and no vma
+ * to check: shared tables are never VM_LOCKED.  The ptes of shm pages
+ * are simply cleared, shmem finds the page again on the next fault.
+ * Anonymous pages in a copy-on-write table leave their swap entry.
+ * Called with the pte_page_lock of the page table held.
+ */
+static int try_to_unmap_shared(struct page * page, pte_t * ptep)
+{
+	pte_t pte;
+
+	pte = ptep_get_and_clear(ptep);
+	flush_tlb_all();
+
+	if (PageSwapCache(page)) {
+		swp_entry_t entry;
+		entry.val = page->index;
+		swap_duplicate(entry);
+		set_pte(ptep, swp_entry_to_pte(entry));
+	}
+
+	/* Move the dirty bit to the physical page now the pte is gone. */
+	if (pte_dirty(pte))
+		set_page_dirty(page);
+
+	page_cache_release(page);
+	return SWAP_SUCCESS;
+}
+
 /**
  * try_to_unmap_one - worker function for try_to_unmap
  * @page: page to unmap
@@ -183,17 +364,31 @@ out:
  *	pagemap_lru_lock		page_launder()
  *	    page lock			page_launder(), trylock
  *		pte_chain_lock		page_launder()
- *		    mm->page_table_lock	try_to_unmap_one(), trylock
+ *		    pte_page_lock	try_to_unmap_one(), trylock
+ *			mm->page_table_lock	try_to_unmap_one(), trylock
  */
 static int FASTCALL(try_to_unmap_one(struct page *, pte_t *));
 static int try_to_unmap_one(struct page * page, pte_t * ptep)
 {
 	unsigned long address = ptep_to_address(ptep);
-	struct mm_struct * mm = ptep_to_mm(ptep);
+	struct page * ptepage = virt_to_page(ptep);
+	struct mm_struct * mm;
 	struct vm_area_struct * vma;
 	pte_t pte;
 	int ret;
 
+	/*
+	 * The page table can become shared, and its owner go away,
+	 * until we hold the owner's page_table_lock.
+	 */
+	if (!pte_page_trylock(ptepage))
+		return SWAP_AGAIN;
+	if (PagePtShared(ptepage)) {
+		ret = try_to_unmap_shared(page, ptep);
+		pte_page_unlock(ptepage);
+		return ret;
+	}
+	mm = ptep_to_mm(ptep);
 	if (!mm)
 		BUG();
 
@@ -201,8 +396,11 @@ static int try_to_unmap_one(struct page * page, pte_t * ptep)
 	 * We need the page_table_lock to protect us from page faults,
 	 * munmap, fork, etc...
 	 */
-	if (!spin_trylock(&mm->page_table_lock))
+	if (!spin_trylock(&mm->page_table_lock)) {
+		pte_page_unlock(ptepage);
 		return SWAP_AGAIN;
+	}
+	pte_page_unlock(ptepage);
 
 	/* During mremap, it's possible pages are not in a VMA. */
 	vma = find_vma(mm, address);
@@ -243,6 +441,194 @@ out_unlock:
 	return ret;
 }
 
+/*
+ * try_to_unmap() for one vma of a PG_objrmap page.
+ */
+static int try_to_unmap_vma(struct page * page, struct vm_area_struct * vma)
+{
+	unsigned long address = vma_address(page, vma);
+	struct mm_struct * mm = vma->vm_mm;
+	struct page * ptepage;
+	pte_t * ptep, pte;
+	int ret = SWAP_SUCCESS;
+
+	if (address == -EFAULT)
+		return SWAP_SUCCESS;
+	if (!spin_trylock(&mm->page_table_lock))
+		return SWAP_AGAIN;
+
+	ptep = page_vma_pte(page, mm, address);
+	if (!ptep)
+		goto out_unlock;
+
+	/* Several vmas lead to a shared page table, unmap it just once. */
+	ptepage = virt_to_page(ptep);
+	if (PagePtShared(ptepage)) {
+		if (!pte_page_trylock(ptepage)) {
+			ret = SWAP_AGAIN;
+			goto out_unlock;
+		}
+		if (pte_present(*ptep) && pte_page(*ptep) == page) {
+			try_to_unmap_shared(page, ptep);
+			page_dec_mapcount(page);
+		}
+		pte_page_unlock(ptepage);
+		goto out_unlock;
+	}
+
+	/* The page is mlock()d, we cannot swap it out. */
+	if (vma->vm_flags & VM_LOCKED) {
+		ret = SWAP_FAIL;
+		goto out_unlock;
+	}
+
+	/* Nuke the page table entry. */
+	pte = ptep_get_and_clear(ptep);
+	flush_tlb_page(vma, address);
+	flush_cache_page(vma, address);
+
+	/* Move the dirty bit to the physical page now the pte is gone. */
+	if (pte_dirty(pte))
+		set_page_dirty(page);
+
+	mm->rss--;
+	page_cache_release(page);
+	page_dec_mapcount(page);
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Unmap a PG_objrmap page from all the vmas of its mapping.  If ptes
+ * remain that no vma leads to (mremap() moving them, a truncate racing
+ * with a fault), the page can't be unmapped for now.
+ */
+static int try_to_unmap_obj(struct page * page)
+{
+	struct address_space * mapping = page->mapping;
+	struct vm_area_struct * vma;
+	int ret = SWAP_SUCCESS;
+
+	if (!page_objrmap_ok(page))
+		return SWAP_FAIL;
+	if (!spin_trylock(&mapping->i_shared_lock))
+		return SWAP_AGAIN;
+
+	for (vma = mapping->i_mmap; vma && page->pte_chain; vma = vma->vm_next_share) {
+		switch (try_to_unmap_vma(page, vma)) {
+			case SWAP_AGAIN:
+				ret = SWAP_AGAIN;
+				break;
+			case SWAP_FAIL:
+				ret = SWAP_FAIL;
+				goto out;
+		}
+	}
+	for (vma = mapping->i_mmap_shared; vma && page->pte_chain; vma = vma->vm_next_share) {
+		switch (try_to_unmap_vma(page, vma)) {
+			case SWAP_AGAIN:
+				ret = SWAP_AGAIN;
+				break;
+			case SWAP_FAIL:
+				ret = SWAP_FAIL;
+				goto out;
+		}
+	}
+	if (page->pte_chain && ret == SWAP_SUCCESS)
+		ret = SWAP_FAIL;
+out:
+	spin_unlock(&mapping->i_shared_lock);
+	return ret;
+}
+
+/*
+ * Collect the ptes mapping page from one vma list of its mapping into
+ * *chain.  Several vmas lead to a shared page table, its pte is taken
+ * once.  Returns 1 if a page_table_lock was busy.
+ */
+static int page_chain_vmas(struct page * page, struct vm_area_struct * vma,
+		struct pte_chain ** chain)
+{
+	struct pte_chain * pc;
+	struct mm_struct * mm;
+	unsigned long address;
+	pte_t * ptep;
+
+	for (; vma; vma = vma->vm_next_share) {
+		address = vma_address(page, vma);
+		if (address == -EFAULT)
+			continue;
+		mm = vma->vm_mm;
+		if (!spin_trylock(&mm->page_table_lock))
+			return 1;
+		ptep = page_vma_pte(page, mm, address);
+		for (pc = *chain; ptep && pc; pc = pc->next)
+			if (pc->ptep == ptep)
+				ptep = NULL;
+		if (ptep) {
+			pc = pte_chain_alloc(page_zone(page));
+			pc->ptep = ptep;
+			pc->next = *chain;
+			*chain = pc;
+		}
+		spin_unlock(&mm->page_table_lock);
+	}
+	return 0;
+}
+
+/**
+ * page_objrmap_to_chain - give a PG_objrmap page a pte_chain
+ * @page: the page
+ *
+ * Called by truncate for a page that is still mapped, a fault having
+ * raced with the truncate, before it takes the page out of the page
+ * cache.  Once ->mapping is gone the vmas mapping the page can't be
+ * found any more, so the ptes are collected into a pte_chain now, and
+ * the page gets unmapped and swapped like anonymous memory from then
+ * on.  The pte_chain_lock keeps ptes from being added or removed
+ * meanwhile, a busy lock further in is retried.  Ptes no vma leads to
+ * (mremap) stay lost to reverse mapping, as they were before.
+ * Caller needs to hold the page lock, not the pte_chain_lock.
+ */
+void page_objrmap_to_chain(struct page * page)
+{
+	struct address_space * mapping = page->mapping;
+	struct pte_chain * chain, * pc;
+	zone_t * zone = page_zone(page);
+	int busy;
+
+	for (;;) {
+		pte_chain_lock(page);
+		if (!PageObjRmap(page) || !page_objrmap_ok(page)) {
+			pte_chain_unlock(page);
+			return;
+		}
+		chain = NULL;
+		busy = !spin_trylock(&mapping->i_shared_lock);
+		if (!busy) {
+			busy = page_chain_vmas(page, mapping->i_mmap, &chain) ||
+			       page_chain_vmas(page, mapping->i_mmap_shared, &chain);
+			spin_unlock(&mapping->i_shared_lock);
+		}
+		if (!busy)
+			break;
+		pte_chain_unlock(page);
+
+		while ((pc = chain) != NULL) {
+			chain = pc->next;
+			pte_chain_free(pc, NULL, NULL, zone);
+		}
+		yield();
+	}
+
+	objrmap_stat[smp_processor_id()].nr -= page_mapcount(page);
+	ClearPageObjRmap(page);
+	page->pte_chain = chain;
+	pte_chain_unlock(page);
+}
+
 /**
  * try_to_unmap - try to remove all page table mappings to a page
  * @page: the page to get unmapped
@@ -271,6 +657,9 @@ int try_to_unmap(struct page * page)
 	if (!page->mapping)
 		BUG();
 
+	if (PageObjRmap(page))
+		return try_to_unmap_obj(page);
+
 	for (pc = page->pte_chain; pc; pc = next_pc) {
 		next_pc = pc->next;
 		switch (try_to_unmap_one(page, pc->ptep)) {
@@ -293,6 +682,40 @@ int try_to_unmap(struct page * page)
 	return ret;
 }
 
+static int page_over_rsslimit_obj(struct page * page)
+{
+	struct address_space * mapping = page->mapping;
+	struct vm_area_struct * vma;
+	struct mm_struct * mm;
+	int over = 0;
+
+	if (!page_objrmap_ok(page))
+		return 0;
+	if (!spin_trylock(&mapping->i_shared_lock))
+		return 0;
+	for (vma = mapping->i_mmap; vma; vma = vma->vm_next_share) {
+		if (vma_address(page, vma) == -EFAULT)
+			continue;
+		mm = vma->vm_mm;
+		if (!mm->rlimit_rss || mm->rss <= mm->rlimit_rss)
+			goto under;
+		over = 1;
+	}
+	for (vma = mapping->i_mmap_shared; vma; vma = vma->vm_next_share) {
+		if (vma_address(page, vma) == -EFAULT)
+			continue;
+		mm = vma->vm_mm;
+		if (!mm->rlimit_rss || mm->rss <= mm->rlimit_rss)
+			goto under;
+		over = 1;
+	}
+	spin_unlock(&mapping->i_shared_lock);
+	return over;
+under:
+	spin_unlock(&mapping->i_shared_lock);
+	return 0;
+}
+
 /**
  * page_over_rsslimit - test if the page is over its RSS limit
  * @page - page to test
@@ -313,15 +736,35 @@ int page_over_rsslimit(struct page * page)
 	if (!pte_chain)
 		return 0;
 
+	if (PageObjRmap(page))
+		return page_over_rsslimit_obj(page);
+
 	do {
+		struct page * ptepage;
+		int under;
+
 		ptep = pte_chain->ptep;
+		ptepage = virt_to_page(ptep);
+
+		/*
+		 * Shared page tables aren't charged to anybody, don't
+		 * penalise pages mapped through them either.
+		 */
+		if (!pte_page_trylock(ptepage))
+			return 0;
+		if (PagePtShared(ptepage)) {
+			pte_page_unlock(ptepage);
+			return 0;
+		}
 		mm = ptep_to_mm(ptep);
+		under = !mm->rlimit_rss || mm->rss <= mm->rlimit_rss;
+		pte_page_unlock(ptepage);
 
 		/*
 		 * If the process is under its RSS limit, stop
 		 * scanning and don't penalise the page.
 		 */
-		if(!mm->rlimit_rss || mm->rss <= mm->rlimit_rss)
+		if (under)
 			return 0;
 		
 		pte_chain = pte_chain->next;
@@ -330,6 +773,90 @@ int page_over_rsslimit(struct page * page)
 	return 1;
 }
 
+/*
+ * Pick a swap slot for an anonymous page that is about to be swapped
+ * out: right behind the slot of a virtual neighbour that is already
+ * in swap, or right in front of it.  That way a process' pages end up
+ * next to each other in swap, and swapin_readahead() following the
+ * page table finds them in one contiguous extent.  Only the page
+ * table of the first mapping is looked at, and only within
+ * 1 << page_cluster ptes, and not if it is shared: the ptes of a
+ * copy-on-write table belong to several processes.  Returns a zero
+ * entry if there is no hint.  The caller needs to hold the page's
+ * pte_chain_lock.
+ */
+swp_entry_t page_swap_hint(struct page * page)
+{
+	swp_entry_t hint;
+	struct mm_struct * mm;
+	struct page * ptepage;
+	pte_t * ptep;
+	unsigned long idx;
+	int k, window = 1 << page_cluster;
+
+	hint.val = 0;
+	if (!page->pte_chain || PageObjRmap(page) || window <= 1)
+		return hint;
+
+	ptep = page->pte_chain->ptep;
+	ptepage = virt_to_page(ptep);
+	if (!pte_page_trylock(ptepage))
+		return hint;
+	if (PagePtShared(ptepage)) {
+		pte_page_unlock(ptepage);
+		return hint;
+	}
+	mm = ptep_to_mm(ptep);
+	if (!spin_trylock(&mm->page_table_lock)) {
+		pte_page_unlock(ptepage);
+		return hint;
+	}
+	pte_page_unlock(ptepage);
+
+	idx = ((unsigned long)ptep & ~PAGE_MASK) / sizeof(pte_t);
+	for (k = 1; k < window; k++) {
+		pte_t pte;
+
+		if (idx >= k) {
+			pte = ptep[-k];
+			if (!pte_none(pte) && !pte_present(pte)) {
+				hint = pte_to_swp_entry(pte);
+				hint = SWP_ENTRY(SWP_TYPE(hint), SWP_OFFSET(hint) + k);
+				break;
+			}
+		}
+		if (idx + k < PTRS_PER_PTE) {
+			pte = ptep[k];
+			if (!pte_none(pte) && !pte_present(pte)) {
+				hint = pte_to_swp_entry(pte);
+				if (SWP_OFFSET(hint) > k) {
+					hint = SWP_ENTRY(SWP_TYPE(hint), SWP_OFFSET(hint) - k);
+					break;
+				}
+				hint.val = 0;
+			}
+		}
+	}
+	spin_unlock(&mm->page_table_lock);
+	return hint;
+}
+
+/*
+ * For /proc/meminfo: the pte_chains object-based reverse mapping saves.
+ */
+int rmap_report_meminfo(char * buf)
+{
+	long nr = 0;
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++)
+		nr += objrmap_stat[i].nr;
+	if (nr < 0)
+		nr = 0;
+	return sprintf(buf, "ObjRmapSaved: %8lu kB\n",
+			(nr * sizeof(struct pte_chain)) >> 10);
+}
+
 /**
  ** No more VM stuff below this comment, only pte_chain helper
  ** functions.
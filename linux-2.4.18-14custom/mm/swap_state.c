@@ -94,17 +94,24 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry)
  * @page: page we want to move to swap
  *
  * Allocate swap space for the page and add the page to the
- * swap cache.  Caller needs to hold the page lock.
+ * swap cache.  The slot is picked next to the swap slots of the
+ * page's virtual neighbours if possible.  Caller needs to hold
+ * the page lock.
  */
 int add_to_swap(struct page * page)
 {
-	swp_entry_t entry;
+	swp_entry_t entry, hint;
 
 	if (!PageLocked(page))
 		BUG();
 
+	pte_chain_lock(page);
+	hint = page_swap_hint(page);
+	pte_chain_unlock(page);
+
 	for (;;) {
-		entry = get_swap_page();
+		entry = get_swap_page_near(hint);
+		hint.val = 0;
 		if (!entry.val)
 			return 0;
 		/*
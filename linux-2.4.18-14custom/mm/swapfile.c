@@ -14,6 +14,7 @@
 #include <linux/vmalloc.h>
 #include <linux/pagemap.h>
 #include <linux/shm.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgtable.h>
 
@@ -144,6 +145,62 @@ out:
 	return entry;
 }
 
+/*
+ * Like get_swap_page(), but try the free slots from 'hint' on first.
+ * The hint comes from page_swap_hint() and keeps a process' pages
+ * together in swap.  It is only followed within one readahead cluster
+ * and only on a swap area of the highest priority in use, otherwise
+ * we fall back to the normal allocator.
+ */
+swp_entry_t get_swap_page_near(swp_entry_t hint)
+{
+	struct swap_info_struct * p;
+	unsigned long offset, end;
+	swp_entry_t entry;
+	int type = SWP_TYPE(hint);
+
+	entry.val = 0;
+	if (!hint.val || type >= nr_swapfiles)
+		return get_swap_page();
+
+	swap_list_lock();
+	p = &swap_info[type];
+	if (nr_swap_pages <= 0 || swap_list.head < 0 ||
+			(p->flags & SWP_WRITEOK) != SWP_WRITEOK ||
+			p->prio < swap_info[swap_list.head].prio)
+		goto out;
+
+	swap_device_lock(p);
+	offset = SWP_OFFSET(hint);
+	end = offset + (1 << page_cluster);
+	if (end > p->highest_bit + 1)
+		end = p->highest_bit + 1;
+	if (offset < p->lowest_bit)
+		offset = p->lowest_bit;
+	for (; offset < end; offset++) {
+		if (p->swap_map[offset])
+			continue;
+		if (offset == p->lowest_bit)
+			p->lowest_bit++;
+		if (offset == p->highest_bit)
+			p->highest_bit--;
+		if (p->lowest_bit > p->highest_bit) {
+			p->lowest_bit = p->max;
+			p->highest_bit = 0;
+		}
+		p->swap_map[offset] = 1;
+		nr_swap_pages--;
+		entry = SWP_ENTRY(type, offset);
+		break;
+	}
+	swap_device_unlock(p);
+out:
+	swap_list_unlock();
+	if (!entry.val)
+		entry = get_swap_page();
+	return entry;
+}
+
 static struct swap_info_struct * swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct * p;
@@ -362,8 +419,12 @@ void free_swap_and_cache(swp_entry_t entry)
  * what to do if a write is requested later.
  */
 /* mmlist_lock and vma->vm_mm->page_table_lock are held */
+/*
+ * A copy-on-write page table is shared by several mms and charged to
+ * none of them, its pages don't count towards anyone's rss.
+ */
 static inline void unuse_pte(struct vm_area_struct * vma, unsigned long address,
-	pte_t *dir, swp_entry_t entry, struct page* page)
+	pte_t *dir, swp_entry_t entry, struct page* page, int shared)
 {
 	pte_t pte = *dir;
 
@@ -375,7 +436,8 @@ static inline void unuse_pte(struct vm_area_struct * vma, unsigned long address,
 	set_pte(dir, pte_mkold(mk_pte(page, vma->vm_page_prot)));
 	page_add_rmap(page, dir);
 	swap_free(entry);
-	++vma->vm_mm->rss;
+	if (!shared)
+		++vma->vm_mm->rss;
 }
 
 /* mmlist_lock and vma->vm_mm->page_table_lock are held */
@@ -383,8 +445,10 @@ static inline void unuse_pmd(struct vm_area_struct * vma, pmd_t *dir,
 	unsigned long address, unsigned long size, unsigned long offset,
 	swp_entry_t entry, struct page* page)
 {
+	struct page * ptepage;
 	pte_t * pte;
 	unsigned long end;
+	int shared;
 
 	if (pmd_none(*dir))
 		return;
@@ -394,16 +458,22 @@ static inline void unuse_pmd(struct vm_area_struct * vma, pmd_t *dir,
 		return;
 	}
 	pte = pte_offset(dir, address);
+	ptepage = virt_to_page(pte);
+	shared = PagePtShared(ptepage);
+	if (shared)
+		pte_page_lock(ptepage);
 	offset += address & PMD_MASK;
 	address &= ~PMD_MASK;
 	end = address + size;
 	if (end > PMD_SIZE)
 		end = PMD_SIZE;
 	do {
-		unuse_pte(vma, offset+address-vma->vm_start, pte, entry, page);
+		unuse_pte(vma, offset+address-vma->vm_start, pte, entry, page, shared);
 		address += PAGE_SIZE;
 		pte++;
 	} while (address && (address < end));
+	if (shared)
+		pte_page_unlock(ptepage);
 }
 
 /* mmlist_lock and vma->vm_mm->page_table_lock are held */
@@ -463,6 +533,9 @@ static void unuse_process(struct mm_struct * mm,
 	spin_lock(&mm->page_table_lock);
 	for (vma = mm->mmap; vma; vma = vma->vm_next) {
 		pgd_t * pgd = pgd_offset(mm, vma->vm_start);
+
+		if (is_vm_hugetlb_page(vma))
+			continue;
 		unuse_vma(vma, pgd, entry, page);
 	}
 	spin_unlock(&mm->page_table_lock);
@@ -29,7 +29,7 @@
 #include <asm/pgalloc.h>
 
 static void refill_freelist(void);
-static void wakeup_memwaiters(void);
+static void refill_zone_freelist(zone_t *);
 /*
  * The "priority" of VM scanning is how much of the queues we
  * will scan in one go. A value of 6 for DEF_PRIORITY implies
@@ -48,6 +48,17 @@ static inline void age_page_down(struct page *page)
 	page->age -= min(PAGE_AGE_DECL, (int)page->age);
 }
 
+/*
+ * Account scanned pages to kswapd or to direct reclaim, for /proc/vmstat.
+ */
+static inline void count_zone_scan(zone_t * zone, int nr_scanned)
+{
+	if (current == zone->zone_pgdat->kswapd)
+		zone->pgscan_kswapd += nr_scanned;
+	else
+		zone->pgscan_direct += nr_scanned;
+}
+
 /* Must be called with page's pte_chain_lock held. */
 static inline int page_mapping_inuse(struct page * page)
 {
@@ -212,11 +223,11 @@ static inline int page_dirty(struct page *page)
  */
 int page_launder_zone(zone_t * zone, int gfp_mask, int full_flush)
 {
-	int maxscan, cleaned_pages, target, maxlaunder, iopages;
+	int maxscan, cleaned_pages, target, maxlaunder, iopages, scanned;
 	struct list_head * entry, * next;
 
 	target = free_plenty(zone);
-	cleaned_pages = iopages = 0;
+	cleaned_pages = iopages = scanned = 0;
 
 	/* If we can get away with it, only flush 2 MB worth of dirty pages */
 	if (full_flush)
@@ -247,6 +258,7 @@ rescan:
 		entry = next;
 		next = entry->prev;
 		page = list_entry(entry, struct page, lru);
+		scanned++;
 
 		/* This page was removed while we looked the other way. */
 		if (!PageInactiveDirty(page))
@@ -300,12 +312,14 @@ rescan:
 
 		/*
 		 * Anonymous process memory without backing store. Try to
-		 * allocate it some swap space here.
-		 *
-		 * XXX: implement swap clustering ?
+		 * allocate it some swap space here, next to the swap
+		 * space of its virtual neighbours.
 		 */
 		pte_chain_lock(page);
 		if (page->pte_chain && !page->mapping && !page->buffers) {
+			/* Left the page cache mapped, its ptes can't be found */
+			if (PageObjRmap(page))
+				goto page_active;
 			page_cache_get(page);
 			pte_chain_unlock(page);
 			spin_unlock(&pagemap_lru_lock);
@@ -465,6 +479,9 @@ page_active:
 	}
 	spin_unlock(&pagemap_lru_lock);
 
+	count_zone_scan(zone, scanned);
+	zone->pgsteal += cleaned_pages;
+
 	/* Return the number of pages moved to the inactive_clean list. */
 	return cleaned_pages;
 }
@@ -507,7 +524,7 @@ int refill_inactive_zone(struct zone_struct * zone, int priority)
 	int maxscan = zone->active_pages >> priority;
 	int target = inactive_high(zone);
 	struct list_head * page_lru;
-	int nr_deactivated = 0;
+	int nr_deactivated = 0, scanned = 0;
 	struct page * page;
 
 	/* Take the lock while messing with the list... */
@@ -515,6 +532,7 @@ int refill_inactive_zone(struct zone_struct * zone, int priority)
 	while (maxscan-- && !list_empty(&zone->active_list)) {
 		page_lru = zone->active_list.prev;
 		page = list_entry(page_lru, struct page, lru);
+		scanned++;
 
 		/* Wrong page on list?! (list corruption, should not happen) */
 		if (unlikely(!PageActive(page))) {
@@ -584,6 +602,7 @@ int refill_inactive_zone(struct zone_struct * zone, int priority)
 
 done:
 	spin_unlock(&pagemap_lru_lock);
+	count_zone_scan(zone, scanned);
 
 	return nr_deactivated;
 }
@@ -621,6 +640,7 @@ int refill_inactive(void)
 
 /**
  * background_aging - slow background aging of zones
+ * @pgdat: node whose zones to age
  * @priority: priority at which to scan
  *
  * When the VM load is low or nonexistant, this function is
@@ -629,19 +649,40 @@ int refill_inactive(void)
  * The effects of this function are very slow, the CPU usage
  * should be minimal to nonexistant under most loads.
  */
-static inline void background_aging(int priority)
+static inline void background_aging(pg_data_t * pgdat, int priority)
 {
-	struct zone_struct * zone;
+	int i;
 
-	for_each_zone(zone)
-		if (inactive_high(zone) > 0)
+	for (i = 0; i < pgdat->nr_zones; i++) {
+		zone_t * zone = pgdat->node_zones + i;
+
+		if (zone->size && inactive_high(zone) > 0)
 			refill_inactive_zone(zone, priority);
+	}
 }
 
 /*
- * Worker function for kswapd and try_to_free_pages, we get
- * called whenever there is a shortage of free/inactive_clean
- * pages.
+ * Shrink the dentry, inode, quota and slab caches.  These aren't
+ * per zone, so whoever is short on memory shrinks them for everybody.
+ */
+static int shrink_caches(unsigned int gfp_mask)
+{
+	int ret = 0;
+
+	ret += shrink_dcache_memory(DEF_PRIORITY, gfp_mask);
+	ret += shrink_icache_memory(1, gfp_mask);
+#ifdef CONFIG_QUOTA
+	ret += shrink_dqcache_memory(DEF_PRIORITY, gfp_mask);
+#endif
+	ret += kmem_cache_reap(gfp_mask);
+
+	return ret;
+}
+
+/*
+ * Worker function for try_to_free_pages, we get called whenever
+ * there is a shortage of free/inactive_clean pages and kswapd
+ * doesn't keep up.
  *
  * This function will also move pages to the inactive list,
  * if needed.
@@ -652,25 +693,17 @@ static int do_try_to_free_pages(unsigned int gfp_mask)
 
 	/*
 	 * Eat memory from filesystem page cache, buffer cache,
-	 * dentry, inode and filesystem quota caches.
+	 * dentry, inode and filesystem quota caches, and reclaim
+	 * unused slab cache memory.
 	 */
 	ret += page_launder(gfp_mask);
-	ret += shrink_dcache_memory(DEF_PRIORITY, gfp_mask);
-	ret += shrink_icache_memory(1, gfp_mask);
-#ifdef CONFIG_QUOTA
-	ret += shrink_dqcache_memory(DEF_PRIORITY, gfp_mask);
-#endif
+	ret += shrink_caches(gfp_mask);
 
 	/*
 	 * Move pages from the active list to the inactive list.
 	 */
 	refill_inactive();
 
-	/* 	
-	 * Reclaim unused slab cache memory.
-	 */
-	ret += kmem_cache_reap(gfp_mask);
-
 	refill_freelist();
 
 	/* Start IO when needed. */
@@ -687,6 +720,28 @@ static int do_try_to_free_pages(unsigned int gfp_mask)
 	return ret;
 }
 
+/**
+ * refill_zone_freelist - move inactive_clean pages to the free list
+ * @zone: zone to refill
+ *
+ * We refill the freelist in a bump from pages_min to pages_min * 2
+ * in order to give the buddy allocator something to play with.
+ */
+static void refill_zone_freelist(zone_t * zone)
+{
+	struct page * page;
+
+	if (!zone->size || zone->free_pages >= zone->pages_min)
+		return;
+
+	while (zone->free_pages < zone->pages_min * 2) {
+		page = reclaim_page(zone);
+		if (!page)
+			break;
+		__free_page(page);
+	}
+}
+
 /**
  * refill_freelist - move inactive_clean pages to free list if needed
  *
@@ -694,31 +749,133 @@ static int do_try_to_free_pages(unsigned int gfp_mask)
  * lists so atomic allocations have pages to work from. This
  * function really only does something when we don't have a 
  * userspace load on __alloc_pages().
- *
- * We refill the freelist in a bump from pages_min to pages_min * 2
- * in order to give the buddy allocator something to play with.
  */
 static void refill_freelist(void)
 {
-	struct page * page;
 	zone_t * zone;
 
-	for_each_zone(zone) {
-		if (!zone->size || zone->free_pages >= zone->pages_min)
-			continue;
+	for_each_zone(zone)
+		refill_zone_freelist(zone);
+}
+
+/*
+ * A zone is balanced once its free + inactive_clean pages are back
+ * above pages_high.  It needs kswapd when it has fallen below pages_low
+ * or an allocation has flagged it with need_balance.
+ */
+static inline int zone_balanced(zone_t * zone)
+{
+	return !zone->size || free_high(zone) <= 0;
+}
 
-		while (zone->free_pages < zone->pages_min * 2) {
-			page = reclaim_page(zone);
-			if (!page)
-				break;
-			__free_page(page);
+static int node_needs_balance(pg_data_t * pgdat)
+{
+	int i;
+
+	for (i = 0; i < pgdat->nr_zones; i++) {
+		zone_t * zone = pgdat->node_zones + i;
+
+		if (zone->size && (zone->need_balance || free_low(zone) > 0))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * kswapd's work for one node: reclaim until all zones of the node
+ * are balanced again.
+ *
+ * The zones are aged proportionally: every round scans the same
+ * fraction (1 / 2^priority) of the active list of each zone, so pages
+ * age at the same rate whatever the size of their zone, and a small
+ * zone under pressure doesn't lose its working set while a big one
+ * sits idle.  Only the zones which are short get laundered, and the
+ * priority goes up while some zone stays short.
+ */
+static int balance_node(pg_data_t * pgdat)
+{
+	int priority, i, nr_short, shrunk = 0, freed = 0;
+	zone_t * zone;
+
+	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
+		nr_short = 0;
+		for (i = 0; i < pgdat->nr_zones; i++) {
+			zone = pgdat->node_zones + i;
+			if (!zone->size)
+				continue;
+			refill_inactive_zone(zone, priority);
+			if (zone_balanced(zone))
+				continue;
+			nr_short++;
+			freed += page_launder_zone(zone, GFP_KSWAPD, !priority);
+			refill_zone_freelist(zone);
 		}
+		if (!nr_short)
+			break;
+
+		/* Page cache alone didn't do it, try the other caches. */
+		if (!shrunk) {
+			freed += shrink_caches(GFP_KSWAPD);
+			shrunk = 1;
+		}
+		run_task_queue(&tq_disk);
+
+		/* Low latency reschedule point */
+		if (current->need_resched)
+			schedule();
 	}
+
+	for (i = 0; i < pgdat->nr_zones; i++) {
+		zone = pgdat->node_zones + i;
+		if (zone_balanced(zone))
+			zone->need_balance = 0;
+	}
+
+	/*
+	 * Hmm.. Cache shrink failed - time to kill something?
+	 */
+	if (!freed && free_min(ANY_ZONE) > 0)
+		out_of_memory();
+
+	return freed;
 }
 
+static int kswapd_overloaded;
+unsigned int kswapd_minfree; /* initialized in mm/page_alloc.c */
+DECLARE_WAIT_QUEUE_HEAD(kswapd_done);
+
 /*
- * The background pageout daemon, started as a kernel thread
- * from the init process. 
+ * Sleep until a zone of the node falls below its low watermark, or
+ * for a second to do background aging.  If we couldn't balance the
+ * node the VM is very loaded, back off a bit instead of using all CPU.
+ */
+static void kswapd_sleep(pg_data_t * pgdat)
+{
+	DECLARE_WAITQUEUE(wait, current);
+
+	add_wait_queue(&pgdat->kswapd_wait, &wait);
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	/* Don't let the processes waiting on memory get stuck, ever. */
+	wake_up(&kswapd_done);
+
+	if (!node_needs_balance(pgdat)) {
+		schedule_timeout(HZ);
+		remove_wait_queue(&pgdat->kswapd_wait, &wait);
+		return;
+	}
+	remove_wait_queue(&pgdat->kswapd_wait, &wait);
+
+	kswapd_overloaded = 1;
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_timeout(HZ / 4);
+	kswapd_overloaded = 0;
+	wmb();
+}
+
+/*
+ * The background pageout daemon, one per node, started as a kernel
+ * thread from the init process.
  *
  * This basically trickles out pages so that we have _some_
  * free memory available even if there is no other activity
@@ -726,16 +883,20 @@ static void refill_freelist(void)
  * etc, where we otherwise might have all activity going on in
  * asynchronous contexts that cannot page things out.
  *
- * If there are applications that are active memory-allocators
- * (most normal use), this basically shouldn't matter.
+ * kswapd is woken when a zone of its node falls below pages_low and
+ * reclaims until all zones of the node are above pages_high, so that
+ * allocators normally never have to reclaim pages themselves.
  */
-int kswapd(void *unused)
+int kswapd(void *data)
 {
+	pg_data_t *pgdat = (pg_data_t *) data;
 	struct task_struct *tsk = current;
+	unsigned long recalc = 0, recalc_inode = 0;
 
 	daemonize();
-	strcpy(tsk->comm, "kswapd");
+	sprintf(tsk->comm, "kswapd%d", pgdat->node_id);
 	sigfillset(&tsk->blocked);
+	pgdat->kswapd = tsk;
 	
 	/*
 	 * Tell the memory management that we're a "memory allocator",
@@ -755,32 +916,28 @@ int kswapd(void *unused)
 	 * Kswapd main loop.
 	 */
 	for (;;) {
-		static long recalc = 0;
-		static long recalc_inode = 0;
+		int i;
 
 		if (current->flags & PF_FREEZE)
 			refrigerator(PF_IOTHREAD);
 
-		/*
-		 * We try to rebalance the VM either when we have a
-		 * global shortage of free pages or when one particular
-		 * zone is very short on free pages.
-		 */
-		if (free_high(ALL_ZONES) >= 0 || free_low(ANY_ZONE) > 0)
-			do_try_to_free_pages(GFP_KSWAPD);
+		if (node_needs_balance(pgdat))
+			balance_node(pgdat);
 
-		refill_freelist();
+		for (i = 0; i < pgdat->nr_zones; i++)
+			refill_zone_freelist(pgdat->node_zones + i);
 
 		/* Once a second ... */
 		if (time_after(jiffies, recalc + HZ)) {
 			recalc = jiffies;
 
 			/* Do background page aging. */
-			background_aging(DEF_PRIORITY);
+			background_aging(pgdat, DEF_PRIORITY);
 		}
 
-		/* Once every 5 minutes ... */
-		if (time_after(jiffies, recalc_inode + 300*HZ)) {
+		/* Once every 5 minutes, the caches are shared by all nodes ... */
+		if (pgdat == pgdat_list &&
+				time_after(jiffies, recalc_inode + 300*HZ)) {
 			recalc_inode = jiffies;
 			shrink_dcache_memory(6, GFP_KERNEL);
 			shrink_icache_memory(6, GFP_KERNEL);
@@ -789,21 +946,42 @@ int kswapd(void *unused)
 #endif
 		}
 
-		wakeup_memwaiters();
+		kswapd_sleep(pgdat);
 	}
 }
 
-static int kswapd_overloaded;
-unsigned int kswapd_minfree; /* initialized in mm/page_alloc.c */
-DECLARE_WAIT_QUEUE_HEAD(kswapd_wait);
-DECLARE_WAIT_QUEUE_HEAD(kswapd_done);
+/**
+ * wakeup_zone_kswapd - start background reclaim for a zone
+ * @zone: zone which fell below its low watermark
+ *
+ * Flags the zone and wakes the kswapd of its node, which then keeps
+ * reclaiming until the zone is above its high watermark.
+ */
+void wakeup_zone_kswapd(zone_t * zone)
+{
+	if (zone->need_balance)
+		return;
+	zone->need_balance = 1;
+	zone->kswapd_wake++;
+	wake_up_interruptible(&zone->zone_pgdat->kswapd_wait);
+}
+
+static void wakeup_low_zones(void)
+{
+	zone_t * zone;
+
+	for_each_zone(zone)
+		if (zone->size && free_low(zone) > 0)
+			wakeup_zone_kswapd(zone);
+}
 
 /**
- * wakeup_kswapd - wake up the pageout daemon
+ * wakeup_kswapd - wake up the pageout daemons
  * gfp_mask: page freeing flags
  *
- * This function wakes up kswapd and can, under heavy VM pressure,
- * put the calling task to sleep temporarily.
+ * This function wakes up the kswapds of all zones below their low
+ * watermark and can, under heavy VM pressure, put the calling task
+ * to sleep temporarily.
  */
 void wakeup_kswapd(unsigned int gfp_mask)
 {
@@ -813,7 +991,7 @@ void wakeup_kswapd(unsigned int gfp_mask)
 	 * but just wake kswapd and go back to businesss.
 	 */
 	if (current->flags & PF_MEMALLOC) {
-		wake_up_interruptible(&kswapd_wait);
+		wakeup_low_zones();
 		return;
 	}
 
@@ -821,7 +999,7 @@ void wakeup_kswapd(unsigned int gfp_mask)
 	 * We still wake kswapd of course.
 	 */
 	if ((gfp_mask & GFP_KSWAPD) != GFP_KSWAPD) {
-		wake_up_interruptible(&kswapd_wait);
+		wakeup_low_zones();
 		return;
 	}
 	
@@ -829,7 +1007,7 @@ void wakeup_kswapd(unsigned int gfp_mask)
         set_current_state(TASK_UNINTERRUPTIBLE);
         
         /* Wake kswapd .... */
-        wake_up_interruptible(&kswapd_wait);
+        wakeup_low_zones();
         
         /* ... and check if we need to wait on it */
 	if ((free_low(ALL_ZONES) > (kswapd_minfree / 2)) && !kswapd_overloaded)
@@ -838,33 +1016,6 @@ void wakeup_kswapd(unsigned int gfp_mask)
 	remove_wait_queue(&kswapd_done, &wait);
 }
 
-static void wakeup_memwaiters(void)
-{
-	DECLARE_WAITQUEUE(wait, current);
-	        
-	add_wait_queue(&kswapd_wait, &wait);
-	set_current_state(TASK_INTERRUPTIBLE);
-
-	/* Don't let the processes waiting on memory get stuck, ever. */
-	wake_up(&kswapd_done);
-
-	/* Enough free RAM, we can easily keep up with memory demand. */
-	if (free_high(ALL_ZONES) <= 0) {
-		schedule_timeout(HZ);
-		remove_wait_queue(&kswapd_wait, &wait);
-		return;
-	}
-	remove_wait_queue(&kswapd_wait, &wait);
-
-	/* OK, the VM is very loaded. Sleep instead of using all CPU. */
-	kswapd_overloaded = 1;
-	set_current_state(TASK_UNINTERRUPTIBLE);
-	schedule_timeout(HZ / 4);
-	kswapd_overloaded = 0;
-	wmb();
-	return;
-}
-
 /**
  * try_to_free_pages - run the pageout code ourselves
  * gfp_mask: mask of things the pageout code is allowed to do
@@ -923,11 +1074,42 @@ void rss_free_pages(unsigned int gfp_mask)
 	return;
 }
 
+/*
+ * /proc/vmstat: the reclaim statistics of each zone type, summed
+ * over all nodes.
+ */
+int get_vmstat_info(char * buf)
+{
+	pg_data_t * pgdat;
+	int i, len = 0;
+
+#define VMSTAT_ZONES(field)						\
+	for (i = 0; i < MAX_NR_ZONES; i++) {				\
+		unsigned long sum = 0;					\
+		for_each_pgdat(pgdat)					\
+			sum += pgdat->node_zones[i].field;		\
+		len += sprintf(buf + len, #field "_%s %lu\n",		\
+				pgdat_list->node_zones[i].name, sum);	\
+	}
+
+	VMSTAT_ZONES(pgscan_kswapd)
+	VMSTAT_ZONES(pgscan_direct)
+	VMSTAT_ZONES(pgsteal)
+	VMSTAT_ZONES(allocstall)
+	VMSTAT_ZONES(kswapd_wake)
+#undef VMSTAT_ZONES
+
+	return len;
+}
+
 static int __init kswapd_init(void)
 {
+	pg_data_t * pgdat;
+
 	printk("Starting kswapd\n");
 	swap_setup();
-	kernel_thread(kswapd, NULL, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
+	for_each_pgdat(pgdat)
+		kernel_thread(kswapd, pgdat, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
 	return 0;
 }
 
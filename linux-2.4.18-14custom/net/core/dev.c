@@ -2810,6 +2810,7 @@ int __init net_dev_init(void)
 
 	dst_init();
 	dev_mcast_init();
+	dev_sysctl_init();
 
 #ifdef CONFIG_NET_SCHED
 	pktsched_init();
@@ -8,6 +8,10 @@
 #include <linux/mm.h>
 #include <linux/sysctl.h>
 #include <linux/config.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/netdevice.h>
+#include <linux/notifier.h>
 
 #ifdef CONFIG_SYSCTL
 
@@ -91,4 +95,109 @@ ctl_table core_table[] = {
 #endif /* CONFIG_NET */
 	{ 0 }
 };
+
+#ifdef CONFIG_NET
+/*
+ *	/proc/sys/net/core/dev/<ifname>/weight: the poll weight of every
+ *	device doing its receive work through dev->poll. dev_weight only
+ *	covers the non-polling devices (the per-cpu backlog).
+ */
+
+static int dev_weight_min = 1;
+
+static struct dev_sysctl_table
+{
+	struct ctl_table_header *sysctl_header;
+	ctl_table dev_vars[2];
+	ctl_table dev_dev[2];
+	ctl_table dev_dir[2];
+	ctl_table dev_core_dir[2];
+	ctl_table dev_root_dir[2];
+} dev_sysctl = {
+	NULL,
+	{{NET_CORE_DEV_POLL_WEIGHT, "weight",
+	  NULL, sizeof(int), 0644, NULL,
+	  &proc_dointvec_minmax, &sysctl_intvec, NULL,
+	  &dev_weight_min, NULL},
+	 {0}},
+	{{0, "default", NULL, 0, 0555, dev_sysctl.dev_vars},{0}},
+	{{NET_CORE_DEV, "dev", NULL, 0, 0555, dev_sysctl.dev_dev},{0}},
+	{{NET_CORE, "core", NULL, 0, 0555, dev_sysctl.dev_dir},{0}},
+	{{CTL_NET, "net", NULL, 0, 0555, dev_sysctl.dev_core_dir},{0}}
+};
+
+static void dev_sysctl_register(struct net_device *dev)
+{
+	struct dev_sysctl_table *t;
+
+	if (dev->poll == NULL || dev->weight_sysctl)
+		return;
+
+	t = kmalloc(sizeof(*t), GFP_KERNEL);
+	if (t == NULL)
+		return;
+	memcpy(t, &dev_sysctl, sizeof(*t));
+	t->dev_vars[0].data = &dev->weight;
+	t->dev_vars[0].de = NULL;
+	t->dev_dev[0].procname = dev->name;
+	t->dev_dev[0].ctl_name = dev->ifindex;
+	t->dev_dev[0].child = t->dev_vars;
+	t->dev_dev[0].de = NULL;
+	t->dev_dir[0].child = t->dev_dev;
+	t->dev_dir[0].de = NULL;
+	t->dev_core_dir[0].child = t->dev_dir;
+	t->dev_core_dir[0].de = NULL;
+	t->dev_root_dir[0].child = t->dev_core_dir;
+	t->dev_root_dir[0].de = NULL;
+
+	t->sysctl_header = register_sysctl_table(t->dev_root_dir, 0);
+	if (t->sysctl_header == NULL)
+		kfree(t);
+	else
+		dev->weight_sysctl = t;
+}
+
+static void dev_sysctl_unregister(struct net_device *dev)
+{
+	if (dev->weight_sysctl) {
+		struct dev_sysctl_table *t = dev->weight_sysctl;
+		dev->weight_sysctl = NULL;
+		unregister_sysctl_table(t->sysctl_header);
+		kfree(t);
+	}
+}
+
+static int dev_sysctl_event(struct notifier_block *this, unsigned long event,
+			    void *ptr)
+{
+	struct net_device *dev = ptr;
+
+	switch (event) {
+	case NETDEV_REGISTER:
+		dev_sysctl_register(dev);
+		break;
+	case NETDEV_UNREGISTER:
+		dev_sysctl_unregister(dev);
+		break;
+	case NETDEV_CHANGENAME:
+		dev_sysctl_unregister(dev);
+		dev_sysctl_register(dev);
+		break;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block dev_sysctl_notifier = {
+	notifier_call:	dev_sysctl_event,
+};
+
+void __init dev_sysctl_init(void)
+{
+	register_netdevice_notifier(&dev_sysctl_notifier);
+}
+#else
+void __init dev_sysctl_init(void)
+{
+}
+#endif /* CONFIG_NET */
 #endif
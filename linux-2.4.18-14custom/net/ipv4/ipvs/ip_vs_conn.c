@@ -52,6 +52,25 @@
  */
 static struct list_head *ip_vs_conn_tab;
 
+/*
+ *  Size of the connection hash table, set at load time by the
+ *  conn_tab_bits parameter and changed at runtime through the
+ *  conn_tab_bits sysctl
+ */
+static int conn_tab_bits = IP_VS_CONN_TAB_BITS;
+MODULE_PARM(conn_tab_bits, "i");
+MODULE_PARM_DESC(conn_tab_bits, "log2 of the connection hash table size");
+
+int ip_vs_conn_tab_bits;
+int ip_vs_conn_tab_size;
+static unsigned ip_vs_conn_tab_mask;
+
+/*
+ *  Held for reading by the walkers of the whole table, so that
+ *  ip_vs_conn_tab_resize() can't swap the table under them
+ */
+static rwlock_t ip_vs_conn_tab_lock = RW_LOCK_UNLOCKED;
+
 /*  SLAB cache for IPVS connections */
 static kmem_cache_t *ip_vs_conn_cachep;
 
@@ -122,15 +141,24 @@ static inline void ct_write_unlock_bh(unsigned key)
 
 
 /*
- *	Returns hash value for IPVS connection entry
+ *	Returns hash value for IPVS connection entry. The value is not
+ *	reduced to the table size: the bucket is ip_vs_conn_bucket() of
+ *	it, looked up with the lock of the hash value held. As the table
+ *	is never smaller than the lock array, a connection keeps its lock
+ *	across a resize.
  */
 static inline unsigned
 ip_vs_conn_hashkey(unsigned proto, __u32 addr, __u16 port)
 {
 	unsigned addrh = ntohl(addr);
 
-	return (proto^addrh^(addrh>>IP_VS_CONN_TAB_BITS)^ntohs(port))
-		& IP_VS_CONN_TAB_MASK;
+	return proto^addrh^(addrh>>IP_VS_CONN_TAB_MIN_BITS)^
+		(addrh>>IP_VS_CONN_TAB_MAX_BITS)^ntohs(port);
+}
+
+static inline struct list_head *ip_vs_conn_bucket(unsigned hash)
+{
+	return &ip_vs_conn_tab[hash & ip_vs_conn_tab_mask];
 }
 
 
@@ -153,7 +181,7 @@ static int ip_vs_conn_hash(struct ip_vs_conn *cp)
 
 	ct_write_lock(hash);
 
-	list_add(&cp->c_list, &ip_vs_conn_tab[hash]);
+	list_add(&cp->c_list, ip_vs_conn_bucket(hash));
 	cp->flags |= IP_VS_CONN_F_HASHED;
 	atomic_inc(&cp->refcnt);
 
@@ -205,10 +233,11 @@ static inline struct ip_vs_conn *__ip_vs_conn_in_get
 	struct list_head *l,*e;
 
 	hash = ip_vs_conn_hashkey(protocol, s_addr, s_port);
-	l = &ip_vs_conn_tab[hash];
 
 	ct_read_lock(hash);
 
+	l = ip_vs_conn_bucket(hash);
+
 	for (e=l->next; e!=l; e=e->next) {
 		cp = list_entry(e, struct ip_vs_conn, c_list);
 		if (s_addr==cp->caddr && s_port==cp->cport &&
@@ -262,10 +291,11 @@ struct ip_vs_conn *ip_vs_conn_out_get
 	 *	Check for "full" addressed entries
 	 */
 	hash = ip_vs_conn_hashkey(protocol, d_addr, d_port);
-	l = &ip_vs_conn_tab[hash];
 
 	ct_read_lock(hash);
 
+	l = ip_vs_conn_bucket(hash);
+
 	for (e=l->next; e!=l; e=e->next) {
 		cp = list_entry(e, struct ip_vs_conn, c_list);
 		if (d_addr == cp->caddr && d_port == cp->cport &&
@@ -1327,7 +1357,8 @@ ip_vs_conn_getinfo(char *buffer, char **start, off_t offset, int length)
 			       "Pro FromIP   FPrt ToIP     TPrt DestIP   DPrt State       Expires");
 	}
 
-	for(idx = 0; idx < IP_VS_CONN_TAB_SIZE; idx++) {
+	read_lock_bh(&ip_vs_conn_tab_lock);
+	for(idx = 0; idx < ip_vs_conn_tab_size; idx++) {
 		/*
 		 *	Lock is actually only need in next loop
 		 *	we are called from uspace: must stop bh.
@@ -1358,6 +1389,7 @@ ip_vs_conn_getinfo(char *buffer, char **start, off_t offset, int length)
 	}
 
   done:
+	read_unlock_bh(&ip_vs_conn_tab_lock);
 	*start = buffer+len-(pos-offset);       /* Start of wanted data */
 	len = pos-offset;
 	if (len > length)
@@ -1410,8 +1442,9 @@ void ip_vs_random_dropentry(void)
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
-	for (idx=0; idx<(IP_VS_CONN_TAB_SIZE>>5); idx++) {
-		unsigned hash = net_random()&IP_VS_CONN_TAB_MASK;
+	read_lock(&ip_vs_conn_tab_lock);
+	for (idx=0; idx<(ip_vs_conn_tab_size>>5); idx++) {
+		unsigned hash = net_random()&ip_vs_conn_tab_mask;
 
 		/*
 		 *  Lock is actually needed in this loop.
@@ -1457,6 +1490,7 @@ void ip_vs_random_dropentry(void)
 		}
 		ct_write_unlock(hash);
 	}
+	read_unlock(&ip_vs_conn_tab_lock);
 }
 
 
@@ -1471,7 +1505,8 @@ static void ip_vs_conn_flush(void)
 	struct ip_vs_conn *ct;
 
   flush_again:
-	for (idx=0; idx<IP_VS_CONN_TAB_SIZE; idx++) {
+	read_lock_bh(&ip_vs_conn_tab_lock);
+	for (idx=0; idx<ip_vs_conn_tab_size; idx++) {
 		/*
 		 *  Lock is actually needed in this loop.
 		 */
@@ -1495,6 +1530,7 @@ static void ip_vs_conn_flush(void)
 		}
 		ct_write_unlock_bh(idx);
 	}
+	read_unlock_bh(&ip_vs_conn_tab_lock);
 
 	/* the counter may be not NULL, because maybe some conn entries
 	   are run by slow timer handler or unhashed but still referred */
@@ -1505,14 +1541,82 @@ static void ip_vs_conn_flush(void)
 }
 
 
+/*
+ *      Rehash all the connection entries into a table of 2^bits buckets
+ */
+int ip_vs_conn_tab_resize(int bits)
+{
+	struct list_head *tab, *old_tab, *l;
+	struct ip_vs_conn *cp;
+	int idx, size, old_size;
+	unsigned hash;
+
+	if (bits < IP_VS_CONN_TAB_MIN_BITS || bits > IP_VS_CONN_TAB_MAX_BITS)
+		return -EINVAL;
+	if (!ip_vs_conn_tab)
+		return -ENOENT;
+
+	size = 1 << bits;
+	tab = vmalloc(size*sizeof(struct list_head));
+	if (!tab)
+		return -ENOMEM;
+	for (idx = 0; idx < size; idx++)
+		INIT_LIST_HEAD(&tab[idx]);
+
+	/*
+	 *  Stop the table walkers and every lookup while moving the
+	 *  entries, taking the lock array in order.
+	 */
+	write_lock_bh(&ip_vs_conn_tab_lock);
+	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)
+		ct_write_lock(idx);
+
+	old_tab = ip_vs_conn_tab;
+	old_size = ip_vs_conn_tab_size;
+	for (idx = 0; idx < old_size; idx++) {
+		l = &old_tab[idx];
+		while (!list_empty(l)) {
+			cp = list_entry(l->next, struct ip_vs_conn, c_list);
+			list_del(&cp->c_list);
+			hash = ip_vs_conn_hashkey(cp->protocol,
+						  cp->caddr, cp->cport);
+			list_add_tail(&cp->c_list, &tab[hash & (size-1)]);
+		}
+	}
+	ip_vs_conn_tab = tab;
+	ip_vs_conn_tab_bits = bits;
+	ip_vs_conn_tab_size = size;
+	ip_vs_conn_tab_mask = size - 1;
+
+	for (idx = CT_LOCKARRAY_SIZE-1; idx >= 0; idx--)
+		ct_write_unlock(idx);
+	write_unlock_bh(&ip_vs_conn_tab_lock);
+
+	vfree(old_tab);
+
+	IP_VS_INFO("Connection hash table resized "
+		   "(size=%d, memory=%ldKbytes)\n", size,
+		   (long)(size*sizeof(struct list_head))/1024);
+	return 0;
+}
+
+
 int ip_vs_conn_init(void)
 {
 	int idx;
 
+	if (conn_tab_bits < IP_VS_CONN_TAB_MIN_BITS)
+		conn_tab_bits = IP_VS_CONN_TAB_MIN_BITS;
+	if (conn_tab_bits > IP_VS_CONN_TAB_MAX_BITS)
+		conn_tab_bits = IP_VS_CONN_TAB_MAX_BITS;
+	ip_vs_conn_tab_bits = conn_tab_bits;
+	ip_vs_conn_tab_size = 1 << conn_tab_bits;
+	ip_vs_conn_tab_mask = ip_vs_conn_tab_size - 1;
+
 	/*
 	 * Allocate the connection hash table and initialize its list heads
 	 */
-	ip_vs_conn_tab = vmalloc(IP_VS_CONN_TAB_SIZE*sizeof(struct list_head));
+	ip_vs_conn_tab = vmalloc(ip_vs_conn_tab_size*sizeof(struct list_head));
 	if (!ip_vs_conn_tab)
 		return -ENOMEM;
 
@@ -1522,17 +1626,18 @@ int ip_vs_conn_init(void)
 					      SLAB_HWCACHE_ALIGN, NULL, NULL);
 	if (!ip_vs_conn_cachep) {
 		vfree(ip_vs_conn_tab);
+		ip_vs_conn_tab = NULL;
 		return -ENOMEM;
 	}
 
 	IP_VS_INFO("Connection hash table configured "
 		   "(size=%d, memory=%ldKbytes)\n",
-		   IP_VS_CONN_TAB_SIZE,
-		   (long)(IP_VS_CONN_TAB_SIZE*sizeof(struct list_head))/1024);
+		   ip_vs_conn_tab_size,
+		   (long)(ip_vs_conn_tab_size*sizeof(struct list_head))/1024);
 	IP_VS_DBG(0, "Each connection entry needs %d bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < IP_VS_CONN_TAB_SIZE; idx++) {
+	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
 		INIT_LIST_HEAD(&ip_vs_conn_tab[idx]);
 	}
 
@@ -1554,4 +1659,5 @@ void ip_vs_conn_cleanup(void)
 	kmem_cache_destroy(ip_vs_conn_cachep);
 	proc_net_remove("ip_vs_conn");
 	vfree(ip_vs_conn_tab);
+	ip_vs_conn_tab = NULL;
 }
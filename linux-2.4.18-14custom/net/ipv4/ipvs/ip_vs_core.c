@@ -88,20 +88,19 @@ ip_vs_in_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest = cp->dest;
 	if (dest && (dest->flags & IP_VS_DEST_F_AVAILABLE)) {
-		spin_lock(&dest->stats.lock);
-		dest->stats.inpkts++;
-		dest->stats.inbytes += skb->len;
-		spin_unlock(&dest->stats.lock);
-
-		spin_lock(&dest->svc->stats.lock);
-		dest->svc->stats.inpkts++;
-		dest->svc->stats.inbytes += skb->len;
-		spin_unlock(&dest->svc->stats.lock);
-
-		spin_lock(&ip_vs_stats.lock);
-		ip_vs_stats.inpkts++;
-		ip_vs_stats.inbytes += skb->len;
-		spin_unlock(&ip_vs_stats.lock);
+		struct ip_vs_cpu_stats *s;
+
+		s = ip_vs_cpu_stats(&dest->stats);
+		s->inpkts++;
+		s->inbytes += skb->len;
+
+		s = ip_vs_cpu_stats(&dest->svc->stats);
+		s->inpkts++;
+		s->inbytes += skb->len;
+
+		s = ip_vs_cpu_stats(&ip_vs_stats);
+		s->inpkts++;
+		s->inbytes += skb->len;
 	}
 }
 
@@ -111,20 +110,19 @@ ip_vs_out_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest = cp->dest;
 	if (dest && (dest->flags & IP_VS_DEST_F_AVAILABLE)) {
-		spin_lock(&dest->stats.lock);
-		dest->stats.outpkts++;
-		dest->stats.outbytes += skb->len;
-		spin_unlock(&dest->stats.lock);
-
-		spin_lock(&dest->svc->stats.lock);
-		dest->svc->stats.outpkts++;
-		dest->svc->stats.outbytes += skb->len;
-		spin_unlock(&dest->svc->stats.lock);
-
-		spin_lock(&ip_vs_stats.lock);
-		ip_vs_stats.outpkts++;
-		ip_vs_stats.outbytes += skb->len;
-		spin_unlock(&ip_vs_stats.lock);
+		struct ip_vs_cpu_stats *s;
+
+		s = ip_vs_cpu_stats(&dest->stats);
+		s->outpkts++;
+		s->outbytes += skb->len;
+
+		s = ip_vs_cpu_stats(&dest->svc->stats);
+		s->outpkts++;
+		s->outbytes += skb->len;
+
+		s = ip_vs_cpu_stats(&ip_vs_stats);
+		s->outpkts++;
+		s->outbytes += skb->len;
 	}
 }
 
@@ -132,17 +130,9 @@ ip_vs_out_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 static inline void
 ip_vs_conn_stats(struct ip_vs_conn *cp, struct ip_vs_service *svc)
 {
-	spin_lock(&cp->dest->stats.lock);
-	cp->dest->stats.conns++;
-	spin_unlock(&cp->dest->stats.lock);
-
-	spin_lock(&svc->stats.lock);
-	svc->stats.conns++;
-	spin_unlock(&svc->stats.lock);
-
-	spin_lock(&ip_vs_stats.lock);
-	ip_vs_stats.conns++;
-	spin_unlock(&ip_vs_stats.lock);
+	ip_vs_cpu_stats(&cp->dest->stats)->conns++;
+	ip_vs_cpu_stats(&svc->stats)->conns++;
+	ip_vs_cpu_stats(&ip_vs_stats)->conns++;
 }
 
 /*
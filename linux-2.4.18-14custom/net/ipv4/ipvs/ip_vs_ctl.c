@@ -1265,6 +1265,7 @@ __ip_vs_zero_stats(struct ip_vs_stats *stats)
 {
 	spin_lock_bh(&stats->lock);
 	memset(stats, 0, (char *)&stats->lock - (char *)stats);
+	ip_vs_rebase_stats(stats);
 	spin_unlock_bh(&stats->lock);
 	ip_vs_zero_estimator(stats);
 }
@@ -1331,6 +1332,37 @@ static int ip_vs_sysctl_defense_mode(ctl_table *ctl, int write,
 }
 
 
+static int ip_vs_sysctl_conn_tab_bits(ctl_table *ctl, int write,
+	struct file * filp, void *buffer, size_t *lenp)
+{
+	int bits = ip_vs_conn_tab_bits;
+	ctl_table tmp = *ctl;
+	int ret;
+
+	tmp.data = &bits;
+	ret = proc_dointvec(&tmp, write, filp, buffer, lenp);
+	if (write && ret == 0 && bits != ip_vs_conn_tab_bits)
+		ret = ip_vs_conn_tab_resize(bits);
+	return ret;
+}
+
+static int ip_vs_sysctl_conn_tab_bits_strategy(ctl_table *table, int *name,
+	int nlen, void *oldval, size_t *oldlenp, void *newval, size_t newlen,
+	void **context)
+{
+	int bits, ret;
+
+	if (!newval || !newlen)
+		return 0;
+	if (newlen != sizeof(int))
+		return -EINVAL;
+	if (get_user(bits, (int *)newval))
+		return -EFAULT;
+	ret = ip_vs_conn_tab_resize(bits);
+	return ret ? ret : 1;
+}
+
+
 /*
  *      IPVS sysctl table
  */
@@ -1413,6 +1445,9 @@ static struct ip_vs_sysctl_table ipv4_vs_table = {
 	 {NET_IPV4_VS_NAT_ICMP_SEND, "nat_icmp_send",
 	  &sysctl_ip_vs_nat_icmp_send, sizeof(int), 0644, NULL,
 	  &proc_dointvec},
+	 {NET_IPV4_VS_CONN_TAB_BITS, "conn_tab_bits",
+	  &ip_vs_conn_tab_bits, sizeof(int), 0644, NULL,
+	  &ip_vs_sysctl_conn_tab_bits, &ip_vs_sysctl_conn_tab_bits_strategy},
 	 {0}},
 	{{NET_IPV4_VS, "vs", NULL, 0, 0555, ipv4_vs_table.vs_vars},
 	 {0}},
@@ -1466,7 +1501,7 @@ static int ip_vs_get_info(char *buf, char **start, off_t offset, int length)
 	if (pos > offset) {
 		sprintf(temp,
 			"IP Virtual Server version %d.%d.%d (size=%d)",
-			NVERSION(IP_VS_VERSION_CODE), IP_VS_CONN_TAB_SIZE);
+			NVERSION(IP_VS_VERSION_CODE), ip_vs_conn_tab_size);
 		len += sprintf(buf+len, "%-63s\n", temp);
 		len += sprintf(buf+len, "%-63s\n",
 			       "Prot LocalAddress:Port Scheduler Flags");
@@ -1594,6 +1629,7 @@ ip_vs_stats_get_info(char *buf, char **start, off_t offset, int length)
 			       "   Conns  Packets  Packets            Bytes            Bytes");
 
 		spin_lock_bh(&ip_vs_stats.lock);
+		ip_vs_fold_stats(&ip_vs_stats);
 		sprintf(temp, "%8X %8X %8X %8X%08X %8X%08X",
 			ip_vs_stats.conns,
 			ip_vs_stats.inpkts,
@@ -1787,6 +1823,7 @@ static inline void
 __ip_vs_copy_stats(struct ip_vs_stats_user *dst, struct ip_vs_stats *src)
 {
 	spin_lock_bh(&src->lock);
+	ip_vs_fold_stats(src);
 	memcpy(dst, src, (char*)&src->lock - (char*)src);
 	spin_unlock_bh(&src->lock);
 }
@@ -1920,7 +1957,7 @@ do_ip_vs_get_ctl(struct sock *sk, int cmd, void *user, int *len)
 		char buf[64];
 
 		sprintf(buf, "IP Virtual Server version %d.%d.%d (size=%d)",
-			NVERSION(IP_VS_VERSION_CODE), IP_VS_CONN_TAB_SIZE);
+			NVERSION(IP_VS_VERSION_CODE), ip_vs_conn_tab_size);
 		if (*len < strlen(buf)+1)
 			return -EINVAL;
 		if (copy_to_user(user, buf, strlen(buf)+1) != 0)
@@ -1933,7 +1970,7 @@ do_ip_vs_get_ctl(struct sock *sk, int cmd, void *user, int *len)
 	{
 		struct ip_vs_getinfo info;
 		info.version = IP_VS_VERSION_CODE;
-		info.size = IP_VS_CONN_TAB_SIZE;
+		info.size = ip_vs_conn_tab_size;
 		info.num_services = ip_vs_num_services;
 		if (copy_to_user(user, &info, sizeof(info)) != 0)
 			return -EFAULT;
@@ -15,6 +15,7 @@
  */
 #include <linux/kernel.h>
 #include <linux/types.h>
+#include <linux/sched.h>
 
 #include <net/ip_vs.h>
 
@@ -65,6 +66,48 @@ static struct ip_vs_estimator *est_list = NULL;
 static rwlock_t est_lock = RW_LOCK_UNLOCKED;
 static struct timer_list est_timer;
 
+
+/*
+ *	The packet path only bumps its own cpu's counters in
+ *	stats->cpustats; the totals are their sum minus stats->base,
+ *	the sum at the time the counters were last zeroed.
+ */
+static void
+ip_vs_sum_cpu_stats(struct ip_vs_stats *stats, struct ip_vs_cpu_stats *sum)
+{
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < smp_num_cpus; i++) {
+		struct ip_vs_cpu_stats *s = &stats->cpustats[cpu_logical_map(i)];
+
+		sum->conns += s->conns;
+		sum->inpkts += s->inpkts;
+		sum->outpkts += s->outpkts;
+		sum->inbytes += s->inbytes;
+		sum->outbytes += s->outbytes;
+	}
+}
+
+/* Update the totals of stats, called with stats->lock held */
+void ip_vs_fold_stats(struct ip_vs_stats *stats)
+{
+	struct ip_vs_cpu_stats sum;
+
+	ip_vs_sum_cpu_stats(stats, &sum);
+	stats->conns = sum.conns - stats->base.conns;
+	stats->inpkts = sum.inpkts - stats->base.inpkts;
+	stats->outpkts = sum.outpkts - stats->base.outpkts;
+	stats->inbytes = sum.inbytes - stats->base.inbytes;
+	stats->outbytes = sum.outbytes - stats->base.outbytes;
+}
+
+/* Restart the totals of stats from zero, called with stats->lock held */
+void ip_vs_rebase_stats(struct ip_vs_stats *stats)
+{
+	ip_vs_sum_cpu_stats(stats, &stats->base);
+}
+
 static void estimation_timer(unsigned long arg)
 {
 	struct ip_vs_estimator *e;
@@ -77,6 +120,9 @@ static void estimation_timer(unsigned long arg)
 	read_lock(&est_lock);
 	for (e = est_list; e; e = e->next) {
 		s = e->stats;
+
+		spin_lock(&s->lock);
+		ip_vs_fold_stats(s);
 		n_conns = s->conns;
 		n_inpkts = s->inpkts;
 		n_outpkts = s->outpkts;
@@ -108,6 +154,7 @@ static void estimation_timer(unsigned long arg)
 		e->last_outbytes = n_outbytes;
 		e->outbps += ((long)rate - (long)e->outbps)>>2;
 		s->outbps = (e->outbps+0xF)>>5;
+		spin_unlock(&s->lock);
 	}
 	read_unlock(&est_lock);
 	mod_timer(&est_timer, jiffies + 2*HZ);
@@ -23,11 +23,13 @@
 #include <linux/stddef.h>
 #include <linux/sysctl.h>
 #include <linux/slab.h>
+#include <linux/random.h>
 /* For ERR_PTR().  Yeah, I know... --RR */
 #include <linux/fs.h>
 
-/* This rwlock protects the main hash table, protocol/helper/expected
-   registrations, conntrack timers*/
+/* This rwlock protects protocol/helper/expected registrations,
+   conntrack timers and walks over the whole hash table; the chains
+   themselves are protected by ip_conntrack_hash_locks. */
 #define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
 #define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
 
@@ -53,6 +55,8 @@ unsigned int ip_conntrack_htable_size = 0;
 static int ip_conntrack_max = 0;
 static atomic_t ip_conntrack_count = ATOMIC_INIT(0);
 struct list_head *ip_conntrack_hash;
+struct ip_conntrack_hash_lock ip_conntrack_hash_locks[IP_CT_HASH_LOCKS];
+static u_int32_t ip_conntrack_hash_rnd;
 static kmem_cache_t *ip_conntrack_cachep;
 
 extern struct ip_conntrack_protocol ip_conntrack_generic_protocol;
@@ -95,20 +99,68 @@ static inline void ip_conntrack_put(struct ip_conntrack *ct)
 	nf_conntrack_put(&ct->infos[0]);
 }
 
+/* Bob Jenkins' lookup2 mixing step. */
+#define __hash_mix(a, b, c)			\
+do {						\
+	a -= b; a -= c; a ^= (c >> 13);		\
+	b -= c; b -= a; b ^= (a << 8);		\
+	c -= a; c -= b; c ^= (b >> 13);		\
+	a -= b; a -= c; a ^= (c >> 12);		\
+	b -= c; b -= a; b ^= (a << 16);		\
+	c -= a; c -= b; c ^= (b >> 5);		\
+	a -= b; a -= c; a ^= (c >> 3);		\
+	b -= c; b -= a; b ^= (a << 10);		\
+	c -= a; c -= b; c ^= (b >> 15);		\
+} while (0)
+
+/* Returns the full hash value: the bucket is hash % table size, which
+   may only be computed with the bucket lock (ip_ct_hash_lock(hash))
+   held.  Seeded at boot so remote hosts can't aim at one chain. */
 static inline u_int32_t
 hash_conntrack(const struct ip_conntrack_tuple *tuple)
 {
+	u_int32_t a, b, c;
+
 #if 0
 	dump_tuple(tuple);
 #endif
-	/* ntohl because more differences in low bits. */
-	/* To ensure that halves of the same connection don't hash
-	   clash, we add the source per-proto again. */
-	return (ntohl(tuple->src.ip + tuple->dst.ip
-		     + tuple->src.u.all + tuple->dst.u.all
-		     + tuple->dst.protonum)
-		+ ntohs(tuple->src.u.all))
-		% ip_conntrack_htable_size;
+	a = tuple->src.ip + 0x9e3779b9;
+	b = tuple->dst.ip + 0x9e3779b9 + tuple->dst.protonum;
+	c = ((u_int32_t)tuple->src.u.all << 16 | tuple->dst.u.all)
+		+ ip_conntrack_hash_rnd;
+	__hash_mix(a, b, c);
+
+	return c;
+}
+
+static inline struct list_head *ip_ct_chain(u_int32_t hash)
+{
+	return &ip_conntrack_hash[hash % ip_conntrack_htable_size];
+}
+
+/* Both directions of a connection, in lock order. */
+static inline void ip_ct_hash_write_lock2(u_int32_t h1, u_int32_t h2)
+{
+	unsigned int l1 = h1 % IP_CT_HASH_LOCKS, l2 = h2 % IP_CT_HASH_LOCKS;
+
+	if (l1 == l2)
+		ip_ct_hash_write_lock(l1);
+	else if (l1 < l2) {
+		ip_ct_hash_write_lock(l1);
+		ip_ct_hash_write_lock(l2);
+	} else {
+		ip_ct_hash_write_lock(l2);
+		ip_ct_hash_write_lock(l1);
+	}
+}
+
+static inline void ip_ct_hash_write_unlock2(u_int32_t h1, u_int32_t h2)
+{
+	unsigned int l1 = h1 % IP_CT_HASH_LOCKS, l2 = h2 % IP_CT_HASH_LOCKS;
+
+	ip_ct_hash_write_unlock(l1);
+	if (l1 != l2)
+		ip_ct_hash_write_unlock(l2);
 }
 
 inline int
@@ -153,16 +205,19 @@ invert_tuple(struct ip_conntrack_tuple *inverse,
 static void
 clean_from_lists(struct ip_conntrack *ct)
 {
+	u_int32_t hash, repl_hash;
+
 	MUST_BE_WRITE_LOCKED(&ip_conntrack_lock);
+	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+
 	/* Remove from both hash lists: must not NULL out next ptrs,
-           otherwise we'll look unconfirmed.  Fortunately, LIST_DELETE
+           otherwise we'll look unconfirmed.  Fortunately, list_del
            doesn't do this. --RR */
-	LIST_DELETE(&ip_conntrack_hash
-		    [hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple)],
-		    &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-	LIST_DELETE(&ip_conntrack_hash
-		    [hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple)],
-		    &ct->tuplehash[IP_CT_DIR_REPLY]);
+	ip_ct_hash_write_lock2(hash, repl_hash);
+	list_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+	list_del(&ct->tuplehash[IP_CT_DIR_REPLY].list);
+	ip_ct_hash_write_unlock2(hash, repl_hash);
 	/* If our expected is in the list, take it out. */
 	if (ct->expected.expectant) {
 		IP_NF_ASSERT(list_inlist(&expect_list, &ct->expected));
@@ -211,23 +266,25 @@ conntrack_tuple_cmp(const struct ip_conntrack_tuple_hash *i,
 		    const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
 	return i->ctrack != ignored_conntrack
 		&& ip_ct_tuple_equal(tuple, &i->tuple);
 }
 
+/* Bucket lock of hash (== hash_conntrack(tuple)) must be held. */
 static struct ip_conntrack_tuple_hash *
-__ip_conntrack_find(const struct ip_conntrack_tuple *tuple,
+__ip_conntrack_find(const struct ip_conntrack_tuple *tuple, u_int32_t hash,
 		    const struct ip_conntrack *ignored_conntrack)
 {
-	struct ip_conntrack_tuple_hash *h;
+	struct list_head *chain = ip_ct_chain(hash), *i;
 
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
-	h = LIST_FIND(&ip_conntrack_hash[hash_conntrack(tuple)],
-		      conntrack_tuple_cmp,
-		      struct ip_conntrack_tuple_hash *,
-		      tuple, ignored_conntrack);
-	return h;
+	list_for_each(i, chain) {
+		struct ip_conntrack_tuple_hash *h
+			= (struct ip_conntrack_tuple_hash *)i;
+
+		if (conntrack_tuple_cmp(h, tuple, ignored_conntrack))
+			return h;
+	}
+	return NULL;
 }
 
 /* Find a connection corresponding to a tuple. */
@@ -236,12 +293,13 @@ ip_conntrack_find_get(const struct ip_conntrack_tuple *tuple,
 		      const struct ip_conntrack *ignored_conntrack)
 {
 	struct ip_conntrack_tuple_hash *h;
+	u_int32_t hash = hash_conntrack(tuple);
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = __ip_conntrack_find(tuple, ignored_conntrack);
+	ip_ct_hash_read_lock(hash);
+	h = __ip_conntrack_find(tuple, hash, ignored_conntrack);
 	if (h)
 		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	ip_ct_hash_read_unlock(hash);
 
 	return h;
 }
@@ -271,7 +329,7 @@ ip_conntrack_get(struct sk_buff *skb, enum ip_conntrack_info *ctinfo)
 int
 __ip_conntrack_confirm(struct nf_ct_info *nfct)
 {
-	unsigned int hash, repl_hash;
+	u_int32_t hash, repl_hash;
 	struct ip_conntrack *ct;
 	enum ip_conntrack_info ctinfo;
 
@@ -297,33 +355,31 @@ __ip_conntrack_confirm(struct nf_ct_info *nfct)
 	IP_NF_ASSERT(!is_confirmed(ct));
 	DEBUGP("Confirming conntrack %p\n", ct);
 
-	WRITE_LOCK(&ip_conntrack_lock);
+	/* Only the two chains are touched: nobody else can see the
+	   conntrack until it is in the hash. */
+	ip_ct_hash_write_lock2(hash, repl_hash);
 	/* See if there's one in the list already, including reverse:
            NAT could have grabbed it without realizing, since we're
            not in the hash.  If there is, we lost race. */
-	if (!LIST_FIND(&ip_conntrack_hash[hash],
-		       conntrack_tuple_cmp,
-		       struct ip_conntrack_tuple_hash *,
-		       &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, NULL)
-	    && !LIST_FIND(&ip_conntrack_hash[repl_hash],
-			  conntrack_tuple_cmp,
-			  struct ip_conntrack_tuple_hash *,
-			  &ct->tuplehash[IP_CT_DIR_REPLY].tuple, NULL)) {
-		list_prepend(&ip_conntrack_hash[hash],
-			     &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-		list_prepend(&ip_conntrack_hash[repl_hash],
-			     &ct->tuplehash[IP_CT_DIR_REPLY]);
+	if (!__ip_conntrack_find(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
+				 hash, NULL)
+	    && !__ip_conntrack_find(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				    repl_hash, NULL)) {
+		list_add(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list,
+			 ip_ct_chain(hash));
+		list_add(&ct->tuplehash[IP_CT_DIR_REPLY].list,
+			 ip_ct_chain(repl_hash));
 		/* Timer relative to confirmation time, not original
 		   setting time, otherwise we'd get timer wrap in
 		   wierd delay cases. */
 		ct->timeout.expires += jiffies;
 		add_timer(&ct->timeout);
 		atomic_inc(&ct->ct_general.use);
-		WRITE_UNLOCK(&ip_conntrack_lock);
+		ip_ct_hash_write_unlock2(hash, repl_hash);
 		return NF_ACCEPT;
 	}
 
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	ip_ct_hash_write_unlock2(hash, repl_hash);
 	return NF_DROP;
 }
 
@@ -334,10 +390,11 @@ ip_conntrack_tuple_taken(const struct ip_conntrack_tuple *tuple,
 			 const struct ip_conntrack *ignored_conntrack)
 {
 	struct ip_conntrack_tuple_hash *h;
+	u_int32_t hash = hash_conntrack(tuple);
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	READ_UNLOCK(&ip_conntrack_lock);
+	ip_ct_hash_read_lock(hash);
+	h = __ip_conntrack_find(tuple, hash, ignored_conntrack);
+	ip_ct_hash_read_unlock(hash);
 
 	return h != NULL;
 }
@@ -440,17 +497,22 @@ static inline int unreplied(const struct ip_conntrack_tuple_hash *i)
 	return !(i->ctrack->status & IPS_ASSURED);
 }
 
-static int early_drop(struct list_head *chain)
+static int early_drop(u_int32_t hash)
 {
 	/* Traverse backwards: gives us oldest, which is roughly LRU */
-	struct ip_conntrack_tuple_hash *h;
+	struct ip_conntrack_tuple_hash *h = NULL;
+	struct list_head *i;
 	int dropped = 0;
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = LIST_FIND(chain, unreplied, struct ip_conntrack_tuple_hash *);
-	if (h)
-		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	ip_ct_hash_read_lock(hash);
+	list_for_each(i, ip_ct_chain(hash)) {
+		if (unreplied((struct ip_conntrack_tuple_hash *)i)) {
+			h = (struct ip_conntrack_tuple_hash *)i;
+			atomic_inc(&h->ctrack->ct_general.use);
+			break;
+		}
+	}
+	ip_ct_hash_read_unlock(hash);
 
 	if (!h)
 		return dropped;
@@ -485,7 +547,7 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack *conntrack;
 	struct ip_conntrack_tuple repl_tuple;
-	size_t hash, repl_hash;
+	u_int32_t hash;
 	struct ip_conntrack_expect *expected;
 	int i;
 	static unsigned int drop_next = 0;
@@ -499,8 +561,8 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
                    bomb one hash chain). */
 		if (drop_next >= ip_conntrack_htable_size)
 			drop_next = 0;
-		if (!early_drop(&ip_conntrack_hash[drop_next++])
-		    && !early_drop(&ip_conntrack_hash[hash])) {
+		if (!early_drop(drop_next++)
+		    && !early_drop(hash)) {
 			if (net_ratelimit())
 				printk(KERN_WARNING
 				       "ip_conntrack: table full, dropping"
@@ -513,7 +575,6 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 		DEBUGP("Can't invert tuple.\n");
 		return NULL;
 	}
-	repl_hash = hash_conntrack(&repl_tuple);
 
 	conntrack = kmem_cache_alloc(ip_conntrack_cachep, GFP_ATOMIC);
 	if (!conntrack) {
@@ -778,8 +839,14 @@ void ip_conntrack_unexpect_related(struct ip_conntrack *related_to)
 int ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 			     const struct ip_conntrack_tuple *newreply)
 {
+	u_int32_t hash = hash_conntrack(newreply);
+	int taken;
+
 	WRITE_LOCK(&ip_conntrack_lock);
-	if (__ip_conntrack_find(newreply, conntrack)) {
+	ip_ct_hash_read_lock(hash);
+	taken = __ip_conntrack_find(newreply, hash, conntrack) != NULL;
+	ip_ct_hash_read_unlock(hash);
+	if (taken) {
 		WRITE_UNLOCK(&ip_conntrack_lock);
 		return 0;
 	}
@@ -833,9 +900,12 @@ void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 	LIST_DELETE(&helpers, me);
 
 	/* Get rid of expecteds, set helpers to NULL. */
-	for (i = 0; i < ip_conntrack_htable_size; i++)
+	for (i = 0; i < ip_conntrack_htable_size; i++) {
+		ip_ct_hash_read_lock(i);
 		LIST_FIND_W(&ip_conntrack_hash[i], unhelp,
 			    struct ip_conntrack_tuple_hash *, me);
+		ip_ct_hash_read_unlock(i);
+	}
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
 	/* Someone could be still looking at the helper in a bh. */
@@ -942,11 +1012,13 @@ get_next_corpse(int (*kill)(const struct ip_conntrack *i, void *data),
 
 	READ_LOCK(&ip_conntrack_lock);
 	for (i = 0; !h && i < ip_conntrack_htable_size; i++) {
+		ip_ct_hash_read_lock(i);
 		h = LIST_FIND(&ip_conntrack_hash[i], do_kill,
 			      struct ip_conntrack_tuple_hash *, kill, data);
+		if (h)
+			atomic_inc(&h->ctrack->ct_general.use);
+		ip_ct_hash_read_unlock(i);
 	}
-	if (h)
-		atomic_inc(&h->ctrack->ct_general.use);
 	READ_UNLOCK(&ip_conntrack_lock);
 
 	return h;
@@ -969,6 +1041,59 @@ ip_ct_selective_cleanup(int (*kill)(const struct ip_conntrack *i, void *data),
 	}
 }
 
+static unsigned int ip_conntrack_round_size(unsigned int size)
+{
+	if (size < IP_CT_HASH_LOCKS)
+		return IP_CT_HASH_LOCKS;
+	return (size + IP_CT_HASH_LOCKS - 1) & ~(IP_CT_HASH_LOCKS - 1);
+}
+
+/* Rehash every conntrack into a new table of (about) size buckets.
+   Lookups stall while the entries are moved, but none are lost. */
+int ip_conntrack_resize(unsigned int size)
+{
+	struct list_head *hash, *old;
+	unsigned int i, old_size;
+
+	if (size == 0 || size > (1 << 24))
+		return -EINVAL;
+	size = ip_conntrack_round_size(size);
+
+	hash = vmalloc(sizeof(struct list_head) * size);
+	if (!hash)
+		return -ENOMEM;
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&hash[i]);
+
+	WRITE_LOCK(&ip_conntrack_lock);
+	for (i = 0; i < IP_CT_HASH_LOCKS; i++)
+		ip_ct_hash_write_lock(i);
+
+	old = ip_conntrack_hash;
+	old_size = ip_conntrack_htable_size;
+	for (i = 0; i < old_size; i++) {
+		/* From the tail, so the chains keep their order. */
+		while (!list_empty(&old[i])) {
+			struct ip_conntrack_tuple_hash *h
+				= (struct ip_conntrack_tuple_hash *)old[i].prev;
+
+			list_del(&h->list);
+			list_add(&h->list,
+				 &hash[hash_conntrack(&h->tuple) % size]);
+		}
+	}
+	ip_conntrack_hash = hash;
+	ip_conntrack_htable_size = size;
+
+	for (i = IP_CT_HASH_LOCKS; i-- > 0; )
+		ip_ct_hash_write_unlock(i);
+	WRITE_UNLOCK(&ip_conntrack_lock);
+
+	vfree(old);
+	printk("ip_conntrack: hash table resized, %u buckets\n", size);
+	return 0;
+}
+
 /* Fast function for those who don't want to parse /proc (and I don't
    blame them). */
 /* Reversing the socket's dst/src point of view gives us the reply
@@ -1025,13 +1150,54 @@ static struct nf_sockopt_ops so_getorigdst
 
 #define NET_IP_CONNTRACK_MAX 2089
 #define NET_IP_CONNTRACK_MAX_NAME "ip_conntrack_max"
+#define NET_IP_CONNTRACK_BUCKETS 2090
+#define NET_IP_CONNTRACK_BUCKETS_NAME "ip_conntrack_buckets"
 
 #ifdef CONFIG_SYSCTL
 static struct ctl_table_header *ip_conntrack_sysctl_header;
 
+static int ip_conntrack_buckets_sysctl(ctl_table *ctl, int write,
+				       struct file *filp, void *buffer,
+				       size_t *lenp)
+{
+	int size = ip_conntrack_htable_size, ret;
+	ctl_table tmp = *ctl;
+
+	tmp.data = &size;
+	ret = proc_dointvec(&tmp, write, filp, buffer, lenp);
+	if (write && ret == 0) {
+		if (size <= 0)
+			return -EINVAL;
+		ret = ip_conntrack_resize(size);
+	}
+	return ret;
+}
+
+static int ip_conntrack_buckets_strategy(ctl_table *table, int *name,
+					 int nlen, void *oldval,
+					 size_t *oldlenp, void *newval,
+					 size_t newlen, void **context)
+{
+	int size, ret;
+
+	if (!newval || !newlen)
+		return 0;
+	if (newlen != sizeof(int))
+		return -EINVAL;
+	if (get_user(size, (int *)newval))
+		return -EFAULT;
+	if (size <= 0)
+		return -EINVAL;
+	ret = ip_conntrack_resize(size);
+	return ret ? ret : 1;
+}
+
 static ctl_table ip_conntrack_table[] = {
 	{ NET_IP_CONNTRACK_MAX, NET_IP_CONNTRACK_MAX_NAME, &ip_conntrack_max,
 	  sizeof(ip_conntrack_max), 0644,  NULL, proc_dointvec },
+	{ NET_IP_CONNTRACK_BUCKETS, NET_IP_CONNTRACK_BUCKETS_NAME,
+	  &ip_conntrack_htable_size, sizeof(ip_conntrack_htable_size), 0644,
+	  NULL, ip_conntrack_buckets_sysctl, ip_conntrack_buckets_strategy },
  	{ 0 }
 };
 
@@ -1095,10 +1261,11 @@ int __init ip_conntrack_init(void)
 			   / sizeof(struct list_head));
 		if (num_physpages > (1024 * 1024 * 1024 / PAGE_SIZE))
 			ip_conntrack_htable_size = 8192;
-		if (ip_conntrack_htable_size < 16)
-			ip_conntrack_htable_size = 16;
 	}
+	ip_conntrack_htable_size
+		= ip_conntrack_round_size(ip_conntrack_htable_size);
 	ip_conntrack_max = 8 * ip_conntrack_htable_size;
+	get_random_bytes(&ip_conntrack_hash_rnd, sizeof(ip_conntrack_hash_rnd));
 
 	printk("ip_conntrack (%u buckets, %d max)\n",
 	       ip_conntrack_htable_size, ip_conntrack_max);
@@ -1134,6 +1301,8 @@ int __init ip_conntrack_init(void)
 
 	for (i = 0; i < ip_conntrack_htable_size; i++)
 		INIT_LIST_HEAD(&ip_conntrack_hash[i]);
+	for (i = 0; i < IP_CT_HASH_LOCKS; i++)
+		ip_conntrack_hash_locks[i].lock = RW_LOCK_UNLOCKED;
 
 /* This is fucking braindead.  There is NO WAY of doing this without
    the CONFIG_SYSCTL unless you don't want to detect errors.
@@ -17,6 +17,7 @@
 #include <linux/version.h>
 #include <linux/brlock.h>
 #include <net/checksum.h>
+#include <asm/div64.h>
 
 #define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
 #define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
@@ -140,9 +141,14 @@ list_conntracks(char *buffer, char **start, off_t offset, int length)
 	READ_LOCK(&ip_conntrack_lock);
 	/* Traverse hash; print originals then reply. */
 	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		if (LIST_FIND(&ip_conntrack_hash[i], conntrack_iterate,
-			      struct ip_conntrack_tuple_hash *,
-			      buffer, offset, &upto, &len, length))
+		int done;
+
+		ip_ct_hash_read_lock(i);
+		done = LIST_FIND(&ip_conntrack_hash[i], conntrack_iterate,
+				 struct ip_conntrack_tuple_hash *,
+				 buffer, offset, &upto, &len, length) != NULL;
+		ip_ct_hash_read_unlock(i);
+		if (done)
 			goto finished;
 	}
 
@@ -169,6 +175,69 @@ list_conntracks(char *buffer, char **start, off_t offset, int length)
 	return len;
 }
 
+/* Chain lengths 0..IP_CT_CHAIN_HIST-2 counted exactly, the last
+   slot gets everything longer. */
+#define IP_CT_CHAIN_HIST 9
+
+static int
+conntrack_hash_stats(char *buffer, char **start, off_t offset, int length)
+{
+	unsigned int hist[IP_CT_CHAIN_HIST] = { 0 };
+	unsigned int i, size, entries = 0, longest = 0;
+	int len = 0;
+
+	READ_LOCK(&ip_conntrack_lock);
+	size = ip_conntrack_htable_size;
+	for (i = 0; i < size; i++) {
+		struct list_head *e;
+		unsigned int chain = 0;
+
+		ip_ct_hash_read_lock(i);
+		list_for_each(e, &ip_conntrack_hash[i])
+			chain++;
+		ip_ct_hash_read_unlock(i);
+
+		entries += chain;
+		if (chain > longest)
+			longest = chain;
+		hist[chain < IP_CT_CHAIN_HIST ? chain : IP_CT_CHAIN_HIST-1]++;
+	}
+	READ_UNLOCK(&ip_conntrack_lock);
+
+	len += sprintf(buffer + len, "buckets %u tuples %u longest %u\n",
+		       size, entries, longest);
+	len += sprintf(buffer + len, "chains");
+	for (i = 0; i < IP_CT_CHAIN_HIST; i++)
+		len += sprintf(buffer + len, " %u", hist[i]);
+	len += sprintf(buffer + len, "\n");
+
+	/* Racy snapshot of the write hold times, in cycles. */
+	len += sprintf(buffer + len, "lock write_holds avg_cycles max_cycles\n");
+	for (i = 0; i < IP_CT_HASH_LOCKS; i++) {
+		struct ip_conntrack_hash_lock *l = &ip_conntrack_hash_locks[i];
+		unsigned long holds = l->write_holds;
+		unsigned long long cycles = l->write_cycles, avg = 0;
+
+		if (holds) {
+			do_div(cycles, holds);
+			avg = cycles;
+		}
+		len += sprintf(buffer + len, "%4u %11lu %10Lu %10Lu\n",
+			       i, holds, avg,
+			       (unsigned long long)l->write_max);
+	}
+
+	if (offset >= len) {
+		*start = buffer;
+		return 0;
+	}
+	*start = buffer + offset;
+	len -= offset;
+	if (len > length)
+		len = length;
+	return len;
+}
+
 static unsigned int ip_confirm(unsigned int hooknum,
 			       struct sk_buff **pskb,
 			       const struct net_device *in,
@@ -247,10 +316,14 @@ static int init_or_cleanup(int init)
 	if (!proc) goto cleanup_init;
 	proc->owner = THIS_MODULE;
 
+	proc = proc_net_create("ip_conntrack_hash",0,conntrack_hash_stats);
+	if (!proc) goto cleanup_proc;
+	proc->owner = THIS_MODULE;
+
 	ret = nf_register_hook(&ip_conntrack_in_ops);
 	if (ret < 0) {
 		printk("ip_conntrack: can't register pre-routing hook.\n");
-		goto cleanup_proc;
+		goto cleanup_proc_hash;
 	}
 	ret = nf_register_hook(&ip_conntrack_local_out_ops);
 	if (ret < 0) {
@@ -278,6 +351,8 @@ static int init_or_cleanup(int init)
 	nf_unregister_hook(&ip_conntrack_local_out_ops);
  cleanup_inops:
 	nf_unregister_hook(&ip_conntrack_in_ops);
+ cleanup_proc_hash:
+	proc_net_remove("ip_conntrack_hash");
  cleanup_proc:
 	proc_net_remove("ip_conntrack");
  cleanup_init:
@@ -358,3 +433,5 @@ EXPORT_SYMBOL(ip_conntrack_unexpect_related);
 EXPORT_SYMBOL(ip_conntrack_tuple_taken);
 EXPORT_SYMBOL(ip_ct_gather_frags);
 EXPORT_SYMBOL(ip_conntrack_htable_size);
+EXPORT_SYMBOL(ip_conntrack_hash_locks);
+EXPORT_SYMBOL(ip_conntrack_resize);
@@ -288,9 +288,14 @@ masq_procinfo(char *buffer, char **start, off_t offset, int length)
 	READ_LOCK(&ip_conntrack_lock);
 	/* Traverse hash; print originals then reply. */
 	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		if (LIST_FIND(&ip_conntrack_hash[i], masq_iterate,
-			      struct ip_conntrack_tuple_hash *,
-			      buffer, offset, &upto, &len, length))
+		int done;
+
+		ip_ct_hash_read_lock(i);
+		done = LIST_FIND(&ip_conntrack_hash[i], masq_iterate,
+				 struct ip_conntrack_tuple_hash *,
+				 buffer, offset, &upto, &len, length) != NULL;
+		ip_ct_hash_read_unlock(i);
+		if (done)
 			break;
 	}
 	READ_UNLOCK(&ip_conntrack_lock);
@@ -413,10 +413,11 @@ void tcp_unhash(struct sock *sk)
  * connection.  So always assume those are both wildcarded
  * during the search since they can never be otherwise.
  */
-static struct sock *__tcp_v4_lookup_listener(struct sock *sk, u32 daddr, unsigned short hnum, int dif)
+static struct sock *__tcp_v4_lookup_listener(struct sock *sk, u32 saddr, u16 sport, u32 daddr, unsigned short hnum, int dif)
 {
-	struct sock *result = NULL;
-	int score, hiscore;
+	struct sock *head = sk, *result = NULL;
+	int score, hiscore, nr;
+	u32 hash;
 
 	hiscore=0;
 	for(; sk; sk = sk->next) {
@@ -434,7 +435,7 @@ static struct sock *__tcp_v4_lookup_listener(struct sock *sk, u32 daddr, unsigne
 					continue;
 				score++;
 			}
-			if (score == 3)
+			if (score == 3 && sk->reuse <= 1)
 				return sk;
 			if (score > hiscore) {
 				hiscore = score;
@@ -442,11 +443,33 @@ static struct sock *__tcp_v4_lookup_listener(struct sock *sk, u32 daddr, unsigne
 			}
 		}
 	}
+	if (result == NULL || result->reuse <= 1)
+		return result;
+
+	/*
+	 * A group of listeners sharing the port (reuse > 1): spread
+	 * connections across the group by the remote address and port,
+	 * so that each connection always goes to the same listener.
+	 */
+	nr = 0;
+	for (sk = head; sk; sk = sk->next)
+		if (sk->num == hnum && sk->reuse > 1 &&
+		    sk->rcv_saddr == result->rcv_saddr &&
+		    sk->bound_dev_if == result->bound_dev_if)
+			nr++;
+	hash = saddr ^ daddr ^ ((u32)sport << 16) ^ hnum;
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+	nr = hash % nr;
+	for (sk = head; sk; sk = sk->next)
+		if (sk->num == hnum && sk->reuse > 1 &&
+		    sk->rcv_saddr == result->rcv_saddr &&
+		    sk->bound_dev_if == result->bound_dev_if && !nr--)
+			return sk;
 	return result;
 }
 
-/* Optimize the common listener case. */
-__inline__ struct sock *tcp_v4_lookup_listener(u32 daddr, unsigned short hnum, int dif)
+static __inline__ struct sock *__tcp_v4_lookup_listen(u32 saddr, u16 sport, u32 daddr, unsigned short hnum, int dif)
 {
 	struct sock *sk;
 
@@ -458,7 +481,7 @@ __inline__ struct sock *tcp_v4_lookup_listener(u32 daddr, unsigned short hnum, i
 		    (!sk->rcv_saddr || sk->rcv_saddr == daddr) &&
 		    !sk->bound_dev_if)
 			goto sherry_cache;
-		sk = __tcp_v4_lookup_listener(sk, daddr, hnum, dif);
+		sk = __tcp_v4_lookup_listener(sk, saddr, sport, daddr, hnum, dif);
 	}
 	if (sk) {
 sherry_cache:
@@ -468,6 +491,12 @@ sherry_cache:
 	return sk;
 }
 
+/* Optimize the common listener case. */
+__inline__ struct sock *tcp_v4_lookup_listener(u32 daddr, unsigned short hnum, int dif)
+{
+	return __tcp_v4_lookup_listen(0, 0, daddr, hnum, dif);
+}
+
 /* Sockets in TCP_CLOSE state are _always_ taken out of the hash, so
  * we need not check it for TCP lookups anymore, thanks Alexey. -DaveM
  *
@@ -518,7 +547,7 @@ static inline struct sock *__tcp_v4_lookup(u32 saddr, u16 sport,
 	if (sk)
 		return sk;
 		
-	return tcp_v4_lookup_listener(daddr, hnum, dif);
+	return __tcp_v4_lookup_listen(saddr, sport, daddr, hnum, dif);
 }
 
 __inline__ struct sock *tcp_v4_lookup(u32 saddr, u16 sport, u32 daddr, u16 dport, int dif)
@@ -1804,7 +1833,7 @@ do_time_wait:
 	{
 		struct sock *sk2;
 
-		sk2 = tcp_v4_lookup_listener(skb->nh.iph->daddr, ntohs(th->dest), tcp_v4_iif(skb));
+		sk2 = __tcp_v4_lookup_listen(skb->nh.iph->saddr, th->source, skb->nh.iph->daddr, ntohs(th->dest), tcp_v4_iif(skb));
 		if (sk2 != NULL) {
 			tcp_tw_deschedule((struct tcp_tw_bucket *)sk);
 			tcp_timewait_kill((struct tcp_tw_bucket *)sk);
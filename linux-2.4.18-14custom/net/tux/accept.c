@@ -58,7 +58,12 @@ struct socket * start_listening(tux_socket_t *listen, int nr)
 	sin.sin_port = htons(port);
 
 	sk = sock->sk;
-	sk->reuse = 1;
+	/*
+	 * With one listen socket per thread, all threads' sockets
+	 * form a group on the same port and TCP spreads incoming
+	 * connections across it:
+	 */
+	sk->reuse = tux_listen_per_cpu ? 2 : 1;
 	sk->urginline = 1;
 
 #define IP(n) ((unsigned char *)&addr)[n]
@@ -6,6 +6,10 @@
  * cachemiss.c: handle the 'slow IO path' by queueing not-yet-cached
  * requests to the IO-thread pool. Dynamic load balancing is done
  * between IO threads, based on the number of requests they have pending.
+ *
+ * Plain file-data misses do not need an IO thread: the reads are
+ * started asynchronously and the TUX thread itself waits for the
+ * pages, see queue_async_read().
  */
 
 #include <net/tux.h>
@@ -51,6 +55,137 @@ void queue_cachemiss (tux_req_t *req)
 	wake_up(&iot->async_sleep);
 }
 
+/*
+ * Start reading the missing part of req->in_file into the page cache
+ * and park the request until its first missing page is unlocked.
+ * The TUX thread is added to the page's waitqueue (poll() style), so
+ * the IO completion wakes it up and complete_async_reads() requeues
+ * the request. This way a single TUX thread can have any number of
+ * reads in flight without blocking.
+ */
+void queue_async_read (tux_req_t *req)
+{
+	threadinfo_t *ti = req->ti;
+	unsigned long index, nr;
+	struct page *page;
+
+	if (ti->thread != current)
+		TUX_BUG();
+	if (req->idle_input || req->wait_output_space)
+		TUX_BUG();
+	if (!list_empty(&req->work))
+		TUX_BUG();
+	if (req->async_page)
+		TUX_BUG();
+	req->had_cachemiss = 1;
+
+	/*
+	 * Read ahead the rest of the object, up to the usual
+	 * readahead window:
+	 */
+	index = req->in_file.f_pos >> PAGE_CACHE_SHIFT;
+	nr = ((req->in_file.f_pos & ~PAGE_CACHE_MASK) + req->output_len +
+				PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
+	if (nr > vm_max_readahead)
+		nr = vm_max_readahead;
+	if (!nr)
+		nr = 1;
+
+	page = page_cache_read_async(&req->in_file, index, nr);
+	if (!page) {
+		/* all there already */
+		add_req_to_workqueue(req);
+		return;
+	}
+	if (IS_ERR(page)) {
+		/* out of memory: an IO thread does a blocking read instead */
+		queue_cachemiss(req);
+		return;
+	}
+	req->async_page = page;
+	init_waitqueue_entry(&req->async_wait, current);
+	add_page_wait_queue(page, &req->async_wait);
+
+	list_add_tail(&req->work, &ti->async_reads);
+	ti->nr_async_reads++;
+	INC_STAT(nr_async_reads_pending);
+}
+
+/*
+ * Called by the TUX thread after a wakeup: requeue every request
+ * whose page IO has finished. If the read failed, leave it to an IO
+ * thread to redo it synchronously and report the error.
+ */
+int complete_async_reads (threadinfo_t *ti)
+{
+	struct list_head *head = &ti->async_reads, *curr, *next;
+	struct page *page;
+	tux_req_t *req;
+	int count = 0;
+
+	list_for_each_safe(curr, next, head) {
+		req = list_entry(curr, tux_req_t, work);
+		page = req->async_page;
+		if (PageLocked(page))
+			continue;
+
+		list_del(curr);
+		DEBUG_DEL_LIST(curr);
+		ti->nr_async_reads--;
+		DEC_STAT(nr_async_reads_pending);
+
+		remove_page_wait_queue(page, &req->async_wait);
+		req->async_page = NULL;
+		if (Page_Uptodate(page))
+			add_req_to_workqueue(req);
+		else
+			queue_cachemiss(req);
+		page_cache_release(page);
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Queue the compression of a static object into the compressed-object
+ * cache. The request itself does not wait for it.
+ */
+void queue_gzfill (tux_req_t *req, tux_gzobj_t *obj)
+{
+	iothread_t *iot = req->ti->iot;
+	tux_gzfill_t *fill;
+
+	fill = kmalloc(sizeof(*fill), GFP_KERNEL);
+	if (!fill) {
+		tux_gzcache_put_obj(obj);
+		return;
+	}
+	fill->obj = obj;
+	fill->dentry = dget(req->dentry);
+	fill->mnt = mntget(req->mnt);
+
+	spin_lock(&iot->async_lock);
+	list_add_tail(&fill->list, &iot->gzfill_queue);
+	iot->nr_gzfill_pending++;
+	spin_unlock(&iot->async_lock);
+
+	wake_up(&iot->async_sleep);
+}
+
+static tux_gzfill_t * get_gzfill (iothread_t *iot)
+{
+	tux_gzfill_t *fill = NULL;
+
+	spin_lock(&iot->async_lock);
+	if (!list_empty(&iot->gzfill_queue)) {
+		fill = list_entry(iot->gzfill_queue.next, tux_gzfill_t, list);
+		list_del(&fill->list);
+		iot->nr_gzfill_pending--;
+	}
+	spin_unlock(&iot->async_lock);
+	return fill;
+}
+
 static tux_req_t * get_cachemiss (iothread_t *iot)
 {
 	struct list_head *tmp;
@@ -134,6 +269,8 @@ static int cachemiss_thread (void *data)
 	add_wait_queue_exclusive(&iot->async_sleep, &wait);
 
 	for (;;) {
+		tux_gzfill_t *fill;
+
 		while (!list_empty(&iot->async_queue) &&
 				(req = get_cachemiss(iot))) {
 
@@ -149,19 +286,28 @@ static int cachemiss_thread (void *data)
 					/* nothing */;
 			}
 		}
+		/*
+		 * Compression work is lower priority than requests
+		 * waiting for IO, do one object then recheck:
+		 */
+		if (!list_empty(&iot->gzfill_queue) &&
+				(fill = get_gzfill(iot)))
+			tux_gzcache_fill(fill);
 		if (signal_pending(current)) {
 			flush_all_signals();
 			while (sys_wait4(-1, NULL, WNOHANG, NULL) > 0)
 				/* nothing */;
 		}
-		if (!list_empty(&iot->async_queue))
+		if (!list_empty(&iot->async_queue) ||
+				!list_empty(&iot->gzfill_queue))
 			continue;
 		if (iot->shutdown) {
 			Dprintk("iot %p/%p got shutdown!\n", iot, current);
 			break;
 		}
 		__set_current_state(TASK_INTERRUPTIBLE);
-		if (list_empty(&iot->async_queue)) {
+		if (list_empty(&iot->async_queue) &&
+				list_empty(&iot->gzfill_queue)) {
 			Dprintk("iot %p/%p going to sleep.\n", iot, current);
 			schedule();
 			Dprintk("iot %p/%p got woken up.\n", iot, current);
@@ -210,6 +356,8 @@ static void __stop_cachemiss_threads (iothread_t *iot)
 		TUX_BUG();
 	if (iot->nr_async_pending)
 		TUX_BUG();
+	if (iot->nr_gzfill_pending)
+		TUX_BUG();
 	Dprintk("stopped async IO threads %p.\n", iot);
 }
 
@@ -241,6 +389,8 @@ int start_cachemiss_threads (threadinfo_t *ti)
 	iot->async_lock = SPIN_LOCK_UNLOCKED;
 	iot->nr_async_pending = 0;
 	INIT_LIST_HEAD(&iot->async_queue);
+	INIT_LIST_HEAD(&iot->gzfill_queue);
+	iot->nr_gzfill_pending = 0;
 	init_waitqueue_head(&iot->async_sleep);
 	init_waitqueue_head(&iot->wait_shutdown);
 		
@@ -144,7 +144,6 @@ repeat_read:
 
 static int exec_external_cgi (void *data)
 {
-	exec_param_t param;
 	tux_req_t *req = data;
 	char *envp[MAX_CGI_METAVARIABLES+1], **envp_p;
 	char *argv[] = { "extcgi", NULL};
@@ -260,7 +259,7 @@ static int exec_external_cgi (void *data)
 	else
 		sprintf(command, "/cgi-bin/%s", req->objectname);
 	Dprintk("before CGI exec.\n");
-	pid = tux_exec_process(command, argv, envp, 1, &param, 0);
+	pid = tux_exec_process(command, argv, envp, 1, 0);
 	Dprintk("after CGI exec.\n");
 
 	if (req->post_data_len) {
@@ -280,6 +279,8 @@ static int exec_external_cgi (void *data)
 	sys_close(1);
 
 	handle_cgi_reply(req);
+	if (pid < 0)
+		return pid;
 repeat:
 	reap_kids();
 	ret = sys_wait4(pid, NULL, __WALL, NULL);
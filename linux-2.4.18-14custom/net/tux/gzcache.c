@@ -0,0 +1,404 @@
+/*
+ * TUX - Integrated Application Protocols Layer and Object Cache
+ *
+ * Copyright (C) 2000, 2001, Ingo Molnar <mingo@redhat.com>
+ *
+ * gzcache.c: cache of gzip-compressed static objects. Objects are
+ * compressed once by the IO threads and then sent from the cached
+ * pages, instead of being deflated again for every request.
+ */
+
+#include <net/tux.h>
+
+/****************************************************************
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2, or (at your option)
+ *      any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ****************************************************************/
+
+/*
+ * Upper limit of the cache, in bytes. 0 disables the cache.
+ */
+unsigned int tux_compressed_cache_size = 16*1024*1024;
+
+#define GZCACHE_HASH_BITS 8
+#define GZCACHE_HASH_SIZE (1 << GZCACHE_HASH_BITS)
+
+static spinlock_t gzcache_lock = SPIN_LOCK_UNLOCKED;
+static struct list_head gzcache_hash [GZCACHE_HASH_SIZE];
+static LIST_HEAD(gzcache_lru);
+static unsigned int gzcache_bytes;
+
+static inline struct list_head * gzcache_hashfn (kdev_t dev, unsigned long ino)
+{
+	unsigned long hash = ino ^ ((unsigned long)kdev_t_to_nr(dev) << 5);
+
+	hash ^= hash >> GZCACHE_HASH_BITS;
+	return gzcache_hash + (hash & (GZCACHE_HASH_SIZE-1));
+}
+
+static inline unsigned int gzobj_bytes (tux_gzobj_t *obj)
+{
+	return sizeof(*obj) + (obj->nr_pages << PAGE_SHIFT);
+}
+
+static void free_gzobj (tux_gzobj_t *obj)
+{
+	unsigned int i;
+
+	Dprintk("freeing gzobj %p (ino %ld, %d pages).\n", obj, obj->ino, obj->nr_pages);
+	for (i = 0; i < obj->nr_pages; i++)
+		__free_page(obj->pages[i]);
+	if (obj->pages)
+		kfree(obj->pages);
+	kfree(obj);
+}
+
+void tux_gzcache_put_obj (tux_gzobj_t *obj)
+{
+	if (atomic_dec_and_test(&obj->count))
+		free_gzobj(obj);
+}
+
+/*
+ * Drop the cache's reference to an object. Requests still sending
+ * it keep the pages until they are done.
+ */
+static void __gzcache_unhash (tux_gzobj_t *obj)
+{
+	list_del_init(&obj->hash);
+	list_del_init(&obj->lru);
+	gzcache_bytes -= gzobj_bytes(obj);
+	tux_gzcache_put_obj(obj);
+}
+
+static void __gzcache_shrink (void)
+{
+	tux_gzobj_t *obj;
+
+	while ((gzcache_bytes > tux_compressed_cache_size) &&
+					!list_empty(&gzcache_lru)) {
+		obj = list_entry(gzcache_lru.prev, tux_gzobj_t, lru);
+		__gzcache_unhash(obj);
+	}
+}
+
+static tux_gzobj_t * __gzcache_find (struct list_head *head, struct inode *inode)
+{
+	struct list_head *tmp;
+	tux_gzobj_t *obj;
+
+	list_for_each(tmp, head) {
+		obj = list_entry(tmp, tux_gzobj_t, hash);
+		if ((obj->ino == inode->i_ino) && (obj->dev == inode->i_dev))
+			return obj;
+	}
+	return NULL;
+}
+
+static inline int gzobj_valid (tux_gzobj_t *obj, struct inode *inode)
+{
+	return (obj->mtime == inode->i_mtime) && (obj->size == inode->i_size);
+}
+
+/*
+ * Look up the compressed version of req's object. On a hit the request
+ * is switched over to sending the cached pages and TUX_GZCACHE_HIT is
+ * returned. On a first miss the object is queued for compression by
+ * the IO threads and the caller falls back to compressing on the fly.
+ * Objects that are being compressed by now, or that do not shrink,
+ * are sent uncompressed: TUX_GZCACHE_PLAIN.
+ */
+int tux_gzcache_lookup (tux_req_t *req)
+{
+	struct inode *inode = req->dentry->d_inode;
+	tux_gzobj_t *obj, *new = NULL;
+	struct list_head *head;
+	int ret = TUX_GZCACHE_PLAIN;
+
+	if (!tux_compressed_cache_size || !inode->i_size)
+		return TUX_GZCACHE_MISS;
+	/*
+	 * Do not let a single object flush the whole cache:
+	 */
+	if (inode->i_size > tux_compressed_cache_size/4)
+		return TUX_GZCACHE_MISS;
+
+	head = gzcache_hashfn(inode->i_dev, inode->i_ino);
+repeat:
+	spin_lock(&gzcache_lock);
+	obj = __gzcache_find(head, inode);
+	if (obj && !gzobj_valid(obj, inode)) {
+		Dprintk("gzobj %p is stale.\n", obj);
+		__gzcache_unhash(obj);
+		obj = NULL;
+	}
+	if (obj) {
+		/*
+		 * Still being compressed, or not worth compressing:
+		 * send it uncompressed.
+		 */
+		if (!obj->nr_pages) {
+			spin_unlock(&gzcache_lock);
+			goto out_free;
+		}
+		list_del(&obj->lru);
+		list_add(&obj->lru, &gzcache_lru);
+		atomic_inc(&obj->count);
+		spin_unlock(&gzcache_lock);
+		goto hit;
+	}
+	if (!new) {
+		spin_unlock(&gzcache_lock);
+		new = kmalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return TUX_GZCACHE_MISS;
+		goto repeat;
+	}
+	memset(new, 0, sizeof(*new));
+	new->dev = inode->i_dev;
+	new->ino = inode->i_ino;
+	new->mtime = inode->i_mtime;
+	new->size = inode->i_size;
+	/* one reference for the cache, one for the fill */
+	atomic_set(&new->count, 2);
+	list_add(&new->hash, head);
+	list_add(&new->lru, &gzcache_lru);
+	gzcache_bytes += gzobj_bytes(new);
+	__gzcache_shrink();
+	spin_unlock(&gzcache_lock);
+
+	Dprintk("gzcache miss, queueing fill of ino %ld.\n", inode->i_ino);
+	queue_gzfill(req, new);
+	return TUX_GZCACHE_MISS;
+
+hit:
+	Dprintk("gzcache hit, gzobj %p, %d bytes.\n", obj, obj->len);
+	req->gzobj = obj;
+	req->content_gzipped = TUX_GZIP_CACHED;
+	req->total_file_len = req->output_len = obj->len;
+	ret = TUX_GZCACHE_HIT;
+out_free:
+	if (new)
+		kfree(new);
+	return ret;
+}
+
+static int gzfill_actor (read_descriptor_t * desc, struct page *page,
+				unsigned long offset, unsigned long size)
+{
+	char *kaddr;
+
+	if (desc->count < size)
+		size = desc->count;
+
+	kaddr = kmap(page);
+	memcpy(desc->buf, kaddr + offset, size);
+	kunmap(page);
+
+	desc->buf += size;
+	desc->count -= size;
+	desc->written += size;
+
+	return size;
+}
+
+/*
+ * Read and compress one object. Called from the IO threads, so it
+ * may block on IO and memory allocation.
+ */
+void tux_gzcache_fill (tux_gzfill_t *fill)
+{
+	tux_gzobj_t *obj = fill->obj;
+	struct inode *inode = fill->dentry->d_inode;
+	unsigned char *in = NULL, *out = NULL;
+	struct page **pages = NULL;
+	unsigned int i, nr_pages = 0, unhash = 1;
+	__u32 in_len = obj->size, out_len;
+	read_descriptor_t desc;
+	struct file file;
+	loff_t pos = 0;
+
+	Dprintk("filling gzobj %p (ino %ld, %d bytes).\n", obj, obj->ino, in_len);
+	if (list_empty(&obj->hash))
+		goto out;
+
+	in = vmalloc(in_len);
+	if (!in)
+		goto out;
+	if (init_private_file(&file, fill->dentry, FMODE_READ))
+		goto out;
+
+	desc.written = 0;
+	desc.count = in_len;
+	desc.buf = in;
+	desc.error = 0;
+	do_generic_file_read(&file, &pos, &desc, gzfill_actor, 0);
+	if (file.f_op && file.f_op->release)
+		file.f_op->release(inode, &file);
+
+	if (desc.error || (desc.written != in_len))
+		goto out;
+	/*
+	 * The object changed while we read it - the next request
+	 * will see the new version and queue a new fill:
+	 */
+	if (!gzobj_valid(obj, inode))
+		goto out;
+
+	out_len = in_len + in_len/1000 + 64;
+	out = vmalloc(out_len);
+	if (!out)
+		goto out;
+	if (tux_gzip_compress_object(in, in_len, out, &out_len))
+		goto out;
+	/*
+	 * Not compressible - keep the empty object around so that
+	 * requests send the object as it is instead of trying again:
+	 */
+	if (out_len >= in_len) {
+		spin_lock(&gzcache_lock);
+		obj->incompressible = 1;
+		spin_unlock(&gzcache_lock);
+		unhash = 0;
+		goto out;
+	}
+
+	nr_pages = (out_len + PAGE_SIZE-1) >> PAGE_SHIFT;
+	pages = kmalloc(nr_pages * sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		goto out;
+	memset(pages, 0, nr_pages * sizeof(struct page *));
+	for (i = 0; i < nr_pages; i++) {
+		unsigned int offset = i << PAGE_SHIFT;
+
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i])
+			goto out;
+		memcpy(page_address(pages[i]), out + offset,
+					min(out_len - offset, (__u32)PAGE_SIZE));
+	}
+
+	spin_lock(&gzcache_lock);
+	if (!list_empty(&obj->hash)) {
+		obj->pages = pages;
+		obj->len = out_len;
+		obj->nr_pages = nr_pages;
+		gzcache_bytes += nr_pages << PAGE_SHIFT;
+		pages = NULL;
+		unhash = 0;
+		__gzcache_shrink();
+	}
+	spin_unlock(&gzcache_lock);
+	Dprintk("gzobj %p: %d bytes compressed into %d.\n", obj, in_len, out_len);
+out:
+	if (unhash) {
+		spin_lock(&gzcache_lock);
+		if (!list_empty(&obj->hash))
+			__gzcache_unhash(obj);
+		spin_unlock(&gzcache_lock);
+	}
+	if (pages) {
+		for (i = 0; i < nr_pages; i++)
+			if (pages[i])
+				__free_page(pages[i]);
+		kfree(pages);
+	}
+	vfree(out);
+	vfree(in);
+
+	dput(fill->dentry);
+	mntput(fill->mnt);
+	tux_gzcache_put_obj(obj);
+	kfree(fill);
+}
+
+/*
+ * Send the cached compressed body. Return codes follow
+ * generic_send_file().
+ */
+int tux_gzcache_send (tux_req_t *req, struct socket *sock, int cachemiss)
+{
+	tux_gzobj_t *obj = req->gzobj;
+	unsigned int offset, size, flags;
+	struct page *page;
+	int written;
+	loff_t pos;
+
+	sock->sk->tp_pinfo.af_tcp.nonagle = 2;
+
+	while (req->output_len) {
+		if (req->proto->check_req_err(req, cachemiss))
+			return -1;
+		if (connection_too_fast(req) == 2)
+			return -5;
+
+		pos = req->in_file.f_pos;
+		if (pos >= obj->len)
+			TUX_BUG();
+		page = obj->pages[pos >> PAGE_SHIFT];
+		offset = pos & ~PAGE_MASK;
+		size = PAGE_SIZE - offset;
+		if (size > req->output_len)
+			size = req->output_len;
+
+		flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+		if (req->output_len > size)
+			flags |= MSG_MORE;
+
+		written = tux_send_page(sock, page, offset, size, flags);
+		Dprintk("gzcache send: pos %Ld, size %d, written %d.\n", pos, size, written);
+		if (written == -EAGAIN)
+			return -4;
+		if (written <= 0) {
+#if CONFIG_TUX_DEBUG
+			req->bytes_expected = 0;
+#endif
+			req->in_file.f_pos = 0;
+			req->error = TUX_ERROR_CONN_CLOSE;
+			zap_request(req, cachemiss);
+			return -1;
+		}
+		req->in_file.f_pos += written;
+		req->bytes_sent += written;
+		req->output_len -= written;
+
+		if ((written < size) && test_bit(SOCK_NOSPACE, &sock->flags))
+			return -4;
+	}
+	return 0;
+}
+
+/*
+ * Drop every cached object, eg. on module unload.
+ */
+void tux_gzcache_flush (void)
+{
+	tux_gzobj_t *obj;
+
+	spin_lock(&gzcache_lock);
+	while (!list_empty(&gzcache_lru)) {
+		obj = list_entry(gzcache_lru.next, tux_gzobj_t, lru);
+		__gzcache_unhash(obj);
+	}
+	spin_unlock(&gzcache_lock);
+}
+
+void tux_gzcache_init (void)
+{
+	int i;
+
+	for (i = 0; i < GZCACHE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(gzcache_hash + i);
+}
@@ -3345,3 +3345,97 @@ void tux_gzip_end (tux_req_t *req)
 	kfree(req->gzip_state);
 	req->gzip_state = NULL;
 }
+
+/*
+ * CRC-32 as used by the gzip trailer (RFC 1952). The table is built
+ * by tux_gzip_init() at module load, before any IO thread runs.
+ */
+static __u32 gzip_crc_table[256];
+
+void tux_gzip_init (void)
+{
+	__u32 c;
+	int n, k;
+
+	for (n = 0; n < 256; n++) {
+		c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+		gzip_crc_table[n] = c;
+	}
+}
+
+static __u32 gzip_crc32 (unsigned char *buf, __u32 len)
+{
+	__u32 crc = 0xffffffff;
+
+	while (len--)
+		crc = gzip_crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffff;
+}
+
+#define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8
+
+static inline void put_le32 (unsigned char *p, __u32 val)
+{
+	p[0] = val; p[1] = val >> 8; p[2] = val >> 16; p[3] = val >> 24;
+}
+
+/*
+ * Compress a whole object into a complete gzip member: header, raw
+ * deflate stream and CRC/size trailer. Returns 0 and the compressed
+ * length in *out_len on success, -1 if the output buffer is too small
+ * or deflate fails.
+ */
+int tux_gzip_compress_object (unsigned char *data_in, __u32 in_len,
+			unsigned char *data_out, __u32 *out_len)
+{
+	z_stream strm;
+	int ret;
+
+	if (*out_len <= GZIP_HEADER_LEN + GZIP_TRAILER_LEN + STREAM_END_SPACE)
+		return -1;
+
+	strm.zalloc = zalloc;
+	strm.zfree = zfree;
+
+	/*
+	 * Negative windowBits suppresses the zlib header, the gzip
+	 * header and trailer are written by hand:
+	 */
+	if (Z_OK != deflateInit2(&strm, 6, Z_DEFLATED, -MAX_WBITS,
+					DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY))
+		return -1;
+
+	data_out[0] = 0x1f;
+	data_out[1] = 0x8b;
+	data_out[2] = Z_DEFLATED;
+	data_out[3] = 0;		/* flags */
+	put_le32(data_out + 4, 0);	/* mtime */
+	data_out[8] = 0;		/* xfl */
+	data_out[9] = 3;		/* OS: Unix */
+
+	strm.next_in = data_in;
+	strm.avail_in = in_len;
+	strm.total_in = 0;
+	strm.next_out = data_out + GZIP_HEADER_LEN;
+	strm.avail_out = *out_len - GZIP_HEADER_LEN - GZIP_TRAILER_LEN;
+	strm.total_out = 0;
+
+	ret = deflate(&strm, Z_FINISH);
+	deflateEnd(&strm);
+	if (ret != Z_STREAM_END) {
+		Dprintk("object deflate returned %d\n", ret);
+		return -1;
+	}
+
+	put_le32(data_out + GZIP_HEADER_LEN + strm.total_out,
+					gzip_crc32(data_in, in_len));
+	put_le32(data_out + GZIP_HEADER_LEN + strm.total_out + 4, in_len);
+	*out_len = GZIP_HEADER_LEN + strm.total_out + GZIP_TRAILER_LEN;
+
+	Dprintk("gzip compressed object %d bytes into %d\n", in_len, *out_len);
+	return 0;
+}
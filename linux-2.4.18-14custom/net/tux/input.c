@@ -427,6 +427,24 @@ restart:
 		}
 	}
 
+	/*
+	 * A pipelining client sends several requests back to back, so
+	 * the previous read might already contain the next complete
+	 * request - parse it without peeking into the socket again:
+	 */
+	if (req->headers && req->headers_len) {
+		len = req->headers_len;
+		((char *)req->headers)[len] = 0;
+		req->headers_len = 0;
+
+		parsed_len = req->proto->parse_message(req, len);
+		if (parsed_len > 0) {
+			INC_STAT(parse_pipelined);
+			goto parsed;
+		}
+		/* incomplete (or bogus) - redo it with the full data */
+	}
+
 	INC_STAT(input_slowpath);
 
 	if (!req->headers)
@@ -472,6 +490,12 @@ restart:
 			GOTO_REDIRECT;
 		GOTO_INCOMPLETE;
 	}
+parsed:
+	/*
+	 * Remember the start of the next pipelined request, if any:
+	 */
+	req->pipelined_len = parsed_len < len ? len - parsed_len : 0;
+	req->headers_len = len;
 	unidle_req(req);
 
 	req->sock->sk->tp_pinfo.af_tcp.nonagle = 2;
@@ -495,6 +519,8 @@ redirect_error:
 	if (req->headers)
 		kfree(req->headers);
 	req->headers = NULL;
+	req->headers_len = 0;
+	req->pipelined_len = 0;
 	if (req->error)
 		zap_request(req, cachemiss);
 	return;
@@ -29,106 +29,64 @@
  *
  ****************************************************************/
 
-static spinlock_t log_lock = SPIN_LOCK_UNLOCKED;
-static unsigned int log_head, log_tail;
 static char * log_buffer = NULL;
 static DECLARE_WAIT_QUEUE_HEAD(log_wait);
-static DECLARE_WAIT_QUEUE_HEAD(log_full);
 static int logger_pid = 0;
 
 /*
  * High-speed TUX logging architecture:
  *
- * All fast threads share a common log-ringbuffer. (default size 1MB)
- * Log entries are binary and are padded to be cacheline aligned, this
- * ensures that there is no cache-pingpong between fast threads.
+ * Every TUX thread has its own log-ringbuffer (LOG_LEN, default size
+ * 1MB). The thread is the only writer of its ring and the logger
+ * thread is the only reader, so entries are added without any locking
+ * and fast threads never share a cacheline for logging purposes.
+ *
+ * Log entries are binary, variable-length and 4-byte aligned: the
+ * record header carries the signature and the record length, so the
+ * stream can be walked without parsing the strings. The userspace
+ * converter in Documentation/networking/tux2clf.c turns a binary
+ * logfile into Common Log Format.
  *
  * The logger thread writes out pending log entries within 1 second
- * (buffer-cache writes data out within 5 seconds). The logger thread
- * gets activated once we have more than 25% of the log ringbuffer
- * filled - or the 1 second log timeout expires. Fast threads block
- * if if more than 95% of the ringbuffer is filled and unblock only
- * if used logbuffer space drops below 90%.
+ * (buffer-cache writes data out within 5 seconds). It gets activated
+ * once a ring is more than 25% full - or the 1 second log timeout
+ * expires. Entries are written in timestamp order: the logger merges
+ * the per-thread rings, each of which is already sorted.
  *
- * This architecture guarantees that 1) logging is reliable (no
- * log entry is ever lost), 2) timely (touches disk within 6 seconds),
- * 3) in the log-contention case the saturation behavior is still
- * write-clustered, but 4) if the logger thread can keep up then
- * the coupling is completely asynchron and parallel.
+ * Fast threads never block on logging: if the logger thread cannot
+ * keep up and a ring is full then the entry is dropped and counted.
  *
  * The binary log format gives us about 50% saved IO/memory bandwith
  * and 50% less on-disk used log space than the traditional W3C ASCII
  * format.
- *
- * (We might switch to raw IO though to write the logfile.)
  */
 
 #define SOFT_LIMIT		(LOG_LEN*25/100)
-#define HARD_LIMIT		(LOG_LEN*95/100)
-#define HARD_RELAX_LIMIT	(LOG_LEN*90/100)
 
 unsigned int tux_logentry_align_order = 5;
 
-#if SMP_CACHE_BYTES == 8
-# define TUX_LOGENTRY_ALIGN 3
-#else
-#if SMP_CACHE_BYTES == 16
-# define TUX_LOGENTRY_ALIGN 4
-#else
-#if SMP_CACHE_BYTES == 32
-# define TUX_LOGENTRY_ALIGN 5
-#else
-#if SMP_CACHE_BYTES == 64
-# define TUX_LOGENTRY_ALIGN 6
-#else
-#if SMP_CACHE_BYTES == 128
-# define TUX_LOGENTRY_ALIGN 7
+#define LOG_ALIGN(x) (((x) + sizeof(u32)-1) & ~(sizeof(u32)-1))
+
+/*
+ * Log record signature - this makes the binary logfile more robust
+ * against potential data corruption and other damage. The signature
+ * also servers as a log format version identifier. A zero signature
+ * in a ring marks the wrap-around point.
+ */
+#if CONFIG_TUX_EXTENDED_LOG
+# define LOG_SIGNATURE		0x4445beef
+# define LOG_TIME_IDX		4
 #else
-#error Add entry!
-#endif
-#endif
-#endif
+# define LOG_SIGNATURE		0x3334beef
+# define LOG_TIME_IDX		3
 #endif
-#endif
-
-#define ROUND_UP(x) (((((x)-1) >> TUX_LOGENTRY_ALIGN) + 1) \
-					<< TUX_LOGENTRY_ALIGN)
-
-static void __throttle_logging (void)
-{
-	DECLARE_WAITQUEUE(wait, current);
-	int pending;
-
-	add_wait_queue(&log_full, &wait);
-	for (;;) {
-		static unsigned long last_warning = 0;
-
-		if (jiffies - last_warning > 10*HZ) {
-			last_warning = jiffies;
-			printk(KERN_NOTICE "TUX: log buffer overflow, have to throttle TUX thread!\n");
-		}
-
-		current->state = TASK_INTERRUPTIBLE;
-
-		spin_lock(&log_lock);
-		pending = log_head-log_tail;
-		spin_unlock(&log_lock);
-
-		if ((pending % LOG_LEN) < HARD_LIMIT)
-			break;
-
-		schedule();
-	}
-	current->state = TASK_RUNNING;
-	remove_wait_queue(&log_full, &wait);
-}
 
 #if CONFIG_TUX_DEBUG
 #define CHECK_LOGPTR(ptr) \
 do { \
-	if ((ptr < log_buffer) || (ptr > log_buffer + LOG_LEN)) { \
+	if ((ptr < ti->log_buffer) || (ptr > ti->log_buffer + LOG_LEN)) { \
 		printk(KERN_ERR "TUX: ouch: log ptr %p > %p + %ld!\n", \
-			ptr, log_buffer, LOG_LEN); \
+			ptr, ti->log_buffer, LOG_LEN); \
 		TUX_BUG(); \
 	} \
 } while (0)
@@ -136,12 +94,56 @@ do { \
 #define CHECK_LOGPTR(ptr) do { } while (0)
 #endif
 
+static inline unsigned int log_pending (threadinfo_t *ti)
+{
+	return (ti->log_head - ti->log_tail) % LOG_LEN;
+}
+
+/*
+ * Find room for a log entry of 'inc' bytes in the thread's ring.
+ * The head never catches up with the tail, so head == tail always
+ * means 'empty'.
+ */
+static char * reserve_log_entry (threadinfo_t *ti, unsigned int inc)
+{
+	unsigned int head = ti->log_head, tail = ti->log_tail;
+
+	/*
+	 * Do not touch space the logger has not finished reading yet:
+	 */
+	smp_mb();
+	if (head >= tail) {
+		if (head + inc < LOG_LEN)
+			return ti->log_buffer + head;
+		if (inc < tail) {
+			*(u32 *)(ti->log_buffer + head) = 0;
+			return ti->log_buffer;
+		}
+		return NULL;
+	}
+	if (head + inc < tail)
+		return ti->log_buffer + head;
+	return NULL;
+}
+
+static void log_entry_dropped (threadinfo_t *ti)
+{
+	static unsigned long last_warning = 0;
+
+	ti->nr_log_dropped++;
+	if (jiffies - last_warning > 10*HZ) {
+		last_warning = jiffies;
+		printk(KERN_NOTICE "TUX: log buffer overflow, thread %d dropped %d log entries so far!\n", ti->cpu, ti->nr_log_dropped);
+	}
+	wake_up(&log_wait);
+}
+
 void __log_request (tux_req_t *req)
 {
-	char *str, *next;
+	threadinfo_t *ti = req->ti;
+	char *str, *start;
 	const char *uri_str;
-	unsigned int inc, len, uri_len, pending, next_head, def_vhost_len = 0;
-	unsigned long flags;
+	unsigned int inc, len, uri_len, def_vhost_len = 0;
 
 	if (req->proto->pre_log)
 		req->proto->pre_log(req);
@@ -190,44 +192,30 @@ void __log_request (tux_req_t *req)
 	}
 	len++;
 
-	inc = 5*sizeof(u32) + len;
+	inc = 6*sizeof(u32) + len;
 #if CONFIG_TUX_EXTENDED_LOG
 	inc += 7*sizeof(u32);
 #endif
+	inc = LOG_ALIGN(inc);
 
-	spin_lock_irqsave(&log_lock, flags);
-
-	next_head = ROUND_UP(log_head + inc);
-
-	if (next_head < LOG_LEN) {
-		str = log_buffer + log_head;
-		if (str > log_buffer + LOG_LEN)
-			TUX_BUG();
-		log_head = next_head;
-	} else {
-		if (log_head < LOG_LEN)
-			memset(log_buffer+log_head, 0, LOG_LEN-log_head);
-		str = log_buffer;
-		log_head = ROUND_UP(inc);
+	if (!ti->log_buffer) {
+		ti->nr_log_dropped++;
+		return;
+	}
+	start = str = reserve_log_entry(ti, inc);
+	if (!str) {
+		log_entry_dropped(ti);
+		return;
 	}
 
-	if (str < log_buffer || str+inc >= log_buffer+LOG_LEN)
-		TUX_BUG();
+	*(u32 *)str = LOG_SIGNATURE;
+	str += sizeof(u32);
 
 	/*
-	 * Log record signature - this makes finding the next entry
-	 * easier (since record length is variable), and makes the
-	 * binary logfile more robust against potential data corruption
-	 * and other damage. The signature also servers as a log format
-	 * version identifier.
+	 * Record length, including the header and the padding:
 	 */
-#if CONFIG_TUX_EXTENDED_LOG
-	*(u32 *)str = 0x2223beef;
-#else
-	*(u32 *)str = 0x1112beef;
-#endif
+	*(u32 *)str = inc;
 	str += sizeof(u32);
-	CHECK_LOGPTR(str);
 
 	*(u32 *)str = 0;
 	/*
@@ -236,7 +224,6 @@ void __log_request (tux_req_t *req)
 	if (tux_ip_logging)
 		*(u32 *)str = req->client_addr;
 	str += sizeof(u32);
-	CHECK_LOGPTR(str);
 
 #if CONFIG_TUX_EXTENDED_LOG
 	/*
@@ -246,7 +233,6 @@ void __log_request (tux_req_t *req)
 	if (tux_ip_logging)
 		*(u32 *)str = req->client_port;
 	str += sizeof(u32);
-	CHECK_LOGPTR(str);
 #endif
 
 	/*
@@ -254,7 +240,6 @@ void __log_request (tux_req_t *req)
 	 */
 	*(u32 *)str = CURRENT_TIME;
 	str += sizeof(u32);
-	CHECK_LOGPTR(str);
 
 #if CONFIG_TUX_EXTENDED_LOG
 	*(u32 *)str = req->accept_timestamp; str += sizeof(u32);
@@ -269,7 +254,6 @@ void __log_request (tux_req_t *req)
 	 */
 	*(u32 *)str = req->bytes_sent;
 	str += sizeof(u32);
-	CHECK_LOGPTR(str);
 
 	*(u32 *)str = req->status;
 	str += sizeof(u32);
@@ -324,27 +308,20 @@ void __log_request (tux_req_t *req)
 		CHECK_LOGPTR(str);
 	}
 	*str++ = 0;
-	CHECK_LOGPTR(str);
 	/*
-	 * pad with spaces to next cacheline, with an ending newline.
-	 * (not needed for the user-space log utility, but results in
-	 * a more readable binary log file, and reduces the amount
-	 * of cache pingpong.)
+	 * Zero-pad up to the record length:
 	 */
-	next = (char *)ROUND_UP((unsigned long)str);
-
-	CHECK_LOGPTR(next);
-	len = next-str;
-	memset(str, ' ', len);
+	memset(str, 0, start + inc - str);
+	CHECK_LOGPTR(start + inc);
 
-	pending = (log_head-log_tail) % LOG_LEN;
-	spin_unlock_irqrestore(&log_lock, flags);
+	/*
+	 * Publish the entry to the logger thread:
+	 */
+	wmb();
+	ti->log_head = start - ti->log_buffer + inc;
 
-	if (pending >= SOFT_LIMIT)
+	if (log_pending(ti) >= SOFT_LIMIT)
 		wake_up(&log_wait);
-
-	if (pending >= HARD_LIMIT)
-		__throttle_logging();
 }
 
 void tux_push_pending (struct sock *sk)
@@ -452,10 +429,23 @@ void flush_request (tux_req_t *req, int cachemiss)
 		dput(req->module_dentry);
 		req->module_dentry = NULL;
 	}
-	if (req->headers)
-		kfree(req->headers);
-	req->headers = NULL;
-	req->headers_len = 0;
+	if (req->headers && req->pipelined_len && req->keep_alive &&
+							!req->error) {
+		/*
+		 * Keep the already read part of the next pipelined
+		 * request, parse_request() will continue with it:
+		 */
+		memmove((char *)req->headers, req->headers +
+			req->headers_len - req->pipelined_len,
+			req->pipelined_len);
+		req->headers_len = req->pipelined_len;
+	} else {
+		if (req->headers)
+			kfree(req->headers);
+		req->headers = NULL;
+		req->headers_len = 0;
+	}
+	req->pipelined_len = 0;
 
 	req->method = METHOD_NONE;
 	req->method_len = 0;
@@ -485,9 +475,13 @@ void flush_request (tux_req_t *req, int cachemiss)
 	req->user_agent_len = 0;
 
 	req->may_send_gzip = 0;
-	req->content_gzipped = 0;
+	req->content_gzipped = TUX_GZIP_NONE;
 	if (req->gzip_state)
 		tux_gzip_end(req);
+	if (req->gzobj) {
+		tux_gzcache_put_obj(req->gzobj);
+		req->gzobj = NULL;
+	}
 
 	req->content_type_str = NULL;
 	req->content_type_len = 0;
@@ -644,9 +638,95 @@ out:
 
 static int warn_once = 1;
 
+/*
+ * Return the oldest unread entry of a ring, or NULL if the ring
+ * has nothing left up to 'head':
+ */
+static u32 * next_log_entry (threadinfo_t *ti, unsigned int head)
+{
+	u32 *entry;
+
+	if (ti->log_tail == head)
+		return NULL;
+	entry = (u32 *)(ti->log_buffer + ti->log_tail);
+	if (!*entry) {
+		/* wrap-around marker */
+		smp_mb();
+		ti->log_tail = 0;
+		if (!head)
+			return NULL;
+		entry = (u32 *)ti->log_buffer;
+	}
+	if ((entry[0] != LOG_SIGNATURE) || (entry[1] < 6*sizeof(u32)))
+		TUX_BUG();
+	return entry;
+}
+
+/*
+ * Merge the per-thread rings into log_buffer, oldest entry first.
+ * Every ring is sorted already, so picking the ring with the oldest
+ * head entry each round yields a sorted stream.
+ */
+static unsigned int merge_log_entries (void)
+{
+	unsigned int head[CONFIG_TUX_NUMTHREADS];
+	unsigned int i, len = 0;
+
+	for (i = 0; i < nr_tux_threads; i++)
+		head[i] = threadinfo[i].log_head;
+	/*
+	 * Read the entries only after the heads that published them:
+	 */
+	rmb();
+
+	for (;;) {
+		threadinfo_t *ti, *oldest_ti = NULL;
+		u32 *entry, *oldest = NULL;
+
+		for (i = 0; i < nr_tux_threads; i++) {
+			ti = threadinfo + i;
+			if (!ti->log_buffer)
+				continue;
+			entry = next_log_entry(ti, head[i]);
+			if (!entry)
+				continue;
+			if (!oldest || ((int)(entry[LOG_TIME_IDX] -
+					oldest[LOG_TIME_IDX]) < 0)) {
+				oldest = entry;
+				oldest_ti = ti;
+			}
+		}
+		if (!oldest)
+			break;
+		if (len + oldest[1] > LOG_LEN)
+			break;
+		memcpy(log_buffer + len, oldest, oldest[1]);
+		len += oldest[1];
+		/*
+		 * The copy has to be complete before the thread
+		 * may reuse the space:
+		 */
+		smp_mb();
+		oldest_ti->log_tail = (char *)oldest - oldest_ti->log_buffer +
+								oldest[1];
+	}
+	return len;
+}
+
+static unsigned int total_log_pending (void)
+{
+	unsigned int i, pending = 0;
+
+	for (i = 0; i < nr_tux_threads; i++)
+		if (threadinfo[i].log_buffer)
+			pending += log_pending(threadinfo + i);
+
+	return pending;
+}
+
 static unsigned int writeout_log (void)
 {
-	unsigned int len, pending, next_log_tail;
+	unsigned int len;
 	mm_segment_t oldmm = get_fs();
 	struct file *log_filp;
 	char * str;
@@ -664,18 +744,10 @@ static unsigned int writeout_log (void)
 		schedule_timeout(HZ);
 		return 0;
 	}
-	spin_lock(&log_lock);
-	str = log_buffer + log_tail;
-	if (log_head < log_tail) {
-		len = LOG_LEN-log_tail;
-		next_log_tail = 0;
-	} else {
-		len = log_head-log_tail;
-		next_log_tail = log_head;
-	}
+	str = log_buffer;
+	len = merge_log_entries();
 	if (!len)
 		goto out;
-	spin_unlock(&log_lock);
 
 	set_fs(KERNEL_DS);
 	ret = log_filp->f_op->write(log_filp, str, len, &log_filp->f_pos);
@@ -688,7 +760,7 @@ static unsigned int writeout_log (void)
 			printk(KERN_ERR "TUX: log write %d != %d.\n", ret, len);
 			printk(KERN_ERR "TUX: log_filp: %p, str: %p, len: %d str[len-1]: %d.\n", log_filp, str, len, str[len-1]);
 		}
-		goto out_lock;
+		goto out;
 	}
 
 	/*
@@ -706,18 +778,9 @@ static unsigned int writeout_log (void)
 	 */
 //	flush_inode_pages(log_filp->f_dentry->d_inode);
 
-out_lock:
-	spin_lock(&log_lock);
 out:
-	log_tail = next_log_tail;
-	pending = (log_head-log_tail) % LOG_LEN;
-	spin_unlock(&log_lock);
-
-	if (pending < HARD_LIMIT)
-		wake_up(&log_full);
-
 	fput(log_filp);
-	return pending;
+	return total_log_pending();
 }
 
 static DECLARE_WAIT_QUEUE_HEAD(stop_logger_wait);
@@ -749,12 +812,6 @@ static int logger_thread (void *data)
 	recalc_sigpending(current);
 	spin_unlock_irq(&current->sigmask_lock);
 
-	if (log_buffer)
-		TUX_BUG();
-	log_buffer = vmalloc(LOG_LEN);
-	memset(log_buffer, 0, LOG_LEN);
-	log_head = log_tail = 0;
-
 	current->rlim[RLIMIT_FSIZE].rlim_cur = RLIM_INFINITY;
 
 	add_wait_queue(&log_wait, &wait);
@@ -765,13 +822,18 @@ static int logger_thread (void *data)
 			if (stop_logger)
 				break;
 		}
-		if (stop_logger)
+		if (stop_logger) {
+			/*
+			 * The TUX threads are gone - drain the rings:
+			 */
+			while (writeout_log())
+				/* nothing */;
 			break;
-			/* nothing */;
+		}
 
 		Dprintk("logger does sleep - stop:%d.\n", stop_logger);
 		__set_current_state(TASK_INTERRUPTIBLE);
-		if (log_head != log_tail) {
+		if (total_log_pending() >= SOFT_LIMIT) {
 			__set_current_state(TASK_RUNNING);
 			continue;
 		}
@@ -785,8 +847,6 @@ static int logger_thread (void *data)
 	}
 	remove_wait_queue(&log_wait, &wait);
 
-	vfree(log_buffer);
-	log_buffer = NULL;
 	stop_logger = 0;
 	wake_up(&stop_logger_wait);
 
@@ -795,10 +855,32 @@ static int logger_thread (void *data)
 	return 0;
 }
 
+/*
+ * Called once the per-thread structures are set up but before
+ * any TUX thread is started.
+ */
 void start_log_thread (void)
 {
+	unsigned int i;
+
 	warn_once = 1;
 
+	if (log_buffer)
+		TUX_BUG();
+	log_buffer = vmalloc(LOG_LEN);
+	if (!log_buffer)
+		TUX_BUG();
+
+	for (i = 0; i < nr_tux_threads; i++) {
+		threadinfo_t *ti = threadinfo + i;
+
+		ti->log_buffer = vmalloc(LOG_LEN);
+		if (!ti->log_buffer)
+			printk(KERN_ERR "TUX: could not allocate log buffer for thread %d, its requests will not be logged!\n", i);
+		ti->log_head = ti->log_tail = 0;
+		ti->nr_log_dropped = 0;
+	}
+
 	logger_pid = kernel_thread(logger_thread, NULL, 0);
 	if (logger_pid < 0)
 		TUX_BUG();
@@ -807,6 +889,7 @@ void start_log_thread (void)
 void stop_log_thread (void)
 {
 	DECLARE_WAITQUEUE(wait, current);
+	unsigned int i;
 	int ret;
 
 	Dprintk("stopping logger thread %d ...\n", logger_pid);
@@ -823,4 +906,16 @@ void stop_log_thread (void)
 	if (stop_logger)
 		TUX_BUG();
 	Dprintk("logger thread stopped!\n");
+
+	for (i = 0; i < nr_tux_threads; i++) {
+		threadinfo_t *ti = threadinfo + i;
+
+		if (ti->nr_log_dropped)
+			printk(KERN_NOTICE "TUX: thread %d dropped %d log entries.\n", i, ti->nr_log_dropped);
+		if (ti->log_buffer)
+			vfree(ti->log_buffer);
+		ti->log_buffer = NULL;
+	}
+	vfree(log_buffer);
+	log_buffer = NULL;
 }
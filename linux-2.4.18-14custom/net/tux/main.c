@@ -118,6 +118,13 @@ repeat_accept:
 			goto handle_userspace_req;
 	}
 
+	/*
+	 * Page IO completions wake us up too, we are on the
+	 * waitqueue of every page we have a read pending for:
+	 */
+	if (ti->nr_async_reads && complete_async_reads(ti))
+		work_done = 1;
+
 	/*
 	 * Be nice to other processes:
 	 */
@@ -183,6 +190,7 @@ static int init_queues (int nr_tux_threads)
 		ti->work_lock = SPIN_LOCK_UNLOCKED;
 		INIT_LIST_HEAD(&ti->work_pending);
 		INIT_LIST_HEAD(&ti->lru);
+		INIT_LIST_HEAD(&ti->async_reads);
 
 	}
 	return 0;
@@ -281,11 +289,6 @@ static int user_req_startup (void)
 		return err;
 	}
 
-	/*
-	 * Start up the logger thread. (which opens the logfile)
-	 */
-	start_log_thread();
-
 	nr_tux_threads = tux_threads;
 	if (nr_tux_threads < 1) 
 		nr_tux_threads = 1;
@@ -307,6 +310,13 @@ static int user_req_startup (void)
 		ti->cpu = i;
 	}
 
+	/*
+	 * Start up the logger thread. (which opens the logfile)
+	 * It sets up the per-thread log rings, so it has to come
+	 * after the thread structures are initialized.
+	 */
+	start_log_thread();
+
 	MOD_INC_USE_COUNT;
 
 	return 0;
@@ -484,6 +494,8 @@ static int user_req_start_thread (threadinfo_t *ti)
 		e1 = tux_listen[cpu] + k;
 		if (!e1->proto)
 			break;
+		if (tux_listen_per_cpu)
+			goto new_socket;
 		for (i = 0; i < CONFIG_TUX_NUMTHREADS; i++) {
 			if (i == cpu)
 				continue;
@@ -499,7 +511,7 @@ static int user_req_start_thread (threadinfo_t *ti)
 				}
 			}
 		}
-
+new_socket:
 		ti->listen[k].sock = start_listening(tux_listen[cpu] + k, cpu);
 		if (!ti->listen[k].sock)
 			goto error_unlock;
@@ -541,6 +553,8 @@ error_nomsg:
 
 	zap_listen_sockets(ti);
 	flush_all_requests(ti);
+	if (ti->nr_async_reads)
+		TUX_BUG();
 	stop_cachemiss_threads(ti);
 
 	err = -EINVAL;
@@ -601,6 +615,7 @@ static void flush_all_requests (threadinfo_t *ti)
 		int count;
 
 		count = flush_idleinput(ti);
+		count += complete_async_reads(ti);
 		count += flush_waitoutput(ti);
 		count += flush_workqueue(ti);
 		count += flush_freequeue(ti);
@@ -654,6 +669,8 @@ static int user_req_stop_thread (threadinfo_t *ti)
 	Dprintk(KERN_NOTICE "TUX: thread %d has all sockets inactive.\n", (int)(ti-threadinfo));
 
 	flush_all_requests(ti);
+	if (ti->nr_async_reads)
+		TUX_BUG();
 	stop_cachemiss_threads(ti);
 
 	if (ti->nr_requests)
@@ -914,7 +931,7 @@ repeat:
 		case -3:
 			INC_STAT(user_sendobject_cachemisses);
 			add_tux_atom(req, user_send_object);
-			queue_cachemiss(req);
+			queue_async_read(req);
 			break;
 		case -1:
 			break;
@@ -945,7 +962,6 @@ void user_get_object (tux_req_t *req, int cachemiss)
 			if (cachemiss)
 				TUX_BUG();
 			INC_STAT(user_lookup_cachemisses);
-fetch_missed:
 			req->ti->userspace_req = NULL;
 			DEC_STAT(nr_userspace_pending);
 			add_tux_atom(req, user_get_object);
@@ -958,7 +974,11 @@ fetch_missed:
 		req->output_len = req->total_file_len;
 	if (tux_fetch_file(req, !cachemiss)) {
 		INC_STAT(user_fetch_cachemisses);
-		goto fetch_missed;
+		req->ti->userspace_req = NULL;
+		DEC_STAT(nr_userspace_pending);
+		add_tux_atom(req, user_get_object);
+		queue_async_read(req);
+		return;
 	}
 	req->in_file.f_pos = 0;
 	add_req_to_workqueue(req);
@@ -1345,6 +1365,9 @@ void tux_exit (void)
 
 int tux_init(void)
 {
+	tux_gzip_init();
+	tux_gzcache_init();
+	init_mimetypes();
 	start_sysctl();
 
 #if CONFIG_TUX_MODULE
@@ -1367,6 +1390,7 @@ void tux_cleanup (void)
 #endif
 
 	end_sysctl();
+	tux_gzcache_flush();
 }
 
 module_init(tux_init)
@@ -78,6 +78,48 @@ typedef struct sock_send_desc
 	tux_req_t *req;
 } sock_send_desc_t;
 
+/*
+ * Send (part of) a page, zero-copy if the device can do scatter-gather.
+ */
+int tux_send_page (struct socket *sock, struct page *page,
+		unsigned long offset, unsigned int size, unsigned int flags)
+{
+	int written;
+
+	if (tux_zerocopy_sendfile && sock->ops->sendpage &&
+	    (sock->sk->route_caps&NETIF_F_SG)) {
+		written = sock->ops->sendpage(sock, page, offset, size, flags);
+	} else {
+		struct msghdr msg;
+		struct iovec iov;
+		char *kaddr;
+		mm_segment_t oldmm;
+
+		if (offset+size > PAGE_SIZE)
+			return -EFAULT;
+
+		kaddr = kmap(page);
+
+		msg.msg_name = NULL;
+		msg.msg_namelen = 0;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		msg.msg_flags = flags;
+		iov.iov_base = kaddr + offset;
+		iov.iov_len = size;
+
+		oldmm = get_fs(); set_fs(KERNEL_DS);
+		written = sock_sendmsg(sock, &msg, size);
+		set_fs(oldmm);
+
+		Dprintk("kaddr: %p, offset: %ld, size: %d, written: %d.\n", kaddr, offset, size, written);
+		kunmap(page);
+	}
+	return written;
+}
+
 static int sock_send_actor (read_descriptor_t * desc, struct page *page,
 				unsigned long offset, unsigned long orig_size)
 {
@@ -96,7 +138,7 @@ static int sock_send_actor (read_descriptor_t * desc, struct page *page,
 		flags |= MSG_MORE;
 	Dprintk("sock_send_actor(), page: %p, offset: %ld, orig_size: %ld, sock: %p, desc->count: %d, desc->written: %d, MSG_MORE: %d.\n", page, offset, orig_size, sock, desc->count, desc->written, flags & MSG_MORE);
 
-	if (req->content_gzipped >= 2) {
+	if (req->content_gzipped == TUX_GZIP_ON_THE_FLY) {
 		unsigned int gzip_left;
 		struct msghdr msg;
 		struct iovec iov;
@@ -145,37 +187,9 @@ buf[9] = 0x03; buf[8] = 0x00; buf[10] = 0x79;
 			
 	} else {
 		size = orig_size;
-		if (tux_zerocopy_sendfile && sock->ops->sendpage &&
-		    (sock->sk->route_caps&NETIF_F_SG)) {
-			written = sock->ops->sendpage(sock, page, offset, size, flags);
-		} else {
-			struct msghdr msg;
-			struct iovec iov;
-			char *kaddr;
-			mm_segment_t oldmm;
-	
-			if (offset+size > PAGE_SIZE)
-				return -EFAULT;
-
-			kaddr = kmap(page);
-	
-			msg.msg_name = NULL;
-			msg.msg_namelen = 0;
-			msg.msg_iov = &iov;
-			msg.msg_iovlen = 1;
-			msg.msg_control = NULL;
-			msg.msg_controllen = 0;
-			msg.msg_flags = flags;
-			iov.iov_base = kaddr + offset;
-			iov.iov_len = size;
-
-			oldmm = get_fs(); set_fs(KERNEL_DS);
-			written = sock_sendmsg(sock, &msg, size);
-			set_fs(oldmm);
-
-			Dprintk("kaddr: %p, offset: %ld, size: %d, written: %d.\n", kaddr, offset, size, written);
-			kunmap(page);
-		}
+		written = tux_send_page(sock, page, offset, size, flags);
+		if (written == -EFAULT)
+			return -EFAULT;
 	}
 	if (written < 0) {
 		desc->error = written;
@@ -74,6 +74,7 @@ unsigned int tux_hide_unreadable = 1;
 unsigned int tux_http_dir_indexing = 0;
 unsigned int tux_log_incomplete = 0;
 unsigned int tux_cpu_offset = 0;
+unsigned int tux_listen_per_cpu = 0;
 unsigned int tux_ftp_login_message = 0;
 
 static struct ctl_table_header *tux_table_header;
@@ -597,6 +598,18 @@ static ctl_table tux_table[] = {
 		NULL,
 		NULL
 	},
+	{	NET_TUX_COMPRESSED_CACHE_SIZE,
+		"compressed_cache_size",
+		&tux_compressed_cache_size,
+		sizeof(int),
+		0644,
+		NULL,
+		proc_dointvec,
+		&sysctl_intvec,
+		NULL,
+		NULL,
+		NULL
+	},
 	{	NET_TUX_NOID,
 		"noid",
 		&tux_noid,
@@ -717,6 +730,18 @@ static ctl_table tux_table[] = {
 		NULL,
 		NULL
 	},
+	{	NET_TUX_LISTEN_PER_CPU,
+		"listen_per_cpu",
+		&tux_listen_per_cpu,
+		sizeof(int),
+		0644,
+		NULL,
+		proc_dointvec,
+		&sysctl_intvec,
+		NULL,
+		NULL,
+		NULL
+	},
 	{	NET_TUX_REFERER_LOGGING,
 		"ftp_login_message",
 		&tux_ftp_login_message,
@@ -760,6 +785,7 @@ static struct proc_dir_entry * log_cpu_mask_entry;
 static struct proc_dir_entry * stat_entry;
 static struct proc_dir_entry * tux_dir [CONFIG_TUX_NUMTHREADS];
 static struct proc_dir_entry * listen_dir [CONFIG_TUX_NUMTHREADS];
+static struct proc_dir_entry * mimetypes_entry [CONFIG_TUX_NUMTHREADS];
 
 tux_socket_t tux_listen [CONFIG_TUX_NUMTHREADS][CONFIG_TUX_NUMSOCKETS] =
  { [0 ... CONFIG_TUX_NUMTHREADS-1] = { {&tux_proto_http, 0, 80, NULL}, } };
@@ -1052,6 +1078,15 @@ static int listen_write_proc (struct file *file, const char *buffer,
 	return -EINVAL;
 }
 
+static int mimetypes_read_proc (char *page, char **start, off_t off,
+			int count, int *eof, void *data)
+{
+	threadinfo_t *ti = data;
+
+	return sprintf(page, "hits: %u\nmisses: %u\n",
+			ti->nr_mime_hits, ti->nr_mime_misses);
+}
+
 #define MAX_NAMELEN 10
 
 static void register_tux_proc (unsigned int nr)
@@ -1082,6 +1117,14 @@ static void register_tux_proc (unsigned int nr)
 		entry->write_proc = listen_write_proc;
 		tux_listen[nr][i].entry = entry;
 	}
+
+	/* create /proc/net/tux/1234/mimetypes */
+	entry = create_proc_entry("mimetypes", 0400, tux_dir[nr]);
+
+	entry->nlink = 1;
+	entry->data = (void *)(threadinfo + nr);
+	entry->read_proc = mimetypes_read_proc;
+	mimetypes_entry[nr] = entry;
 }
 
 static void unregister_tux_proc (unsigned int nr)
@@ -1094,6 +1137,7 @@ static void unregister_tux_proc (unsigned int nr)
 	}
 
 	remove_proc_entry(listen_dir[nr]->name, tux_dir[nr]);
+	remove_proc_entry(mimetypes_entry[nr]->name, tux_dir[nr]);
 
 	remove_proc_entry(tux_dir[nr]->name, root_tux_dir);
 }
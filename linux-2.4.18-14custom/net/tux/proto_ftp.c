@@ -641,7 +641,7 @@ repeat:
 			break;
 		case -3:
 			add_tux_atom(req, ftp_send_file);
-			queue_cachemiss(req);
+			queue_async_read(req);
 			break;
 		case -1:
 			break;
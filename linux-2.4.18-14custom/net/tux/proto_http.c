@@ -1004,7 +1004,7 @@ int handle_gzip_req (tux_req_t *req, unsigned int flags)
 		install_req_dentry(req, dentry, mnt);
 		req->total_file_len = req->output_len = size;
 		Dprintk("content WILL be gzipped!\n");
-		req->content_gzipped = 1;
+		req->content_gzipped = TUX_GZIP_STATIC;
 	} else {
 		dput(dentry);
 		mntput(mnt);
@@ -1013,10 +1013,25 @@ int handle_gzip_req (tux_req_t *req, unsigned int flags)
 	return 0;
 }
 
-static spinlock_t mimetypes_lock = SPIN_LOCK_UNLOCKED;
-
+/*
+ * MIME types are hashed by extension. Lookups only take the
+ * read side of a big-reader lock, registration is rare.
+ */
 static LIST_HEAD(mimetypes_head);
 
+#define MIMETYPES_HASH_BITS 6
+#define MIMETYPES_HASH_SIZE (1 << MIMETYPES_HASH_BITS)
+
+static struct list_head mimetypes_hash [MIMETYPES_HASH_SIZE];
+
+static inline struct list_head * mimetype_hashfn (const char *ext, int len)
+{
+	unsigned int hash = full_name_hash(ext, len);
+
+	hash ^= hash >> MIMETYPES_HASH_BITS;
+	return mimetypes_hash + (hash & (MIMETYPES_HASH_SIZE-1));
+}
+
 static mimetype_t default_mimetype = { type: "text/plain", type_len: 10, expire_str: "", expire_str_len: 0 };
 
 #define MAX_MIMETYPE_LEN 128
@@ -1037,6 +1052,14 @@ void add_mimetype (char *new_ext, char *new_type, char *new_expire)
         if (expire_len > MAX_CACHE_CONTROL_AGE_LEN)
                 expire_len = MAX_CACHE_CONTROL_AGE_LEN;
 
+	/*
+	 * Extensions are matched after the dot:
+	 */
+	while (*new_ext == '.') {
+		new_ext++;
+		ext_len--;
+	}
+
 	mime = kmalloc(sizeof(*mime), GFP_KERNEL);
 	memset(mime, 0, sizeof(*mime));
 	ext = kmalloc(ext_len + 1, GFP_KERNEL);
@@ -1070,81 +1093,83 @@ void add_mimetype (char *new_ext, char *new_type, char *new_expire)
 	if (!strcmp(type, "TUX/module"))
 		mime->special = MIME_TYPE_MODULE;
 
-	spin_lock(&mimetypes_lock);
+	br_write_lock(BR_TUX_MIMETYPES_LOCK);
 	list_add(&mime->list, &mimetypes_head);
-	spin_unlock(&mimetypes_lock);
+	/*
+	 * A later registration of the same extension overrides
+	 * the earlier one:
+	 */
+	list_add(&mime->hash, mimetype_hashfn(mime->ext, mime->ext_len));
+	br_write_unlock(BR_TUX_MIMETYPES_LOCK);
 }
 
-static inline int ext_matches (char *file, int len, char *ext, int extlen)
+static mimetype_t * __find_mimetype (char *ext, int len)
 {
-	int i;
-	char *tmp = file + len-1;
-	char *tmp2 = ext + extlen-1;
-
-	if (len < extlen)
-		return 0;
+	struct list_head *head, *tmp;
+	mimetype_t *mime;
 
-	for (i = 0; i < extlen; i++) {
-		if (*tmp != *tmp2)
-			return 0;
-		tmp--;
-		tmp2--;
+	head = mimetype_hashfn(ext, len);
+	list_for_each(tmp, head) {
+		mime = list_entry(tmp, mimetype_t, hash);
+		if ((mime->ext_len == len) && !memcmp(mime->ext, ext, len))
+			return mime;
 	}
-	return 1;
+	return NULL;
 }
 
 /*
- * Overhead is not a problem, we cache the MIME type
- * in the dentry.
+ * The result is cached in the dentry, but this still runs for
+ * every new dentry. Multi-dot extensions ("tar.gz") take precedence
+ * over the last component ("gz").
  */
 static mimetype_t * lookup_mimetype (tux_req_t *req)
 {
 	char *objectname = req->objectname;
 	int len = req->objectname_len;
 	mimetype_t *mime = NULL;
-	struct list_head *head, *tmp, *tmp1, *tmp2, *tmp3;
-
-	if (!memchr(objectname, '.', len))
+	char *name, *end = objectname + len, *ext;
+
+	name = objectname;
+	for (ext = objectname; ext < end; ext++)
+		if (*ext == '/')
+			name = ext + 1;
+	ext = memchr(name, '.', end - name);
+	if (!ext)
 		goto out;
 
-	spin_lock(&mimetypes_lock);
-	head = &mimetypes_head;
-	tmp = head->next;
-
-	while (tmp != head) {
-		mime = list_entry(tmp, mimetype_t, list);
-		if (ext_matches(objectname, len, mime->ext, mime->ext_len)) {
-			/*
-			 * Percolate often-used mimetypes up:
-			 */
-			if (tmp->prev != &mimetypes_head) {
-				tmp1 = tmp;
-				tmp2 = tmp->prev;
-				tmp3 = tmp->prev->prev;
-				list_del(tmp1);
-				list_del(tmp2);
-				list_add(tmp, tmp3);
-				list_add(tmp2, tmp);
-			}
+	br_read_lock(BR_TUX_MIMETYPES_LOCK);
+	while (ext) {
+		ext++;
+		mime = __find_mimetype(ext, end - ext);
+		if (mime)
 			break;
-		} else
-			mime = NULL;
-		tmp = tmp->next;
+		ext = memchr(ext, '.', end - ext);
 	}
-	spin_unlock(&mimetypes_lock);
+	br_read_unlock(BR_TUX_MIMETYPES_LOCK);
 
 out:
-	if (!mime)
+	if (!mime) {
+		req->ti->nr_mime_misses++;
 		mime = &default_mimetype;
+	} else
+		req->ti->nr_mime_hits++;
 	return mime;
 }
 
+void init_mimetypes (void)
+{
+	int i;
+
+	for (i = 0; i < MIMETYPES_HASH_SIZE; i++)
+		INIT_LIST_HEAD(mimetypes_hash + i);
+}
+
 void free_mimetypes (void)
 {
 	struct list_head *head, *tmp, *next;
 	mimetype_t *mime;
 
-	spin_lock(&mimetypes_lock);
+	br_write_lock(BR_TUX_MIMETYPES_LOCK);
 	head = &mimetypes_head;
 	tmp = head->next;
 
@@ -1152,6 +1177,7 @@ void free_mimetypes (void)
 		next = tmp->next;
 		mime = list_entry(tmp, mimetype_t, list);
 		list_del(tmp);
+		list_del(&mime->hash);
 
 		kfree(mime->ext);
 		mime->ext = NULL;
@@ -1161,7 +1187,7 @@ void free_mimetypes (void)
 
 		tmp = next;
 	}
-	spin_unlock(&mimetypes_lock);
+	br_write_unlock(BR_TUX_MIMETYPES_LOCK);
 }
 
 /*
@@ -1318,6 +1344,7 @@ tux_attribute_t * lookup_tux_attribute (tux_req_t *req)
 	if (!attr)
 		TUX_BUG();
 	memset(attr, 0, sizeof(*attr));
+	attr->header_lock = SPIN_LOCK_UNLOCKED;
 
 	mime = lookup_mimetype(req);
 
@@ -1713,9 +1740,10 @@ cachemiss:
 	if (req->may_send_gzip && !req->offset_start && !req->offset_end) {
 		if (handle_gzip_req(req, lookup_flag))
 			goto cachemiss;
-		if ((tux_compression >= 2) && !req->content_gzipped) {
+		if ((tux_compression >= 2) && !req->content_gzipped &&
+			(tux_gzcache_lookup(req) == TUX_GZCACHE_MISS)) {
 			tux_gzip_start(req);
-			req->content_gzipped = 2;
+			req->content_gzipped = TUX_GZIP_ON_THE_FLY;
 		}
 	}
 	if (req->parsed_len)
@@ -1778,13 +1806,14 @@ repeat:
 	ret = 0;
 	if (!req->status)
 		req->status = 200;
-	if (req->method != METHOD_HEAD)
-		ret = generic_send_file(req, req->sock, cachemiss);
-	else {
+	if (req->method == METHOD_HEAD) {
 #if CONFIG_TUX_DEBUG
 		req->bytes_expected = 0;
 #endif
-	}
+	} else if (req->gzobj)
+		ret = tux_gzcache_send(req, req->sock, cachemiss);
+	else
+		ret = generic_send_file(req, req->sock, cachemiss);
 
 	switch (ret) {
 		case -5:
@@ -1801,7 +1830,10 @@ repeat:
 		case -3:
 			INC_STAT(static_sendfile_cachemisses);
 			add_tux_atom(req, http_send_body);
-			queue_cachemiss(req);
+			if (req->gzobj)
+				queue_cachemiss(req);
+			else
+				queue_async_read(req);
 			break;
 		case -1:
 			break;
@@ -1875,36 +1907,18 @@ char tux_date [DATE_LEN] = DEFAULT_DATE;
 		DATE_LEN + sizeof(HEADER_PART4) + sizeof(tux_extra_html_header) \
 		+ sizeof(HEADER_PART3CA) + MAX_CACHE_CONTROL_AGE_LEN)
 
-static void http_pre_header (tux_req_t *req, int head)
-{
-	int partial = req->offset_start | req->offset_end;
-	unsigned long flags;
-	char *buf, *curr;
-	mimetype_t *mime = NULL;
-	int size;
-
-
-	if (MAX_OUT_HEADER_LEN > PAGE_SIZE)
-		TUX_BUG();
-	if ((req->attr && req->attr->tcapi) || req->usermode)
-		TUX_BUG();
-
 #define COPY_STATIC_PART(nr,curr)					\
 	do {	\
 		memcpy(curr, HEADER_PART##nr, sizeof(HEADER_PART##nr)-1); \
 		curr += sizeof(HEADER_PART##nr)-1;			\
 	} while (0)
 
-	buf = curr = get_abuf(req, MAX_OUT_HEADER_LEN);
-
-	if (req->lookup_dir) {
-		COPY_STATIC_PART(1D, curr);
-		goto dir_next;
-	}
-	mime = req->attr->mime;
-	if (!mime)
-		TUX_BUG();
-
+/*
+ * Status line, Content-Type and Cache-Control:
+ */
+static char * http_header_type (tux_req_t *req, char *curr,
+					mimetype_t *mime, int partial)
+{
 	if (req->status == 404) {
 		COPY_STATIC_PART(1C, curr);
 		memcpy(curr, mime->type, mime->type_len);
@@ -1930,7 +1944,11 @@ static void http_pre_header (tux_req_t *req, int head)
 		memcpy(curr, mime->expire_str, mime->expire_str_len);
 		curr += mime->expire_str_len;
 	}
+	return curr;
+}
 
+static char * http_header_connection (tux_req_t *req, char *curr)
+{
 	if (req->keep_alive /* && (req->version == HTTP_1_0) */)
 		COPY_STATIC_PART(2_keepalive, curr);
 	else if (!req->keep_alive && (req->version == HTTP_1_1))
@@ -1939,10 +1957,14 @@ static void http_pre_header (tux_req_t *req, int head)
 		// HTTP/1.0 default means close
 		COPY_STATIC_PART(2_none, curr);
 
-dir_next:
-	memcpy(curr, tux_date, DATE_LEN-1);
-	curr += DATE_LEN-1;
+	return curr;
+}
 
+/*
+ * Everything after the Date, up to and including the empty line:
+ */
+static char * http_header_object (tux_req_t *req, char *curr, int partial)
+{
 	if (req->content_gzipped)
 		COPY_STATIC_PART(3A, curr);
 
@@ -1955,7 +1977,7 @@ dir_next:
 		else
 			COPY_STATIC_PART(3BY, curr);
 
-		if (partial)
+		if (partial || req->gzobj)
 			curr += sprintf(curr, "%Ld", req->output_len);
 		else {
 			// "%d" req->total_file_len
@@ -1984,6 +2006,100 @@ dir_next:
 				req->offset_end-1, req->total_file_len);
 	}
 	COPY_STATIC_PART(4, curr);
+
+	return curr;
+}
+
+/*
+ * The sysctls that change the shape of a cached header:
+ */
+#define HEADER_CACHE_FLAGS ((!!tux_noid) | (!!tux_generate_etags << 1) | \
+	(!!tux_generate_last_mod << 2) | (!!tux_generate_cache_control << 3))
+
+static inline int header_cache_valid (tux_attribute_t *attr, tux_req_t *req)
+{
+	return attr->header_len && (attr->header_mtime == req->mtime) &&
+		(attr->header_size == req->total_file_len) &&
+		(attr->header_flags == HEADER_CACHE_FLAGS);
+}
+
+static void http_pre_header (tux_req_t *req, int head)
+{
+	int partial = req->offset_start | req->offset_end;
+	tux_attribute_t *attr = NULL;
+	unsigned long flags;
+	char *buf, *curr, *part1, *part3;
+	mimetype_t *mime = NULL;
+	int size, len1, len3;
+
+
+	if (MAX_OUT_HEADER_LEN > PAGE_SIZE)
+		TUX_BUG();
+	if ((req->attr && req->attr->tcapi) || req->usermode)
+		TUX_BUG();
+
+	buf = curr = get_abuf(req, MAX_OUT_HEADER_LEN);
+
+	if (req->lookup_dir) {
+		COPY_STATIC_PART(1D, curr);
+		memcpy(curr, tux_date, DATE_LEN-1);
+		curr += DATE_LEN-1;
+		curr = http_header_object(req, curr, partial);
+		goto out;
+	}
+	mime = req->attr->mime;
+	if (!mime)
+		TUX_BUG();
+
+	/*
+	 * Plain 200 responses are the same for every request of the
+	 * object except for the Connection and Date lines, so the rest
+	 * is kept prebuilt in the object's attributes. A changed mtime
+	 * or size (from the inode at lookup time) invalidates it.
+	 */
+	if (!partial && !req->content_gzipped && (req->status != 404))
+		attr = req->attr;
+
+	if (attr) {
+		spin_lock(&attr->header_lock);
+		if (header_cache_valid(attr, req)) {
+			len1 = attr->header_len1;
+			len3 = attr->header_len - len1;
+			memcpy(curr, attr->header, len1);
+			curr += len1;
+			curr = http_header_connection(req, curr);
+			memcpy(curr, tux_date, DATE_LEN-1);
+			curr += DATE_LEN-1;
+			memcpy(curr, attr->header + len1, len3);
+			curr += len3;
+			spin_unlock(&attr->header_lock);
+			goto out;
+		}
+		spin_unlock(&attr->header_lock);
+	}
+
+	part1 = curr;
+	curr = http_header_type(req, curr, mime, partial);
+	len1 = curr - part1;
+	curr = http_header_connection(req, curr);
+	memcpy(curr, tux_date, DATE_LEN-1);
+	curr += DATE_LEN-1;
+	part3 = curr;
+	curr = http_header_object(req, curr, partial);
+	len3 = curr - part3;
+
+	if (attr && (len1 + len3 <= TUX_ATTR_HEADER_LEN)) {
+		spin_lock(&attr->header_lock);
+		memcpy(attr->header, part1, len1);
+		memcpy(attr->header + len1, part3, len3);
+		attr->header_len1 = len1;
+		attr->header_len = len1 + len3;
+		attr->header_mtime = req->mtime;
+		attr->header_size = req->total_file_len;
+		attr->header_flags = HEADER_CACHE_FLAGS;
+		spin_unlock(&attr->header_lock);
+	}
+out:
 	/*
 	 * Possibly add an extra HTML header:
 	 */